@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "roaring_bitmap.h"
+#include "song.h"
+
+enum class SongAttribute : std::uint8_t { Energy, Danceability, Year };
+
+inline int attributeValue(const Song& song, SongAttribute attribute) {
+    switch (attribute) {
+        case SongAttribute::Energy:
+            return song.energy;
+        case SongAttribute::Danceability:
+            return song.danceability;
+        case SongAttribute::Year:
+            return song.year;
+    }
+    return 0;
+}
+
+// False for the unknown year, which range indexes leave out.
+inline bool attributeKnown(const Song& song, SongAttribute attribute) {
+    return attribute != SongAttribute::Year || song.year != kUnknownYear;
+}
+
+// Songs with each value of a small-range attribute (energy, danceability), as
+// one bitmap per value. A range is the union of its values' bitmaps, or the
+// complement of the values outside it when those hold fewer songs.
+class ValueBitmaps {
+public:
+    void rebuild(const std::vector<Song>& songs, SongAttribute indexed) {
+        attribute = indexed;
+        songCount = songs.size();
+        lowest = 0;
+        bitmaps.clear();
+        if (songs.empty()) {
+            return;
+        }
+        auto [low, high] = std::minmax_element(songs.begin(), songs.end(), [&](const Song& a, const Song& b) {
+            return attributeValue(a, attribute) < attributeValue(b, attribute);
+        });
+        lowest = attributeValue(*low, attribute);
+        std::vector<std::vector<SongId>> ids(static_cast<std::size_t>(attributeValue(*high, attribute) - lowest) + 1);
+        for (SongId id = 0; id < songs.size(); ++id) {
+            ids[attributeValue(songs[id], attribute) - lowest].push_back(id);
+        }
+        for (const auto& valueIds : ids) {
+            bitmaps.push_back(RoaringBitmap::fromSorted(valueIds));
+        }
+    }
+
+    void addSong(SongId id, const Song& song) {
+        const int value = attributeValue(song, attribute);
+        if (bitmaps.empty()) {
+            lowest = value;
+        }
+        if (value < lowest) {
+            bitmaps.insert(bitmaps.begin(), static_cast<std::size_t>(lowest - value), RoaringBitmap());
+            lowest = value;
+        }
+        if (static_cast<std::size_t>(value - lowest) >= bitmaps.size()) {
+            bitmaps.resize(static_cast<std::size_t>(value - lowest) + 1);
+        }
+        bitmaps[value - lowest].add(id);
+        songCount = std::max<std::size_t>(songCount, id + 1);
+    }
+
+    // Songs with a value in [lo, hi].
+    RoaringBitmap between(int lo, int hi) const {
+        const auto [first, last] = clamp(lo, hi);
+        if (first >= last) {
+            return RoaringBitmap();
+        }
+        const std::size_t inside = count(first, last);
+        if (inside * 2 <= songCount) {
+            return unite(first, last);
+        }
+        RoaringBitmap outside = unite(0, first) | unite(last, bitmaps.size());
+        return andNot(RoaringBitmap::range(static_cast<std::uint32_t>(songCount)), outside);
+    }
+
+    // Number of songs with a value in [lo, hi].
+    std::size_t countBetween(int lo, int hi) const {
+        const auto [first, last] = clamp(lo, hi);
+        return first < last ? count(first, last) : 0;
+    }
+
+    std::size_t sizeInBytes() const {
+        std::size_t bytes = 0;
+        for (const auto& bitmap : bitmaps) {
+            bytes += bitmap.sizeInBytes();
+        }
+        return bytes;
+    }
+
+private:
+    SongAttribute attribute = SongAttribute::Energy;
+    std::size_t songCount = 0;
+    int lowest = 0;
+    // bitmaps[v] holds the songs with value lowest + v.
+    std::vector<RoaringBitmap> bitmaps;
+
+    // [lo, hi] as a half-open range of bitmap positions.
+    std::pair<std::size_t, std::size_t> clamp(int lo, int hi) const {
+        const long long size = static_cast<long long>(bitmaps.size());
+        const long long first = std::clamp<long long>(static_cast<long long>(lo) - lowest, 0, size);
+        const long long last = std::clamp<long long>(static_cast<long long>(hi) - lowest + 1, 0, size);
+        return {static_cast<std::size_t>(first), static_cast<std::size_t>(std::max(first, last))};
+    }
+
+    std::size_t count(std::size_t first, std::size_t last) const {
+        std::size_t total = 0;
+        for (std::size_t v = first; v < last; ++v) {
+            total += bitmaps[v].cardinality();
+        }
+        return total;
+    }
+
+    RoaringBitmap unite(std::size_t first, std::size_t last) const {
+        RoaringBitmap result;
+        for (std::size_t v = first; v < last; ++v) {
+            result = result | bitmaps[v];
+        }
+        return result;
+    }
+};
+
+// Songs ordered by a wide-range attribute (year). The sorted values are laid
+// out in Eytzinger (breadth-first) order, so a lower-bound search walks down an
+// implicit binary tree whose top levels share a few cache lines and can
+// prefetch four levels ahead, instead of jumping across the whole array like a
+// binary search. A range maps to a slice of songs in value order, turned into a
+// bitmap directly or, if it covers most of the catalog, via its complement.
+//
+// The layout is static: songs added after rebuild() are kept in a short list
+// that range queries scan. Songs whose value is unknown are in no range.
+class SortedAttributeIndex {
+public:
+    void rebuild(const std::vector<Song>& songs, SongAttribute indexed) {
+        attribute = indexed;
+        songCount = songs.size();
+        unknown.clear();
+        // (value, id) packed so one sort orders by value, then id.
+        std::vector<std::uint64_t> keyed;
+        keyed.reserve(songs.size());
+        for (SongId id = 0; id < songs.size(); ++id) {
+            if (!attributeKnown(songs[id], attribute)) {
+                unknown.push_back(id);
+                continue;
+            }
+            keyed.push_back(static_cast<std::uint64_t>(biased(attributeValue(songs[id], attribute))) << 32 | id);
+        }
+        std::sort(keyed.begin(), keyed.end());
+        order.resize(keyed.size());
+        for (std::size_t i = 0; i < keyed.size(); ++i) {
+            order[i] = static_cast<SongId>(keyed[i]);
+        }
+        tree.assign(keyed.size() + 1, 0);
+        ranks.assign(keyed.size() + 1, 0);
+        std::size_t rank = 0;
+        fill(keyed, 1, rank);
+        recent.clear();
+    }
+
+    void addSong(SongId id, const Song& song) {
+        if (attributeKnown(song, attribute)) {
+            recent.push_back({id, attributeValue(song, attribute)});
+        }
+    }
+
+    // Songs with a value in [lo, hi].
+    RoaringBitmap between(int lo, int hi) const {
+        if (lo > hi) {
+            return RoaringBitmap();
+        }
+        const std::size_t first = lowerBound(biased(lo));
+        const std::size_t last = hi == std::numeric_limits<int>::max() ? order.size() : lowerBound(biased(hi + 1));
+        RoaringBitmap result;
+        if ((last - first) * 2 <= songCount) {
+            result = RoaringBitmap::fromUnsorted(order.data() + first, order.data() + last);
+        } else {
+            // Cheaper to collect the songs outside the slice.
+            std::vector<SongId> outside(order.begin(), order.begin() + first);
+            outside.insert(outside.end(), order.begin() + last, order.end());
+            outside.insert(outside.end(), unknown.begin(), unknown.end());
+            result = andNot(RoaringBitmap::range(static_cast<std::uint32_t>(songCount)),
+                            RoaringBitmap::fromUnsorted(outside.data(), outside.data() + outside.size()));
+        }
+        for (const auto& song : recent) {
+            if (song.value >= lo && song.value <= hi) {
+                result.add(song.id);
+            }
+        }
+        return result;
+    }
+
+    std::size_t countBetween(int lo, int hi) const {
+        if (lo > hi) {
+            return 0;
+        }
+        const std::size_t last = hi == std::numeric_limits<int>::max() ? order.size() : lowerBound(biased(hi + 1));
+        std::size_t total = last - lowerBound(biased(lo));
+        for (const auto& song : recent) {
+            total += song.value >= lo && song.value <= hi;
+        }
+        return total;
+    }
+
+    std::size_t sizeInBytes() const {
+        return (order.size() + unknown.size()) * sizeof(SongId) + tree.size() * sizeof(std::uint32_t) +
+               ranks.size() * sizeof(std::uint32_t) + recent.size() * sizeof(Recent);
+    }
+
+private:
+    struct Recent {
+        SongId id;
+        int value;
+    };
+
+    SongAttribute attribute = SongAttribute::Year;
+    std::size_t songCount = 0;
+    // Song ids sorted by (value, id), and those with no known value.
+    std::vector<SongId> order;
+    std::vector<SongId> unknown;
+    // 1-based Eytzinger layout of the sorted (biased) values, and the sorted
+    // position of each node.
+    std::vector<std::uint32_t> tree;
+    std::vector<std::uint32_t> ranks;
+    std::vector<Recent> recent;
+
+    // Values as unsigned integers in the same order.
+    static std::uint32_t biased(int value) { return static_cast<std::uint32_t>(value) ^ 0x80000000u; }
+
+    // In-order walk of the implicit tree, handing out sorted values.
+    void fill(const std::vector<std::uint64_t>& keyed, std::size_t node, std::size_t& rank) {
+        if (node >= tree.size()) {
+            return;
+        }
+        fill(keyed, 2 * node, rank);
+        tree[node] = static_cast<std::uint32_t>(keyed[rank] >> 32);
+        ranks[node] = static_cast<std::uint32_t>(rank++);
+        fill(keyed, 2 * node + 1, rank);
+    }
+
+    // Sorted position of the first value >= `value`.
+    std::size_t lowerBound(std::uint32_t value) const {
+        if (tree.empty()) {
+            return 0;
+        }
+        const std::size_t n = tree.size() - 1;
+        std::size_t node = 1;
+        while (node <= n) {
+            // The 16 nodes four levels down are adjacent.
+            __builtin_prefetch(tree.data() + std::min(16 * node, n));
+            node = 2 * node + (tree[node] < value);
+        }
+        // Undo the right turns taken after the last left turn; that left turn
+        // was at the answer.
+        node >>= __builtin_ffsll(static_cast<long long>(~node));
+        return node == 0 ? n : ranks[node];
+    }
+};
+
+// Secondary indexes on the numeric song attributes, returning bitmaps that
+// combine with the mood bitmaps (e.g. "energetic" AND energy 6-8 AND released
+// 1980-1999) without scanning the catalog.
+class AttributeIndex {
+public:
+    void rebuild(const std::vector<Song>& songs) {
+        energy.rebuild(songs, SongAttribute::Energy);
+        danceability.rebuild(songs, SongAttribute::Danceability);
+        year.rebuild(songs, SongAttribute::Year);
+    }
+
+    // Call after appending `song` to the catalog under `id`.
+    void addSong(SongId id, const Song& song) {
+        energy.addSong(id, song);
+        danceability.addSong(id, song);
+        year.addSong(id, song);
+    }
+
+    // Songs whose `attribute` lies in [lo, hi].
+    RoaringBitmap between(SongAttribute attribute, int lo, int hi) const {
+        switch (attribute) {
+            case SongAttribute::Energy:
+                return energy.between(lo, hi);
+            case SongAttribute::Danceability:
+                return danceability.between(lo, hi);
+            case SongAttribute::Year:
+                return year.between(lo, hi);
+        }
+        return RoaringBitmap();
+    }
+
+    // Exact size of between(attribute, lo, hi), without building it.
+    std::size_t countBetween(SongAttribute attribute, int lo, int hi) const {
+        switch (attribute) {
+            case SongAttribute::Energy:
+                return energy.countBetween(lo, hi);
+            case SongAttribute::Danceability:
+                return danceability.countBetween(lo, hi);
+            case SongAttribute::Year:
+                return year.countBetween(lo, hi);
+        }
+        return 0;
+    }
+
+    std::size_t sizeInBytes() const { return energy.sizeInBytes() + danceability.sizeInBytes() + year.sizeInBytes(); }
+
+private:
+    ValueBitmaps energy;
+    ValueBitmaps danceability;
+    SortedAttributeIndex year;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_fingerprint.h"
+#include "fft.h"
+#include "musical_key.h"
+#include "tempo.h"
+#include "wav_reader.h"
+
+struct AudioFeatures {
+    double durationSeconds = 0.0;
+    double rmsDb = -120.0;
+    double spectralCentroidHz = 0.0;
+    // Mean frame-to-frame change of the normalised magnitude spectrum.
+    double spectralFlux = 0.0;
+    // Mean and peakiness (stddev / mean) of the onset strength envelope.
+    double onsetStrength = 0.0;
+    double onsetPeakiness = 0.0;
+    // Mapped onto the Song 0-10 scales.
+    int energy = 0;
+    int danceability = 0;
+    // 0 / kUnknownKey when there is no clear beat / tonal centre.
+    double bpm = 0.0;
+    double tempoConfidence = 0.0;
+    int key = kUnknownKey;
+    double keyCorrelation = 0.0;
+    AudioFingerprint fingerprint;
+};
+
+// Computes AudioFeatures for a WAV file by streaming it in overlapping Hann
+// windowed frames; memory use does not depend on the length of the file. One
+// analyzer per thread: it owns its FFT tables and buffers.
+class AudioAnalyzer {
+public:
+    static constexpr std::size_t kFrameSize = 2048;
+    static constexpr std::size_t kHopSize = 512;
+
+    AudioAnalyzer() : fft(kFrameSize), window(kFrameSize), frame(kFrameSize), re(kFrameSize), im(kFrameSize),
+                      magnitude(kFrameSize / 2 + 1), previousMagnitude(kFrameSize / 2 + 1),
+                      previousLogMagnitude(kFrameSize / 2 + 1), power(kFrameSize / 2 + 1),
+                      binPitchClass(kFrameSize / 2 + 1) {
+        const double pi = 3.14159265358979323846;
+        for (std::size_t i = 0; i < kFrameSize; ++i) {
+            window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * pi * i / (kFrameSize - 1)));
+        }
+    }
+
+    std::optional<AudioFeatures> analyze(const std::string& path) {
+        WavReader reader;
+        if (!reader.open(path)) {
+            return std::nullopt;
+        }
+        if (reader.sampleRate() != sampleRate) {
+            sampleRate = reader.sampleRate();
+            mapBinsToPitchClasses();
+        }
+        std::fill(frame.begin(), frame.end(), 0.0f);
+        std::fill(previousMagnitude.begin(), previousMagnitude.end(), 0.0f);
+        std::fill(previousLogMagnitude.begin(), previousLogMagnitude.end(), 0.0f);
+        onsetEnvelope.clear();
+        chroma.fill(0.0);
+        fingerprinter.reset(sampleRate, kFrameSize);
+        AudioFingerprint fingerprint;
+
+        double sumSquares = 0.0, centroidSum = 0.0, fluxSum = 0.0;
+        std::size_t samples = 0, frames = 0;
+        std::vector<float> hop(kHopSize);
+        std::size_t got;
+        while ((got = reader.read(hop.data(), kHopSize)) > 0) {
+            std::fill(hop.begin() + got, hop.end(), 0.0f);
+            for (std::size_t i = 0; i < got; ++i) {
+                sumSquares += static_cast<double>(hop[i]) * hop[i];
+            }
+            samples += got;
+            // Slide the frame by one hop and append the new samples.
+            std::copy(frame.begin() + kHopSize, frame.end(), frame.begin());
+            std::copy(hop.begin(), hop.end(), frame.end() - kHopSize);
+            double centroid, flux;
+            onsetEnvelope.push_back(processFrame(centroid, flux));
+            fingerprinter.add(power.data(), fingerprint);
+            centroidSum += centroid;
+            fluxSum += flux;
+            ++frames;
+        }
+        if (samples == 0) {
+            return std::nullopt;
+        }
+
+        AudioFeatures features;
+        features.durationSeconds = reader.durationSeconds();
+        const double rms = std::sqrt(sumSquares / samples);
+        features.rmsDb = rms > 0.0 ? 20.0 * std::log10(rms) : -120.0;
+        features.spectralCentroidHz = centroidSum / frames;
+        features.spectralFlux = fluxSum / frames;
+
+        double mean = 0.0, variance = 0.0;
+        for (float o : onsetEnvelope) {
+            mean += o;
+        }
+        mean /= onsetEnvelope.size();
+        for (float o : onsetEnvelope) {
+            variance += (o - mean) * (o - mean);
+        }
+        variance /= onsetEnvelope.size();
+        features.onsetStrength = mean;
+        features.onsetPeakiness = mean > 1e-9 ? std::sqrt(variance) / mean : 0.0;
+
+        mapToSongScales(features);
+
+        const TempoEstimate tempo = estimateTempo(onsetEnvelope, onsetRate());
+        features.bpm = tempo.bpm;
+        features.tempoConfidence = tempo.confidence;
+        const KeyEstimate key = estimateKey(chroma);
+        features.key = key.key;
+        features.keyCorrelation = key.correlation;
+        features.fingerprint = std::move(fingerprint);
+        return features;
+    }
+
+    // Onset strength per hop of the last analysed file.
+    const std::vector<float>& onsets() const { return onsetEnvelope; }
+    double onsetRate() const { return static_cast<double>(sampleRate) / kHopSize; }
+
+private:
+    Fft fft;
+    std::vector<float> window, frame, re, im;
+    std::vector<float> magnitude, previousMagnitude, previousLogMagnitude;
+    std::vector<float> power;
+    std::vector<float> onsetEnvelope;
+    LandmarkFingerprinter fingerprinter;
+    // Pitch class of each FFT bin, -1 outside the range used for chroma.
+    std::vector<int> binPitchClass;
+    std::array<double, 12> chroma{};
+    std::uint32_t sampleRate = 0;
+
+    // Bins between A2 and ~C8 contribute to the chroma; lower bins are too wide
+    // to tell semitones apart at this frame size.
+    void mapBinsToPitchClasses() {
+        const double binHz = static_cast<double>(sampleRate) / kFrameSize;
+        for (std::size_t k = 0; k < binPitchClass.size(); ++k) {
+            const double hz = k * binHz;
+            if (hz < 110.0 || hz > 4200.0) {
+                binPitchClass[k] = -1;
+                continue;
+            }
+            // MIDI note 69 is A4 = 440 Hz; pitch class 0 is C.
+            const long note = std::lround(69.0 + 12.0 * std::log2(hz / 440.0));
+            binPitchClass[k] = static_cast<int>(note % 12);
+        }
+    }
+
+    // Returns the onset strength of the current frame (half-wave rectified
+    // increase of the log-compressed spectrum).
+    float processFrame(double& centroidHz, double& flux) {
+        for (std::size_t i = 0; i < kFrameSize; ++i) {
+            re[i] = frame[i] * window[i];
+            im[i] = 0.0f;
+        }
+        fft.forward(re.data(), im.data());
+
+        const std::size_t bins = kFrameSize / 2 + 1;
+        double total = 0.0, weighted = 0.0;
+        for (std::size_t k = 0; k < bins; ++k) {
+            power[k] = re[k] * re[k] + im[k] * im[k];
+            magnitude[k] = std::sqrt(power[k]);
+            total += magnitude[k];
+            weighted += magnitude[k] * k;
+            if (binPitchClass[k] >= 0) {
+                chroma[binPitchClass[k]] += power[k];
+            }
+        }
+        const double binHz = static_cast<double>(sampleRate) / kFrameSize;
+        centroidHz = total > 0.0 ? weighted / total * binHz : 0.0;
+
+        double previousTotal = 0.0;
+        for (std::size_t k = 0; k < bins; ++k) {
+            previousTotal += previousMagnitude[k];
+        }
+        flux = 0.0;
+        float onset = 0.0f;
+        for (std::size_t k = 0; k < bins; ++k) {
+            if (total > 0.0 && previousTotal > 0.0) {
+                const double diff = magnitude[k] / total - previousMagnitude[k] / previousTotal;
+                flux += diff * diff;
+            }
+            const float logMagnitude = std::log1p(100.0f * magnitude[k]);
+            onset += std::max(0.0f, logMagnitude - previousLogMagnitude[k]);
+            previousLogMagnitude[k] = logMagnitude;
+        }
+        flux = std::sqrt(flux);
+        std::swap(magnitude, previousMagnitude);
+        return onset / bins;
+    }
+
+    // Loudness from -40 dBFS (0) to -6 dBFS (10); danceability from how strong
+    // the onsets are and how much they stand out from the rest of the signal
+    // (a steady tone has a peaky but negligible onset envelope).
+    static void mapToSongScales(AudioFeatures& features) {
+        const double energy = (features.rmsDb + 40.0) / 34.0 * 10.0 + features.spectralFlux * 10.0;
+        features.energy = static_cast<int>(std::lround(std::clamp(energy, 0.0, 10.0)));
+        const double dance = features.onsetStrength * features.onsetPeakiness * 16.0;
+        features.danceability = static_cast<int>(std::lround(std::clamp(dance, 0.0, 10.0)));
+    }
+};
+
+// Analyses files on `threads` workers (0 = all cores), each streaming one file
+// at a time. Results are in the order of `paths`; unreadable files give nullopt.
+inline std::vector<std::optional<AudioFeatures>> analyzeAudioFiles(const std::vector<std::string>& paths,
+                                                                   std::size_t threads = 0) {
+    if (threads == 0) {
+        threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, std::max<std::size_t>(1, paths.size()));
+    std::vector<std::optional<AudioFeatures>> results(paths.size());
+    std::atomic<std::size_t> next(0);
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            AudioAnalyzer analyzer;
+            for (std::size_t i = next++; i < paths.size(); i = next++) {
+                results[i] = analyzer.analyze(paths[i]);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return results;
+}
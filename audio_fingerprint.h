@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "song.h"
+
+// One landmark of a fingerprint: a hash of two nearby spectral peaks and the
+// analysis frame of the earlier one.
+struct FingerprintEntry {
+    std::uint32_t hash;
+    std::uint32_t offset;
+};
+
+using AudioFingerprint = std::vector<FingerprintEntry>;
+
+// Landmark fingerprints as in Wang (2003): spectral peaks that start a note or
+// hit are paired with the few peaks just before them, and each pair is hashed
+// from the two frequencies and the frame gap. Peaks survive noise, gain and
+// lossy encoding, and a pair's hash does not depend on where the recording
+// starts. Only 1 in kLandmarkSampling hashes is kept, chosen by hash value so
+// that copies keep the same ones; a four minute song has about a thousand
+// landmarks (8 KB).
+constexpr std::uint32_t kLandmarkSampling = 4;
+
+inline bool isSampledLandmark(std::uint32_t hash) {
+    // The top bits of a multiplicative hash depend on every bit of `hash`.
+    return (hash * 0x9E3779B1u) < 0xFFFFFFFFu / kLandmarkSampling;
+}
+
+class LandmarkFingerprinter {
+public:
+    static constexpr std::size_t kPeaksPerFrame = 3;
+    static constexpr std::size_t kFanOut = 4;
+    static constexpr std::uint32_t kMaxGap = 63;
+    static constexpr double kMinHz = 200.0;
+    static constexpr double kMaxHz = 5000.0;
+    static constexpr double kHzPerStep = 20.0;
+
+    void reset(std::uint32_t sampleRate, std::size_t frameSize) {
+        binHz = static_cast<double>(sampleRate) / frameSize;
+        firstBin = std::max<std::size_t>(2, static_cast<std::size_t>(kMinHz / binHz));
+        lastBin = std::min(frameSize / 2 - 2, static_cast<std::size_t>(kMaxHz / binHz));
+        previousLog.assign(frameSize / 2 + 1, -100.0f);
+        logPower.assign(frameSize / 2 + 1, -100.0f);
+        recent.clear();
+        frame = 0;
+    }
+
+    // Adds one frame's power spectrum, appending the sampled landmarks that end
+    // at this frame to `fingerprint`.
+    void add(const float* power, AudioFingerprint& fingerprint) {
+        float loudest = -100.0f;
+        double mean = 0.0;
+        for (std::size_t k = firstBin - 2; k <= lastBin + 2; ++k) {
+            logPower[k] = 10.0f * std::log10(power[k] + 1e-10f);
+            loudest = std::max(loudest, logPower[k]);
+            mean += logPower[k];
+        }
+        const float floor = std::max(loudest - 40.0f, static_cast<float>(mean / (lastBin - firstBin + 5)) + 20.0f);
+
+        // Local maxima within +-2 bins that stand 20 dB above the average bin (so
+        // not noise), are within 40 dB of the loudest bin and are at least 6 dB
+        // louder than the same region in the previous frame.
+        std::array<std::pair<float, std::size_t>, kPeaksPerFrame> peaks;
+        std::size_t peakCount = 0;
+        for (std::size_t k = firstBin; k <= lastBin; ++k) {
+            const float v = logPower[k];
+            if (v < floor || v <= logPower[k - 1] || v < logPower[k + 1] || v <= logPower[k - 2] ||
+                v < logPower[k + 2]) {
+                continue;
+            }
+            const float before = std::max({previousLog[k - 1], previousLog[k], previousLog[k + 1]});
+            if (v - before < 6.0f) {
+                continue;
+            }
+            if (peakCount < kPeaksPerFrame) {
+                peaks[peakCount++] = {v, k};
+            } else {
+                auto weakest = std::min_element(peaks.begin(), peaks.end());
+                if (v > weakest->first) {
+                    *weakest = {v, k};
+                }
+            }
+        }
+        std::swap(previousLog, logPower);
+
+        while (!recent.empty() && frame - recent.front().frame > kMaxGap) {
+            recent.erase(recent.begin());
+        }
+        for (std::size_t p = 0; p < peakCount; ++p) {
+            const std::uint32_t step = frequencyStep(peaks[p].second);
+            std::size_t paired = 0;
+            for (auto it = recent.rbegin(); it != recent.rend() && paired < kFanOut; ++it) {
+                if (it->frame == frame) {
+                    continue;
+                }
+                const std::uint32_t gap = static_cast<std::uint32_t>(frame - it->frame);
+                const std::uint32_t hash = (it->step << 16) | (step << 6) | gap;
+                ++paired;
+                if (isSampledLandmark(hash)) {
+                    fingerprint.push_back({hash, static_cast<std::uint32_t>(it->frame)});
+                }
+            }
+        }
+        for (std::size_t p = 0; p < peakCount; ++p) {
+            recent.push_back({frame, frequencyStep(peaks[p].second)});
+        }
+        ++frame;
+    }
+
+private:
+    struct Peak {
+        std::size_t frame;
+        std::uint32_t step;
+    };
+
+    double binHz = 1.0;
+    std::size_t firstBin = 2;
+    std::size_t lastBin = 2;
+    std::vector<float> previousLog;
+    std::vector<float> logPower;
+    std::vector<Peak> recent;
+    std::size_t frame = 0;
+
+    // Frequency in kHzPerStep units (10 bits), independent of the sample rate.
+    std::uint32_t frequencyStep(std::size_t bin) const {
+        return std::min<std::uint32_t>(1023, static_cast<std::uint32_t>(bin * binHz / kHzPerStep));
+    }
+};
+
+struct DuplicatePair {
+    SongId first;
+    SongId second;
+    // Landmarks shared at a consistent time offset.
+    std::uint32_t votes;
+};
+
+// Inverted index from landmark hash to (song, frame) postings, stored as a
+// sorted key array with CSR offsets into one postings array. Keys are the hashes
+// put through a bijective mix so they spread evenly, and a directory on their
+// top bits narrows each lookup to a handful of keys. Finding duplicates looks
+// up each song's landmarks and counts, per other song, the landmarks that agree
+// on the time offset between the two recordings; no pair of songs is ever
+// compared directly.
+class FingerprintIndex {
+public:
+    struct Posting {
+        SongId song;
+        std::uint32_t offset;
+    };
+
+    void build(const std::vector<AudioFingerprint>& fingerprints, std::size_t threads = 0) {
+        threads = threadCount(threads);
+        // Radix-partition by the top byte of the key, then sort the partitions
+        // in parallel.
+        constexpr std::size_t kPartitions = 256;
+        std::vector<std::size_t> partitionStart(kPartitions + 1, 0);
+        for (const auto& fingerprint : fingerprints) {
+            for (const auto& entry : fingerprint) {
+                ++partitionStart[(mix(entry.hash) >> 24) + 1];
+            }
+        }
+        std::partial_sum(partitionStart.begin(), partitionStart.end(), partitionStart.begin());
+
+        struct Entry {
+            std::uint32_t key;
+            Posting posting;
+        };
+        std::vector<Entry> entries(partitionStart.back());
+        std::vector<std::size_t> cursor(partitionStart.begin(), partitionStart.end() - 1);
+        for (std::size_t song = 0; song < fingerprints.size(); ++song) {
+            for (const auto& entry : fingerprints[song]) {
+                const std::uint32_t key = mix(entry.hash);
+                entries[cursor[key >> 24]++] = {key, {static_cast<SongId>(song), entry.offset}};
+            }
+        }
+        parallelFor(kPartitions, threads, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t p = begin; p < end; ++p) {
+                std::sort(entries.begin() + partitionStart[p], entries.begin() + partitionStart[p + 1],
+                          [](const Entry& a, const Entry& b) {
+                              return a.key != b.key ? a.key < b.key : a.posting.song < b.posting.song;
+                          });
+            }
+        });
+
+        keys.clear();
+        starts.clear();
+        postings.resize(entries.size());
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            if (i == 0 || entries[i].key != entries[i - 1].key) {
+                keys.push_back(entries[i].key);
+                starts.push_back(i);
+            }
+            postings[i] = entries[i].posting;
+        }
+        starts.push_back(entries.size());
+
+        directory.assign((std::size_t{1} << kDirectoryBits) + 1, 0);
+        for (std::uint32_t key : keys) {
+            ++directory[(key >> (32 - kDirectoryBits)) + 1];
+        }
+        std::partial_sum(directory.begin(), directory.end(), directory.begin());
+    }
+
+    std::size_t hashCount() const { return keys.size(); }
+    std::size_t postingCount() const { return postings.size(); }
+
+    // Pairs of songs sharing at least `minVotes` landmarks at one time offset
+    // (give or take a frame), each reported once with first < second. Hashes
+    // with more than `maxPostings` postings match too many songs to be useful
+    // and are skipped.
+    std::vector<DuplicatePair> findDuplicates(const std::vector<AudioFingerprint>& fingerprints,
+                                              std::uint32_t minVotes = 8, std::size_t maxPostings = 64,
+                                              std::size_t threads = 0) const {
+        threads = threadCount(threads);
+        std::vector<std::vector<DuplicatePair>> found(threads);
+        const std::size_t chunk = (fingerprints.size() + threads - 1) / threads;
+        parallelFor(threads, threads, [&](std::size_t begin, std::size_t end) {
+            std::vector<std::uint64_t> candidates;
+            for (std::size_t t = begin; t < end; ++t) {
+                const std::size_t first = std::min(fingerprints.size(), t * chunk);
+                const std::size_t last = std::min(fingerprints.size(), first + chunk);
+                for (std::size_t song = first; song < last; ++song) {
+                    candidates.clear();
+                    for (const auto& entry : fingerprints[song]) {
+                        const std::uint32_t key = mix(entry.hash);
+                        const std::size_t bucket = key >> (32 - kDirectoryBits);
+                        auto end = keys.begin() + directory[bucket + 1];
+                        auto it = std::lower_bound(keys.begin() + directory[bucket], end, key);
+                        if (it == end || *it != key) {
+                            continue;
+                        }
+                        const std::size_t h = it - keys.begin();
+                        if (starts[h + 1] - starts[h] > maxPostings) {
+                            continue;
+                        }
+                        for (std::size_t p = starts[h]; p < starts[h + 1]; ++p) {
+                            if (postings[p].song <= song) {
+                                continue;
+                            }
+                            // Song in the high half, offset difference (biased) in
+                            // the low half, so sorting groups by song then offset.
+                            const std::uint32_t delta = postings[p].offset - entry.offset + 0x80000000u;
+                            candidates.push_back((static_cast<std::uint64_t>(postings[p].song) << 32) | delta);
+                        }
+                    }
+                    collectVotes(static_cast<SongId>(song), candidates, minVotes, found[t]);
+                }
+            }
+        });
+
+        std::vector<DuplicatePair> pairs;
+        for (auto& part : found) {
+            pairs.insert(pairs.end(), part.begin(), part.end());
+        }
+        return pairs;
+    }
+
+private:
+    static constexpr std::size_t kDirectoryBits = 20;
+
+    std::vector<std::uint32_t> keys;
+    std::vector<std::size_t> starts;
+    std::vector<Posting> postings;
+    std::vector<std::size_t> directory;
+
+    static std::uint32_t mix(std::uint32_t hash) { return hash * 0x9E3779B1u; }
+
+    static std::size_t threadCount(std::size_t threads) {
+        return threads ? threads : std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    template <typename F>
+    static void parallelFor(std::size_t count, std::size_t threads, F f) {
+        const std::size_t workers = std::min(threads, std::max<std::size_t>(1, count));
+        if (workers <= 1) {
+            f(0, count);
+            return;
+        }
+        std::vector<std::thread> pool;
+        const std::size_t chunk = (count + workers - 1) / workers;
+        for (std::size_t w = 0; w < workers; ++w) {
+            const std::size_t begin = std::min(count, w * chunk);
+            const std::size_t end = std::min(count, begin + chunk);
+            pool.emplace_back([&f, begin, end] { f(begin, end); });
+        }
+        for (auto& thread : pool) {
+            thread.join();
+        }
+    }
+
+    // `candidates` holds (song, offset difference) keys; the best vote for a song
+    // is the largest count over three neighbouring offset differences.
+    static void collectVotes(SongId song, std::vector<std::uint64_t>& candidates, std::uint32_t minVotes,
+                             std::vector<DuplicatePair>& out) {
+        std::sort(candidates.begin(), candidates.end());
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> runs;
+        for (std::size_t i = 0; i < candidates.size();) {
+            std::size_t j = i;
+            while (j < candidates.size() && candidates[j] == candidates[i]) {
+                ++j;
+            }
+            runs.push_back({candidates[i], static_cast<std::uint32_t>(j - i)});
+            i = j;
+        }
+        for (std::size_t i = 0; i < runs.size();) {
+            const std::uint64_t other = runs[i].first >> 32;
+            std::uint32_t best = 0;
+            std::size_t j = i;
+            for (; j < runs.size() && (runs[j].first >> 32) == other; ++j) {
+                std::uint32_t votes = runs[j].second;
+                if (j > i && runs[j].first - runs[j - 1].first == 1) {
+                    votes += runs[j - 1].second;
+                }
+                if (j + 1 < runs.size() && (runs[j + 1].first >> 32) == other &&
+                    runs[j + 1].first - runs[j].first == 1) {
+                    votes += runs[j + 1].second;
+                }
+                best = std::max(best, votes);
+            }
+            if (best >= minVotes) {
+                out.push_back({song, static_cast<SongId>(other), best});
+            }
+            i = j;
+        }
+    }
+};
+
+// Groups songs connected by duplicate pairs (union-find); only groups of two or
+// more songs are returned, each sorted by id.
+inline std::vector<std::vector<SongId>> duplicateGroups(const std::vector<DuplicatePair>& pairs,
+                                                        std::size_t songCount) {
+    std::vector<SongId> parent(songCount);
+    std::iota(parent.begin(), parent.end(), SongId{0});
+    auto find = [&parent](SongId x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+    for (const auto& pair : pairs) {
+        SongId a = find(pair.first), b = find(pair.second);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+    std::vector<std::vector<SongId>> byRoot(songCount);
+    for (const auto& pair : pairs) {
+        for (SongId id : {pair.first, pair.second}) {
+            auto& group = byRoot[find(id)];
+            if (std::find(group.begin(), group.end(), id) == group.end()) {
+                group.push_back(id);
+            }
+        }
+    }
+    std::vector<std::vector<SongId>> groups;
+    for (auto& group : byRoot) {
+        if (group.size() > 1) {
+            std::sort(group.begin(), group.end());
+            groups.push_back(std::move(group));
+        }
+    }
+    return groups;
+}
@@ -0,0 +1,57 @@
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "bench.h"
+
+static bool parseCount(const char* text, std::uint64_t& value) {
+    if (!std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    const unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (errno == ERANGE || *end != '\0') {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " NAME [options]\n"
+              << "  --seed N            seed for the synthetic catalog\n"
+              << "  --size N            catalog size\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || std::string(argv[1]) == "--help") {
+        printUsage(argv[0]);
+        return argc < 2 ? 1 : 0;
+    }
+    BenchOptions options;
+    for (int i = 2; i < argc; ++i) {
+        const std::string flag = argv[i];
+        std::uint64_t count = 0;
+        if (i + 1 >= argc || (flag != "--seed" && flag != "--size")) {
+            std::cerr << "Unknown option or missing value: " << flag << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (!parseCount(value, count)) {
+            std::cerr << "Bad value for " << flag << ": " << value << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (flag == "--seed") {
+            options.seed = count;
+        } else {
+            options.catalogSize = count;
+        }
+    }
+    return runBenchmark(argv[1], options) ? 0 : 1;
+}
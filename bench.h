@@ -0,0 +1,1364 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "attribute_index.h"
+#include "audio_analysis.h"
+#include "audio_fingerprint.h"
+#include "catalog_file.h"
+#include "completion_trie.h"
+#include "duration_playlist.h"
+#include "energy_arc.h"
+#include "fast_random.h"
+#include "filter_plan.h"
+#include "filter_query.h"
+#include "hnsw_index.h"
+#include "mood_clustering.h"
+#include "mood_index.h"
+#include "mood_query.h"
+#include "moods.h"
+#include "musical_key.h"
+#include "playlist_cache.h"
+#include "quantized_features.h"
+#include "ranking_policy.h"
+#include "score_program.h"
+#include "song.h"
+#include "song_columns.h"
+#include "song_features.h"
+#include "text_normalize.h"
+#include "transition_sequence.h"
+#include "trigram_index.h"
+
+// Benchmarks over synthetic catalogs, run with `./bench <name>` after
+// `make bench`, which builds with optimisations.
+struct BenchOptions {
+    std::size_t catalogSize = 1000000;
+    std::uint64_t seed = 1;
+};
+
+inline Song syntheticSong(std::size_t index, FastRandom& rng) {
+    std::vector<std::string> moods;
+    const std::size_t moodCount = 1 + rng.below(2);
+    for (std::size_t i = 0; i < moodCount; ++i) {
+        moods.push_back(kMoodNames[rng.below(kMoodCount)]);
+    }
+    return Song("Song " + std::to_string(index), "Artist " + std::to_string(rng.below(50000)), moods,
+                static_cast<int>(rng.below(11)), static_cast<int>(rng.below(11)),
+                1950 + static_cast<int>(rng.below(76)));
+}
+
+inline FeatureMatrix syntheticFeatures(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    FeatureMatrix matrix;
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        matrix.append(songFeatures(syntheticSong(i, rng)));
+    }
+    return matrix;
+}
+
+template <typename F>
+double elapsedMs(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline void benchKnn(const BenchOptions& options) {
+    FeatureMatrix matrix = syntheticFeatures(options);
+    const FeatureWeights weights = FeatureWeights::defaults();
+    FastRandom rng(options.seed + 1);
+    const int queries = 20;
+
+    std::cout << "Brute-force k-NN over " << matrix.size() << " songs (" << queries << " queries per k)\n";
+    for (std::size_t k : {1, 10, 100, 1000}) {
+        std::size_t found = 0;
+        double ms = elapsedMs([&] {
+            for (int q = 0; q < queries; ++q) {
+                SongId seed = static_cast<SongId>(rng.below(matrix.size()));
+                found += matrix.nearest(matrix.row(seed), k, weights).size();
+            }
+        });
+        std::cout << "  k=" << std::setw(4) << k << ": " << std::fixed << std::setprecision(3)
+                  << ms / queries << " ms/query, " << std::setprecision(1)
+                  << matrix.size() * queries / (ms * 1000.0) << " M rows/s"
+                  << (found == 0 ? " (no results)" : "") << "\n";
+    }
+}
+
+// Recall@10 and latency of the HNSW index against exact search, across ef.
+inline void benchHnsw(const BenchOptions& options) {
+    FeatureMatrix matrix = syntheticFeatures(options);
+    const FeatureWeights weights = FeatureWeights::defaults();
+    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t k = 10;
+    const int queries = 100;
+
+    HnswIndex index;
+    double buildMs = elapsedMs([&] { index.build(matrix, weights, HnswIndex::Params(), threads); });
+    std::cout << "HNSW over " << matrix.size() << " songs: built in " << std::fixed << std::setprecision(0)
+              << buildMs << " ms on " << threads << " threads\n";
+
+    FastRandom rng(options.seed + 1);
+    std::vector<FeatureVector> queryRows(queries);
+    std::vector<float> kthDistance(queries);
+    double exactMs = elapsedMs([&] {
+        for (int q = 0; q < queries; ++q) {
+            const float* row = matrix.row(static_cast<SongId>(rng.below(matrix.size())));
+            std::copy(row, row + kFeatureDims, queryRows[q].begin());
+            auto exact = matrix.nearest(queryRows[q].data(), k, weights);
+            kthDistance[q] = exact.empty() ? 0.0f : exact.back().distance;
+        }
+    });
+    std::cout << "  exact:  " << std::setprecision(3) << exactMs / queries << " ms/query\n";
+
+    // Synthetic attributes are discrete, so many songs tie; a result counts as a
+    // hit if it is no farther than the exact k-th neighbour.
+    for (std::size_t ef : {10, 20, 40, 80, 160, 320}) {
+        std::size_t hits = 0;
+        double ms = elapsedMs([&] {
+            for (int q = 0; q < queries; ++q) {
+                for (const Neighbor& n : index.search(queryRows[q].data(), k, ef)) {
+                    hits += n.distance <= kthDistance[q] + 1e-6f;
+                }
+            }
+        });
+        std::cout << "  ef=" << std::setw(3) << ef << ": " << std::setprecision(3) << ms / queries
+                  << " ms/query, recall@" << k << " " << std::setprecision(3)
+                  << static_cast<double>(hits) / (queries * k) << "\n";
+    }
+
+    // Concurrent queries against the same index.
+    std::vector<std::thread> workers;
+    double concurrentMs = elapsedMs([&] {
+        for (std::size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (int q = static_cast<int>(t); q < queries; q += static_cast<int>(threads)) {
+                    index.search(queryRows[q].data(), k, 80);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    });
+    std::cout << "  ef= 80 on " << threads << " threads: " << std::setprecision(0)
+              << queries / (concurrentMs / 1000.0) << " queries/s\n";
+}
+
+// Int8 feature store against the float matrix: memory, scan latency, distance
+// and dot-product error, and recall of quantized k-NN.
+inline void benchQuantized(const BenchOptions& options) {
+    FeatureMatrix matrix = syntheticFeatures(options);
+    QuantizedFeatureMatrix quantized = QuantizedFeatureMatrix::fromMatrix(matrix);
+    const FeatureWeights weights = FeatureWeights::defaults();
+    const FeatureVector combined = quantized.combinedWeights(weights);
+    const std::size_t k = 10;
+    const int queries = 20;
+
+    std::cout << "Quantized features for " << matrix.size() << " songs: "
+              << matrix.size() * kFeatureDims * sizeof(float) / (1024 * 1024) << " MB float, "
+              << quantized.bytes() / (1024 * 1024) << " MB int8\n";
+
+    FastRandom rng(options.seed + 1);
+    double maxDistanceError = 0.0, sumDistanceError = 0.0, maxDotError = 0.0;
+    const int pairs = 10000;
+    for (int p = 0; p < pairs; ++p) {
+        SongId a = static_cast<SongId>(rng.below(matrix.size()));
+        SongId b = static_cast<SongId>(rng.below(matrix.size()));
+        double exact = weightedDistance(matrix.row(a), matrix.row(b), weights.weights.data());
+        double approx = quantizedDistance(quantized.row(a), quantized.row(b), combined.data());
+        double exactDot = 0.0;
+        for (std::size_t d = 0; d < kFeatureDims; ++d) {
+            exactDot += weights.weights[d] * matrix.row(a)[d] * matrix.row(b)[d];
+        }
+        double approxDot = quantizedDot(quantized.row(a), quantized.row(b), combined.data());
+        maxDistanceError = std::max(maxDistanceError, std::fabs(exact - approx));
+        sumDistanceError += std::fabs(exact - approx);
+        maxDotError = std::max(maxDotError, std::fabs(exactDot - approxDot));
+    }
+    std::cout << "  distance error: mean " << std::scientific << std::setprecision(2) << sumDistanceError / pairs
+              << ", max " << maxDistanceError << "; dot product max error " << maxDotError << "\n";
+
+    // The app's mood-restricted "more like this" scans a subset this way.
+    std::vector<SongId> all(matrix.size());
+    for (std::size_t i = 0; i < all.size(); ++i) {
+        all[i] = static_cast<SongId>(i);
+    }
+    std::size_t hits = 0, rerankedHits = 0;
+    double floatMs = 0.0, int8Ms = 0.0, rerankedMs = 0.0;
+    for (int q = 0; q < queries; ++q) {
+        const float* query = matrix.row(static_cast<SongId>(rng.below(matrix.size())));
+        std::vector<Neighbor> exact, approx, reranked;
+        floatMs += elapsedMs([&] { exact = matrix.nearest(query, k, weights); });
+        int8Ms += elapsedMs([&] { approx = quantized.nearest(query, k, weights); });
+        rerankedMs += elapsedMs([&] { reranked = rerankedNearest(matrix, quantized, query, all, k, 4 * k, weights); });
+        // Rank by the true distance so ties count as hits.
+        for (const Neighbor& n : approx) {
+            float trueDistance = weightedDistance(matrix.row(n.id), query, weights.weights.data());
+            hits += trueDistance <= exact.back().distance + 1e-6f;
+        }
+        for (const Neighbor& n : reranked) {
+            rerankedHits += n.distance <= exact.back().distance + 1e-6f;
+        }
+    }
+    std::cout << std::fixed << std::setprecision(3) << "  float scan: " << floatMs / queries
+              << " ms/query, int8 scan: " << int8Ms / queries << " ms/query, int8 recall@" << k << ": "
+              << static_cast<double>(hits) / (queries * k) << "\n"
+              << "  int8 scan + float rerank of " << 4 * k << ": " << rerankedMs / queries << " ms/query, recall@"
+              << k << ": " << static_cast<double>(rerankedHits) / (queries * k) << "\n";
+}
+
+// Mood auto-tagging: half the synthetic catalog loses its moods and is re-tagged
+// by mini-batch k-means seeded from the other half.
+inline void benchMoodClustering(const BenchOptions& options) {
+    FeatureMatrix matrix = syntheticFeatures(options);
+    FastRandom rng(options.seed + 1);
+    std::vector<std::vector<MoodId>> hidden(matrix.size());
+    for (std::size_t i = 0; i < matrix.size(); i += 2) {
+        float* row = matrix.row(static_cast<SongId>(i));
+        for (std::size_t m = 0; m < kMoodCount; ++m) {
+            if (row[kFeatureFirstMood + m] > 0.5f) {
+                hidden[i].push_back(static_cast<MoodId>(m));
+            }
+            row[kFeatureFirstMood + m] = 0.0f;
+        }
+    }
+
+    std::vector<MoodAssignment> assignments;
+    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    double ms = elapsedMs([&] {
+        MoodClusteringOptions clusteringOptions;
+        clusteringOptions.threads = threads;
+        assignments = MoodClustering(clusteringOptions).run(matrix);
+    });
+
+    std::size_t agreeing = 0;
+    std::array<std::size_t, kMoodCount> perMood{};
+    for (const auto& assignment : assignments) {
+        const auto& truth = hidden[assignment.id];
+        bool agrees = false;
+        for (MoodId mood : assignment.moods) {
+            perMood[mood]++;
+            agrees = agrees || std::find(truth.begin(), truth.end(), mood) != truth.end();
+        }
+        agreeing += agrees;
+    }
+    std::cout << "Mood auto-tagging of " << assignments.size() << " untagged songs (" << matrix.size()
+              << " total) on " << threads << " threads: " << std::fixed << std::setprecision(0) << ms << " ms, "
+              << std::setprecision(2) << assignments.size() / (ms * 1000.0) << " M songs/s\n";
+    std::cout << "  songs sharing a tag with their hidden moods: " << std::setprecision(3)
+              << static_cast<double>(agreeing) / std::max<std::size_t>(1, assignments.size())
+              << " (synthetic moods are random, so this is near chance)\n  tags:";
+    for (std::size_t m = 0; m < kMoodCount; ++m) {
+        std::cout << " " << kMoodNames[m] << "=" << perMood[m];
+    }
+    std::cout << "\n";
+}
+
+// Writes a 16-bit mono WAV with a kick drum on every beat, the tonic triad held
+// throughout and a melody stepping through the scale, so tempo and key are known.
+inline bool writeSyntheticTrack(const std::string& path, double bpm, int key, double seconds, FastRandom& rng) {
+    const std::uint32_t sampleRate = 22050;
+    const std::uint32_t frames = static_cast<std::uint32_t>(seconds * sampleRate);
+    const double pi = 3.14159265358979323846;
+    const int majorScale[7] = {0, 2, 4, 5, 7, 9, 11};
+    const int minorScale[7] = {0, 2, 3, 5, 7, 8, 10};
+    const int* scale = isMinorKey(key) ? minorScale : majorScale;
+    const int tonic = keyTonic(key);
+    const int chord[3] = {tonic, tonic + scale[2], tonic + scale[4]};
+    auto hz = [](int semitonesAboveC4) { return 261.63 * std::pow(2.0, semitonesAboveC4 / 12.0); };
+
+    std::vector<std::int16_t> samples(frames);
+    const double beat = 60.0 / bpm;
+    int melodyNote = tonic;
+    std::size_t lastBeat = static_cast<std::size_t>(-1);
+    for (std::uint32_t i = 0; i < frames; ++i) {
+        const double t = static_cast<double>(i) / sampleRate;
+        const std::size_t beatIndex = static_cast<std::size_t>(t / beat);
+        const double phase = t - beatIndex * beat;
+        if (beatIndex != lastBeat) {
+            melodyNote = tonic + 12 + scale[rng.below(7)];
+            lastBeat = beatIndex;
+        }
+        double v = 0.6 * std::exp(-phase * 25.0) * std::sin(2.0 * pi * 55.0 * t);
+        for (int note : chord) {
+            v += 0.08 * std::sin(2.0 * pi * hz(note) * t);
+        }
+        v += 0.1 * std::exp(-phase / beat * 2.0) * std::sin(2.0 * pi * hz(melodyNote) * t);
+        samples[i] = static_cast<std::int16_t>(std::clamp(v, -1.0, 1.0) * 32767.0);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    auto put = [&file](std::uint32_t value, int bytes) { file.write(reinterpret_cast<const char*>(&value), bytes); };
+    const std::uint32_t dataBytes = frames * 2;
+    file.write("RIFF", 4);
+    put(36 + dataBytes, 4);
+    file.write("WAVEfmt ", 8);
+    put(16, 4);
+    put(1, 2);
+    put(1, 2);
+    put(sampleRate, 4);
+    put(sampleRate * 2, 4);
+    put(2, 2);
+    put(16, 2);
+    file.write("data", 4);
+    put(dataBytes, 4);
+    file.write(reinterpret_cast<const char*>(samples.data()), dataBytes);
+    return static_cast<bool>(file);
+}
+
+// Audio analysis throughput (energy, danceability, tempo and key) over
+// synthetic 30 s tracks of known tempo and key, on one core and on all cores.
+inline void benchAudioAnalysis(const BenchOptions& options) {
+    // The tracks are written to disk, so the catalog size is capped.
+    const std::size_t fileCount = std::min<std::size_t>(options.catalogSize, 64);
+    const double seconds = 30.0;
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "grool_bench_audio";
+    std::filesystem::create_directories(directory);
+
+    FastRandom rng(options.seed);
+    std::vector<std::string> paths;
+    std::vector<double> tempos;
+    std::vector<int> keys;
+    for (std::size_t i = 0; i < fileCount; ++i) {
+        tempos.push_back(70.0 + rng.below(111));
+        keys.push_back(static_cast<int>(rng.below(kKeyCount)));
+        paths.push_back((directory / ("track" + std::to_string(i) + ".wav")).string());
+        writeSyntheticTrack(paths.back(), tempos.back(), keys.back(), seconds, rng);
+    }
+
+    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::optional<AudioFeatures>> results;
+    double singleMs = elapsedMs([&] { results = analyzeAudioFiles(paths, 1); });
+    double parallelMs = elapsedMs([&] { results = analyzeAudioFiles(paths, threads); });
+
+    std::size_t tempoHits = 0, keyHits = 0;
+    for (std::size_t i = 0; i < fileCount; ++i) {
+        if (results[i]) {
+            tempoHits += std::fabs(results[i]->bpm - tempos[i]) <= 0.02 * tempos[i];
+            keyHits += results[i]->key == keys[i];
+        }
+    }
+    std::cout << "Audio analysis of " << fileCount << " x " << seconds << " s tracks\n" << std::fixed
+              << std::setprecision(1) << "  1 thread: " << fileCount / (singleMs / 1000.0) << " files/s ("
+              << fileCount * seconds / (singleMs / 1000.0) << "x real time)\n"
+              << "  " << threads << " threads: " << fileCount / (parallelMs / 1000.0) << " files/s, "
+              << fileCount / (parallelMs / 1000.0) / threads << " files/s/core\n"
+              << std::setprecision(3) << "  tempo within 2%: " << static_cast<double>(tempoHits) / fileCount
+              << ", key correct: " << static_cast<double>(keyHits) / fileCount << "\n";
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+// Duplicate detection over synthetic fingerprints: 1% of the tracks are copies
+// of another track that start at a different point, lost 40% of their landmarks
+// and gained some of their own.
+inline void benchDedup(const BenchOptions& options) {
+    const std::size_t landmarksPerTrack = 64;
+    FastRandom rng(options.seed);
+    std::vector<AudioFingerprint> fingerprints(options.catalogSize);
+    for (auto& fingerprint : fingerprints) {
+        std::uint32_t offset = 0;
+        for (std::size_t i = 0; i < landmarksPerTrack; ++i) {
+            offset += 1 + static_cast<std::uint32_t>(rng.below(40));
+            // Landmark hashes use 26 bits (two frequencies and a gap).
+            fingerprint.push_back({static_cast<std::uint32_t>(rng.below(1u << 26)), offset});
+        }
+    }
+    std::vector<std::pair<SongId, SongId>> planted;
+    for (std::size_t copy = 0; copy + 100 <= options.catalogSize; copy += 100) {
+        const SongId original = static_cast<SongId>(copy + 1 + rng.below(99));
+        const std::uint32_t shift = static_cast<std::uint32_t>(rng.below(200));
+        AudioFingerprint duplicate;
+        for (const auto& entry : fingerprints[original]) {
+            if (rng.below(10) < 6) {
+                duplicate.push_back({entry.hash, entry.offset + shift + static_cast<std::uint32_t>(rng.below(2))});
+            }
+            if (rng.below(5) == 0) {
+                duplicate.push_back({static_cast<std::uint32_t>(rng.below(1u << 26)), entry.offset + shift});
+            }
+        }
+        fingerprints[copy] = std::move(duplicate);
+        planted.push_back({static_cast<SongId>(copy), original});
+    }
+
+    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    FingerprintIndex index;
+    double buildMs = elapsedMs([&] { index.build(fingerprints, threads); });
+    std::vector<DuplicatePair> pairs;
+    double searchMs = elapsedMs([&] { pairs = index.findDuplicates(fingerprints, 8, 64, threads); });
+
+    std::size_t found = 0;
+    for (const auto& expected : planted) {
+        found += std::any_of(pairs.begin(), pairs.end(), [&](const DuplicatePair& pair) {
+            return pair.first == expected.first && pair.second == expected.second;
+        });
+    }
+    std::cout << "Fingerprint dedup over " << fingerprints.size() << " tracks (" << index.postingCount()
+              << " landmarks, " << index.hashCount() << " distinct) on " << threads << " threads\n"
+              << std::fixed << std::setprecision(0) << "  index build: " << buildMs << " ms, duplicate search: "
+              << searchMs << " ms (" << std::setprecision(2) << fingerprints.size() / (searchMs * 1000.0)
+              << " M tracks/s)\n"
+              << "  planted duplicates found: " << found << "/" << planted.size()
+              << ", other pairs reported: " << pairs.size() - found << "\n";
+}
+
+// Title/artist normalisation and key hashing over an import of synthetic rows,
+// once with plain ASCII rows and once with 30% of the words accented, in other
+// scripts or with typographic punctuation.
+inline void benchNormalize(const BenchOptions& options) {
+    const char* asciiWords[] = {"Don't", "STOP", "Believin'", "the", "Love", "Night", "(Remastered", "2011)",
+                                "Dancing", "Queen", "feat.", "&", "Rock-n-Roll", "Heart", "of", "Gold"};
+    const char* otherWords[] = {"Beyoncé", "Björk", "Motörhead", "Straße", "Łódź", "ΣΟΦΙΑ", "КИНО",
+                                "Don’t", "Café", "日本語"};
+    const std::size_t rows = options.catalogSize;
+
+    for (bool mixed : {false, true}) {
+        FastRandom rng(options.seed);
+        std::string blob;
+        std::vector<std::size_t> ends;
+        blob.reserve(rows * 48);
+        ends.reserve(rows * 2);
+        for (std::size_t r = 0; r < rows * 2; ++r) {
+            const std::size_t words = 2 + rng.below(4);
+            for (std::size_t w = 0; w < words; ++w) {
+                if (w > 0) {
+                    blob.push_back(' ');
+                }
+                blob.append(mixed && rng.below(10) < 3 ? otherWords[rng.below(10)] : asciiWords[rng.below(16)]);
+            }
+            ends.push_back(blob.size());
+        }
+
+        std::uint64_t checksum = 0;
+        double ms = elapsedMs([&] {
+            std::size_t begin = 0;
+            for (std::size_t r = 0; r < rows; ++r) {
+                const std::size_t middle = ends[2 * r];
+                const std::size_t end = ends[2 * r + 1];
+                checksum += songKey(std::string_view(blob.data() + begin, middle - begin),
+                                    std::string_view(blob.data() + middle, end - middle));
+                begin = end;
+            }
+        });
+        std::cout << (mixed ? "Mixed-script" : "ASCII") << " rows: " << rows << " title/artist keys in "
+                  << std::fixed << std::setprecision(0) << ms << " ms (" << std::setprecision(2)
+                  << rows / (ms * 1000.0) << " M rows/s, " << std::setprecision(0)
+                  << blob.size() / (ms * 1000.0) << " MB/s)" << (checksum == 0 ? " (zero checksum)" : "") << "\n";
+    }
+}
+
+// Pronounceable made-up words, so synthetic titles have a realistic spread of
+// common and rare trigrams.
+inline std::string syntheticWord(FastRandom& rng) {
+    static const char consonants[] = "bcdfghjklmnprstvwz";
+    static const char vowels[] = "aeiouy";
+    std::string word;
+    const std::size_t syllables = 1 + rng.below(3);
+    for (std::size_t i = 0; i < syllables; ++i) {
+        word.push_back(consonants[rng.below(sizeof(consonants) - 1)]);
+        word.push_back(vowels[rng.below(sizeof(vowels) - 1)]);
+        if (rng.below(3) == 0) {
+            word.push_back(consonants[rng.below(sizeof(consonants) - 1)]);
+        }
+    }
+    word[0] = static_cast<char>(word[0] - 'a' + 'A');
+    return word;
+}
+
+// Fuzzy title/artist search: queries are a song's title and the start of its
+// artist, half of them with one character replaced. A query counts as found if
+// the song is among the top 10 hits.
+inline void benchSearch(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<std::string> artists(std::max<std::size_t>(1, options.catalogSize / 20));
+    for (auto& artist : artists) {
+        artist = syntheticWord(rng) + " " + syntheticWord(rng);
+    }
+    std::vector<Song> songs;
+    songs.reserve(options.catalogSize);
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        std::string title = syntheticWord(rng);
+        for (std::size_t w = rng.below(3); w > 0; --w) {
+            title += " " + syntheticWord(rng);
+        }
+        songs.push_back(Song(title, artists[rng.below(artists.size())], {}, 5, 5, 2000));
+    }
+
+    TrigramIndex index;
+    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    double buildMs = elapsedMs([&] { index.build(songs, threads); });
+
+    const std::size_t queries = 2000;
+    std::vector<double> latencies;
+    std::size_t found = 0, hits = 0;
+    for (std::size_t q = 0; q < queries && !songs.empty(); ++q) {
+        const SongId target = static_cast<SongId>(rng.below(songs.size()));
+        std::string query = songs[target].title + " " + songs[target].artist.substr(0, 4);
+        if (q % 2 == 1) {
+            query[rng.below(query.size())] = static_cast<char>('a' + rng.below(26));
+        }
+        std::vector<SearchHit> results;
+        latencies.push_back(elapsedMs([&] { results = index.search(query, 10); }) * 1000.0);
+        hits += results.size();
+        found += std::any_of(results.begin(), results.end(), [&](const SearchHit& hit) {
+            return hit.id == target || (songs[hit.id].title == songs[target].title &&
+                                        songs[hit.id].artist == songs[target].artist);
+        });
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0.0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+    std::cout << "Trigram search over " << songs.size() << " songs (" << index.trigramCount() << " trigrams, "
+              << index.postingCount() << " postings, " << std::fixed << std::setprecision(2)
+              << static_cast<double>(index.indexBytes()) / std::max<std::size_t>(1, index.postingCount())
+              << " bytes/posting)\n"
+              << std::setprecision(0) << "  index build: " << buildMs << " ms on " << threads << " threads\n"
+              << std::setprecision(1) << "  query latency: mean " << total / latencies.size() << " us, p50 "
+              << latencies[latencies.size() / 2] << " us, p99 " << latencies[latencies.size() * 99 / 100]
+              << " us\n"
+              << "  found in top 10: " << found << "/" << latencies.size() << " (" << std::setprecision(1)
+              << static_cast<double>(hits) / latencies.size() << " hits per query)\n";
+}
+
+// Prefix completion over synthetic titles and artists with skewed play counts:
+// trie size, startup cost of mapping the stored trie versus rebuilding it, and
+// latency for prefixes of 1-6 characters.
+inline void benchComplete(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<std::string> artists(std::max<std::size_t>(1, options.catalogSize / 20));
+    for (auto& artist : artists) {
+        artist = syntheticWord(rng) + " " + syntheticWord(rng);
+    }
+    std::vector<Song> songs;
+    songs.reserve(options.catalogSize);
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        std::string title = syntheticWord(rng);
+        for (std::size_t w = rng.below(3); w > 0; --w) {
+            title += " " + syntheticWord(rng);
+        }
+        songs.push_back(Song(title, artists[rng.below(artists.size())], {}, 5, 5, 2000));
+        // Roughly Zipf-distributed plays.
+        songs.back().playCount = static_cast<int>(1000.0 / (1.0 + rng.below(1000)));
+    }
+    // Text of the distinct titles and artists, as the trie stores each once.
+    std::vector<std::string> strings = artists;
+    for (const Song& song : songs) {
+        strings.push_back(song.title);
+    }
+    std::sort(strings.begin(), strings.end());
+    strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    std::size_t textBytes = 0;
+    for (const auto& text : strings) {
+        textBytes += text.size();
+    }
+
+    std::string image;
+    double buildMs = elapsedMs([&] { image = CompletionTrie::build(songs, 0); });
+    const std::string path =
+        (std::filesystem::temp_directory_path() / ("grool_complete_bench_" + std::to_string(options.seed))).string();
+    CatalogFile catalog;
+    catalog.setSection("ACMP", image);
+    if (!catalog.write(path)) {
+        std::cout << "Could not write " << path << "\n";
+        return;
+    }
+
+    MappedCatalog mapped;
+    CompletionTrie trie;
+    std::vector<Completion> first;
+    double attachMs = elapsedMs([&] {
+        auto section = mapped.open(path) ? mapped.section("ACMP") : std::nullopt;
+        if (section && trie.attach(*section)) {
+            first = trie.complete("ba", 10);
+        }
+    });
+
+    const std::size_t queries = 20000;
+    std::vector<double> latencies;
+    std::size_t results = 0;
+    for (std::size_t q = 0; q < queries && !songs.empty(); ++q) {
+        const std::string& title = songs[rng.below(songs.size())].title;
+        const std::string prefix = title.substr(0, 1 + q % 6);
+        latencies.push_back(elapsedMs([&] { results += trie.complete(prefix, 10).size(); }) * 1000.0);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0.0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+    auto perString = [&](std::size_t bytes) {
+        return static_cast<double>(bytes) / std::max<std::size_t>(1, trie.stringCount());
+    };
+    std::cout << "Completion trie over " << songs.size() << " songs (" << trie.stringCount() << " distinct titles and artists)\n"
+              << std::fixed << std::setprecision(2) << "  size: " << image.size() / 1e6 << " MB, "
+              << perString(image.size()) << " bytes/string: raw text " << perString(textBytes) << " + overhead "
+              << perString(image.size()) - perString(textBytes) << " (song table " << perString(trie.songTableBytes())
+              << ")\n"
+              << std::setprecision(0) << "  build: " << buildMs << " ms, map + attach + first query: "
+              << std::setprecision(2) << attachMs << " ms\n"
+              << std::setprecision(1) << "  completion latency: mean " << total / latencies.size() << " us, p50 "
+              << latencies[latencies.size() / 2] << " us, p99 " << latencies[latencies.size() * 99 / 100]
+              << " us (" << static_cast<double>(results) / latencies.size() << " results per query)\n";
+    std::filesystem::remove(path);
+}
+
+// Boolean mood queries over per-mood compressed bitmaps, against the same
+// queries on sorted id vectors (std::set_* algorithms) and a scan of the songs'
+// mood lists. Half the catalog is in mood-sorted runs (as after an import of
+// tagged albums) and half tagged at random.
+inline void benchMoodQuery(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<Song> songs;
+    songs.reserve(options.catalogSize);
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        songs.push_back(syntheticSong(i, rng));
+        if (i < options.catalogSize / 2) {
+            // Albums of ~2000 songs sharing a mood pair.
+            const std::size_t album = i / 2000;
+            songs.back().moods = {kMoodNames[album % kMoodCount], kMoodNames[(album * 7 + 3) % kMoodCount]};
+        }
+    }
+    const std::vector<std::string> moods(kMoodNames.begin(), kMoodNames.end());
+    MoodIndex index;
+    double buildMs = elapsedMs([&] { index.rebuild(moods, songs); });
+    std::size_t bitmapBytes = 0;
+    std::vector<std::vector<SongId>> sorted(kMoodCount);
+    for (std::size_t m = 0; m < kMoodCount; ++m) {
+        bitmapBytes += index.bitmapFor(moods[m]).sizeInBytes();
+        sorted[m] = index.bitmapFor(moods[m]).toVector();
+    }
+    std::size_t vectorBytes = 0;
+    for (const auto& ids : sorted) {
+        vectorBytes += ids.size() * sizeof(SongId);
+    }
+    std::cout << "Mood bitmaps over " << songs.size() << " songs: " << std::fixed << std::setprecision(2)
+              << bitmapBytes / 1e6 << " MB (sorted id vectors: " << vectorBytes / 1e6 << " MB), built in "
+              << std::setprecision(0) << buildMs << " ms\n";
+
+    struct Case {
+        const char* text;
+        // The same query on sorted vectors and on a song's moods.
+        std::vector<SongId> (*vectors)(const std::vector<std::vector<SongId>>&);
+        bool (*matches)(const std::vector<std::string>&);
+    };
+    auto has = [](const std::vector<std::string>& songMoods, MoodId mood) {
+        return std::find(songMoods.begin(), songMoods.end(), kMoodNames[mood]) != songMoods.end();
+    };
+    static decltype(has) hasMood = has;
+    const Case cases[] = {
+        {"energetic AND happy",
+         [](const std::vector<std::vector<SongId>>& v) {
+             std::vector<SongId> out;
+             std::set_intersection(v[2].begin(), v[2].end(), v[0].begin(), v[0].end(), std::back_inserter(out));
+             return out;
+         },
+         [](const std::vector<std::string>& m) { return hasMood(m, 2) && hasMood(m, 0); }},
+        {"energetic AND happy AND NOT party",
+         [](const std::vector<std::vector<SongId>>& v) {
+             std::vector<SongId> both, out;
+             std::set_intersection(v[2].begin(), v[2].end(), v[0].begin(), v[0].end(), std::back_inserter(both));
+             std::set_difference(both.begin(), both.end(), v[4].begin(), v[4].end(), std::back_inserter(out));
+             return out;
+         },
+         [](const std::vector<std::string>& m) { return hasMood(m, 2) && hasMood(m, 0) && !hasMood(m, 4); }},
+        {"calm OR relaxed",
+         [](const std::vector<std::vector<SongId>>& v) {
+             std::vector<SongId> out;
+             std::set_union(v[3].begin(), v[3].end(), v[8].begin(), v[8].end(), std::back_inserter(out));
+             return out;
+         },
+         [](const std::vector<std::string>& m) { return hasMood(m, 3) || hasMood(m, 8); }},
+        {"(epic OR sad) AND NOT calm",
+         [](const std::vector<std::vector<SongId>>& v) {
+             std::vector<SongId> either, out;
+             std::set_union(v[7].begin(), v[7].end(), v[1].begin(), v[1].end(), std::back_inserter(either));
+             std::set_difference(either.begin(), either.end(), v[3].begin(), v[3].end(), std::back_inserter(out));
+             return out;
+         },
+         [](const std::vector<std::string>& m) { return (hasMood(m, 7) || hasMood(m, 1)) && !hasMood(m, 3); }},
+    };
+
+    const int repeats = 50;
+    for (const Case& c : cases) {
+        auto query = MoodQuery::parse(c.text, moods);
+        RoaringBitmap result;
+        double bitmapMs = elapsedMs([&] {
+            for (int r = 0; r < repeats; ++r) {
+                result = index.evaluate(*query);
+            }
+        }) / repeats;
+        std::vector<SongId> expected;
+        double vectorMs = elapsedMs([&] {
+            for (int r = 0; r < repeats; ++r) {
+                expected = c.vectors(sorted);
+            }
+        }) / repeats;
+        std::size_t scanned = 0;
+        double scanMs = elapsedMs([&] {
+            for (const Song& song : songs) {
+                scanned += c.matches(song.moods);
+            }
+        });
+        std::cout << "  " << std::left << std::setw(36) << c.text << std::right << std::setw(8)
+                  << result.cardinality() << " songs: bitmaps " << std::setprecision(1) << bitmapMs * 1000.0
+                  << " us, sorted vectors " << vectorMs * 1000.0 << " us, scan " << scanMs * 1000.0 << " us"
+                  << (result.toVector() == expected && scanned == expected.size() ? "" : " (MISMATCH)") << "\n";
+    }
+}
+
+// Range queries on energy, danceability and year through the attribute
+// indexes, alone and combined with a mood bitmap, against scanning the songs.
+// The catalog is in import order, so the ranges select scattered ids.
+inline void benchRangeQuery(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<Song> songs;
+    songs.reserve(options.catalogSize);
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        songs.push_back(syntheticSong(i, rng));
+    }
+    const std::vector<std::string> moods(kMoodNames.begin(), kMoodNames.end());
+    MoodIndex moodIndex;
+    moodIndex.rebuild(moods, songs);
+    AttributeIndex index;
+    double buildMs = elapsedMs([&] { index.rebuild(songs); });
+    std::cout << "Attribute indexes over " << songs.size() << " songs: " << std::fixed << std::setprecision(2)
+              << index.sizeInBytes() / 1e6 << " MB, built in " << std::setprecision(0) << buildMs << " ms\n";
+
+    struct Range {
+        SongAttribute attribute;
+        int lo, hi;
+    };
+    struct Case {
+        const char* text;
+        // Empty for no mood.
+        std::string mood;
+        std::vector<Range> ranges;
+    };
+    const Case cases[] = {
+        {"year 1995", "", {{SongAttribute::Year, 1995, 1995}}},
+        {"energy 10", "", {{SongAttribute::Energy, 10, 10}}},
+        {"energy 6-8", "", {{SongAttribute::Energy, 6, 8}}},
+        {"year 1980-1999", "", {{SongAttribute::Year, 1980, 1999}}},
+        {"danceability 2-10", "", {{SongAttribute::Danceability, 2, 10}}},
+        {"year 1950-2020", "", {{SongAttribute::Year, 1950, 2020}}},
+        {"energy 6-8, year 1980-1999", "", {{SongAttribute::Energy, 6, 8}, {SongAttribute::Year, 1980, 1999}}},
+        {"energetic, energy 6-8, year 1980-1999",
+         "energetic",
+         {{SongAttribute::Energy, 6, 8}, {SongAttribute::Year, 1980, 1999}}},
+        {"calm, danceability 0-2, year 1995", "calm",
+         {{SongAttribute::Danceability, 0, 2}, {SongAttribute::Year, 1995, 1995}}},
+    };
+
+    const int repeats = 20;
+    for (const Case& c : cases) {
+        // Most selective range first, as a planner would.
+        std::vector<Range> ranges = c.ranges;
+        std::sort(ranges.begin(), ranges.end(), [&](const Range& a, const Range& b) {
+            return index.countBetween(a.attribute, a.lo, a.hi) < index.countBetween(b.attribute, b.lo, b.hi);
+        });
+        RoaringBitmap result;
+        double indexMs = elapsedMs([&] {
+            for (int r = 0; r < repeats; ++r) {
+                result = index.between(ranges[0].attribute, ranges[0].lo, ranges[0].hi);
+                for (std::size_t i = 1; i < ranges.size(); ++i) {
+                    result = result & index.between(ranges[i].attribute, ranges[i].lo, ranges[i].hi);
+                }
+                if (!c.mood.empty()) {
+                    result = result & moodIndex.bitmapFor(c.mood);
+                }
+            }
+        }) / repeats;
+        std::vector<SongId> expected;
+        double scanMs = elapsedMs([&] {
+            for (int r = 0; r < repeats; ++r) {
+                expected.clear();
+                for (SongId id = 0; id < songs.size(); ++id) {
+                    const Song& song = songs[id];
+                    bool keep = std::all_of(c.ranges.begin(), c.ranges.end(), [&](const Range& range) {
+                        const int value = attributeValue(song, range.attribute);
+                        return value >= range.lo && value <= range.hi;
+                    });
+                    if (keep && !c.mood.empty()) {
+                        keep = std::find(song.moods.begin(), song.moods.end(), c.mood) != song.moods.end();
+                    }
+                    if (keep) {
+                        expected.push_back(id);
+                    }
+                }
+            }
+        }) / repeats;
+        std::cout << "  " << std::left << std::setw(38) << c.text << std::right << std::setw(8)
+                  << result.cardinality() << " songs: index " << std::setprecision(1) << indexMs * 1000.0
+                  << " us, scan " << scanMs * 1000.0 << " us"
+                  << (result.toVector() == expected ? "" : " (MISMATCH)") << "\n";
+    }
+}
+
+// Filter queries of varying selectivity, run with the plan the cost model
+// picks and with pure index and pure scan plans for comparison.
+inline void benchFilter(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<std::string> artists(std::max<std::size_t>(1, options.catalogSize / 20));
+    for (auto& artist : artists) {
+        artist = syntheticWord(rng) + " " + syntheticWord(rng);
+    }
+    std::vector<Song> songs;
+    songs.reserve(options.catalogSize);
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        songs.push_back(syntheticSong(i, rng));
+        songs.back().title = syntheticWord(rng) + " " + syntheticWord(rng);
+        songs.back().artist = artists[rng.below(artists.size())];
+    }
+    const std::vector<std::string> moods(kMoodNames.begin(), kMoodNames.end());
+    MoodIndex moodIndex;
+    AttributeIndex attributeIndex;
+    TrigramIndex textIndex;
+    SongColumns columns;
+    double buildMs = elapsedMs([&] {
+        moodIndex.rebuild(moods, songs);
+        attributeIndex.rebuild(songs);
+        textIndex.build(songs, std::max(1u, std::thread::hardware_concurrency()));
+        columns.rebuild(songs);
+    });
+    std::cout << "Filter plans over " << songs.size() << " songs (indexes built in " << std::fixed
+              << std::setprecision(0) << buildMs << " ms); times in us\n";
+    const FilterSources sources{songs, columns, moodIndex, attributeIndex, textIndex};
+
+    // A first name long enough to have trigrams.
+    std::string artistWord;
+    for (std::size_t a = artists.size() / 2; a < artists.size() && artistWord.size() < 4; ++a) {
+        artistWord = normalizeText(artists[a].substr(0, artists[a].find(' ')));
+    }
+    const std::vector<std::string> queries = {
+        "year=1995 energy=10",
+        "mood:energetic energy>=7 year<2000",
+        "year:1970-1979 danceability:4-6",
+        "energy>=2 danceability>=2",
+        "mood:calm OR mood:relaxed -energy>5",
+        "artist~" + artistWord + " year>=1990",
+        "-mood:sad year>1960",
+    };
+    const int repeats = 5;
+    const char* kindNames[] = {"index", "intersect", "union", "complement", "filter", "scan"};
+    std::cout << "  " << std::left << std::setw(40) << "query" << std::right << std::setw(8) << "songs"
+              << std::setw(12) << "plan" << std::setw(10) << "chosen" << std::setw(10) << "index"
+              << std::setw(10) << "scan" << "\n";
+    for (const std::string& text : queries) {
+        auto query = FilterQuery::parse(text, moods);
+        if (!query) {
+            continue;
+        }
+        double ms[3] = {0, 0, 0};
+        std::vector<SongId> results[3];
+        std::string chosen;
+        const FilterPlan::Strategy strategies[] = {FilterPlan::Strategy::Auto, FilterPlan::Strategy::IndexOnly,
+                                                   FilterPlan::Strategy::ScanOnly};
+        for (int s = 0; s < 3; ++s) {
+            RoaringBitmap result;
+            ms[s] = elapsedMs([&] {
+                for (int r = 0; r < repeats; ++r) {
+                    FilterPlan plan(*query, sources, strategies[s]);
+                    result = plan.execute();
+                    if (s == 0) {
+                        chosen = kindNames[static_cast<int>(plan.rootStep().kind)];
+                    }
+                }
+            }) / repeats;
+            results[s] = result.toVector();
+        }
+        std::cout << "  " << std::left << std::setw(40) << text << std::right << std::setw(8) << results[0].size()
+                  << std::setw(12) << chosen << std::setprecision(1) << std::setw(10) << ms[0] * 1000.0
+                  << std::setw(10) << ms[1] * 1000.0 << std::setw(10) << ms[2] * 1000.0
+                  << (results[0] == results[1] && results[0] == results[2] ? "" : " (MISMATCH)") << "\n";
+    }
+
+    FilterPlan plan(*FilterQuery::parse(queries[1], moods), sources);
+    plan.execute();
+    std::cout << "\n";
+    plan.explain(std::cout);
+}
+
+// Times one scoring formula through the VM and through `native`, the same
+// formula written out in C++, over the whole catalog and over `candidates`.
+template <typename Native>
+inline void benchScoringFormula(const std::string& formula, const SongColumns& columns,
+                         const std::vector<SongId>& candidates, int currentYear, Native&& native) {
+    auto program = ScoreProgram::parse(formula, currentYear);
+    if (!program) {
+        return;
+    }
+    const std::size_t count = columns.size();
+    std::vector<float> vmScores(count), nativeScores(count);
+    std::vector<float> vmCandidates(candidates.size()), nativeCandidates(candidates.size());
+    const int repeats = 10;
+    const double vmMs = elapsedMs([&] {
+        for (int r = 0; r < repeats; ++r) {
+            program->scoreRange(columns, 0, count, vmScores.data());
+        }
+    }) / repeats;
+    const double nativeMs = elapsedMs([&] {
+        for (int r = 0; r < repeats; ++r) {
+            for (std::size_t i = 0; i < count; ++i) {
+                nativeScores[i] = native(i);
+            }
+        }
+    }) / repeats;
+    const double vmGatherMs = elapsedMs([&] {
+        for (int r = 0; r < repeats; ++r) {
+            program->scoreSongs(columns, candidates.data(), candidates.size(), vmCandidates.data());
+        }
+    }) / repeats;
+    const double nativeGatherMs = elapsedMs([&] {
+        for (int r = 0; r < repeats; ++r) {
+            for (std::size_t i = 0; i < candidates.size(); ++i) {
+                nativeCandidates[i] = native(candidates[i]);
+            }
+        }
+    }) / repeats;
+    float maxDiff = 0.0f;
+    for (std::size_t i = 0; i < count; ++i) {
+        maxDiff = std::max(maxDiff, std::abs(vmScores[i] - nativeScores[i]));
+    }
+    for (std::size_t i = 0; i < candidates.size(); ++i) {
+        maxDiff = std::max(maxDiff, std::abs(vmCandidates[i] - nativeCandidates[i]));
+    }
+    std::cout << "  " << std::left << std::setw(50) << formula << std::right << std::setw(6)
+              << program->codeSize() << std::setprecision(2) << std::setw(9) << vmMs << std::setw(9) << nativeMs
+              << std::setw(9) << vmGatherMs << std::setw(9) << nativeGatherMs << std::setprecision(6)
+              << std::setw(11) << maxDiff << "\n";
+}
+
+// Scoring formulas through the bytecode VM against the same formulas as
+// hand-written C++ over the columns, for every song and for the songs of one
+// mood (scattered ids, as when ranking playlist candidates).
+inline void benchScoring(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<Song> songs;
+    songs.reserve(options.catalogSize);
+    std::vector<SongId> candidates;
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        songs.push_back(syntheticSong(i, rng));
+        songs.back().playCount = static_cast<int>(rng.below(1000));
+        songs.back().bpm = 60.0f + static_cast<float>(rng.below(120));
+        const auto& moods = songs.back().moods;
+        if (std::find(moods.begin(), moods.end(), "happy") != moods.end()) {
+            candidates.push_back(static_cast<SongId>(i));
+        }
+    }
+    SongColumns columns;
+    columns.rebuild(songs);
+    const int currentYear = 2026;
+    std::cout << "Scoring " << songs.size() << " songs, and the " << candidates.size()
+              << " happy ones by id; times in ms\n";
+    std::cout << "  " << std::left << std::setw(50) << "formula" << std::right << std::setw(6) << "bytes"
+              << std::setw(9) << "vm" << std::setw(9) << "native" << std::setw(9) << "vm ids" << std::setw(9)
+              << "native" << std::setw(11) << "max diff" << "\n"
+              << std::fixed;
+
+    const std::uint8_t* energy = columns.energy.data();
+    const std::uint8_t* danceability = columns.danceability.data();
+    const std::int16_t* year = columns.year.data();
+    const std::uint32_t* plays = columns.playCount.data();
+    const float* bpm = columns.bpm.data();
+    const float now = static_cast<float>(currentYear);
+    benchScoringFormula("0.6*energy + 0.4*danceability - age_penalty", columns, candidates, currentYear,
+                        [&](std::size_t i) {
+                            return energy[i] * 0.6f + danceability[i] * 0.4f - (now - year[i]) * 0.1f;
+                        });
+    benchScoringFormula("max(energy, danceability) - abs(bpm - 120) / 20", columns, candidates, currentYear,
+                        [&](std::size_t i) {
+                            const float high = std::max<float>(energy[i], danceability[i]);
+                            return high - std::abs(bpm[i] + -120.0f) / 20.0f;
+                        });
+    benchScoringFormula("(plays + 1) / (age + 1)", columns, candidates, currentYear, [&](std::size_t i) {
+        return (static_cast<float>(plays[i]) + 1.0f) / ((now - year[i]) + 1.0f);
+    });
+
+    auto program = ScoreProgram::parse("0.6*energy + 0.4*danceability - age_penalty", currentYear);
+    std::cout << std::defaultfloat << "\nBytecode for " << program->text() << ":\n";
+    program->disassemble(std::cout);
+}
+
+// Every built-in ranking (score policy x tie-break) picking a 50-song playlist
+// from the candidates of one mood, against the same scores as a ScoreProgram
+// formula, which is interpreted and sorted the same way.
+inline void benchRanking(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<Song> songs;
+    songs.reserve(options.catalogSize);
+    std::vector<SongId> ids;
+    for (std::size_t i = 0; i < options.catalogSize; ++i) {
+        songs.push_back(syntheticSong(i, rng));
+        songs.back().playCount = static_cast<int>(rng.below(1000));
+        const auto& moods = songs.back().moods;
+        if (std::find(moods.begin(), moods.end(), "happy") != moods.end()) {
+            ids.push_back(static_cast<SongId>(i));
+        }
+    }
+    SongColumns columns;
+    columns.rebuild(songs);
+    const EnergyBuckets candidates = EnergyBuckets::build(ids, songs);
+    const int currentYear = 2026;
+    const RankingContext context{columns, currentYear};
+    const std::size_t count = 50;
+    const int repeats = 20;
+    std::cout << "Ranking " << candidates.total() << " happy songs of " << songs.size()
+              << " for a " << count << "-song playlist; times in us\n"
+              << "  " << std::left << std::setw(10) << "score" << std::right;
+    for (const char* tieBreak : kRankingTieBreakNames) {
+        std::cout << std::setw(10) << tieBreak;
+    }
+    std::cout << std::setw(10) << "formula" << "\n" << std::fixed << std::setprecision(0);
+
+    // The formula equivalent of each score policy.
+    const char* formulas[] = {"-energy", "0.7*danceability + 0.3*energy", "energy + 0.5*max(0, min(10, 10 - age))",
+                              "plays"};
+    for (std::size_t s = 0; s < kRankingScoreNames.size(); ++s) {
+        std::cout << "  " << std::left << std::setw(10) << kRankingScoreNames[s] << std::right;
+        std::vector<SongId> catalogOrder;
+        for (std::size_t t = 0; t < kRankingTieBreakNames.size(); ++t) {
+            const Ranker ranker = rankerFor(static_cast<RankingScore>(s), static_cast<RankingTieBreak>(t));
+            std::vector<SongId> picked;
+            FastRandom pickRng(options.seed);
+            const double ms = elapsedMs([&] {
+                for (int r = 0; r < repeats; ++r) {
+                    picked = ranker(candidates, count, context, pickRng);
+                }
+            }) / repeats;
+            if (static_cast<RankingTieBreak>(t) == RankingTieBreak::CatalogOrder) {
+                catalogOrder = picked;
+            }
+            std::cout << std::setw(10) << ms * 1000.0;
+        }
+
+        // Formula scores, ties in catalog order, as rankCandidates would do.
+        auto program = ScoreProgram::parse(formulas[s], currentYear);
+        std::vector<SongId> flat;
+        for (const auto& bucket : candidates.songs) {
+            flat.insert(flat.end(), bucket.begin(), bucket.end());
+        }
+        std::vector<float> scores(flat.size());
+        std::vector<std::uint32_t> order(flat.size());
+        const double formulaMs = elapsedMs([&] {
+            for (int r = 0; r < repeats; ++r) {
+                program->scoreSongs(columns, flat.data(), flat.size(), scores.data());
+                for (std::uint32_t i = 0; i < order.size(); ++i) {
+                    order[i] = i;
+                }
+                std::partial_sort(order.begin(), order.begin() + std::min(count, order.size()), order.end(),
+                                  [&](std::uint32_t a, std::uint32_t b) {
+                                      return scores[a] != scores[b] ? scores[a] > scores[b] : flat[a] < flat[b];
+                                  });
+            }
+        }) / repeats;
+        bool same = catalogOrder.size() == std::min(count, flat.size());
+        for (std::size_t i = 0; same && i < catalogOrder.size(); ++i) {
+            same = catalogOrder[i] == flat[order[i]];
+        }
+        std::cout << std::setw(10) << formulaMs * 1000.0 << (same ? "" : " (MISMATCH)") << "\n";
+    }
+}
+
+// Energy-arc sequencing: plan a warm-up/peak/cool-down playlist and pick its
+// songs from pools of candidates, against the default ramp (the lowest-energy
+// songs in order). Deviation is the RMS distance from the target curve; the
+// 60-song pool is too small for the ideal arc, so its levels run out.
+inline void benchEnergyArc(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<Song> songs;
+    const std::size_t poolSize = std::min<std::size_t>(options.catalogSize, 100000);
+    for (std::size_t i = 0; i < poolSize; ++i) {
+        songs.push_back(syntheticSong(i, rng));
+    }
+    SongColumns columns;
+    columns.rebuild(songs);
+    const RankingContext context{columns, 2026};
+    std::cout << "Energy arcs (times in us)\n"
+              << "  " << std::right << std::setw(8) << "pool" << std::setw(8) << "length" << std::setw(10) << "plan"
+              << std::setw(10) << "total" << std::setw(11) << "deviation" << std::setw(10) << "max jump"
+              << std::setw(11) << "ramp dev" << "\n"
+              << std::fixed;
+
+    struct Case {
+        std::size_t pool, length;
+    };
+    const Case cases[] = {{poolSize, 10}, {poolSize, 50}, {poolSize, 200}, {60, 50}};
+    for (const Case& c : cases) {
+        std::vector<SongId> ids(std::min(c.pool, songs.size()));
+        for (std::size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = static_cast<SongId>(i);
+        }
+        const EnergyBuckets candidates = EnergyBuckets::build(ids, songs);
+        const std::vector<float> target =
+            energyArcTarget(c.length, static_cast<float>(candidates.energies.front()),
+                            static_cast<float>(candidates.energies.back()));
+        const int repeats = 50;
+        std::vector<std::size_t> plan;
+        const double planMs = elapsedMs([&] {
+            for (int r = 0; r < repeats; ++r) {
+                plan = planEnergyArc(target, candidates);
+            }
+        }) / repeats;
+        // Planning plus picking random songs for each level, as the app does.
+        std::vector<SongId> picked;
+        const double totalMs = elapsedMs([&] {
+            for (int r = 0; r < repeats; ++r) {
+                plan = planEnergyArc(target, candidates);
+                std::vector<std::size_t> perLevel(candidates.energies.size()), taken(perLevel.size());
+                for (std::size_t level : plan) {
+                    ++perLevel[level];
+                }
+                std::vector<std::vector<SongId>> chosen(perLevel.size());
+                for (std::size_t l = 0; l < perLevel.size(); ++l) {
+                    if (perLevel[l] > 0) {
+                        EnergyBuckets level;
+                        level.energies = {candidates.energies[l]};
+                        level.songs = {candidates.songs[l]};
+                        chosen[l] = rankCandidates<EnergyAscending, RandomTieBreak>(level, perLevel[l], context, rng);
+                    }
+                }
+                picked.clear();
+                for (std::size_t level : plan) {
+                    picked.push_back(chosen[level][taken[level]++]);
+                }
+            }
+        }) / repeats;
+
+        auto deviation = [&](const std::vector<SongId>& playlist) {
+            double sum = 0.0;
+            for (std::size_t p = 0; p < playlist.size(); ++p) {
+                const double d = songs[playlist[p]].energy - target[p];
+                sum += d * d;
+            }
+            return std::sqrt(sum / static_cast<double>(std::max<std::size_t>(playlist.size(), 1)));
+        };
+        int maxJump = 0;
+        for (std::size_t p = 1; p < picked.size(); ++p) {
+            maxJump = std::max(maxJump, std::abs(songs[picked[p]].energy - songs[picked[p - 1]].energy));
+        }
+        const std::vector<SongId> ramp =
+            rankCandidates<EnergyAscending, RandomTieBreak>(candidates, c.length, context, rng);
+        std::cout << "  " << std::setw(8) << ids.size() << std::setw(8) << picked.size() << std::setprecision(1)
+                  << std::setw(10) << planMs * 1000.0 << std::setw(10) << totalMs * 1000.0 << std::setprecision(2)
+                  << std::setw(11) << deviation(picked) << std::setw(10) << maxJump << std::setw(11)
+                  << deviation(ramp) << "\n";
+    }
+}
+
+// DJ-style sequencing over a pool of synthetic songs with random tempo and key
+// (10% unanalysed): SIMD against scalar transition scoring, then 50-song
+// playlists by beam search at several widths, with and without a time budget,
+// against the default energy ramp. Key, BPM and energy are the mean change
+// between consecutive songs.
+inline void benchMix(const BenchOptions& options) {
+    FastRandom rng(options.seed);
+    std::vector<Song> songs;
+    const std::size_t poolSize = std::min<std::size_t>(options.catalogSize, 100000);
+    std::vector<SongId> ids;
+    for (std::size_t i = 0; i < poolSize; ++i) {
+        songs.push_back(syntheticSong(i, rng));
+        songs.back().bpm = 70.0f + static_cast<float>(rng.below(1100)) / 10.0f;
+        songs.back().key = rng.below(10) == 0 ? kUnknownKey : static_cast<int>(rng.below(kKeyCount));
+        ids.push_back(static_cast<SongId>(i));
+    }
+    SongColumns columns;
+    columns.rebuild(songs);
+    const TransitionPool pool(columns, ids);
+    const TransitionWeights weights;
+
+    std::vector<float> simd(pool.paddedSize()), scalar(pool.paddedSize());
+    const int repeats = 50;
+    const double simdMs = elapsedMs([&] {
+        for (int r = 0; r < repeats; ++r) {
+            pool.costsFrom(static_cast<std::size_t>(r), weights, simd.data());
+        }
+    }) / repeats;
+    const double scalarMs = elapsedMs([&] {
+        for (int r = 0; r < repeats; ++r) {
+            pool.costsFromScalar(static_cast<std::size_t>(r), weights, scalar.data());
+        }
+    }) / repeats;
+    std::cout << "Scoring transitions from one song to " << pool.size() << ": simd " << std::fixed
+              << std::setprecision(1) << simdMs * 1000.0 << " us, scalar " << scalarMs * 1000.0 << " us"
+              << (simd == scalar ? "" : " (MISMATCH)") << "\n\n";
+
+    auto report = [&](const std::string& label, const std::vector<SongId>& playlist, double ms, std::size_t width,
+                      float cost) {
+        double key = 0.0, bpm = 0.0, energy = 0.0;
+        for (std::size_t p = 1; p < playlist.size(); ++p) {
+            const Song& a = songs[playlist[p - 1]];
+            const Song& b = songs[playlist[p]];
+            key += a.key == kUnknownKey || b.key == kUnknownKey ? TransitionPool::kUnknownKeyCost
+                                                                : camelotDistance(a.key, b.key);
+            bpm += std::abs(a.bpm - b.bpm);
+            energy += std::abs(a.energy - b.energy);
+        }
+        const double transitions = static_cast<double>(std::max<std::size_t>(playlist.size(), 2) - 1);
+        std::cout << "  " << std::left << std::setw(22) << label << std::right << std::setprecision(1)
+                  << std::setw(9) << ms << std::setw(7) << width << std::setw(8) << cost << std::setprecision(2)
+                  << std::setw(8) << key / transitions << std::setw(8) << bpm / transitions << std::setw(8)
+                  << energy / transitions << "\n";
+    };
+    const std::size_t length = 50;
+    const RankingContext context{columns, 2026};
+    // A small pool runs short of close matches, which is where a wider beam
+    // pays off.
+    for (std::size_t size : {poolSize, std::min<std::size_t>(poolSize, 500)}) {
+        const std::vector<SongId> subset(ids.begin(), ids.begin() + size);
+        const TransitionPool subsetPool(columns, subset);
+        std::cout << "50-song playlists from " << size << " songs\n"
+                  << "  " << std::left << std::setw(22) << "search" << std::right << std::setw(9) << "ms"
+                  << std::setw(7) << "width" << std::setw(8) << "cost" << std::setw(8) << "key" << std::setw(8)
+                  << "bpm" << std::setw(8) << "energy" << "\n";
+        const EnergyBuckets buckets = EnergyBuckets::build(subset, songs);
+        std::vector<SongId> ramp;
+        const double rampMs = elapsedMs(
+            [&] { ramp = rankCandidates<EnergyAscending, RandomTieBreak>(buckets, length, context, rng); });
+        // Pool positions are song ids here.
+        float rampCost = 0.0f;
+        for (std::size_t p = 1; p < ramp.size(); ++p) {
+            rampCost += subsetPool.cost(ramp[p - 1], ramp[p], weights);
+        }
+        report("energy ramp", ramp, rampMs, 0, rampCost);
+
+        struct Case {
+            std::size_t width;
+            double budgetMs;
+        };
+        const Case cases[] = {{1, 0.0}, {4, 0.0}, {16, 0.0}, {64, 0.0}, {64, 20.0}};
+        for (const Case& c : cases) {
+            BeamSearchStats stats;
+            const std::vector<SongId> playlist = sequenceTransitions(subsetPool, 0, length, weights,
+                                                                     BeamSearchOptions{c.width, 4, c.budgetMs}, &stats);
+            std::string label = "beam " + std::to_string(c.width);
+            if (c.budgetMs > 0.0) {
+                label += ", " + std::to_string(static_cast<int>(c.budgetMs)) + " ms budget";
+            }
+            report(label, playlist, stats.ms, stats.finalWidth, stats.cost);
+        }
+        std::cout << "\n";
+    }
+}
+
+// Duration-targeted playlists from a ranked pool of synthetic songs two to
+// seven minutes long (whole even seconds), for 100 targets of 20 to 120
+// minutes within 30 seconds and no artist twice within 5 tracks. A near-zero
+// budget leaves the best-ranked songs that fit, which is where the knapsack
+// starts. "Rank/s" is the mean rank of the song playing, per second; lower is
+// better. The last case asks for an odd total that no set of songs reaches, so
+// only the time budget ends the search.
+inline void benchTimedPlaylist(const BenchOptions& options) {
+    const std::size_t poolSize = std::min<std::size_t>(options.catalogSize, 100000);
+    struct Case {
+        const char* label;
+        double budgetMs;
+        std::uint32_t artists;
+        std::uint32_t toleranceSeconds;
+        bool oddTarget;
+    };
+    const Case cases[] = {{"best-ranked that fit", 1e-6, 5000, 30, false},
+                          {"knapsack", 0.0, 5000, 30, false},
+                          {"knapsack, 1 ms budget", 1.0, 5000, 30, false},
+                          {"knapsack, 8 artists", 0.0, 8, 30, false},
+                          {"no fit, 20 ms budget", 20.0, 5000, 0, true}};
+    std::cout << "Timed playlists from " << poolSize << " ranked songs, 100 targets each\n"
+              << "  " << std::left << std::setw(24) << "plan" << std::right << std::setw(7) << "hit %"
+              << std::setw(9) << "mean ms" << std::setw(9) << "max ms" << std::setw(9) << "solved" << std::setw(8)
+              << "rank/s" << std::setw(7) << "swaps" << std::setw(7) << "gaps" << "\n";
+    for (const Case& c : cases) {
+        FastRandom rng(options.seed);
+        std::vector<TimedCandidate> ranked(poolSize);
+        for (std::size_t i = 0; i < poolSize; ++i) {
+            ranked[i] = {static_cast<SongId>(i), 120 + 2 * static_cast<std::uint32_t>(rng.below(151)),
+                         static_cast<std::uint32_t>(rng.below(c.artists))};
+        }
+        const int targets = 100;
+        std::size_t hits = 0, solved = 0, swaps = 0, gaps = 0;
+        double totalMs = 0.0, maxMs = 0.0, rankPerSecond = 0.0;
+        for (int t = 0; t < targets; ++t) {
+            DurationTarget target;
+            target.seconds = 20 * 60 + static_cast<std::uint32_t>(rng.below(100 * 60));
+            target.seconds = c.oddTarget ? target.seconds | 1 : target.seconds;
+            target.toleranceSeconds = c.toleranceSeconds;
+            target.artistGap = 5;
+            target.budgetMs = c.budgetMs;
+            DurationPlanStats stats;
+            const std::vector<SongId> playlist = planTimedPlaylist(ranked, target, &stats);
+            double cost = 0.0;
+            for (SongId id : playlist) {
+                cost += static_cast<double>(id + 1) * ranked[id].seconds;
+            }
+            hits += stats.withinTolerance ? 1 : 0;
+            solved += stats.candidatesSolved;
+            swaps += stats.artistSwaps;
+            gaps += stats.gapViolations;
+            totalMs += stats.ms;
+            maxMs = std::max(maxMs, stats.ms);
+            rankPerSecond += stats.totalSeconds > 0 ? cost / stats.totalSeconds : 0.0;
+        }
+        std::cout << "  " << std::left << std::setw(24) << c.label << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(7) << 100.0 * hits / targets << std::setprecision(3)
+                  << std::setw(9) << totalMs / targets << std::setw(9) << maxMs << std::setw(9)
+                  << solved / targets << std::setprecision(1) << std::setw(8) << rankPerSecond / targets
+                  << std::setw(7) << swaps << std::setw(7) << gaps << "\n";
+    }
+}
+
+// Returns false if `name` is not a known benchmark.
+inline bool runBenchmark(const std::string& name, const BenchOptions& options) {
+    if (name == "knn") {
+        benchKnn(options);
+    } else if (name == "hnsw") {
+        benchHnsw(options);
+    } else if (name == "quant") {
+        benchQuantized(options);
+    } else if (name == "kmeans") {
+        benchMoodClustering(options);
+    } else if (name == "audio") {
+        benchAudioAnalysis(options);
+    } else if (name == "dedup") {
+        benchDedup(options);
+    } else if (name == "normalize") {
+        benchNormalize(options);
+    } else if (name == "search") {
+        benchSearch(options);
+    } else if (name == "complete") {
+        benchComplete(options);
+    } else if (name == "bool") {
+        benchMoodQuery(options);
+    } else if (name == "range") {
+        benchRangeQuery(options);
+    } else if (name == "filter") {
+        benchFilter(options);
+    } else if (name == "score") {
+        benchScoring(options);
+    } else if (name == "rank") {
+        benchRanking(options);
+    } else if (name == "arc") {
+        benchEnergyArc(options);
+    } else if (name == "mix") {
+        benchMix(options);
+    } else if (name == "timed") {
+        benchTimedPlaylist(options);
+    } else {
+        std::cerr << "Unknown benchmark '" << name << "'. Available: knn, hnsw, quant, kmeans, audio, dedup, normalize, search, complete, bool, range, filter, score, rank, arc, mix, timed\n";
+        return false;
+    }
+    return true;
+}
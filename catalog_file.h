@@ -0,0 +1,435 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "audio_fingerprint.h"
+#include "song.h"
+
+// The song catalog on disk: a header, a table of named sections and the section
+// payloads, each aligned to 8 bytes. New data (indexes, extra columns) is added
+// as new sections so older readers can skip what they do not understand.
+class CatalogFile {
+public:
+    void setSection(const std::string& tag, std::string bytes) {
+        sections[tag] = std::move(bytes);
+    }
+
+    const std::string* section(const std::string& tag) const {
+        auto it = sections.find(tag);
+        return it == sections.end() ? nullptr : &it->second;
+    }
+
+    // Writes to a temporary file and renames it over `path`, so a MappedCatalog
+    // of the previous version stays valid.
+    bool write(const std::string& path) const {
+        const std::string temporary = path + ".tmp";
+        if (!writeTo(temporary)) {
+            return false;
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        return !error;
+    }
+
+    bool read(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return parse(bytes.data(), bytes.size());
+    }
+
+    // Parses a catalog image already in memory.
+    bool parse(const char* data, std::size_t size) {
+        std::map<std::string, std::string_view> views;
+        sections.clear();
+        if (!parseTable(data, size, views)) {
+            return false;
+        }
+        for (const auto& view : views) {
+            sections[view.first] = std::string(view.second);
+        }
+        return true;
+    }
+
+    // Finds the sections of a catalog image without copying them.
+    static bool parseTable(const char* data, std::size_t size, std::map<std::string, std::string_view>& views) {
+        views.clear();
+        if (size < kHeaderSize || std::memcmp(data, kMagic, 4) != 0 || readU32(data + 4) != kVersion) {
+            return false;
+        }
+        const std::uint64_t count = readU64(data + 8);
+        if (count > (size - kHeaderSize) / kEntrySize) {
+            return false;
+        }
+        for (std::uint64_t i = 0; i < count; ++i) {
+            const char* entry = data + kHeaderSize + i * kEntrySize;
+            std::string tag(entry, std::find(entry, entry + 4, '\0'));
+            const std::uint64_t offset = readU64(entry + 4);
+            const std::uint64_t length = readU64(entry + 12);
+            if (offset > size || length > size - offset) {
+                views.clear();
+                return false;
+            }
+            views[tag] = std::string_view(data + offset, length);
+        }
+        return true;
+    }
+
+private:
+    static constexpr const char* kMagic = "GCAT";
+    static constexpr std::uint32_t kVersion = 1;
+    static constexpr std::size_t kHeaderSize = 16;
+    static constexpr std::size_t kEntrySize = 20;
+
+    std::map<std::string, std::string> sections;
+
+    bool writeTo(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        std::uint64_t offset = align(kHeaderSize + sections.size() * kEntrySize);
+        file.write(kMagic, 4);
+        writeU32(file, kVersion);
+        writeU64(file, sections.size());
+        for (const auto& entry : sections) {
+            char tag[4] = {};
+            std::memcpy(tag, entry.first.data(), std::min<std::size_t>(4, entry.first.size()));
+            file.write(tag, 4);
+            writeU64(file, offset);
+            writeU64(file, entry.second.size());
+            offset = align(offset + entry.second.size());
+        }
+        for (const auto& entry : sections) {
+            pad(file);
+            file.write(entry.second.data(), entry.second.size());
+        }
+        return static_cast<bool>(file);
+    }
+
+    static std::uint64_t align(std::uint64_t offset) { return (offset + 7) & ~std::uint64_t{7}; }
+
+    static void pad(std::ofstream& file) {
+        static const char zeros[8] = {};
+        const auto position = static_cast<std::uint64_t>(file.tellp());
+        file.write(zeros, align(position) - position);
+    }
+
+    static void writeU32(std::ofstream& file, std::uint32_t value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void writeU64(std::ofstream& file, std::uint64_t value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static std::uint32_t readU32(const char* p) {
+        std::uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static std::uint64_t readU64(const char* p) {
+        std::uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+};
+
+// A catalog file mapped read-only into memory, so large sections (indexes) are
+// used in place and paged in on demand instead of being read and copied at
+// startup. Views into it stay valid until the next open() or destruction.
+class MappedCatalog {
+public:
+    MappedCatalog() = default;
+    MappedCatalog(const MappedCatalog&) = delete;
+    MappedCatalog& operator=(const MappedCatalog&) = delete;
+    ~MappedCatalog() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = copy.data();
+        size = copy.size();
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = static_cast<const char*>(mapped);
+                size = static_cast<std::size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+        if (!data || !CatalogFile::parseTable(data, size, sections)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    std::optional<std::string_view> section(const std::string& tag) const {
+        auto it = sections.find(tag);
+        if (it == sections.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    // True if `bytes` lies inside the mapping.
+    bool contains(std::string_view bytes) const {
+        return data && bytes.data() >= data && bytes.data() + bytes.size() <= data + size;
+    }
+
+private:
+    const char* data = nullptr;
+    std::size_t size = 0;
+    std::map<std::string, std::string_view> sections;
+#ifdef _WIN32
+    std::string copy;
+#endif
+
+    void close() {
+#ifndef _WIN32
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+#endif
+        data = nullptr;
+        size = 0;
+        sections.clear();
+    }
+};
+
+// Little helpers for the "SONG" section: length-prefixed strings and fixed-size
+// integers, one record per song.
+class SongSectionWriter {
+public:
+    void putU32(std::uint32_t value) { bytes.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void putI32(std::int32_t value) { bytes.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void putF32(float value) { bytes.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void putString(const std::string& value) {
+        putU32(static_cast<std::uint32_t>(value.size()));
+        bytes.append(value);
+    }
+    std::string take() { return std::move(bytes); }
+
+private:
+    std::string bytes;
+};
+
+class SongSectionReader {
+public:
+    explicit SongSectionReader(std::string_view section) : bytes(section) {}
+
+    bool getU32(std::uint32_t& value) { return getRaw(&value, sizeof(value)); }
+    bool getI32(std::int32_t& value) { return getRaw(&value, sizeof(value)); }
+    bool getF32(float& value) { return getRaw(&value, sizeof(value)); }
+    bool getString(std::string& value) {
+        std::uint32_t size = 0;
+        if (!getU32(size) || size > bytes.size() - pos) {
+            return false;
+        }
+        value.assign(bytes.data() + pos, size);
+        pos += size;
+        return true;
+    }
+
+private:
+    std::string_view bytes;
+    std::size_t pos = 0;
+
+    bool getRaw(void* out, std::size_t size) {
+        if (size > bytes.size() - pos) {
+            return false;
+        }
+        std::memcpy(out, bytes.data() + pos, size);
+        pos += size;
+        return true;
+    }
+};
+
+constexpr std::uint32_t kMaxMoodsPerSong = 64;
+
+inline std::string encodeSongs(const std::vector<Song>& songs) {
+    SongSectionWriter writer;
+    writer.putU32(static_cast<std::uint32_t>(songs.size()));
+    for (const auto& song : songs) {
+        writer.putString(song.title);
+        writer.putString(song.artist);
+        writer.putU32(static_cast<std::uint32_t>(song.moods.size()));
+        for (const auto& mood : song.moods) {
+            writer.putString(mood);
+        }
+        writer.putI32(song.energy);
+        writer.putI32(song.danceability);
+        writer.putI32(song.year);
+        writer.putI32(song.playCount);
+    }
+    return writer.take();
+}
+
+inline bool decodeSongs(std::string_view section, std::vector<Song>& songs) {
+    SongSectionReader reader(section);
+    std::uint32_t count = 0;
+    if (!reader.getU32(count)) {
+        return false;
+    }
+    std::vector<Song> decoded;
+    for (std::uint32_t i = 0; i < count; ++i) {
+        Song song;
+        std::uint32_t moodCount = 0;
+        if (!reader.getString(song.title) || !reader.getString(song.artist) || !reader.getU32(moodCount) ||
+            moodCount > kMaxMoodsPerSong) {
+            return false;
+        }
+        song.moods.resize(moodCount);
+        for (auto& mood : song.moods) {
+            if (!reader.getString(mood)) {
+                return false;
+            }
+        }
+        std::int32_t energy, danceability, year, playCount;
+        if (!reader.getI32(energy) || !reader.getI32(danceability) || !reader.getI32(year) ||
+            !reader.getI32(playCount)) {
+            return false;
+        }
+        song.energy = energy;
+        song.danceability = danceability;
+        song.year = year;
+        song.playCount = playCount;
+        decoded.push_back(std::move(song));
+    }
+    songs = std::move(decoded);
+    return true;
+}
+
+// The "TKEY" section: tempo and key per song, in catalog order.
+inline std::string encodeTempoAndKey(const std::vector<Song>& songs) {
+    SongSectionWriter writer;
+    writer.putU32(static_cast<std::uint32_t>(songs.size()));
+    for (const auto& song : songs) {
+        writer.putF32(song.bpm);
+        writer.putI32(song.key);
+    }
+    return writer.take();
+}
+
+// Leaves `songs` untouched unless the section matches the catalog.
+inline bool decodeTempoAndKey(std::string_view section, std::vector<Song>& songs) {
+    SongSectionReader reader(section);
+    std::uint32_t count = 0;
+    if (!reader.getU32(count) || count != songs.size()) {
+        return false;
+    }
+    std::vector<std::pair<float, std::int32_t>> columns(count);
+    for (auto& column : columns) {
+        if (!reader.getF32(column.first) || !reader.getI32(column.second)) {
+            return false;
+        }
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        songs[i].bpm = columns[i].first;
+        songs[i].key = columns[i].second >= 0 && columns[i].second < kKeyCount ? columns[i].second : kUnknownKey;
+    }
+    return true;
+}
+
+// The "DURS" section: the length of each song in seconds, in catalog order.
+inline std::string encodeDurations(const std::vector<Song>& songs) {
+    SongSectionWriter writer;
+    writer.putU32(static_cast<std::uint32_t>(songs.size()));
+    for (const auto& song : songs) {
+        writer.putI32(song.durationSeconds);
+    }
+    return writer.take();
+}
+
+// Leaves `songs` untouched unless the section matches the catalog.
+inline bool decodeDurations(std::string_view section, std::vector<Song>& songs) {
+    SongSectionReader reader(section);
+    std::uint32_t count = 0;
+    if (!reader.getU32(count) || count != songs.size()) {
+        return false;
+    }
+    std::vector<std::int32_t> durations(count);
+    for (auto& duration : durations) {
+        if (!reader.getI32(duration)) {
+            return false;
+        }
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        songs[i].durationSeconds = std::max(durations[i], 0);
+    }
+    return true;
+}
+
+// The "FPRT" section: the audio fingerprint of each song, in catalog order
+// (empty for songs that were never analysed).
+inline std::string encodeFingerprints(const std::vector<AudioFingerprint>& fingerprints) {
+    SongSectionWriter writer;
+    writer.putU32(static_cast<std::uint32_t>(fingerprints.size()));
+    for (const auto& fingerprint : fingerprints) {
+        writer.putU32(static_cast<std::uint32_t>(fingerprint.size()));
+        for (const auto& entry : fingerprint) {
+            writer.putU32(entry.hash);
+            writer.putU32(entry.offset);
+        }
+    }
+    return writer.take();
+}
+
+inline bool decodeFingerprints(std::string_view section, std::size_t songCount,
+                               std::vector<AudioFingerprint>& fingerprints) {
+    SongSectionReader reader(section);
+    std::uint32_t count = 0;
+    if (!reader.getU32(count) || count != songCount) {
+        return false;
+    }
+    std::vector<AudioFingerprint> decoded(count);
+    for (auto& fingerprint : decoded) {
+        std::uint32_t entries = 0;
+        if (!reader.getU32(entries) || entries > section.size() / sizeof(FingerprintEntry)) {
+            return false;
+        }
+        fingerprint.resize(entries);
+        for (auto& entry : fingerprint) {
+            if (!reader.getU32(entry.hash) || !reader.getU32(entry.offset)) {
+                return false;
+            }
+        }
+    }
+    fingerprints = std::move(decoded);
+    return true;
+}
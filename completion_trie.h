@@ -0,0 +1,461 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "song.h"
+#include "text_normalize.h"
+
+struct Completion {
+    // A song with this title (or by this artist); the most played one if several.
+    SongId song;
+    bool artist;
+    std::uint64_t weight;
+};
+
+// Static radix trie over the normalised titles and artists of the catalog, for
+// prefix completion weighted by play count. The whole trie is one byte image
+// with no pointers, so it can be stored as a catalog section and used straight
+// from the mapped file:
+//
+//   header: magic, version, song count, catalog checksum, root offset, strings,
+//           song table offset, bits per song table entry
+//   node:   varint (label length << 2 | has children << 1 | terminal), label
+//           bytes, [varint children, varint best weight in subtree, varint
+//           strings in subtree, varint bytes of the children] if it has
+//           children, [varint weight] if terminal, then its children.
+//   songs:  (song << 1 | artist) per string, bit-packed, in string order.
+//
+// Nodes are in preorder, so a node's first child follows it, the next child
+// follows the first one's subtree and the strings below a node are numbered
+// consecutively, which is how the song table is indexed. Each node stores the
+// best weight below it, so top-k completion is a best-first walk that never
+// looks at subtrees that cannot make the cut.
+class CompletionTrie {
+public:
+    // Weights are the songs' play counts plus one, summed over songs sharing a
+    // title or artist, so unplayed catalogs rank by how common a name is.
+    static std::string build(const std::vector<Song>& songs, std::uint64_t catalogChecksum) {
+        std::vector<Entry> entries;
+        entries.reserve(songs.size() * 2);
+        TextNormalizer normalizer;
+        for (SongId id = 0; id < songs.size(); ++id) {
+            const std::uint64_t weight = static_cast<std::uint64_t>(std::max(songs[id].playCount, 0)) + 1;
+            for (bool artist : {false, true}) {
+                Entry entry{{}, weight, weight, static_cast<std::uint64_t>(id) << 1 | artist};
+                normalizer.normalize(artist ? songs[id].artist : songs[id].title, entry.text);
+                if (!entry.text.empty()) {
+                    entries.push_back(std::move(entry));
+                }
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return std::tie(a.text, b.best, a.value) < std::tie(b.text, a.best, b.value);
+        });
+        // One entry per string: the weights add up, the most played song (first
+        // after sorting) represents it.
+        std::size_t unique = 0;
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            if (unique > 0 && entries[unique - 1].text == entries[i].text) {
+                entries[unique - 1].weight += entries[i].weight;
+            } else if (unique++ != i) {
+                entries[unique - 1] = std::move(entries[i]);
+            }
+        }
+        entries.resize(unique);
+
+        std::string image(kHeaderSize, '\0');
+        std::uint64_t rootWeight = 0;
+        encodeNode(entries, 0, entries.size(), 0, {}, image, rootWeight);
+
+        // Preorder numbers the strings in sorted order, so string i is entries[i].
+        const std::uint32_t songsOffset = static_cast<std::uint32_t>(image.size());
+        std::uint32_t bits = 1;
+        while (bits < 40 && (static_cast<std::uint64_t>(songs.size()) << 1) > (std::uint64_t{1} << bits)) {
+            ++bits;
+        }
+        // Padded so a table entry can always be read with one 8-byte load.
+        image.resize(image.size() + (entries.size() * bits + 7) / 8 + 8, '\0');
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            const std::size_t bit = i * bits;
+            std::uint64_t word;
+            std::memcpy(&word, &image[songsOffset + bit / 8], 8);
+            word |= entries[i].value << (bit % 8);
+            std::memcpy(&image[songsOffset + bit / 8], &word, 8);
+        }
+
+        std::memcpy(&image[0], kMagic, 4);
+        putFixed(image, 4, kVersion);
+        putFixed(image, 8, static_cast<std::uint64_t>(songs.size()));
+        putFixed(image, 16, catalogChecksum);
+        putFixed(image, 24, static_cast<std::uint32_t>(kHeaderSize));
+        putFixed(image, 28, static_cast<std::uint32_t>(entries.size()));
+        putFixed(image, 32, songsOffset);
+        putFixed(image, 36, bits);
+        return image;
+    }
+
+    // Uses `bytes` in place; it must outlive the trie (or the next attach).
+    // Returns false, leaving the trie empty, if it is not a well-formed trie
+    // image.
+    bool attach(std::string_view bytes) {
+        owned.clear();
+        if (!view(bytes) || !wellFormed()) {
+            image = {};
+            return false;
+        }
+        return true;
+    }
+
+    // Takes ownership of a freshly built image.
+    void assign(std::string bytes) {
+        owned = std::move(bytes);
+        view(owned);
+    }
+
+    // True if the trie was built for this catalog.
+    bool matches(std::size_t songCount, std::uint64_t catalogChecksum) const {
+        return !image.empty() && getFixed<std::uint64_t>(8) == songCount &&
+               getFixed<std::uint64_t>(16) == catalogChecksum;
+    }
+
+    std::string_view bytes() const { return image; }
+    std::size_t stringCount() const { return image.empty() ? 0 : getFixed<std::uint32_t>(28); }
+
+    // Bytes of the image taken by the song table, the rest being the trie.
+    std::size_t songTableBytes() const { return image.empty() ? 0 : image.size() - getFixed<std::uint32_t>(32); }
+
+    // The `limit` heaviest titles and artists starting with `prefix` (after
+    // normalisation), heaviest first.
+    std::vector<Completion> complete(std::string_view prefix, std::size_t limit) const {
+        std::vector<Completion> result;
+        if (image.empty() || limit == 0) {
+            return result;
+        }
+        thread_local TextNormalizer normalizer;
+        thread_local std::string text;
+        normalizer.normalize(prefix, text);
+
+        // Walk down to the node covering the prefix; it may end inside a label.
+        // `rank` is the number of the first string at or below `node`.
+        std::size_t node = getFixed<std::uint32_t>(24);
+        std::size_t rank = 0;
+        std::size_t matched = 0;
+        while (matched < text.size()) {
+            const Node current = readNode(node);
+            std::size_t offset = current.childrenStart;
+            std::size_t childRank = rank + current.terminal;
+            bool found = false;
+            for (std::size_t c = 0; c < current.children && !found; ++c) {
+                const Node child = readNode(offset);
+                if (child.label[0] != static_cast<unsigned char>(text[matched])) {
+                    childRank += child.strings;
+                    offset = child.end;
+                    continue;
+                }
+                const std::size_t length = std::min(child.labelLength, text.size() - matched);
+                if (std::memcmp(child.label, text.data() + matched, length) != 0) {
+                    return result;
+                }
+                matched += length;
+                node = offset;
+                rank = childRank;
+                found = true;
+            }
+            if (!found) {
+                return result;
+            }
+        }
+
+        // Best-first over (weight, is-a-completion, node offset or string
+        // number, number of the node's first string). Ties go to completions,
+        // then to the one first in sorted order.
+        using Item = std::tuple<std::uint64_t, bool, std::uint64_t, std::uint64_t>;
+        auto worse = [](const Item& a, const Item& b) {
+            if (std::get<0>(a) != std::get<0>(b)) {
+                return std::get<0>(a) < std::get<0>(b);
+            }
+            if (std::get<1>(a) != std::get<1>(b)) {
+                return std::get<1>(b);
+            }
+            return std::get<2>(a) > std::get<2>(b);
+        };
+        std::priority_queue<Item, std::vector<Item>, decltype(worse)> frontier(worse);
+        frontier.push({readNode(node).best, false, node, rank});
+        while (!frontier.empty() && result.size() < limit) {
+            const Item item = frontier.top();
+            frontier.pop();
+            if (std::get<1>(item)) {
+                const std::uint64_t value = songAt(std::get<2>(item));
+                result.push_back({static_cast<SongId>(value >> 1), (value & 1) != 0, std::get<0>(item)});
+                continue;
+            }
+            const Node current = readNode(std::get<2>(item));
+            std::uint64_t childRank = std::get<3>(item);
+            if (current.terminal) {
+                frontier.push({current.weight, true, childRank, childRank});
+                ++childRank;
+            }
+            std::size_t offset = current.childrenStart;
+            for (std::size_t c = 0; c < current.children; ++c) {
+                const Node child = readNode(offset);
+                frontier.push({child.best, false, offset, childRank});
+                childRank += child.strings;
+                offset = child.end;
+            }
+        }
+        return result;
+    }
+
+private:
+    static constexpr const char* kMagic = "GCTR";
+    static constexpr std::uint32_t kVersion = 2;
+    static constexpr std::size_t kHeaderSize = 40;
+
+    struct Entry {
+        std::string text;
+        std::uint64_t weight;
+        // Weight of the single song, to pick the representative.
+        std::uint64_t best;
+        std::uint64_t value;
+    };
+
+    struct Node {
+        const unsigned char* label;
+        std::size_t labelLength;
+        bool terminal;
+        std::size_t children;
+        std::uint64_t best;
+        std::uint64_t weight;
+        // Strings at or below the node.
+        std::size_t strings;
+        // Offsets of the first child and of the end of the subtree.
+        std::size_t childrenStart;
+        std::size_t end;
+    };
+
+    std::string owned;
+    std::string_view image;
+
+    bool view(std::string_view bytes) {
+        image = {};
+        if (bytes.size() < kHeaderSize || std::memcmp(bytes.data(), kMagic, 4) != 0) {
+            return false;
+        }
+        image = bytes;
+        const std::uint32_t bits = getFixed<std::uint32_t>(36);
+        const std::uint64_t songsOffset = getFixed<std::uint32_t>(32);
+        if (getFixed<std::uint32_t>(4) != kVersion || getFixed<std::uint32_t>(24) >= songsOffset || bits == 0 ||
+            bits > 40 || songsOffset + (stringCount() * bits + 7) / 8 + 8 > bytes.size()) {
+            image = {};
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    T getFixed(std::size_t offset) const {
+        T value;
+        std::memcpy(&value, image.data() + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    static void putFixed(std::string& out, std::size_t offset, T value) {
+        std::memcpy(&out[offset], &value, sizeof(T));
+    }
+
+    static void putVarint(std::string& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static std::uint64_t getVarint(const unsigned char*& p) {
+        std::uint64_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            const unsigned char byte = *p++;
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+    }
+
+    // As above, but false instead of reading at or past `end`.
+    static bool getVarint(const unsigned char*& p, const unsigned char* end, std::uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+            const unsigned char byte = *p++;
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // One pass over the whole image. Every node must lie inside the trie part
+    // of the image, each node's children must exactly fill its child bytes,
+    // and the string counts must add up. Then complete(), which trusts the
+    // image, cannot read out of bounds on a damaged catalog file.
+    bool wellFormed() const {
+        const unsigned char* base = reinterpret_cast<const unsigned char*>(image.data());
+        const std::size_t rootOffset = getFixed<std::uint32_t>(24);
+        const std::size_t limit = getFixed<std::uint32_t>(32);
+        // Checks that the node at `offset` can be read without reaching `end`,
+        // then reads it.
+        auto check = [&](std::size_t offset, std::size_t end, Node& node) {
+            const unsigned char* p = base + offset;
+            const unsigned char* stop = base + end;
+            std::uint64_t header, children = 0, value;
+            if (!getVarint(p, stop, header) || (offset != rootOffset && (header & 3) == 0) ||
+                header >> 2 > static_cast<std::uint64_t>(stop - p)) {
+                return false;
+            }
+            p += header >> 2;
+            if ((header & 2) && (!getVarint(p, stop, children) || children == 0 || !getVarint(p, stop, value) ||
+                                 !getVarint(p, stop, value) || !getVarint(p, stop, value) ||
+                                 value > static_cast<std::uint64_t>(stop - p))) {
+                return false;
+            }
+            if ((header & 1) && !getVarint(p, stop, value)) {
+                return false;
+            }
+            node = readNode(offset);
+            return true;
+        };
+
+        struct Frame {
+            Node node;
+            std::size_t next;
+            std::size_t childrenLeft;
+            std::size_t strings;
+        };
+        Node root;
+        if (!check(rootOffset, limit, root) || root.end != limit || root.strings != stringCount()) {
+            return false;
+        }
+        std::vector<Frame> stack{{root, root.childrenStart, root.children, root.terminal ? 1u : 0u}};
+        while (!stack.empty()) {
+            if (stack.back().childrenLeft == 0) {
+                const Frame done = stack.back();
+                stack.pop_back();
+                if (done.next != done.node.end || done.strings != done.node.strings) {
+                    return false;
+                }
+                if (!stack.empty()) {
+                    stack.back().strings += done.strings;
+                }
+                continue;
+            }
+            Frame& parent = stack.back();
+            Node child;
+            if (parent.next >= parent.node.end || !check(parent.next, parent.node.end, child) ||
+                child.labelLength == 0) {
+                return false;
+            }
+            --parent.childrenLeft;
+            parent.next = child.end;
+            stack.push_back({child, child.childrenStart, child.children, child.terminal ? 1u : 0u});
+        }
+        // And every string's song must be in the catalog.
+        const std::uint64_t songCount = getFixed<std::uint64_t>(8);
+        for (std::size_t rank = 0; rank < stringCount(); ++rank) {
+            if (songAt(rank) >> 1 >= songCount) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // (song << 1 | artist) of string number `rank`.
+    std::uint64_t songAt(std::uint64_t rank) const {
+        const std::uint32_t bits = getFixed<std::uint32_t>(36);
+        const std::uint64_t bit = rank * bits;
+        const std::uint64_t word = getFixed<std::uint64_t>(getFixed<std::uint32_t>(32) + bit / 8);
+        return word >> (bit % 8) & ((std::uint64_t{1} << bits) - 1);
+    }
+
+    Node readNode(std::size_t offset) const {
+        const unsigned char* base = reinterpret_cast<const unsigned char*>(image.data());
+        const unsigned char* p = base + offset;
+        Node node{};
+        const std::uint64_t header = getVarint(p);
+        node.terminal = (header & 1) != 0;
+        node.labelLength = static_cast<std::size_t>(header >> 2);
+        node.label = p;
+        p += node.labelLength;
+        std::size_t childBytes = 0;
+        if (header & 2) {
+            node.children = static_cast<std::size_t>(getVarint(p));
+            node.best = getVarint(p);
+            node.strings = static_cast<std::size_t>(getVarint(p));
+            childBytes = static_cast<std::size_t>(getVarint(p));
+        } else {
+            node.strings = node.terminal ? 1 : 0;
+        }
+        if (node.terminal) {
+            node.weight = getVarint(p);
+            if (node.children == 0) {
+                node.best = node.weight;
+            }
+        }
+        node.childrenStart = static_cast<std::size_t>(p - base);
+        node.end = node.childrenStart + childBytes;
+        return node;
+    }
+
+    // Appends the node for entries[lo, hi), which share their first `depth`
+    // bytes and are reached over `label`, and its subtree; sets the subtree's
+    // best weight.
+    static void encodeNode(const std::vector<Entry>& entries, std::size_t lo, std::size_t hi, std::size_t depth,
+                           std::string_view label, std::string& out, std::uint64_t& best) {
+        const bool terminal = lo < hi && entries[lo].text.size() == depth;
+        best = terminal ? entries[lo].weight : 0;
+        // The node records how many bytes its children take, so they are
+        // encoded first.
+        std::string below;
+        std::size_t children = 0;
+        for (std::size_t i = terminal ? lo + 1 : lo; i < hi; ++children) {
+            const char first = entries[i].text[depth];
+            std::size_t end = i + 1;
+            while (end < hi && entries[end].text[depth] == first) {
+                ++end;
+            }
+            // Sorted, so the group's common prefix is that of its first and last.
+            const std::string& a = entries[i].text;
+            const std::string& b = entries[end - 1].text;
+            std::size_t common = depth + 1;
+            while (common < a.size() && common < b.size() && a[common] == b[common]) {
+                ++common;
+            }
+            std::uint64_t childBest = 0;
+            encodeNode(entries, i, end, common, std::string_view(a).substr(depth, common - depth), below, childBest);
+            best = std::max(best, childBest);
+            i = end;
+        }
+
+        putVarint(out, static_cast<std::uint64_t>(label.size()) << 2 | (children > 0) << 1 | terminal);
+        out.append(label.data(), label.size());
+        if (children > 0) {
+            putVarint(out, children);
+            putVarint(out, best);
+            putVarint(out, hi - lo);
+            putVarint(out, below.size());
+        }
+        if (terminal) {
+            putVarint(out, entries[lo].weight);
+        }
+        out += below;
+    }
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "song.h"
+
+// Songs with no known duration count as this long when timing a playlist.
+constexpr std::uint32_t kAssumedSongSeconds = 210;
+
+// "m:ss".
+inline std::string formatDuration(std::uint32_t seconds) {
+    const std::uint32_t s = seconds % 60;
+    return std::to_string(seconds / 60) + (s < 10 ? ":0" : ":") + std::to_string(s);
+}
+
+struct TimedCandidate {
+    SongId id;
+    // 0 if unknown.
+    std::uint32_t seconds;
+    // Songs with equal tags count as the same artist.
+    std::uint32_t artist;
+};
+
+struct DurationTarget {
+    std::uint32_t seconds = 45 * 60;
+    std::uint32_t toleranceSeconds = 60;
+    // Songs by one artist are at least this many tracks apart, so 5 means no
+    // artist twice within any 5 consecutive tracks; 0 or 1 for no limit.
+    std::size_t artistGap = 5;
+    // The whole plan takes about this many milliseconds at most: the
+    // knapsack stops and the best playlist found so far is used, and the
+    // artist repair stops looking for exchanges. 0 for no limit.
+    double budgetMs = 20.0;
+};
+
+struct DurationPlanStats {
+    double ms = 0.0;
+    // Candidates the knapsack went through before it proved nothing later
+    // could do better, ran out of candidates or ran out of time.
+    std::size_t candidatesSolved = 0;
+    bool timedOut = false;
+    std::uint32_t totalSeconds = 0;
+    bool withinTolerance = false;
+    // Songs exchanged for a song by another artist to keep the gap, and
+    // places where no exchange was possible and an artist repeats early.
+    std::size_t artistSwaps = 0;
+    std::size_t gapViolations = 0;
+};
+
+// Picks songs from `ranked` (best first) whose durations add up to the target
+// within the tolerance, then orders them so no artist comes back within
+// artistGap tracks.
+//
+// Choosing the songs is a 0/1 knapsack over whole seconds: every second of the
+// playlist costs the rank of the song playing it, and among the totals inside
+// the tolerance the plan with the lowest cost per second wins, so the best
+// songs are kept and short and long songs are treated alike. The table after
+// i candidates holds the cheapest plan for every total using only those i,
+// which makes it an anytime search: the candidates are added best first, the
+// best plan is read off at checkpoints, and the search stops once no later
+// candidate could be part of a cheaper plan or the time budget runs out.
+// Before the first checkpoint the best plan is the best-ranked songs that fit;
+// if no set of songs fits, it is the one coming closest from below.
+//
+// The separation is then repaired greedily: each position takes the best
+// remaining song whose artist is not among the previous artistGap - 1. If
+// every remaining song is blocked, the first one is exchanged for the best
+// unused candidate by another artist that keeps the total in tolerance (or no
+// further from the target), and failing that it is played anyway.
+//
+// Every pass over `ranked` looks at the clock every kTimeCheckInterval
+// candidates, so a long list cannot push the plan past its budget.
+constexpr std::size_t kTimeCheckInterval = 1024;
+
+inline std::vector<SongId> planTimedPlaylist(const std::vector<TimedCandidate>& ranked, const DurationTarget& target,
+                                             DurationPlanStats* stats = nullptr) {
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsedMs = [&] {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    // Once true, stays true.
+    bool expired = false;
+    auto outOfTime = [&] {
+        expired = expired || (target.budgetMs > 0.0 && elapsedMs() > target.budgetMs);
+        return expired;
+    };
+    auto checkpoint = [](std::size_t i) { return i % kTimeCheckInterval == kTimeCheckInterval - 1; };
+    const std::uint32_t low = target.seconds - std::min(target.toleranceSeconds, target.seconds);
+    const std::uint32_t high = target.seconds + target.toleranceSeconds;
+    auto secondsOf = [&](std::size_t i) { return ranked[i].seconds > 0 ? ranked[i].seconds : kAssumedSongSeconds; };
+    auto distance = [&](std::uint32_t total) {
+        return total > target.seconds ? total - target.seconds : target.seconds - total;
+    };
+
+    struct Plan {
+        std::vector<std::size_t> picks;
+        std::uint32_t total = 0;
+        double costPerSecond = std::numeric_limits<double>::infinity();
+    };
+    auto better = [&](std::uint32_t total, double costPerSecond, const Plan& than) {
+        const bool fits = total >= low && total <= high, fitted = than.total >= low && than.total <= high;
+        if (fits != fitted) {
+            return fits;
+        }
+        if (!fits) {
+            return distance(total) < distance(than.total);
+        }
+        return costPerSecond < than.costPerSecond ||
+               (costPerSecond == than.costPerSecond && distance(total) < distance(than.total));
+    };
+
+    Plan best;
+    std::uint64_t greedyCost = 0;
+    for (std::size_t i = 0; i < ranked.size() && best.total < low && !(checkpoint(i) && outOfTime()); ++i) {
+        if (best.total + secondsOf(i) <= high) {
+            best.picks.push_back(i);
+            best.total += secondsOf(i);
+            greedyCost += (i + 1) * static_cast<std::uint64_t>(secondsOf(i));
+        }
+    }
+    if (best.total > 0) {
+        best.costPerSecond = static_cast<double>(greedyCost) / best.total;
+    }
+
+    // cost[c]: cheapest plan totalling exactly c seconds so far. Row r of
+    // `took` marks the totals whose cheapest plan changed to include rows[r];
+    // rows are allocated one by one, so adding one never copies the others.
+    constexpr std::uint64_t kUnreachable = std::numeric_limits<std::uint64_t>::max();
+    std::vector<std::uint64_t> cost(high + 1, kUnreachable);
+    cost[0] = 0;
+    const std::size_t words = high / 64 + 1;
+    std::vector<std::vector<std::uint64_t>> took;
+    std::vector<std::size_t> rows;
+    std::uint32_t shortest = std::numeric_limits<std::uint32_t>::max();
+    for (std::size_t i = 0; i < ranked.size() && !(checkpoint(i) && outOfTime()); ++i) {
+        shortest = std::min(shortest, secondsOf(i));
+    }
+    auto readBest = [&] {
+        std::uint32_t total = 0;
+        double perSecond = std::numeric_limits<double>::infinity();
+        for (std::uint32_t c = low; c <= high; ++c) {
+            if (cost[c] == kUnreachable || c == 0) {
+                continue;
+            }
+            const double candidate = static_cast<double>(cost[c]) / c;
+            if (total == 0 || candidate < perSecond || (candidate == perSecond && distance(c) < distance(total))) {
+                total = c;
+                perSecond = candidate;
+            }
+        }
+        // Nothing fits yet: the longest total short of the tolerance.
+        for (std::uint32_t c = low; total == 0 && c-- > 1;) {
+            if (cost[c] != kUnreachable) {
+                total = c;
+                perSecond = static_cast<double>(cost[c]) / c;
+            }
+        }
+        if (total == 0 || !better(total, perSecond, best)) {
+            return;
+        }
+        best.picks.clear();
+        best.total = total;
+        best.costPerSecond = perSecond;
+        for (std::size_t r = rows.size(); r-- > 0 && total > 0;) {
+            if (took[r][total / 64] >> (total % 64) & 1) {
+                best.picks.push_back(rows[r]);
+                total -= secondsOf(rows[r]);
+            }
+        }
+        std::reverse(best.picks.begin(), best.picks.end());
+    };
+
+    std::size_t solved = 0;
+    for (std::size_t i = 0; i < ranked.size() && !expired; ++i) {
+        // A plan with candidate i in it costs at least i + 1 per second for
+        // its songs and 1 per second for the rest.
+        if (best.total >= low && 1.0 + static_cast<double>(i) * shortest / high >= best.costPerSecond) {
+            break;
+        }
+        if (outOfTime()) {
+            break;
+        }
+        solved = i + 1;
+        const std::uint32_t seconds = secondsOf(i);
+        if (seconds > high) {
+            continue;
+        }
+        const std::uint64_t weight = (i + 1) * static_cast<std::uint64_t>(seconds);
+        rows.push_back(i);
+        took.emplace_back(words, 0);
+        std::uint64_t* row = took.back().data();
+        for (std::uint32_t c = high; c >= seconds; --c) {
+            const std::uint64_t from = cost[c - seconds];
+            if (from != kUnreachable && from + weight < cost[c]) {
+                cost[c] = from + weight;
+                row[c / 64] |= std::uint64_t{1} << (c % 64);
+            }
+        }
+        if ((solved & (solved - 1)) == 0 && solved >= 16) {
+            readBest();
+        }
+    }
+    const bool timedOut = expired;
+    readBest();
+
+    const std::size_t window = target.artistGap > 1 ? target.artistGap - 1 : 0;
+    // The picks and songs exchanged in, sorted; a handful, unlike `ranked`.
+    std::vector<std::size_t> used = best.picks;
+    std::sort(used.begin(), used.end());
+    std::vector<std::size_t> remaining = best.picks, order;
+    auto blocked = [&](std::size_t candidate) {
+        for (std::size_t back = 1; back <= window && back <= order.size(); ++back) {
+            if (ranked[order[order.size() - back]].artist == ranked[candidate].artist) {
+                return true;
+            }
+        }
+        return false;
+    };
+    std::size_t swaps = 0, violations = 0;
+    while (!remaining.empty()) {
+        auto next = std::find_if_not(remaining.begin(), remaining.end(), blocked);
+        if (next == remaining.end()) {
+            next = remaining.begin();
+            const std::uint32_t without = best.total - secondsOf(*next);
+            const bool fitted = best.total >= low && best.total <= high;
+            for (std::size_t i = 0; i < ranked.size() && !(checkpoint(i) && outOfTime()); ++i) {
+                const std::uint32_t total = without + secondsOf(i);
+                if (blocked(i) || !(fitted ? total >= low && total <= high : distance(total) <= distance(best.total)) ||
+                    std::binary_search(used.begin(), used.end(), i)) {
+                    continue;
+                }
+                used.insert(std::upper_bound(used.begin(), used.end(), i), i);
+                best.total = total;
+                *next = i;
+                ++swaps;
+                break;
+            }
+            if (blocked(*next)) {
+                ++violations;
+            }
+        }
+        order.push_back(*next);
+        remaining.erase(next);
+    }
+
+    std::vector<SongId> playlist;
+    for (std::size_t i : order) {
+        playlist.push_back(ranked[i].id);
+    }
+    if (stats) {
+        stats->ms = elapsedMs();
+        stats->candidatesSolved = solved;
+        stats->timedOut = timedOut;
+        stats->totalSeconds = best.total;
+        stats->withinTolerance = best.total >= low && best.total <= high;
+        stats->artistSwaps = swaps;
+        stats->gapViolations = violations;
+    }
+    return playlist;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "playlist_cache.h"
+
+// Target energy for each of `length` positions: a warm-up from `low` to `peak`
+// over the first 40% of the playlist, the peak held for the next 20%, and a
+// cool-down back to `low`.
+inline std::vector<float> energyArcTarget(std::size_t length, float low, float peak) {
+    std::vector<float> target(length);
+    for (std::size_t p = 0; p < length; ++p) {
+        const float t = length > 1 ? static_cast<float>(p) / static_cast<float>(length - 1) : 0.5f;
+        const float rise = t < 0.4f ? t / 0.4f : t <= 0.6f ? 1.0f : (1.0f - t) / 0.4f;
+        target[p] = low + (peak - low) * rise;
+    }
+    return target;
+}
+
+// Chooses an energy level (an index into candidates.energies) for each
+// position of a playlist following `target`, minimising
+//
+//   sum over p of (energy[p] - target[p])^2 + jumpWeight * (energy[p] - energy[p-1])^2
+//
+// by dynamic programming over (position, level): the cheapest way to end at
+// level l after p songs extends the cheapest way to end at some level after
+// p - 1. That is positions x levels^2 steps, independent of how many songs the
+// levels hold.
+//
+// A level cannot be used more often than it has songs. Levels the optimum
+// overuses get a per-use surcharge and the plan is solved again, keeping the
+// cheapest plan that fits. If none does after a few rounds, songs move off
+// overused levels one at a time, each time the move that adds the least
+// deviation, and the resulting levels are laid along the curve in order. The
+// plan is shorter than `target` if there are fewer candidates.
+inline std::vector<std::size_t> planEnergyArc(const std::vector<float>& target, const EnergyBuckets& candidates,
+                                              float jumpWeight = 0.5f) {
+    const std::size_t positions = std::min(target.size(), candidates.total());
+    const std::size_t levels = candidates.energies.size();
+    std::vector<std::size_t> plan(positions);
+    if (positions == 0) {
+        return plan;
+    }
+    std::vector<float> energy(levels);
+    for (std::size_t l = 0; l < levels; ++l) {
+        energy[l] = static_cast<float>(candidates.energies[l]);
+    }
+    auto deviation = [&](std::size_t p, std::size_t l) {
+        const float d = energy[l] - target[p];
+        return d * d;
+    };
+    auto overuse = [&](const std::vector<std::size_t>& candidate, std::vector<std::size_t>& used) {
+        std::fill(used.begin(), used.end(), 0);
+        for (std::size_t level : candidate) {
+            ++used[level];
+        }
+        std::size_t over = 0;
+        for (std::size_t l = 0; l < levels; ++l) {
+            over += used[l] > candidates.songs[l].size() ? used[l] - candidates.songs[l].size() : 0;
+        }
+        return over;
+    };
+
+    constexpr int kSurchargeRounds = 8;
+    std::vector<float> surcharge(levels, 0.0f);
+    std::vector<float> cost(levels), next(levels);
+    std::vector<std::uint32_t> parent(positions * levels);
+    std::vector<std::size_t> used(levels);
+    std::vector<std::size_t> best;
+    float bestCost = std::numeric_limits<float>::infinity();
+    for (int round = 0; round <= kSurchargeRounds; ++round) {
+        for (std::size_t l = 0; l < levels; ++l) {
+            cost[l] = deviation(0, l) + surcharge[l];
+        }
+        for (std::size_t p = 1; p < positions; ++p) {
+            for (std::size_t l = 0; l < levels; ++l) {
+                float cheapest = std::numeric_limits<float>::infinity();
+                std::uint32_t from = 0;
+                for (std::size_t k = 0; k < levels; ++k) {
+                    const float jump = energy[l] - energy[k];
+                    const float c = cost[k] + jumpWeight * jump * jump;
+                    if (c < cheapest) {
+                        cheapest = c;
+                        from = static_cast<std::uint32_t>(k);
+                    }
+                }
+                next[l] = cheapest + deviation(p, l) + surcharge[l];
+                parent[p * levels + l] = from;
+            }
+            std::swap(cost, next);
+        }
+        plan[positions - 1] = static_cast<std::size_t>(std::min_element(cost.begin(), cost.end()) - cost.begin());
+        for (std::size_t p = positions - 1; p > 0; --p) {
+            plan[p - 1] = parent[p * levels + plan[p]];
+        }
+
+        if (overuse(plan, used) == 0) {
+            float planCost = deviation(0, plan[0]);
+            for (std::size_t p = 1; p < positions; ++p) {
+                const float jump = energy[plan[p]] - energy[plan[p - 1]];
+                planCost += deviation(p, plan[p]) + jumpWeight * jump * jump;
+            }
+            if (planCost < bestCost) {
+                bestCost = planCost;
+                best = plan;
+            }
+            if (round == 0) {
+                break;
+            }
+        }
+        // Subgradient step: raise the price of overused levels, lower it for
+        // levels with songs to spare.
+        const float step = 1.0f / static_cast<float>(round + 1);
+        for (std::size_t l = 0; l < levels; ++l) {
+            const float excess = static_cast<float>(used[l]) - static_cast<float>(candidates.songs[l].size());
+            surcharge[l] = std::max(0.0f, surcharge[l] + step * excess);
+        }
+    }
+    if (!best.empty()) {
+        return best;
+    }
+
+    while (overuse(plan, used) > 0) {
+        float cheapest = std::numeric_limits<float>::infinity();
+        std::size_t movePosition = 0, moveLevel = 0;
+        for (std::size_t p = 0; p < positions; ++p) {
+            if (used[plan[p]] <= candidates.songs[plan[p]].size()) {
+                continue;
+            }
+            for (std::size_t l = 0; l < levels; ++l) {
+                const float added = deviation(p, l) - deviation(p, plan[p]);
+                if (used[l] < candidates.songs[l].size() && added < cheapest) {
+                    cheapest = added;
+                    movePosition = p;
+                    moveLevel = l;
+                }
+            }
+        }
+        plan[movePosition] = moveLevel;
+    }
+    // The moves ignore jumps; deal the levels out again lowest to the lowest
+    // targets, which minimises the deviation for this set of levels and follows
+    // the curve smoothly.
+    std::vector<std::size_t> byTarget(positions);
+    for (std::size_t p = 0; p < positions; ++p) {
+        byTarget[p] = p;
+    }
+    std::stable_sort(byTarget.begin(), byTarget.end(),
+                     [&](std::size_t a, std::size_t b) { return target[a] < target[b]; });
+    std::sort(plan.begin(), plan.end());
+    std::vector<std::size_t> dealt(positions);
+    for (std::size_t i = 0; i < positions; ++i) {
+        dealt[byTarget[i]] = plan[i];
+    }
+    return dealt;
+}
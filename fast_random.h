@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+
+// xoshiro256** generator. 32 bytes of state instead of the ~5 KB of std::mt19937,
+// and it satisfies UniformRandomBitGenerator so it plugs into <random>/<algorithm>.
+class FastRandom {
+public:
+    using result_type = std::uint64_t;
+
+    explicit FastRandom(std::uint64_t seed = 0) { reseed(seed); }
+
+    // Expands a 64-bit seed into the full state with splitmix64, so nearby seeds
+    // still give unrelated streams.
+    void reseed(std::uint64_t seed) {
+        for (auto& word : state) {
+            seed += 0x9E3779B97F4A7C15ULL;
+            std::uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        const std::uint64_t result = rotl(state[1] * 5, 7) * 9;
+        const std::uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    // Unbiased integer in [0, bound) using Lemire's multiply-shift method.
+    std::uint64_t below(std::uint64_t bound) {
+        unsigned __int128 m = static_cast<unsigned __int128>((*this)()) * bound;
+        std::uint64_t low = static_cast<std::uint64_t>(m);
+        if (low < bound) {
+            const std::uint64_t threshold = (0 - bound) % bound;
+            while (low < threshold) {
+                m = static_cast<unsigned __int128>((*this)()) * bound;
+                low = static_cast<std::uint64_t>(m);
+            }
+        }
+        return static_cast<std::uint64_t>(m >> 64);
+    }
+
+    // Per-thread generator, seeded from std::random_device once per thread.
+    static FastRandom& threadLocal() {
+        thread_local FastRandom rng(seedFromDevice());
+        return rng;
+    }
+
+private:
+    std::uint64_t state[4];
+
+    static std::uint64_t rotl(std::uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    static std::uint64_t seedFromDevice() {
+        std::random_device rd;
+        return (static_cast<std::uint64_t>(rd()) << 32) ^ rd();
+    }
+};
+
+// Fisher-Yates shuffle driven by FastRandom::below. Unlike std::shuffle its output
+// for a given seed does not depend on the standard library implementation.
+template <typename RandomIt>
+void fastShuffle(RandomIt first, RandomIt last, FastRandom& rng) {
+    const auto n = static_cast<std::uint64_t>(last - first);
+    for (std::uint64_t i = n; i > 1; --i) {
+        const std::uint64_t j = rng.below(i);
+        using std::swap;
+        swap(first[i - 1], first[j]);
+    }
+}
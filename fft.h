@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// In-place radix-2 complex FFT on split real/imaginary arrays. Twiddle factors
+// are stored contiguously per stage, so every butterfly loop walks unit-stride
+// arrays and the compiler can vectorise it.
+class Fft {
+public:
+    // `size` must be a power of two.
+    explicit Fft(std::size_t size) : n(size), bitReversed(size) {
+        std::size_t bits = 0;
+        while ((std::size_t{1} << bits) < n) {
+            ++bits;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t r = 0;
+            for (std::size_t b = 0; b < bits; ++b) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            bitReversed[i] = static_cast<std::uint32_t>(r);
+        }
+        const double pi = 3.14159265358979323846;
+        for (std::size_t half = 1; half < n; half *= 2) {
+            for (std::size_t k = 0; k < half; ++k) {
+                twiddleRe.push_back(static_cast<float>(std::cos(-pi * k / half)));
+                twiddleIm.push_back(static_cast<float>(std::sin(-pi * k / half)));
+            }
+        }
+    }
+
+    std::size_t size() const { return n; }
+
+    void forward(float* re, float* im) const {
+        for (std::size_t i = 0; i < n; ++i) {
+            std::size_t j = bitReversed[i];
+            if (i < j) {
+                std::swap(re[i], re[j]);
+                std::swap(im[i], im[j]);
+            }
+        }
+        std::size_t twiddleOffset = 0;
+        for (std::size_t half = 1; half < n; half *= 2) {
+            const float* wr = twiddleRe.data() + twiddleOffset;
+            const float* wi = twiddleIm.data() + twiddleOffset;
+            for (std::size_t start = 0; start < n; start += 2 * half) {
+                float* ar = re + start;
+                float* ai = im + start;
+                float* br = ar + half;
+                float* bi = ai + half;
+                for (std::size_t k = 0; k < half; ++k) {
+                    const float tr = br[k] * wr[k] - bi[k] * wi[k];
+                    const float ti = br[k] * wi[k] + bi[k] * wr[k];
+                    br[k] = ar[k] - tr;
+                    bi[k] = ai[k] - ti;
+                    ar[k] += tr;
+                    ai[k] += ti;
+                }
+            }
+            twiddleOffset += half;
+        }
+    }
+
+private:
+    std::size_t n;
+    std::vector<std::uint32_t> bitReversed;
+    std::vector<float> twiddleRe;
+    std::vector<float> twiddleIm;
+};
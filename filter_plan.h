@@ -0,0 +1,595 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "attribute_index.h"
+#include "filter_query.h"
+#include "mood_index.h"
+#include "roaring_bitmap.h"
+#include "song.h"
+#include "song_columns.h"
+#include "text_normalize.h"
+#include "trigram_index.h"
+
+// Bit i set if lo <= values[i] <= hi, for count <= 64 values; full blocks are
+// compared 16 at a time.
+inline std::uint64_t rangeMask(const std::uint8_t* values, std::size_t count, int lo, int hi) {
+    lo = std::max(lo, 0);
+    hi = std::min(hi, 255);
+    if (lo > hi) {
+        return 0;
+    }
+    // Unsigned wrap-around turns the two comparisons into one.
+    const std::uint8_t base = static_cast<std::uint8_t>(lo), span = static_cast<std::uint8_t>(hi - lo);
+#if defined(__SSE2__)
+    if (count == 64) {
+        const __m128i baseVector = _mm_set1_epi8(static_cast<char>(base));
+        const __m128i spanVector = _mm_set1_epi8(static_cast<char>(span));
+        std::uint64_t mask = 0;
+        for (std::size_t i = 0; i < 64; i += 16) {
+            const __m128i offset =
+                _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)), baseVector);
+            const __m128i inside = _mm_cmpeq_epi8(_mm_min_epu8(offset, spanVector), offset);
+            mask |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(_mm_movemask_epi8(inside))) << i;
+        }
+        return mask;
+    }
+#endif
+    std::uint64_t mask = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        mask |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(values[i] - base) <= span) << i;
+    }
+    return mask;
+}
+
+inline std::uint64_t rangeMask(const std::int16_t* values, std::size_t count, int lo, int hi) {
+    lo = std::max(lo, -32768);
+    hi = std::min(hi, 32767);
+    if (lo > hi) {
+        return 0;
+    }
+    const std::uint16_t base = static_cast<std::uint16_t>(lo), span = static_cast<std::uint16_t>(hi - lo);
+#if defined(__SSE2__)
+    if (count == 64) {
+        // SSE2 only compares signed 16-bit lanes, so flip the sign bits to
+        // compare the unsigned offsets.
+        const __m128i baseVector = _mm_set1_epi16(static_cast<short>(base));
+        const __m128i sign = _mm_set1_epi16(static_cast<short>(0x8000));
+        const __m128i spanVector = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(span)), sign);
+        auto above = [&](const std::int16_t* p) {
+            const __m128i offset = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), baseVector);
+            return _mm_cmpgt_epi16(_mm_xor_si128(offset, sign), spanVector);
+        };
+        std::uint64_t mask = 0;
+        for (std::size_t i = 0; i < 64; i += 16) {
+            const __m128i outside = _mm_packs_epi16(above(values + i), above(values + i + 8));
+            mask |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(~_mm_movemask_epi8(outside))) << i;
+        }
+        return mask;
+    }
+#endif
+    std::uint64_t mask = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        mask |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(values[i] - base) <= span) << i;
+    }
+    return mask;
+}
+
+// What a filter runs against; everything must describe the same catalog.
+struct FilterSources {
+    const std::vector<Song>& songs;
+    const SongColumns& columns;
+    const MoodIndex& moods;
+    const AttributeIndex& attributes;
+    const TrigramIndex& text;
+};
+
+// An executable plan for a FilterQuery, chosen by a simple cost model. Each
+// query node is answered one of three ways:
+//
+//   index:  look terms up in the mood, attribute and trigram indexes and
+//           combine the bitmaps (intersect smallest first, union, complement)
+//   filter: for an AND, take the smallest operand from the indexes and check
+//           the other operands on each of its songs
+//   scan:   evaluate the node over the attribute columns, a batch of songs
+//           at a time
+//
+// Row counts are estimated from exact per-term counts (index sizes, or the
+// shortest posting list for text) assuming independent terms, and costs are
+// rough nanoseconds per song touched. execute() records actual rows and time
+// per step for explain().
+class FilterPlan {
+public:
+    enum class Strategy : std::uint8_t { Auto, IndexOnly, ScanOnly };
+
+    struct Step {
+        enum class Kind : std::uint8_t { Lookup, Intersect, Union, Complement, Filter, Scan };
+        Kind kind;
+        // Query node this step answers.
+        int node;
+        // Steps whose results this one combines (Filter: the driving step).
+        std::vector<int> inputs;
+        // Filter: query nodes checked per song.
+        std::vector<int> checks;
+        double estimatedRows = 0;
+        double cost = 0;
+        // Set by execute().
+        std::size_t rows = 0;
+        double ms = 0;
+    };
+
+    FilterPlan(FilterQuery filter, const FilterSources& from, Strategy strategy = Strategy::Auto)
+        : query(std::move(filter)), sources(from), songCount(from.songs.size()) {
+        choices.resize(query.nodeCount());
+        choose(query.rootNode(), strategy);
+        if (strategy == Strategy::ScanOnly) {
+            choices[query.rootNode()].kind = Step::Kind::Scan;
+        }
+        root = emit(query.rootNode());
+    }
+
+    RoaringBitmap execute() { return run(root); }
+
+    const std::vector<Step>& plannedSteps() const { return steps; }
+    const Step& rootStep() const { return steps[root]; }
+    double estimatedCost() const { return steps[root].cost; }
+
+    // The plan as an indented operator tree, with estimates and, once
+    // executed, actual rows and time (including inputs) per step.
+    void explain(std::ostream& out) const {
+        out << "Plan for " << query.toString() << " over " << songCount << " songs:\n";
+        explainStep(out, root, 1);
+    }
+
+private:
+    // Songs per mask word, and per batch evaluated in one pass over the
+    // query tree.
+    static constexpr std::size_t kBlock = 64;
+    static constexpr std::size_t kBatch = 1024;
+
+    // Cost model, in nanoseconds.
+    static constexpr double kMoodLookupPerSong = 0.2;
+    static constexpr double kValueLookupPerSong = 0.5;
+    static constexpr double kSortedLookupPerSong = 3;
+    static constexpr double kTextCheckPerSong = 150;
+    static constexpr double kCombinePerSong = 0.5;
+    static constexpr double kScanPerSong = 0.15;
+    static constexpr double kScanPerColumn = 0.15;
+    static constexpr double kDensePerSong = 0.01;
+    static constexpr double kFilterPerSong = 3;
+    static constexpr double kFilterPerColumn = 2;
+
+    struct Choice {
+        Step::Kind kind;
+        double rows;
+        double cost;
+        // Filter: operand driving the lookups.
+        int driver = -1;
+    };
+
+    FilterQuery query;
+    FilterSources sources;
+    std::size_t songCount;
+    std::vector<Choice> choices;
+    std::vector<Step> steps;
+    int root = -1;
+    // Dense bitsets of mood and text terms, for scans and filters.
+    std::vector<std::vector<std::uint64_t>> denseTerms;
+
+    using Field = FilterQuery::Field;
+    using Op = FilterQuery::Op;
+
+    static bool isColumnTerm(const FilterQuery::Node& node) {
+        return node.op == Op::Term && (node.field == Field::Energy || node.field == Field::Danceability ||
+                                       node.field == Field::Year);
+    }
+
+    static SongAttribute attributeOf(Field field) {
+        return field == Field::Energy ? SongAttribute::Energy
+               : field == Field::Danceability ? SongAttribute::Danceability
+                                              : SongAttribute::Year;
+    }
+
+    double termRows(const FilterQuery::Node& node) const {
+        switch (node.field) {
+            case Field::Mood:
+                return static_cast<double>(sources.moods.bitmapFor(node.text).cardinality());
+            case Field::Title:
+            case Field::Artist:
+                // No trigrams: every song is a candidate, guess a tenth match.
+                return static_cast<double>(sources.text.estimateContaining(node.text).value_or(songCount / 10));
+            default:
+                return static_cast<double>(sources.attributes.countBetween(attributeOf(node.field), node.lo, node.hi));
+        }
+    }
+
+    double termLookupCost(const FilterQuery::Node& node, double rows) const {
+        const double n = static_cast<double>(songCount);
+        switch (node.field) {
+            case Field::Mood:
+                return kMoodLookupPerSong * rows;
+            case Field::Title:
+            case Field::Artist:
+                return kTextCheckPerSong * (sources.text.estimateContaining(node.text) ? rows : n);
+            case Field::Year:
+                // The slice or its complement, through a dense buffer.
+                return kSortedLookupPerSong * std::min(rows, n - rows) + kDensePerSong * n;
+            default:
+                return kValueLookupPerSong * std::min(rows, n - rows);
+        }
+    }
+
+    // Cost of evaluating `node` per song (scan or filter), and the one-off cost
+    // of the dense bitsets its mood and text terms need.
+    void rowCosts(int node, double perColumn, double& perSong, double& setup) const {
+        const FilterQuery::Node& current = query.node(node);
+        if (current.op != Op::Term) {
+            for (int operand : current.operands) {
+                rowCosts(operand, perColumn, perSong, setup);
+            }
+            return;
+        }
+        perSong += perColumn;
+        if (!isColumnTerm(current)) {
+            setup += termLookupCost(current, termRows(current)) + kDensePerSong * songCount;
+        }
+    }
+
+    double scanCost(int node) const {
+        double perSong = kScanPerSong, setup = 0;
+        rowCosts(node, kScanPerColumn, perSong, setup);
+        return setup + perSong * songCount;
+    }
+
+    const Choice& choose(int node, Strategy strategy) {
+        const FilterQuery::Node& current = query.node(node);
+        const double n = std::max<double>(1.0, static_cast<double>(songCount));
+        Choice index{Step::Kind::Lookup, 0, 0};
+        switch (current.op) {
+            case Op::Term:
+                index.rows = termRows(current);
+                index.cost = termLookupCost(current, index.rows);
+                break;
+            case Op::Not: {
+                const Choice& operand = choose(current.operands[0], strategy);
+                index = {Step::Kind::Complement, n - operand.rows, operand.cost + kCombinePerSong * n};
+                break;
+            }
+            case Op::Or: {
+                double none = 1;
+                index.kind = Step::Kind::Union;
+                for (int operand : current.operands) {
+                    const Choice& choice = choose(operand, strategy);
+                    index.cost += choice.cost + kCombinePerSong * std::min(n, n * (1 - none) + choice.rows);
+                    none *= 1 - choice.rows / n;
+                }
+                index.rows = n * (1 - none);
+                break;
+            }
+            case Op::And: {
+                double all = 1;
+                index.kind = Step::Kind::Intersect;
+                // Operands are intersected smallest first; each step costs
+                // about the size of both sides.
+                std::vector<double> sizes;
+                for (int operand : current.operands) {
+                    const Choice& choice = choose(operand, strategy);
+                    all *= choice.rows / n;
+                    index.cost += choice.cost;
+                    sizes.push_back(choice.rows);
+                }
+                std::sort(sizes.begin(), sizes.end());
+                double sofar = sizes[0];
+                for (std::size_t i = 1; i < sizes.size(); ++i) {
+                    index.cost += kCombinePerSong * std::min(n, sofar + sizes[i]);
+                    sofar *= sizes[i] / n;
+                }
+                index.rows = n * all;
+                break;
+            }
+        }
+        Choice best = index;
+        if (strategy == Strategy::Auto) {
+            if (current.op == Op::And) {
+                // Drive from the operand with the cheapest lookup-plus-checks.
+                for (int driver : current.operands) {
+                    const Choice& driving = choices[driver];
+                    double perSong = kFilterPerSong, setup = 0;
+                    for (int operand : current.operands) {
+                        if (operand != driver) {
+                            rowCosts(operand, kFilterPerColumn, perSong, setup);
+                        }
+                    }
+                    const double cost = driving.cost + setup + perSong * driving.rows;
+                    if (cost < best.cost) {
+                        best = {Step::Kind::Filter, index.rows, cost, driver};
+                    }
+                }
+            }
+            const double cost = scanCost(node);
+            if (cost < best.cost) {
+                best = {Step::Kind::Scan, index.rows, cost};
+            }
+        }
+        choices[node] = best;
+        return choices[node];
+    }
+
+    int addStep(Step step) {
+        steps.push_back(std::move(step));
+        return static_cast<int>(steps.size()) - 1;
+    }
+
+    int emit(int node) {
+        const Choice& choice = choices[node];
+        const FilterQuery::Node& current = query.node(node);
+        Step step;
+        step.kind = choice.kind;
+        step.node = node;
+        step.estimatedRows = choice.rows;
+        step.cost = choice.kind == Step::Kind::Scan ? scanCost(node) : choice.cost;
+        if (choice.kind == Step::Kind::Filter) {
+            step.inputs.push_back(emit(choice.driver));
+            for (int operand : current.operands) {
+                if (operand != choice.driver) {
+                    step.checks.push_back(operand);
+                }
+            }
+        } else if (choice.kind != Step::Kind::Lookup && choice.kind != Step::Kind::Scan) {
+            for (int operand : current.operands) {
+                step.inputs.push_back(emit(operand));
+            }
+            if (choice.kind == Step::Kind::Intersect) {
+                std::sort(step.inputs.begin(), step.inputs.end(),
+                          [&](int a, int b) { return steps[a].estimatedRows < steps[b].estimatedRows; });
+            }
+        }
+        return addStep(std::move(step));
+    }
+
+    RoaringBitmap run(int index) {
+        const auto start = std::chrono::steady_clock::now();
+        const Step& step = steps[index];
+        RoaringBitmap result;
+        switch (step.kind) {
+            case Step::Kind::Lookup:
+                result = lookup(query.node(step.node));
+                break;
+            case Step::Kind::Intersect:
+                result = run(step.inputs[0]);
+                for (std::size_t i = 1; i < step.inputs.size() && !result.empty(); ++i) {
+                    result = result & run(step.inputs[i]);
+                }
+                break;
+            case Step::Kind::Union:
+                for (int input : step.inputs) {
+                    result = result | run(input);
+                }
+                break;
+            case Step::Kind::Complement:
+                result = andNot(RoaringBitmap::range(static_cast<std::uint32_t>(songCount)), run(step.inputs[0]));
+                break;
+            case Step::Kind::Filter:
+                result = filter(run(step.inputs[0]), step.checks);
+                break;
+            case Step::Kind::Scan:
+                result = scan(step.node);
+                break;
+        }
+        steps[index].rows = result.cardinality();
+        steps[index].ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    RoaringBitmap lookup(const FilterQuery::Node& term) const {
+        switch (term.field) {
+            case Field::Mood:
+                return sources.moods.bitmapFor(term.text);
+            case Field::Title:
+            case Field::Artist:
+                return lookupText(term);
+            default:
+                return sources.attributes.between(attributeOf(term.field), term.lo, term.hi);
+        }
+    }
+
+    // Trigram candidates, checked against the song's normalised field.
+    RoaringBitmap lookupText(const FilterQuery::Node& term) const {
+        std::optional<std::vector<SongId>> candidates = sources.text.containing(term.text);
+        TextNormalizer normalizer;
+        std::string text;
+        std::vector<SongId> matches;
+        auto check = [&](SongId id) {
+            const Song& song = sources.songs[id];
+            normalizer.normalize(term.field == Field::Title ? song.title : song.artist, text);
+            if (text.find(term.text) != std::string::npos) {
+                matches.push_back(id);
+            }
+        };
+        if (candidates) {
+            for (SongId id : *candidates) {
+                check(id);
+            }
+        } else {
+            for (SongId id = 0; id < songCount; ++id) {
+                check(id);
+            }
+        }
+        return RoaringBitmap::fromSorted(matches);
+    }
+
+    // Makes the dense bitsets for the mood and text terms under `node`.
+    void prepareDense(int node) {
+        denseTerms.resize(query.nodeCount());
+        const FilterQuery::Node& current = query.node(node);
+        if (current.op != Op::Term) {
+            for (int operand : current.operands) {
+                prepareDense(operand);
+            }
+        } else if (!isColumnTerm(current) && denseTerms[node].empty()) {
+            denseTerms[node].assign((songCount + kBlock - 1) / kBlock + 1, 0);
+            lookup(current).copyTo(denseTerms[node].data(), denseTerms[node].size());
+        }
+    }
+
+    // Sets out[i / 64] bit i % 64 for each of the `count` (<= kBatch) songs
+    // ids[i], or first + i if `ids` is null, that match `node`. Each node is
+    // evaluated for the whole batch before its parent combines the masks.
+    void evaluate(int node, const SongId* ids, SongId first, std::size_t count, std::uint64_t* out) const {
+        const std::size_t words = (count + kBlock - 1) / kBlock;
+        const FilterQuery::Node& current = query.node(node);
+        switch (current.op) {
+            case Op::Term:
+                if (!isColumnTerm(current)) {
+                    const std::vector<std::uint64_t>& bits = denseTerms[node];
+                    if (!ids) {
+                        std::copy(bits.begin() + first / kBlock, bits.begin() + first / kBlock + words, out);
+                        break;
+                    }
+                    std::fill(out, out + words, 0);
+                    for (std::size_t i = 0; i < count; ++i) {
+                        out[i / kBlock] |= ((bits[ids[i] / kBlock] >> (ids[i] % kBlock)) & 1) << (i % kBlock);
+                    }
+                    break;
+                }
+                for (std::size_t w = 0; w < words; ++w) {
+                    const std::size_t offset = w * kBlock, size = std::min(kBlock, count - offset);
+                    const SongId* blockIds = ids ? ids + offset : nullptr;
+                    const SongId blockFirst = static_cast<SongId>(first + offset);
+                    out[w] = current.field == Field::Year
+                                 ? columnMask(sources.columns.year, blockIds, blockFirst, size, current.lo, current.hi)
+                                 : columnMask(current.field == Field::Energy ? sources.columns.energy
+                                                                             : sources.columns.danceability,
+                                              blockIds, blockFirst, size, current.lo, current.hi);
+                }
+                break;
+            case Op::Not:
+                evaluate(current.operands[0], ids, first, count, out);
+                for (std::size_t w = 0; w < words; ++w) {
+                    out[w] = ~out[w];
+                }
+                break;
+            case Op::And:
+            case Op::Or: {
+                const bool both = current.op == Op::And;
+                evaluate(current.operands[0], ids, first, count, out);
+                std::uint64_t operand[kBatch / kBlock];
+                for (std::size_t i = 1; i < current.operands.size(); ++i) {
+                    evaluate(current.operands[i], ids, first, count, operand);
+                    for (std::size_t w = 0; w < words; ++w) {
+                        out[w] = both ? out[w] & operand[w] : out[w] | operand[w];
+                    }
+                }
+                break;
+            }
+        }
+        // Bits past `count` are undefined above (NOT sets them).
+        if (count % kBlock != 0) {
+            out[words - 1] &= (std::uint64_t{1} << (count % kBlock)) - 1;
+        }
+    }
+
+    template <typename T>
+    static std::uint64_t columnMask(const std::vector<T>& column, const SongId* ids, SongId first, std::size_t count,
+                                    int lo, int hi) {
+        if (!ids) {
+            return rangeMask(column.data() + first, count, lo, hi);
+        }
+        T gathered[kBlock];
+        for (std::size_t i = 0; i < count; ++i) {
+            gathered[i] = column[ids[i]];
+        }
+        return rangeMask(gathered, count, lo, hi);
+    }
+
+    RoaringBitmap filter(const RoaringBitmap& candidates, const std::vector<int>& checks) {
+        for (int check : checks) {
+            prepareDense(check);
+        }
+        const std::vector<SongId> ids = candidates.toVector();
+        std::vector<SongId> kept;
+        std::uint64_t mask[kBatch / kBlock], operand[kBatch / kBlock];
+        for (std::size_t offset = 0; offset < ids.size(); offset += kBatch) {
+            const std::size_t count = std::min(kBatch, ids.size() - offset);
+            const std::size_t words = (count + kBlock - 1) / kBlock;
+            evaluate(checks[0], ids.data() + offset, 0, count, mask);
+            for (std::size_t c = 1; c < checks.size(); ++c) {
+                evaluate(checks[c], ids.data() + offset, 0, count, operand);
+                for (std::size_t w = 0; w < words; ++w) {
+                    mask[w] &= operand[w];
+                }
+            }
+            for (std::size_t w = 0; w < words; ++w) {
+                for (std::uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+                    kept.push_back(ids[offset + w * kBlock + __builtin_ctzll(bits)]);
+                }
+            }
+        }
+        return RoaringBitmap::fromSorted(kept);
+    }
+
+    RoaringBitmap scan(int node) {
+        prepareDense(node);
+        std::vector<std::uint64_t> words((songCount + kBlock - 1) / kBlock);
+        for (std::size_t first = 0; first < songCount; first += kBatch) {
+            evaluate(node, nullptr, static_cast<SongId>(first), std::min(kBatch, songCount - first),
+                     words.data() + first / kBlock);
+        }
+        return RoaringBitmap::fromWords(words.data(), words.size());
+    }
+
+    void explainStep(std::ostream& out, int index, int depth) const {
+        const Step& step = steps[index];
+        std::string label;
+        switch (step.kind) {
+            case Step::Kind::Lookup:
+                label = (isColumnTerm(query.node(step.node)) ? "Range index " : "Index ") + query.toString(step.node);
+                if (query.node(step.node).field == Field::Title || query.node(step.node).field == Field::Artist) {
+                    label = "Trigram index " + query.toString(step.node);
+                }
+                break;
+            case Step::Kind::Intersect:
+                label = "Intersect";
+                break;
+            case Step::Kind::Union:
+                label = "Union";
+                break;
+            case Step::Kind::Complement:
+                label = "Complement";
+                break;
+            case Step::Kind::Filter:
+                label = "Filter";
+                for (int check : step.checks) {
+                    label += " " + query.toString(check);
+                }
+                break;
+            case Step::Kind::Scan:
+                label = "Vectorized scan " + query.toString(step.node);
+                break;
+        }
+        out << std::string(depth * 2, ' ') << std::left << std::setw(std::max(1, 48 - depth * 2)) << label
+            << std::right << " est " << std::setw(8) << static_cast<std::size_t>(step.estimatedRows) << " cost "
+            << std::fixed << std::setprecision(1) << std::setw(9) << step.cost / 1e3 << " us";
+        if (step.ms > 0) {
+            out << "  -> " << std::setw(8) << step.rows << " rows " << std::setw(9) << step.ms * 1e3 << " us";
+        }
+        out << "\n";
+        for (int input : step.inputs) {
+            explainStep(out, input, depth + 1);
+        }
+    }
+};
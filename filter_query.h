@@ -0,0 +1,419 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "song.h"
+#include "text_normalize.h"
+
+// A song filter such as "mood:happy energy>=7 year<2000 artist~queen":
+//
+//   mood:NAME                      songs tagged with a mood
+//   energy, danceability, year     =N, :N, :LO-HI, <N, <=N, >N, >=N, !=N
+//   title~TEXT, artist~TEXT        normalised field contains TEXT (quote
+//                                  texts with spaces: artist~"daft punk")
+//
+// Terms next to each other must all hold; OR, NOT (or a leading "-") and
+// parentheses combine them further, with NOT binding tightest and OR loosest.
+// Year terms, year!=N included, never match songs of unknown year.
+class FilterQuery {
+public:
+    enum class Field : std::uint8_t { Mood, Energy, Danceability, Year, Title, Artist };
+    enum class Op : std::uint8_t { Term, Not, And, Or };
+
+    struct Node {
+        Op op;
+        Field field;
+        // Inclusive bounds for numeric fields.
+        int lo, hi;
+        // Mood name, or normalised text for title and artist.
+        std::string text;
+        std::vector<int> operands;
+    };
+
+    // Returns nullopt (and a message in `error`) for malformed filters or moods
+    // not in `knownMoods`.
+    static std::optional<FilterQuery> parse(const std::string& text, const std::vector<std::string>& knownMoods,
+                                            std::string* error = nullptr) {
+        FilterQuery query;
+        std::string tokenError;
+        std::vector<Token> tokens = tokenize(text, tokenError);
+        Parser parser{query, tokens, 0, knownMoods, tokenError};
+        std::optional<int> root = tokenError.empty() ? parser.parseOr() : std::nullopt;
+        if (root && parser.pos < tokens.size()) {
+            parser.error = "unexpected '" + tokens[parser.pos].text + "'";
+            root.reset();
+        }
+        if (!root) {
+            if (error) {
+                *error = parser.error;
+            }
+            return std::nullopt;
+        }
+        query.root = *root;
+        return query;
+    }
+
+    // True if `text` uses filter syntax at all, as opposed to being a plain
+    // title or artist search.
+    static bool looksLikeFilter(const std::string& text) { return text.find_first_of(":~<>=") != std::string::npos; }
+
+    const Node& node(int index) const { return nodes[index]; }
+    int rootNode() const { return root; }
+    std::size_t nodeCount() const { return nodes.size(); }
+
+    std::string toString() const { return format(root); }
+    std::string toString(int index) const { return format(index); }
+
+    static const char* fieldName(Field field) {
+        switch (field) {
+            case Field::Mood:
+                return "mood";
+            case Field::Energy:
+                return "energy";
+            case Field::Danceability:
+                return "danceability";
+            case Field::Year:
+                return "year";
+            case Field::Title:
+                return "title";
+            case Field::Artist:
+                return "artist";
+        }
+        return "";
+    }
+
+private:
+    static constexpr int kMin = std::numeric_limits<int>::min();
+    static constexpr int kMax = std::numeric_limits<int>::max();
+    // Lowest year a year term covers, which leaves out kUnknownYear.
+    static constexpr int kKnownYear = kUnknownYear + 1;
+
+    struct Token {
+        // "(", ")", "&", "|", "!" (NOT), an operator (":", "=", "!=", "<", "<=", ">",
+        // ">=", "~") or a word.
+        std::string text;
+        bool word;
+    };
+
+    std::vector<Node> nodes;
+    int root = -1;
+
+    static std::vector<Token> tokenize(const std::string& text, std::string& error) {
+        std::vector<Token> tokens;
+        auto isOperator = [](char c) { return c == ':' || c == '=' || c == '<' || c == '>' || c == '~' || c == '!'; };
+        std::size_t i = 0;
+        while (i < text.size()) {
+            const char c = text[i];
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                ++i;
+            } else if (c == '(' || c == ')') {
+                tokens.push_back({std::string(1, c), false});
+                ++i;
+            } else if (c == '-' &&
+                       (i == 0 || text[i - 1] == '(' || std::isspace(static_cast<unsigned char>(text[i - 1])))) {
+                tokens.push_back({"!", false});
+                ++i;
+            } else if (isOperator(c)) {
+                const bool twoChars = i + 1 < text.size() && text[i + 1] == '=' && c != '=' && c != ':' && c != '~';
+                std::string op = text.substr(i, twoChars ? 2 : 1);
+                tokens.push_back({op, false});
+                i += op.size();
+            } else if (c == '"') {
+                const std::size_t end = text.find('"', i + 1);
+                if (end == std::string::npos) {
+                    error = "missing closing quote";
+                    return tokens;
+                }
+                tokens.push_back({text.substr(i + 1, end - i - 1), true});
+                i = end + 1;
+            } else {
+                std::size_t end = i;
+                while (end < text.size() && !std::isspace(static_cast<unsigned char>(text[end])) &&
+                       text[end] != '(' && text[end] != ')' && !isOperator(text[end]) && text[end] != '"') {
+                    ++end;
+                }
+                std::string word = text.substr(i, end - i);
+                std::string lower = word;
+                std::transform(lower.begin(), lower.end(), lower.begin(),
+                               [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+                if (lower == "and" || lower == "or" || lower == "not") {
+                    tokens.push_back({lower == "and" ? "&" : lower == "or" ? "|" : "!", false});
+                } else {
+                    tokens.push_back({word, true});
+                }
+                i = end;
+            }
+        }
+        return tokens;
+    }
+
+    struct Parser {
+        FilterQuery& query;
+        const std::vector<Token>& tokens;
+        std::size_t pos;
+        const std::vector<std::string>& knownMoods;
+        std::string error;
+
+        bool accept(const char* symbol) {
+            if (pos < tokens.size() && !tokens[pos].word && tokens[pos].text == symbol) {
+                ++pos;
+                return true;
+            }
+            return false;
+        }
+
+        std::optional<int> parseOr() {
+            std::optional<int> first = parseAnd();
+            if (!first || !accept("|")) {
+                return first;
+            }
+            Node node{Op::Or, Field::Mood, 0, 0, {}, {*first}};
+            do {
+                std::optional<int> next = parseAnd();
+                if (!next) {
+                    return std::nullopt;
+                }
+                node.operands.push_back(*next);
+            } while (accept("|"));
+            return add(std::move(node));
+        }
+
+        // AND is implicit between terms; an explicit AND is allowed too.
+        std::optional<int> parseAnd() {
+            std::optional<int> first = parseUnary();
+            if (!first) {
+                return std::nullopt;
+            }
+            Node node{Op::And, Field::Mood, 0, 0, {}, {*first}};
+            while (pos < tokens.size() &&
+                   (tokens[pos].word || (tokens[pos].text != ")" && tokens[pos].text != "|"))) {
+                accept("&");
+                std::optional<int> next = parseUnary();
+                if (!next) {
+                    return std::nullopt;
+                }
+                node.operands.push_back(*next);
+            }
+            return node.operands.size() == 1 ? *first : add(std::move(node));
+        }
+
+        std::optional<int> parseUnary() {
+            if (accept("!")) {
+                std::optional<int> operand = parseUnary();
+                if (!operand) {
+                    return std::nullopt;
+                }
+                return add({Op::Not, Field::Mood, 0, 0, {}, {*operand}});
+            }
+            if (accept("(")) {
+                std::optional<int> inner = parseOr();
+                if (inner && !accept(")")) {
+                    error = "missing ')'";
+                    return std::nullopt;
+                }
+                return inner;
+            }
+            return parseTerm();
+        }
+
+        std::optional<int> parseTerm() {
+            if (pos == tokens.size() || !tokens[pos].word) {
+                error = pos == tokens.size() ? "expected a filter term" : "unexpected '" + tokens[pos].text + "'";
+                return std::nullopt;
+            }
+            std::string name = tokens[pos].text;
+            std::transform(name.begin(), name.end(), name.begin(),
+                           [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+            std::optional<Field> field = fieldNamed(name);
+            if (!field) {
+                error = "unknown field '" + tokens[pos].text + "'";
+                return std::nullopt;
+            }
+            if (pos + 2 >= tokens.size() || tokens[pos + 1].word || !tokens[pos + 2].word) {
+                error = "expected an operator and a value after '" + name + "'";
+                return std::nullopt;
+            }
+            const std::string op = tokens[pos + 1].text;
+            const std::string value = tokens[pos + 2].text;
+            pos += 3;
+
+            Node node{Op::Term, *field, kMin, kMax, {}, {}};
+            if (*field == Field::Mood) {
+                std::string mood = value;
+                std::transform(mood.begin(), mood.end(), mood.begin(),
+                               [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+                if (op != ":" && op != "=") {
+                    error = "mood takes ':'";
+                    return std::nullopt;
+                }
+                if (std::find(knownMoods.begin(), knownMoods.end(), mood) == knownMoods.end()) {
+                    error = "unknown mood '" + value + "'";
+                    return std::nullopt;
+                }
+                node.text = mood;
+                return add(std::move(node));
+            }
+            if (*field == Field::Title || *field == Field::Artist) {
+                if (op != "~" && op != ":") {
+                    error = name + " takes '~'";
+                    return std::nullopt;
+                }
+                node.text = normalizeText(value);
+                if (node.text.empty()) {
+                    error = "empty " + name + " text";
+                    return std::nullopt;
+                }
+                return add(std::move(node));
+            }
+
+            std::optional<std::pair<int, int>> range = parseRange(value, op == ":" || op == "=");
+            if (!range) {
+                error = "bad " + name + " value '" + value + "'";
+                return std::nullopt;
+            }
+            const auto [lo, hi] = *range;
+            if (*field == Field::Year && op == "!=") {
+                // Known years on either side, rather than NOT year=N.
+                Node below = node, above = node;
+                below.lo = kKnownYear;
+                below.hi = lo - 1;
+                above.lo = std::max(lo + 1, kKnownYear);
+                return add({Op::Or, Field::Mood, 0, 0, {}, {add(std::move(below)), add(std::move(above))}});
+            }
+            if (op == ":" || op == "=") {
+                node.lo = lo;
+                node.hi = hi;
+            } else if (op == "!=") {
+                node.lo = node.hi = lo;
+                const int term = add(std::move(node));
+                return add({Op::Not, Field::Mood, 0, 0, {}, {term}});
+            } else if (op == "<") {
+                node.hi = lo - 1;
+            } else if (op == "<=") {
+                node.hi = lo;
+            } else if (op == ">") {
+                node.lo = lo + 1;
+            } else if (op == ">=") {
+                node.lo = lo;
+            } else {
+                error = name + " does not take '" + op + "'";
+                return std::nullopt;
+            }
+            if (*field == Field::Year) {
+                node.lo = std::max(node.lo, kKnownYear);
+            }
+            return add(std::move(node));
+        }
+
+        // "N", or "LO-HI" if `allowRange`.
+        static std::optional<std::pair<int, int>> parseRange(const std::string& value, bool allowRange) {
+            const std::size_t dash = allowRange ? value.find('-', 1) : std::string::npos;
+            std::optional<int> lo = parseInt(value.substr(0, dash));
+            std::optional<int> hi = dash == std::string::npos ? lo : parseInt(value.substr(dash + 1));
+            if (!lo || !hi || *lo > *hi) {
+                return std::nullopt;
+            }
+            return std::make_pair(*lo, *hi);
+        }
+
+        static std::optional<int> parseInt(const std::string& text) {
+            std::size_t i = text.size() > 1 && text[0] == '-' ? 1 : 0;
+            if (i == text.size() || text.size() - i > 9) {
+                return std::nullopt;
+            }
+            for (std::size_t j = i; j < text.size(); ++j) {
+                if (!std::isdigit(static_cast<unsigned char>(text[j]))) {
+                    return std::nullopt;
+                }
+            }
+            return std::stoi(text);
+        }
+
+        static std::optional<Field> fieldNamed(const std::string& name) {
+            if (name == "mood") {
+                return Field::Mood;
+            }
+            if (name == "energy") {
+                return Field::Energy;
+            }
+            if (name == "danceability" || name == "dance") {
+                return Field::Danceability;
+            }
+            if (name == "year") {
+                return Field::Year;
+            }
+            if (name == "title") {
+                return Field::Title;
+            }
+            if (name == "artist") {
+                return Field::Artist;
+            }
+            return std::nullopt;
+        }
+
+        int add(Node node) {
+            query.nodes.push_back(std::move(node));
+            return static_cast<int>(query.nodes.size()) - 1;
+        }
+    };
+
+    std::string format(int index) const {
+        const Node& node = nodes[index];
+        switch (node.op) {
+            case Op::Term:
+                return formatTerm(node);
+            case Op::Not: {
+                const Op inner = nodes[node.operands[0]].op;
+                const std::string operand = format(node.operands[0]);
+                return "NOT " + (inner == Op::And || inner == Op::Or ? "(" + operand + ")" : operand);
+            }
+            case Op::And:
+            case Op::Or: {
+                std::string text;
+                for (int child : node.operands) {
+                    if (!text.empty()) {
+                        text += node.op == Op::And ? " " : " OR ";
+                    }
+                    // Implicit AND binds tighter than OR, so only OR inside AND
+                    // needs parentheses.
+                    const bool wrap = node.op == Op::And && nodes[child].op == Op::Or;
+                    text += wrap ? "(" + format(child) + ")" : format(child);
+                }
+                return text;
+            }
+        }
+        return "";
+    }
+
+    static std::string formatTerm(const Node& node) {
+        const std::string name = fieldName(node.field);
+        switch (node.field) {
+            case Field::Mood:
+                return "mood:" + node.text;
+            case Field::Title:
+            case Field::Artist:
+                return name + "~" +
+                       (node.text.find(' ') == std::string::npos ? node.text : "\"" + node.text + "\"");
+            default:
+                break;
+        }
+        if (node.lo == node.hi) {
+            return name + "=" + std::to_string(node.lo);
+        }
+        if (node.lo == kMin || (node.field == Field::Year && node.lo == kKnownYear)) {
+            return name + "<=" + std::to_string(node.hi);
+        }
+        if (node.hi == kMax) {
+            return name + ">=" + std::to_string(node.lo);
+        }
+        return name + ":" + std::to_string(node.lo) + "-" + std::to_string(node.hi);
+    }
+};
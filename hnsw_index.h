@@ -0,0 +1,489 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "fast_random.h"
+#include "song.h"
+#include "song_features.h"
+
+// Hierarchical navigable small world graph over a FeatureMatrix for approximate
+// nearest-neighbour search. Building runs on several threads with striped node
+// locks; once built, search() is const and safe to call from many threads.
+struct HnswParams {
+    std::size_t m = 16;
+    std::size_t efConstruction = 100;
+    std::uint64_t seed = 42;
+};
+
+class HnswIndex {
+public:
+    using Params = HnswParams;
+
+    void build(const FeatureMatrix& features, const FeatureWeights& featureWeights,
+               Params buildParams = Params(), std::size_t threadCount = 0) {
+        reset(features, featureWeights, buildParams);
+        const std::size_t n = features.size();
+        grow(n);
+        if (n == 0) {
+            return;
+        }
+
+        insertNode(0, false);
+        if (threadCount == 0) {
+            threadCount = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        }
+        std::atomic<std::size_t> next(1);
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&] {
+                for (std::size_t id = next++; id < n; id = next++) {
+                    insertNode(static_cast<SongId>(id), threadCount > 1);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Adds the matrix rows appended since the last build or insert.
+    void insertNew() {
+        const std::size_t first = levels.size();
+        grow(matrix->size());
+        for (std::size_t id = first; id < levels.size(); ++id) {
+            insertNode(static_cast<SongId>(id), false);
+        }
+    }
+
+    std::size_t size() const { return levels.size(); }
+
+    // Approximate k nearest neighbours, nearest first. Larger `ef` trades latency
+    // for recall.
+    std::vector<Neighbor> search(const float* query, std::size_t k, std::size_t ef) const {
+        std::vector<Neighbor> result;
+        if (maxLevel < 0) {
+            return result;
+        }
+        SongId ep = entryPoint;
+        float epDistance = distance(query, ep);
+        for (int layer = maxLevel; layer > 0; --layer) {
+            greedyStep(query, ep, epDistance, layer, false);
+        }
+        auto found = searchLayer(query, {{epDistance, ep}}, std::max(ef, k), 0, false);
+        for (std::size_t i = 0; i < found.size() && i < k; ++i) {
+            result.push_back({found[i].second, found[i].first});
+        }
+        return result;
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        const std::uint64_t n = levels.size();
+        writePod(file, kMagic);
+        writePod(file, n);
+        writePod(file, static_cast<std::uint64_t>(params.m));
+        writePod(file, static_cast<std::uint64_t>(params.efConstruction));
+        writePod(file, checksum(*matrix, weights));
+        writePod(file, entryPoint);
+        writePod(file, maxLevel);
+        writeVector(file, levels);
+        writeVector(file, counts0);
+        writeVector(file, links0);
+        for (std::size_t id = 0; id < n; ++id) {
+            if (levels[id] > 0) {
+                writeVector(file, upperCounts[id]);
+                writeVector(file, upperLinks[id]);
+            }
+        }
+        return static_cast<bool>(file);
+    }
+
+    // Loads an index saved for exactly this feature matrix and weighting; returns
+    // false (leaving the index empty) if the file is missing or stale.
+    bool load(const std::string& path, const FeatureMatrix& features, const FeatureWeights& featureWeights) {
+        std::ifstream file(path, std::ios::binary);
+        std::uint32_t magic = 0;
+        std::uint64_t n = 0, m = 0, efConstruction = 0, sum = 0;
+        if (!file.is_open() || !readPod(file, magic) || magic != kMagic || !readPod(file, n) ||
+            n != features.size() || !readPod(file, m) || !readPod(file, efConstruction) ||
+            !readPod(file, sum) || sum != checksum(features, featureWeights) || m < 2 || m > 127 ||
+            efConstruction == 0) {
+            return false;
+        }
+        reset(features, featureWeights,
+              Params{static_cast<std::size_t>(m), static_cast<std::size_t>(efConstruction), params.seed});
+        if (!readPod(file, entryPoint) || !readPod(file, maxLevel) || !readVector(file, levels, n) ||
+            !readVector(file, counts0, n) || !readVector(file, links0, n * maxLinks(0))) {
+            reset(features, featureWeights, params);
+            return false;
+        }
+        upperCounts.assign(n, {});
+        upperLinks.assign(n, {});
+        for (std::size_t id = 0; id < n; ++id) {
+            if (levels[id] > 0 &&
+                (!readVector(file, upperCounts[id], levels[id]) ||
+                 !readVector(file, upperLinks[id], levels[id] * params.m))) {
+                reset(features, featureWeights, params);
+                return false;
+            }
+        }
+        if (!consistent()) {
+            reset(features, featureWeights, params);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr std::uint32_t kMagic = 0x314E4847;  // "GHN1"
+    static constexpr std::size_t kLockStripes = 1024;
+
+    using Candidate = std::pair<float, SongId>;
+
+    const FeatureMatrix* matrix = nullptr;
+    FeatureWeights weights = FeatureWeights::defaults();
+    Params params;
+    double levelScale = 0.0;
+
+    std::vector<std::uint8_t> levels;
+    // Layer 0 links live in one flat array, maxLinks(0) slots per node.
+    std::vector<std::uint8_t> counts0;
+    std::vector<SongId> links0;
+    // Upper layers only exist for the few nodes with level > 0.
+    std::vector<std::vector<std::uint8_t>> upperCounts;
+    std::vector<std::vector<SongId>> upperLinks;
+
+    SongId entryPoint = 0;
+    int maxLevel = -1;
+
+    mutable std::array<std::mutex, kLockStripes> nodeLocks;
+    std::mutex entryLock;
+
+    void reset(const FeatureMatrix& features, const FeatureWeights& featureWeights, Params newParams) {
+        matrix = &features;
+        weights = featureWeights;
+        params = newParams;
+        params.m = std::clamp<std::size_t>(params.m, 2, 127);
+        levelScale = 1.0 / std::log(static_cast<double>(params.m));
+        levels.clear();
+        counts0.clear();
+        links0.clear();
+        upperCounts.clear();
+        upperLinks.clear();
+        entryPoint = 0;
+        maxLevel = -1;
+    }
+
+    std::size_t maxLinks(int layer) const { return layer == 0 ? params.m * 2 : params.m; }
+
+    // True if a loaded graph only refers to nodes that exist: the entry point
+    // is on the top level, no node is above it, and every link count fits its
+    // slots and every link names a node.
+    bool consistent() const {
+        const std::size_t n = levels.size();
+        if (n == 0) {
+            return maxLevel == -1;
+        }
+        if (entryPoint >= n || maxLevel < 0 || maxLevel > 16 || levels[entryPoint] != maxLevel) {
+            return false;
+        }
+        auto linksValid = [&](const SongId* slots, std::size_t count, std::size_t capacity) {
+            return count <= capacity &&
+                   std::all_of(slots, slots + count, [&](SongId link) { return link < n; });
+        };
+        for (std::size_t id = 0; id < n; ++id) {
+            if (levels[id] > maxLevel || !linksValid(&links0[id * maxLinks(0)], counts0[id], maxLinks(0))) {
+                return false;
+            }
+            for (int layer = 1; layer <= levels[id]; ++layer) {
+                if (!linksValid(&upperLinks[id][(layer - 1) * params.m], upperCounts[id][layer - 1], params.m)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Levels come from a per-node generator so the graph shape does not depend on
+    // thread scheduling.
+    std::uint8_t randomLevel(SongId id) const {
+        FastRandom rng(params.seed ^ (static_cast<std::uint64_t>(id) * 0x9E3779B97F4A7C15ULL));
+        const double u = (rng() >> 11) * (1.0 / 9007199254740992.0);
+        const double level = -std::log(1.0 - u) * levelScale;
+        return static_cast<std::uint8_t>(std::min(level, 16.0));
+    }
+
+    void grow(std::size_t n) {
+        const std::size_t first = levels.size();
+        levels.resize(n);
+        counts0.resize(n, 0);
+        links0.resize(n * maxLinks(0));
+        upperCounts.resize(n);
+        upperLinks.resize(n);
+        for (std::size_t id = first; id < n; ++id) {
+            levels[id] = randomLevel(static_cast<SongId>(id));
+            upperCounts[id].assign(levels[id], 0);
+            upperLinks[id].assign(levels[id] * params.m, 0);
+        }
+    }
+
+    float distance(const float* query, SongId id) const {
+        return weightedDistance(matrix->row(id), query, weights.weights.data());
+    }
+
+    float distance(SongId a, SongId b) const {
+        return weightedDistance(matrix->row(a), matrix->row(b), weights.weights.data());
+    }
+
+    std::uint8_t& linkCount(SongId id, int layer) {
+        return layer == 0 ? counts0[id] : upperCounts[id][layer - 1];
+    }
+
+    std::uint8_t linkCount(SongId id, int layer) const {
+        return layer == 0 ? counts0[id] : upperCounts[id][layer - 1];
+    }
+
+    SongId* linkSlots(SongId id, int layer) {
+        return layer == 0 ? &links0[static_cast<std::size_t>(id) * maxLinks(0)]
+                          : &upperLinks[id][(layer - 1) * params.m];
+    }
+
+    const SongId* linkSlots(SongId id, int layer) const {
+        return layer == 0 ? &links0[static_cast<std::size_t>(id) * maxLinks(0)]
+                          : &upperLinks[id][(layer - 1) * params.m];
+    }
+
+    void copyLinks(SongId id, int layer, std::vector<SongId>& out, bool lockNodes) const {
+        std::unique_lock<std::mutex> lock;
+        if (lockNodes) {
+            lock = std::unique_lock<std::mutex>(nodeLocks[id % kLockStripes]);
+        }
+        const std::size_t count = linkCount(id, layer);
+        const SongId* slots = linkSlots(id, layer);
+        out.assign(slots, slots + count);
+    }
+
+    void greedyStep(const float* query, SongId& ep, float& epDistance, int layer, bool lockNodes) const {
+        std::vector<SongId> links;
+        for (bool changed = true; changed;) {
+            changed = false;
+            copyLinks(ep, layer, links, lockNodes);
+            for (SongId next : links) {
+                float d = distance(query, next);
+                if (d < epDistance) {
+                    epDistance = d;
+                    ep = next;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Beam search within one layer; returns up to `ef` candidates, nearest first.
+    std::vector<Candidate> searchLayer(const float* query, const std::vector<Candidate>& entries,
+                                       std::size_t ef, int layer, bool lockNodes) const {
+        thread_local std::vector<std::uint32_t> visitedMarks;
+        thread_local std::uint32_t visitedEpoch = 0;
+        if (visitedMarks.size() < levels.size()) {
+            visitedMarks.assign(levels.size(), 0);
+            visitedEpoch = 0;
+        }
+        if (++visitedEpoch == 0) {
+            std::fill(visitedMarks.begin(), visitedMarks.end(), 0);
+            visitedEpoch = 1;
+        }
+
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+        std::priority_queue<Candidate> best;
+        for (const auto& entry : entries) {
+            visitedMarks[entry.second] = visitedEpoch;
+            frontier.push(entry);
+            best.push(entry);
+        }
+        while (best.size() > ef) {
+            best.pop();
+        }
+
+        std::vector<SongId> links;
+        while (!frontier.empty()) {
+            Candidate current = frontier.top();
+            if (current.first > best.top().first && best.size() >= ef) {
+                break;
+            }
+            frontier.pop();
+            copyLinks(current.second, layer, links, lockNodes);
+            for (SongId next : links) {
+                if (visitedMarks[next] == visitedEpoch) {
+                    continue;
+                }
+                visitedMarks[next] = visitedEpoch;
+                float d = distance(query, next);
+                if (best.size() < ef || d < best.top().first) {
+                    frontier.emplace(d, next);
+                    best.emplace(d, next);
+                    if (best.size() > ef) {
+                        best.pop();
+                    }
+                }
+            }
+        }
+
+        std::vector<Candidate> result(best.size());
+        for (std::size_t i = result.size(); i-- > 0;) {
+            result[i] = best.top();
+            best.pop();
+        }
+        return result;
+    }
+
+    // Neighbour selection heuristic: prefer candidates that are closer to the new
+    // node than to any already selected neighbour, then top up with the rest.
+    std::vector<SongId> selectNeighbors(const std::vector<Candidate>& sorted, std::size_t limit) const {
+        std::vector<SongId> selected;
+        std::vector<SongId> skipped;
+        for (const auto& candidate : sorted) {
+            if (selected.size() >= limit) {
+                break;
+            }
+            bool diverse = true;
+            for (SongId chosen : selected) {
+                if (distance(candidate.second, chosen) < candidate.first) {
+                    diverse = false;
+                    break;
+                }
+            }
+            (diverse ? selected : skipped).push_back(candidate.second);
+        }
+        for (std::size_t i = 0; i < skipped.size() && selected.size() < limit; ++i) {
+            selected.push_back(skipped[i]);
+        }
+        return selected;
+    }
+
+    void addLink(SongId from, SongId to, int layer, bool lockNodes) {
+        std::unique_lock<std::mutex> lock;
+        if (lockNodes) {
+            lock = std::unique_lock<std::mutex>(nodeLocks[from % kLockStripes]);
+        }
+        std::uint8_t& count = linkCount(from, layer);
+        SongId* slots = linkSlots(from, layer);
+        const std::size_t limit = maxLinks(layer);
+        if (count < limit) {
+            slots[count++] = to;
+            return;
+        }
+        std::vector<Candidate> candidates;
+        candidates.reserve(limit + 1);
+        candidates.emplace_back(distance(from, to), to);
+        for (std::size_t i = 0; i < count; ++i) {
+            candidates.emplace_back(distance(from, slots[i]), slots[i]);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        std::vector<SongId> kept = selectNeighbors(candidates, limit);
+        std::copy(kept.begin(), kept.end(), slots);
+        count = static_cast<std::uint8_t>(kept.size());
+    }
+
+    void insertNode(SongId id, bool lockNodes) {
+        const int level = levels[id];
+        SongId ep;
+        int top;
+        {
+            std::lock_guard<std::mutex> lock(entryLock);
+            if (maxLevel < 0) {
+                entryPoint = id;
+                maxLevel = level;
+                return;
+            }
+            ep = entryPoint;
+            top = maxLevel;
+        }
+
+        const float* query = matrix->row(id);
+        float epDistance = distance(query, ep);
+        for (int layer = top; layer > level; --layer) {
+            greedyStep(query, ep, epDistance, layer, lockNodes);
+        }
+
+        std::vector<Candidate> entries{{epDistance, ep}};
+        for (int layer = std::min(top, level); layer >= 0; --layer) {
+            std::vector<Candidate> found = searchLayer(query, entries, params.efConstruction, layer, lockNodes);
+            std::vector<SongId> neighbors = selectNeighbors(found, params.m);
+            {
+                std::unique_lock<std::mutex> lock;
+                if (lockNodes) {
+                    lock = std::unique_lock<std::mutex>(nodeLocks[id % kLockStripes]);
+                }
+                std::copy(neighbors.begin(), neighbors.end(), linkSlots(id, layer));
+                linkCount(id, layer) = static_cast<std::uint8_t>(neighbors.size());
+            }
+            for (SongId neighbor : neighbors) {
+                addLink(neighbor, id, layer, lockNodes);
+            }
+            entries = std::move(found);
+        }
+
+        if (level > top) {
+            std::lock_guard<std::mutex> lock(entryLock);
+            if (level > maxLevel) {
+                maxLevel = level;
+                entryPoint = id;
+            }
+        }
+    }
+
+    // Identifies the features an index was built from, so a saved index is only
+    // reused for the same catalog.
+    static std::uint64_t checksum(const FeatureMatrix& features, const FeatureWeights& featureWeights) {
+        std::uint64_t h = 0xCBF29CE484222325ULL;
+        auto mix = [&h](const float* values, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                std::uint32_t bits;
+                std::memcpy(&bits, &values[i], sizeof(bits));
+                h = (h ^ bits) * 0x100000001B3ULL;
+            }
+        };
+        mix(featureWeights.weights.data(), kFeatureDims);
+        if (features.size() > 0) {
+            mix(features.row(0), features.size() * kFeatureDims);
+        }
+        return h;
+    }
+
+    template <typename T>
+    static void writePod(std::ofstream& file, const T& value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool readPod(std::ifstream& file, T& value) {
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    template <typename T>
+    static void writeVector(std::ofstream& file, const std::vector<T>& values) {
+        file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+    template <typename T>
+    static bool readVector(std::ifstream& file, std::vector<T>& values, std::size_t count) {
+        values.resize(count);
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(values.data()), count * sizeof(T)));
+    }
+};
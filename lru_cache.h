@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// Fixed-capacity least-recently-used cache with hit/miss/eviction counters.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+    };
+
+    explicit LruCache(std::size_t capacity) : capacity(capacity == 0 ? 1 : capacity) {}
+
+    // Returns the cached value and marks it most recently used, or nullptr.
+    const Value* find(const Key& key) {
+        auto it = index.find(key);
+        if (it == index.end()) {
+            ++counters.misses;
+            return nullptr;
+        }
+        ++counters.hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return &it->second->second;
+    }
+
+    const Value& insert(const Key& key, Value value) {
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = std::move(value);
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+        if (entries.size() == capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+            ++counters.evictions;
+        }
+        entries.emplace_front(key, std::move(value));
+        index.emplace(key, entries.begin());
+        return entries.front().second;
+    }
+
+    void clear() {
+        entries.clear();
+        index.clear();
+    }
+
+    std::size_t size() const { return entries.size(); }
+    const Stats& stats() const { return counters; }
+
+private:
+    using Entry = std::pair<Key, Value>;
+
+    std::size_t capacity;
+    std::list<Entry> entries;
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+    Stats counters;
+};
@@ -2,6 +2,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <random>
 #include <algorithm>
 #include <chrono>
@@ -10,6 +11,46 @@
 #include <fstream>
 #include <ctime>
 #include <sstream>
+#include <optional>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "attribute_index.h"
+#include "audio_analysis.h"
+#include "audio_fingerprint.h"
+#include "catalog_file.h"
+#include "completion_trie.h"
+#include "duration_playlist.h"
+#include "energy_arc.h"
+#include "fast_random.h"
+#include "filter_plan.h"
+#include "filter_query.h"
+#include "hnsw_index.h"
+#include "mood_index.h"
+#include "mood_clustering.h"
+#include "mood_history.h"
+#include "mood_transitions.h"
+#include "moods.h"
+#include "playlist_cache.h"
+#include "quantized_features.h"
+#include "radio_stream.h"
+#include "ranking_policy.h"
+#include "score_program.h"
+#include "song.h"
+#include "song_features.h"
+#include "transition_sequence.h"
+#include "trigram_index.h"
 
 // ANSI color codes for console output
 #define RESET   "\033[0m"
@@ -20,54 +61,200 @@
 #define MAGENTA "\033[35m"
 #define CYAN    "\033[36m"
 
-class Song {
-public:
-    std::string title;
-    std::string artist;
-    std::vector<std::string> moods;
-    int energy;
-    int danceability;
-    int year;
-    int playCount;
-
-    Song() : title(""), artist(""), energy(0), danceability(0), year(0), playCount(0) {}
-
-    Song(std::string t, std::string a, std::vector<std::string> m, int e, int d, int y)
-        : title(t), artist(a), moods(m), energy(e), danceability(d), year(y), playCount(0) {}
-
-    bool operator==(const Song& other) const {
-        return title == other.title && artist == other.artist;
-    }
-};
-
 class MoodPlaylistGenerator {
 private:
+    static constexpr const char* kCatalogPath = "song_catalog.bin";
+    static constexpr const char* kSongIndexPath = "song_catalog.hnsw";
+
     std::vector<Song> songDatabase;
     std::vector<std::string> moodOptions;
     std::map<std::string, std::vector<Song>> userFavorites;
     int userHappinessLevel;
     std::map<std::string, int> moodCounts;
+    MoodAggregates moodAggregates;
+    MoodHistory moodHistory;
+    std::optional<std::uint64_t> playlistSeed;
+    std::uint64_t catalogVersion = 0;
+    std::map<std::string, std::uint64_t> favoritesVersions;
+    PlaylistCache playlistCache{64};
+    MoodIndex moodIndex;
+    AttributeIndex attributeIndex;
+    SongColumns songColumns;
+    // Ranks mood candidates when set; otherwise the built-in ranking below
+    // does.
+    std::optional<ScoreProgram> scoreProgram;
+    RankingScore rankingScore = RankingScore::Energy;
+    RankingTieBreak rankingTieBreak = RankingTieBreak::Random;
+    // Ramp plays the ranked songs in rank order; Arc shapes the playlist to a
+    // warm-up, peak and cool-down in energy; Mix orders it for DJ-style
+    // transitions in key, tempo and energy.
+    enum class Sequencing { Ramp, Arc, Mix };
+    Sequencing sequencing = Sequencing::Ramp;
+    BeamSearchOptions mixSearch{8, 4, 50.0};
+    // When set, playlists are filled to this length instead of a song count.
+    std::optional<DurationTarget> durationTarget;
+    DurationPlanStats lastTimedPlan;
+    const int currentYear = yearNow();
+    FeatureMatrix songFeatureMatrix;
+    // songFeatureMatrix as int8, for scans over many songs.
+    QuantizedFeatureMatrix songQuantizedFeatures;
+    HnswIndex songIndex;
+    TrigramIndex songSearchIndex;
+    // Parallel to songDatabase; empty for songs without analysed audio.
+    std::vector<AudioFingerprint> songFingerprints;
+    // Song::matchKey() to the first song with that key.
+    std::unordered_map<std::uint64_t, SongId> songKeys;
+    // Order-dependent mix of every song's matchKey(), to tell whether a stored
+    // completion trie belongs to this catalog.
+    std::uint64_t catalogChecksum = 0;
+    // The catalog file as loaded; songCompletions may point into it.
+    MappedCatalog catalogImage;
+    CompletionTrie songCompletions;
+    // Guards the catalog, favorites and playlist cache against the prefetch thread.
+    std::mutex stateMutex;
+
+    // A playlist the prefetch thread builds ahead of the request. Fields past
+    // catalogVersion are set by the thread, under prefetchMutex.
+    struct PrefetchedPlaylist {
+        std::string mood;
+        int size;
+        std::uint64_t favoritesVersion;
+        std::uint64_t catalogVersion;
+        bool started = false;
+        bool ready = false;
+        std::vector<Song> playlist;
+        DurationPlanStats planStats;
+        std::chrono::microseconds elapsed{0};
+    };
+
+    MoodTransitions moodTransitions;
+    // Predictions for the next request, by mood. One long-lived thread works
+    // through prefetchQueue, so its FastRandom::threadLocal() is seeded once;
+    // predictions nobody asks for are dropped from the queue, or left to
+    // finish, without anyone waiting on them.
+    std::map<std::string, std::shared_ptr<PrefetchedPlaylist>> prefetchedPlaylists;
+    std::deque<std::shared_ptr<PrefetchedPlaylist>> prefetchQueue;
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchChanged;
+    bool stopPrefetch = false;
+    std::thread prefetchThread;
+    std::uint64_t prefetchedRequests = 0;
+    std::uint64_t prefetchHits = 0;
+    std::chrono::microseconds prefetchTimeSaved{0};
 
     void initializeSongDatabase() {
-        songDatabase = {
-            Song("Happy", "Pharrell Williams", {"happy", "energetic"}, 8, 7, 2013),
-            Song("Someone Like You", "Adele", {"sad", "emotional"}, 4, 2, 2011),
-            Song("Thunderstruck", "AC/DC", {"energetic", "powerful"}, 9, 6, 1990),
-            Song("Relaxing Piano", "John Smith", {"calm", "relaxed"}, 2, 1, 2020),
-            Song("Party Rock Anthem", "LMFAO", {"party", "energetic"}, 9, 9, 2011),
-            Song("The Scientist", "Coldplay", {"melancholy", "thoughtful"}, 3, 2, 2002),
-            Song("Don't Stop Believin'", "Journey", {"motivational", "uplifting"}, 7, 6, 1981),
-            Song("Bohemian Rhapsody", "Queen", {"epic", "emotional"}, 6, 4, 1975),
-            Song("Smooth Jazz Compilation", "Various Artists", {"relaxed", "calm"}, 3, 2, 2019),
-            Song("Eye of the Tiger", "Survivor", {"motivational", "energetic"}, 8, 7, 1982),
-            Song("Imagine", "John Lennon", {"thoughtful", "calm"}, 5, 3, 1971),
-            Song("Dancing Queen", "ABBA", {"happy", "party"}, 7, 8, 1976),
-            Song("Stairway to Heaven", "Led Zeppelin", {"epic", "thoughtful"}, 6, 4, 1971),
-            Song("Smells Like Teen Spirit", "Nirvana", {"energetic", "powerful"}, 8, 6, 1991),
-            Song("Wonderwall", "Oasis", {"melancholy", "uplifting"}, 5, 4, 1995)
-        };
+        if (!loadCatalog()) {
+            songDatabase = {
+                Song("Happy", "Pharrell Williams", {"happy", "energetic"}, 8, 7, 2013, 233),
+                Song("Someone Like You", "Adele", {"sad", "emotional"}, 4, 2, 2011, 285),
+                Song("Thunderstruck", "AC/DC", {"energetic", "powerful"}, 9, 6, 1990, 292),
+                Song("Relaxing Piano", "John Smith", {"calm", "relaxed"}, 2, 1, 2020),
+                Song("Party Rock Anthem", "LMFAO", {"party", "energetic"}, 9, 9, 2011, 262),
+                Song("The Scientist", "Coldplay", {"melancholy", "thoughtful"}, 3, 2, 2002, 309),
+                Song("Don't Stop Believin'", "Journey", {"motivational", "uplifting"}, 7, 6, 1981, 250),
+                Song("Bohemian Rhapsody", "Queen", {"epic", "emotional"}, 6, 4, 1975, 354),
+                Song("Smooth Jazz Compilation", "Various Artists", {"relaxed", "calm"}, 3, 2, 2019),
+                Song("Eye of the Tiger", "Survivor", {"motivational", "energetic"}, 8, 7, 1982, 245),
+                Song("Imagine", "John Lennon", {"thoughtful", "calm"}, 5, 3, 1971, 183),
+                Song("Dancing Queen", "ABBA", {"happy", "party"}, 7, 8, 1976, 231),
+                Song("Stairway to Heaven", "Led Zeppelin", {"epic", "thoughtful"}, 6, 4, 1971, 482),
+                Song("Smells Like Teen Spirit", "Nirvana", {"energetic", "powerful"}, 8, 6, 1991, 301),
+                Song("Wonderwall", "Oasis", {"melancholy", "uplifting"}, 5, 4, 1995, 258)
+            };
+        }
 
-        moodOptions = {"happy", "sad", "energetic", "calm", "party", "melancholy", "motivational", "epic", "relaxed", "thoughtful"};
+        moodOptions.assign(kMoodNames.begin(), kMoodNames.end());
+        rebuildCatalogIndexes();
+        // Store a freshly built completion trie so the next start maps it.
+        if (!catalogImage.contains(songCompletions.bytes())) {
+            saveCatalog();
+        }
+    }
+
+    static std::uint64_t mixChecksum(std::uint64_t checksum, std::uint64_t key) {
+        return (checksum ^ key) * 0x100000001B3ull;
+    }
+
+    // Rebuilds everything derived from songDatabase after it was replaced.
+    void rebuildCatalogIndexes() {
+        ++catalogVersion;
+        playlistCache.clear();
+        songFingerprints.resize(songDatabase.size());
+        songKeys.clear();
+        songKeys.reserve(songDatabase.size());
+        catalogChecksum = 0;
+        for (std::size_t i = 0; i < songDatabase.size(); ++i) {
+            const std::uint64_t key = songDatabase[i].matchKey();
+            songKeys.emplace(key, static_cast<SongId>(i));
+            catalogChecksum = mixChecksum(catalogChecksum, key);
+        }
+        if (!songCompletions.matches(songDatabase.size(), catalogChecksum)) {
+            songCompletions.assign(CompletionTrie::build(songDatabase, catalogChecksum));
+        }
+        moodIndex.rebuild(moodOptions, songDatabase);
+        attributeIndex.rebuild(songDatabase);
+        songColumns.rebuild(songDatabase);
+        songSearchIndex.build(songDatabase);
+        songFeatureMatrix = FeatureMatrix::fromSongs(songDatabase);
+        autoTagUntaggedSongs();
+        songQuantizedFeatures = QuantizedFeatureMatrix::fromMatrix(songFeatureMatrix);
+        if (!songIndex.load(kSongIndexPath, songFeatureMatrix, FeatureWeights::defaults())) {
+            songIndex.build(songFeatureMatrix, FeatureWeights::defaults());
+            songIndex.save(kSongIndexPath);
+        }
+    }
+
+    bool loadCatalog() {
+        if (!catalogImage.open(kCatalogPath)) {
+            return false;
+        }
+        auto songs = catalogImage.section("SONG");
+        if (!songs || !decodeSongs(*songs, songDatabase)) {
+            return false;
+        }
+        if (auto tempoAndKey = catalogImage.section("TKEY")) {
+            decodeTempoAndKey(*tempoAndKey, songDatabase);
+        }
+        if (auto durations = catalogImage.section("DURS")) {
+            decodeDurations(*durations, songDatabase);
+        }
+        if (auto fingerprints = catalogImage.section("FPRT")) {
+            decodeFingerprints(*fingerprints, songDatabase.size(), songFingerprints);
+        }
+        // Used in place; rebuildCatalogIndexes() replaces it if it is stale.
+        if (auto completions = catalogImage.section("ACMP")) {
+            songCompletions.attach(*completions);
+        }
+        return true;
+    }
+
+    bool saveCatalog() const {
+        CatalogFile catalog;
+        catalog.setSection("SONG", encodeSongs(songDatabase));
+        catalog.setSection("TKEY", encodeTempoAndKey(songDatabase));
+        catalog.setSection("DURS", encodeDurations(songDatabase));
+        catalog.setSection("FPRT", encodeFingerprints(songFingerprints));
+        catalog.setSection("ACMP", std::string(songCompletions.bytes()));
+        return catalog.write(kCatalogPath);
+    }
+
+    // Gives songs without moods the moods of their nearest mood clusters and adds
+    // them to the mood index. Returns the number of songs tagged.
+    std::size_t autoTagUntaggedSongs() {
+        std::vector<MoodAssignment> assignments = MoodClustering().run(songFeatureMatrix);
+        for (const auto& assignment : assignments) {
+            Song& song = songDatabase[assignment.id];
+            for (MoodId mood : assignment.moods) {
+                song.moods.push_back(kMoodNames[mood]);
+            }
+            moodIndex.addSong(assignment.id, song);
+            FeatureVector features = songFeatures(song);
+            std::copy(features.begin(), features.end(), songFeatureMatrix.row(assignment.id));
+        }
+        if (!assignments.empty()) {
+            ++catalogVersion;
+        }
+        return assignments.size();
     }
 
     void displayHeader(const std::string& title) {
@@ -84,67 +271,720 @@ private:
         std::cout << std::endl;
     }
 
+    void recordMood(const std::string& mood) {
+        moodCounts[mood]++;
+        if (auto id = moodIdOf(mood)) {
+            moodAggregates.record(*id);
+            moodHistory.record(static_cast<std::uint64_t>(std::time(nullptr)), *id);
+            moodTransitions.record(*id);
+        }
+    }
+
     std::string getUserMood() {
         std::cout << CYAN << "How are you feeling today? Choose a mood:\n" << RESET;
         for (size_t i = 0; i < moodOptions.size(); ++i) {
             std::cout << i + 1 << ". " << moodOptions[i] << "\n";
         }
 
-        int choice;
+        std::cout << "Or combine moods, e.g. \"energetic AND happy AND NOT party\" or \"calm OR relaxed\".\n";
+
+        std::string input;
         while (true) {
-            std::cout << YELLOW << "Enter your choice (1-" << moodOptions.size() << "): " << RESET;
-            std::cin >> choice;
-            if (choice > 0 && choice <= static_cast<int>(moodOptions.size())) {
-                moodCounts[moodOptions[choice - 1]]++;
-                return moodOptions[choice - 1];
+            std::cout << YELLOW << "Enter your choice (1-" << moodOptions.size() << ") or a mood query: " << RESET;
+            std::getline(std::cin >> std::ws, input);
+            if (!input.empty() && input.size() < 4 &&
+                std::all_of(input.begin(), input.end(), [](unsigned char c) { return std::isdigit(c); })) {
+                int choice = std::stoi(input);
+                if (choice > 0 && choice <= static_cast<int>(moodOptions.size())) {
+                    recordMood(moodOptions[choice - 1]);
+                    return moodOptions[choice - 1];
+                }
+                std::cout << RED << "Invalid choice. Please try again.\n" << RESET;
+                continue;
+            }
+            std::string error;
+            if (auto query = MoodQuery::parse(input, moodOptions, &error)) {
+                // One choice, so one event: the query's primary mood counts,
+                // and its other moods are not a transition away from it.
+                const std::string mood = query->toString();
+                const std::string primary = primaryMood(mood);
+                if (!primary.empty()) {
+                    recordMood(primary);
+                }
+                return mood;
+            }
+            std::cout << RED << "Invalid mood query: " << error << ". Please try again.\n" << RESET;
+        }
+    }
+
+    // The single mood standing for `mood`, which is a mood name or a mood
+    // query: the query's first mood without a NOT, or for queries like
+    // "NOT sad" the mood most of its songs are tagged with. Empty if no song
+    // matches. History, favorites, prefetching and recommendations are all
+    // kept per single mood.
+    std::string primaryMood(const std::string& mood) {
+        if (std::find(moodOptions.begin(), moodOptions.end(), mood) != moodOptions.end()) {
+            return mood;
+        }
+        auto query = MoodQuery::parse(mood, moodOptions);
+        if (!query) {
+            return "";
+        }
+        const auto positive = query->positiveMoods();
+        if (!positive.empty()) {
+            return positive.front();
+        }
+        std::lock_guard<std::mutex> lock(stateMutex);
+        const RoaringBitmap matching = moodIndex.evaluate(*query);
+        std::string primary;
+        std::size_t most = 0;
+        for (const auto& option : moodOptions) {
+            const std::size_t count = (matching & moodIndex.bitmapFor(option)).cardinality();
+            if (count > most) {
+                primary = option;
+                most = count;
             }
-            std::cout << RED << "Invalid choice. Please try again.\n" << RESET;
         }
+        return primary;
     }
 
-    std::vector<Song> generatePlaylist(const std::string& mood, int playlistSize) {
-        std::vector<Song> matchingSongs;
-        for (const auto& song : songDatabase) {
-            if (std::find(song.moods.begin(), song.moods.end(), mood) != song.moods.end()) {
-                matchingSongs.push_back(song);
+    // The mood to file `song` under when it is picked from a playlist for
+    // `mood`: one of the query's moods the song is tagged with, else one of
+    // the song's own moods, else the primary mood.
+    std::string favoriteMoodFor(const Song& song, const std::string& mood) {
+        if (std::find(moodOptions.begin(), moodOptions.end(), mood) != moodOptions.end()) {
+            return mood;
+        }
+        if (auto query = MoodQuery::parse(mood, moodOptions)) {
+            const auto positive = query->positiveMoods();
+            for (const auto& candidate : positive) {
+                if (std::find(song.moods.begin(), song.moods.end(), candidate) != song.moods.end()) {
+                    return candidate;
+                }
+            }
+            if (positive.empty() && !song.moods.empty()) {
+                return song.moods.front();
             }
         }
+        return primaryMood(mood);
+    }
+
+    // Changes whenever favorites that candidateBuckets(mood) merges change: a
+    // mood's own list, or for a query any list. Caller must hold stateMutex.
+    std::uint64_t favoritesVersionOf(const std::string& mood) {
+        if (std::find(moodOptions.begin(), moodOptions.end(), mood) != moodOptions.end()) {
+            return favoritesVersions[mood];
+        }
+        std::uint64_t version = 0;
+        for (const auto& pair : favoritesVersions) {
+            version += pair.second;
+        }
+        return version;
+    }
+
+    // Looks a song up by normalised title and artist. Caller must hold
+    // stateMutex (or be the constructor).
+    std::optional<SongId> findSong(const std::string& title, const std::string& artist) const {
+        auto it = songKeys.find(songKey(title, artist));
+        if (it == songKeys.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    // Caller must hold stateMutex.
+    std::shared_ptr<const EnergyBuckets> candidateBuckets(const std::string& mood) {
+        PlaylistCacheKey key{mood, favoritesVersionOf(mood), catalogVersion};
+        if (const auto* cached = playlistCache.find(key)) {
+            return *cached;
+        }
+
+        EnergyBuckets merged = moodIndex.bucketsFor(mood, songDatabase);
 
         // Add user favorites that match the mood
-        for (const auto& favorite : userFavorites[mood]) {
-            if (std::find(matchingSongs.begin(), matchingSongs.end(), favorite) == matchingSongs.end()) {
-                matchingSongs.push_back(favorite);
+        auto favorites = userFavorites.find(mood);
+        if (favorites != userFavorites.end()) {
+            for (const auto& favorite : favorites->second) {
+                if (auto id = findSong(favorite.title, favorite.artist)) {
+                    merged.insert(*id, songDatabase[*id].energy);
+                }
+            }
+        } else if (auto query = MoodQuery::parse(mood, moodOptions)) {
+            // A favorite counts as tagged with the mood it was saved under, so
+            // "happy AND NOT party" takes happy favorites that are not party
+            // songs.
+            for (const auto& [favoriteMood, songs] : userFavorites) {
+                for (const auto& favorite : songs) {
+                    auto id = findSong(favorite.title, favorite.artist);
+                    if (!id) {
+                        continue;
+                    }
+                    const auto& tags = songDatabase[*id].moods;
+                    if (query->matches([&](const std::string& name) {
+                            return name == favoriteMood || std::find(tags.begin(), tags.end(), name) != tags.end();
+                        })) {
+                        merged.insert(*id, songDatabase[*id].energy);
+                    }
+                }
+            }
+        }
+
+        auto buckets = std::make_shared<const EnergyBuckets>(std::move(merged));
+        return playlistCache.insert(key, buckets);
+    }
+
+    // `mood` is a mood name or a boolean mood query ("calm OR relaxed").
+    // Passing a seed makes the playlist reproducible; otherwise the per-thread
+    // generator is used. With a seed song the playlist is built from the songs
+    // most similar to it (restricted to `mood` unless that is empty) instead of
+    // from the whole mood.
+    std::vector<Song> generatePlaylist(const std::string& mood, int playlistSize,
+                                       std::optional<std::uint64_t> seed = std::nullopt,
+                                       std::optional<SongId> seedSong = std::nullopt) {
+        return buildPlaylist(mood, playlistSize, seed, seedSong, lastTimedPlan);
+    }
+
+    // generatePlaylist(), recording duration planning in `planStats` rather
+    // than lastTimedPlan, so that only served playlists show up there.
+    std::vector<Song> buildPlaylist(const std::string& mood, int playlistSize, std::optional<std::uint64_t> seed,
+                                    std::optional<SongId> seedSong, DurationPlanStats& planStats) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        const std::size_t size = static_cast<std::size_t>(std::max(playlistSize, 0));
+
+        std::vector<SongId> picked;
+        if (seedSong) {
+            picked = songsLike(*seedSong, mood, size);
+        } else {
+            FastRandom seeded(seed.value_or(0));
+            FastRandom& g = seed ? seeded : FastRandom::threadLocal();
+            auto candidates = candidateBuckets(mood);
+            picked = durationTarget                  ? timedSongs(*candidates, g, planStats)
+                     : sequencing == Sequencing::Arc ? energyArcSongs(*candidates, size, g)
+                     : sequencing == Sequencing::Mix ? mixedSongs(*candidates, size, g)
+                                                     : rankSongs(*candidates, size, g);
+        }
+
+        std::vector<Song> playlist;
+        for (SongId id : picked) {
+            playlist.push_back(songDatabase[id]);
+            // Increment play count for selected songs
+            playlist.back().playCount++;
+        }
+        return playlist;
+    }
+
+    // The `count` best candidates, best first, under the scoring formula if one
+    // is set and the built-in ranking otherwise. Caller must hold stateMutex.
+    std::vector<SongId> rankSongs(const EnergyBuckets& candidates, std::size_t count, FastRandom& rng) const {
+        if (scoreProgram) {
+            return topScoredSongs(candidates, count, rng);
+        }
+        // Lowest energy first by default, for more coherent playlist flow
+        return rankerFor(rankingScore, rankingTieBreak)(candidates, count, RankingContext{songColumns, currentYear},
+                                                        rng);
+    }
+
+    // `count` candidates rising from the mood's lowest energy to its highest and
+    // back (see planEnergyArc); within each energy level the songs are the best
+    // under rankSongs(). Caller must hold stateMutex.
+    std::vector<SongId> energyArcSongs(const EnergyBuckets& candidates, std::size_t count, FastRandom& rng) const {
+        std::vector<SongId> picked;
+        if (candidates.energies.empty()) {
+            return picked;
+        }
+        const std::vector<std::size_t> plan = planEnergyArc(
+            energyArcTarget(count, static_cast<float>(candidates.energies.front()),
+                            static_cast<float>(candidates.energies.back())),
+            candidates);
+        const std::size_t levels = candidates.energies.size();
+        std::vector<std::size_t> perLevel(levels);
+        for (std::size_t level : plan) {
+            ++perLevel[level];
+        }
+        std::vector<std::vector<SongId>> chosen(levels);
+        for (std::size_t l = 0; l < levels; ++l) {
+            if (perLevel[l] > 0) {
+                EnergyBuckets level;
+                level.energies = {candidates.energies[l]};
+                level.songs = {candidates.songs[l]};
+                chosen[l] = rankSongs(level, perLevel[l], rng);
             }
         }
+        std::vector<std::size_t> taken(levels);
+        for (std::size_t level : plan) {
+            picked.push_back(chosen[level][taken[level]++]);
+        }
+        return picked;
+    }
 
-        std::random_device rd;
-        std::mt19937 g(rd());
-        std::shuffle(matchingSongs.begin(), matchingSongs.end(), g);
+    // `count` candidates in DJ order: the best under rankSongs() first, then
+    // whatever beam search finds gives the smoothest run of key, tempo and
+    // energy changes (see sequenceTransitions). Caller must hold stateMutex.
+    std::vector<SongId> mixedSongs(const EnergyBuckets& candidates, std::size_t count, FastRandom& rng) const {
+        std::vector<SongId> opener = rankSongs(candidates, 1, rng);
+        if (opener.empty()) {
+            return opener;
+        }
+        std::vector<SongId> ids;
+        for (const auto& bucket : candidates.songs) {
+            ids.insert(ids.end(), bucket.begin(), bucket.end());
+        }
+        const auto first = static_cast<std::size_t>(std::find(ids.begin(), ids.end(), opener[0]) - ids.begin());
+        TransitionPool pool(songColumns, std::move(ids));
+        return sequenceTransitions(pool, first, count, TransitionWeights(), mixSearch);
+    }
 
-        // Sort by energy level for more coherent playlist flow
-        std::sort(matchingSongs.begin(), matchingSongs.end(), [](const Song& a, const Song& b) {
-            return a.energy < b.energy;
+    // Candidates filling durationTarget, chosen and spaced out by artist by
+    // planTimedPlaylist() from the best kTimedCandidates under rankSongs().
+    // Caller must hold stateMutex.
+    std::vector<SongId> timedSongs(const EnergyBuckets& candidates, FastRandom& rng, DurationPlanStats& planStats) {
+        constexpr std::size_t kTimedCandidates = 4096;
+        std::vector<TimedCandidate> ranked;
+        for (SongId id : rankSongs(candidates, std::min(candidates.total(), kTimedCandidates), rng)) {
+            const Song& song = songDatabase[id];
+            const std::string artist = normalizeText(song.artist);
+            ranked.push_back({id, static_cast<std::uint32_t>(song.durationSeconds),
+                              static_cast<std::uint32_t>(hashBytes(artist.data(), artist.size(), 0))});
+        }
+        return planTimedPlaylist(ranked, *durationTarget, &planStats);
+    }
+
+    // The `count` best candidates under the scoring formula, highest score
+    // first, with ties broken at random. Caller must hold stateMutex.
+    std::vector<SongId> topScoredSongs(const EnergyBuckets& buckets, std::size_t count, FastRandom& rng) const {
+        std::vector<SongId> ids;
+        for (const auto& bucket : buckets.songs) {
+            ids.insert(ids.end(), bucket.begin(), bucket.end());
+        }
+        fastShuffle(ids.begin(), ids.end(), rng);
+        std::vector<float> scores(ids.size());
+        scoreProgram->scoreSongs(songColumns, ids.data(), ids.size(), scores.data());
+        for (float& score : scores) {
+            if (std::isnan(score)) {
+                score = -std::numeric_limits<float>::infinity();
+            }
+        }
+        std::vector<std::uint32_t> order(ids.size());
+        std::iota(order.begin(), order.end(), 0u);
+        const std::size_t take = std::min(count, ids.size());
+        std::partial_sort(order.begin(), order.begin() + take, order.end(), [&](std::uint32_t a, std::uint32_t b) {
+            return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
         });
+        std::vector<SongId> picked;
+        for (std::size_t i = 0; i < take; ++i) {
+            picked.push_back(ids[order[i]]);
+        }
+        return picked;
+    }
+
+    // Caller must hold stateMutex.
+    std::vector<SongId> songsLike(SongId seedSong, const std::string& mood, std::size_t count) {
+        std::vector<SongId> picked;
+        if (seedSong >= songDatabase.size()) {
+            return picked;
+        }
+        if (mood.empty()) {
+            for (const Neighbor& neighbor : nearestSongs(seedSong, count)) {
+                picked.push_back(neighbor.id);
+            }
+        } else {
+            // Only the mood's songs are compared, a quarter of the bytes each
+            // in the int8 store, so the playlist fills however few of the
+            // seed's graph neighbours share the mood.
+            std::vector<SongId> allowed;
+            if (auto matching = moodIndex.matching(mood)) {
+                allowed = matching->toVector();
+            } else {
+                for (std::size_t i = 0; i < songDatabase.size(); ++i) {
+                    const auto& moods = songDatabase[i].moods;
+                    if (std::find(moods.begin(), moods.end(), mood) != moods.end()) {
+                        allowed.push_back(static_cast<SongId>(i));
+                    }
+                }
+            }
+            allowed.erase(std::remove(allowed.begin(), allowed.end(), seedSong), allowed.end());
+            for (const Neighbor& neighbor :
+                 rerankedNearest(songFeatureMatrix, songQuantizedFeatures, songFeatureMatrix.row(seedSong), allowed,
+                                 count, 4 * count, FeatureWeights::defaults())) {
+                picked.push_back(neighbor.id);
+            }
+        }
+        std::stable_sort(picked.begin(), picked.end(), [&](SongId a, SongId b) {
+            return songDatabase[a].energy < songDatabase[b].energy;
+        });
+        return picked;
+    }
+
+    // Starts computing playlists for the moods most likely to be picked after
+    // `mood` while the user is still looking at the current one.
+    void prefetchLikelyNextPlaylists(const std::string& mood, int playlistSize) {
+        auto id = moodIdOf(mood);
+        if (!id) {
+            return;
+        }
+        std::vector<std::shared_ptr<PrefetchedPlaylist>> predictions;
+        for (MoodId next : moodTransitions.likelyNext(*id, 2)) {
+            auto pending = std::make_shared<PrefetchedPlaylist>();
+            pending->mood = kMoodNames[next];
+            pending->size = playlistSize;
+            std::lock_guard<std::mutex> lock(stateMutex);
+            pending->favoritesVersion = favoritesVersionOf(pending->mood);
+            pending->catalogVersion = catalogVersion;
+            predictions.push_back(std::move(pending));
+        }
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        prefetchQueue.clear();
+        prefetchedPlaylists.clear();
+        for (auto& pending : predictions) {
+            prefetchQueue.push_back(pending);
+            prefetchedPlaylists[pending->mood] = std::move(pending);
+        }
+        if (!prefetchThread.joinable()) {
+            prefetchThread = std::thread([this] { runPrefetches(); });
+        }
+        prefetchChanged.notify_all();
+    }
+
+    void runPrefetches() {
+        std::unique_lock<std::mutex> lock(prefetchMutex);
+        while (true) {
+            prefetchChanged.wait(lock, [this] { return stopPrefetch || !prefetchQueue.empty(); });
+            if (stopPrefetch) {
+                return;
+            }
+            std::shared_ptr<PrefetchedPlaylist> pending = std::move(prefetchQueue.front());
+            prefetchQueue.pop_front();
+            pending->started = true;
+            lock.unlock();
+            DurationPlanStats planStats;
+            const auto start = std::chrono::steady_clock::now();
+            std::vector<Song> playlist = buildPlaylist(pending->mood, pending->size, playlistSeed, std::nullopt,
+                                                       planStats);
+            const auto elapsed =
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            lock.lock();
+            pending->playlist = std::move(playlist);
+            pending->planStats = planStats;
+            pending->elapsed = elapsed;
+            pending->ready = true;
+            prefetchChanged.notify_all();
+        }
+    }
+
+    void stopPrefetching() {
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            stopPrefetch = true;
+            prefetchQueue.clear();
+        }
+        prefetchChanged.notify_all();
+        if (prefetchThread.joinable()) {
+            prefetchThread.join();
+        }
+    }
+
+    // Serves the playlist from a prefetch if one was made for this mood and its
+    // inputs are unchanged, otherwise generates it now. A prefetch still in
+    // progress is waited for, and the wait does not count as time saved; one
+    // not yet started is dropped along with the other predictions.
+    std::vector<Song> nextPlaylist(const std::string& mood, int playlistSize) {
+        std::shared_ptr<PrefetchedPlaylist> result;
+        std::chrono::microseconds waited{0};
+        {
+            std::unique_lock<std::mutex> lock(prefetchMutex);
+            if (!prefetchedPlaylists.empty()) {
+                ++prefetchedRequests;
+            }
+            auto it = prefetchedPlaylists.find(mood);
+            if (it != prefetchedPlaylists.end() && it->second->started) {
+                result = it->second;
+            }
+            prefetchedPlaylists.clear();
+            prefetchQueue.clear();
+            if (result && !result->ready) {
+                const auto start = std::chrono::steady_clock::now();
+                prefetchChanged.wait(lock, [&] { return result->ready; });
+                waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                               start);
+            }
+        }
+        if (result) {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (result->size == playlistSize && result->favoritesVersion == favoritesVersionOf(mood) &&
+                result->catalogVersion == catalogVersion) {
+                ++prefetchHits;
+                prefetchTimeSaved += std::max(result->elapsed - waited, std::chrono::microseconds(0));
+                lastTimedPlan = result->planStats;
+                return std::move(result->playlist);
+            }
+        }
+        return generatePlaylist(mood, playlistSize, playlistSeed);
+    }
+
+    RadioStream startRadio(const std::string& mood, std::size_t noRepeatWindow) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        std::vector<SongId> candidateIds;
+        for (const auto& bucket : candidateBuckets(mood)->songs) {
+            candidateIds.insert(candidateIds.end(), bucket.begin(), bucket.end());
+        }
+        std::uint64_t seed = playlistSeed ? *playlistSeed : FastRandom::threadLocal()();
+        return RadioStream(std::move(candidateIds), songDatabase.size(), noRepeatWindow, seed);
+    }
+
+    void playRadio(const std::string& mood) {
+        RadioStream radio = startRadio(mood, 8);
+        if (radio.empty()) {
+            std::cout << RED << "No songs found for this mood.\n" << RESET;
+            return;
+        }
+
+        std::cout << GREEN << "\nNow streaming " << mood << " radio (no repeats within "
+                  << radio.window() << " songs):\n" << RESET;
+        int played = 0;
+        int count = 3;
+        while (count > 0) {
+            for (SongId id : radio.next(count)) {
+                const Song& song = songDatabase[id];
+                std::cout << CYAN << ++played << ". " << song.title << " - " << song.artist
+                          << yearSuffix(song) << RESET << "\n";
+            }
+            std::cout << YELLOW << "How many more songs? (0 to stop): " << RESET;
+            if (!(std::cin >> count)) {
+                break;
+            }
+            count = std::min(count, 50);
+        }
+    }
 
-        if (matchingSongs.size() > static_cast<size_t>(playlistSize)) {
-            matchingSongs.resize(playlistSize);
+    // Approximate k nearest songs to `seed` in feature space, excluding the seed
+    // itself. Caller must hold stateMutex.
+    std::vector<Neighbor> nearestSongs(SongId seed, std::size_t k) const {
+        std::vector<Neighbor> neighbors =
+            songIndex.search(songFeatureMatrix.row(seed), k + 1, std::max<std::size_t>(64, 2 * k));
+        neighbors.erase(std::remove_if(neighbors.begin(), neighbors.end(),
+                                       [seed](const Neighbor& n) { return n.id == seed; }),
+                        neighbors.end());
+        if (neighbors.size() > k) {
+            neighbors.resize(k);
         }
+        return neighbors;
+    }
+
+    std::vector<Neighbor> findSimilarSongs(SongId seed, std::size_t k) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return nearestSongs(seed, k);
+    }
 
-        // Increment play count for selected songs
-        for (auto& song : matchingSongs) {
-            song.playCount++;
+    void displaySimilarSongs() {
+        std::cout << CYAN << "Find songs like:\n" << RESET;
+        for (size_t i = 0; i < songDatabase.size(); ++i) {
+            std::cout << i + 1 << ". " << songDatabase[i].title << " - " << songDatabase[i].artist << "\n";
+        }
+        std::cout << YELLOW << "Enter song number: " << RESET;
+        int choice;
+        std::cin >> choice;
+        if (choice <= 0 || choice > static_cast<int>(songDatabase.size())) {
+            std::cout << RED << "Invalid choice.\n" << RESET;
+            return;
         }
 
-        return matchingSongs;
+        displaySongsLike(static_cast<SongId>(choice - 1));
+    }
+
+    void displaySongsLike(SongId seedSong) {
+        const Song& seed = songDatabase[seedSong];
+        std::cout << GREEN << "\nSongs like '" << seed.title << "':\n" << RESET;
+        int rank = 0;
+        for (const Neighbor& neighbor : findSimilarSongs(seedSong, 5)) {
+            const Song& song = songDatabase[neighbor.id];
+            std::cout << CYAN << ++rank << ". " << song.title << " - " << song.artist << yearSuffix(song)
+                      << RESET << " [distance " << std::fixed << std::setprecision(2) << neighbor.distance << "]\n";
+        }
+
+        std::cout << YELLOW << "\nMake a playlist from this song? Enter a mood to keep to, 'any', or 0 to skip: "
+                  << RESET;
+        std::string mood;
+        std::cin >> mood;
+        if (mood == "0") {
+            return;
+        }
+        if (mood == "any") {
+            mood.clear();
+        }
+        std::vector<Song> playlist = generatePlaylist(mood, 5, playlistSeed, seedSong);
+        if (playlist.empty()) {
+            std::cout << RED << "No similar songs" << (mood.empty() ? "" : " for that mood") << ".\n" << RESET;
+            return;
+        }
+        std::cout << GREEN << "\nPlaylist from '" << seed.title << "':\n" << RESET;
+        displayPlaylistSongs(playlist);
+    }
+
+    std::vector<SearchHit> searchCatalog(const std::string& query, std::size_t limit) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return songSearchIndex.search(query, limit);
+    }
+
+    std::vector<Completion> completeSongNames(const std::string& prefix, std::size_t limit) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!songCompletions.matches(songDatabase.size(), catalogChecksum)) {
+            songCompletions.assign(CompletionTrie::build(songDatabase, catalogChecksum));
+        }
+        return songCompletions.complete(prefix, limit);
+    }
+
+    // Songs matching `filter`, most played first. The executed plan is written
+    // to `explanation` if given.
+    std::vector<SongId> filterCatalog(FilterQuery filter, double& elapsedUs, std::string* explanation) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        auto start = std::chrono::steady_clock::now();
+        FilterPlan plan(std::move(filter),
+                        FilterSources{songDatabase, songColumns, moodIndex, attributeIndex, songSearchIndex});
+        std::vector<SongId> ids = plan.execute().toVector();
+        elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        std::stable_sort(ids.begin(), ids.end(),
+                         [&](SongId a, SongId b) { return songDatabase[a].playCount > songDatabase[b].playCount; });
+        if (explanation) {
+            std::ostringstream out;
+            plan.explain(out);
+            *explanation = out.str();
+        }
+        return ids;
+    }
+
+    void filterSongs(const FilterQuery& filter, bool explain) {
+        double elapsed = 0;
+        std::string explanation;
+        const std::string text = filter.toString();
+        std::vector<SongId> ids = filterCatalog(filter, elapsed, explain ? &explanation : nullptr);
+        if (explain) {
+            std::cout << BLUE << "\n" << explanation << RESET;
+        }
+        if (ids.empty()) {
+            std::cout << RED << "No songs match " << text << ".\n" << RESET;
+            std::cin.unget();
+            return;
+        }
+        std::cout << GREEN << "\n" << ids.size() << " songs match " << text << " (" << std::fixed
+                  << std::setprecision(0) << elapsed << " us)" << (ids.size() > 10 ? ", most played first" : "")
+                  << ":\n" << RESET;
+        ids.resize(std::min<std::size_t>(ids.size(), 10));
+        for (size_t i = 0; i < ids.size(); ++i) {
+            const Song& song = songDatabase[ids[i]];
+            std::cout << CYAN << i + 1 << ". " << song.title << " - " << song.artist << yearSuffix(song)
+                      << RESET << " [Energy " << song.energy << ", Danceability " << song.danceability << "]\n";
+        }
+        offerSongsLike(ids);
+    }
+
+    void offerSongsLike(const std::vector<SongId>& shown) {
+        std::cout << YELLOW << "Enter a song number to find songs like it (0 to skip): " << RESET;
+        int choice;
+        std::cin >> choice;
+        if (choice > 0 && choice <= static_cast<int>(shown.size())) {
+            displaySongsLike(shown[choice - 1]);
+        }
+    }
+
+    void searchSongs() {
+        std::cout << CYAN << "Search by title or artist (typos are fine), or filter, e.g.\n"
+                  << "  mood:happy energy>=7 year<2000 artist~queen\n"
+                  << "(start with EXPLAIN to see how a filter runs): " << RESET;
+        std::string query;
+        std::getline(std::cin >> std::ws, query);
+
+        bool explain = false;
+        if (query.size() > 8 && normalizeText(query.substr(0, 8)) == "explain") {
+            explain = true;
+            query = query.substr(8);
+        }
+        if (FilterQuery::looksLikeFilter(query)) {
+            std::string error;
+            if (auto filter = FilterQuery::parse(query, moodOptions, &error)) {
+                filterSongs(*filter, explain);
+                return;
+            }
+            std::cout << RED << "Not a filter (" << error << "); searching titles and artists instead.\n" << RESET;
+        }
+
+        std::vector<Completion> completions = completeSongNames(query, 5);
+        if (!completions.empty()) {
+            std::cout << BLUE << "\nSuggestions:\n" << RESET;
+            for (const Completion& completion : completions) {
+                const Song& song = songDatabase[completion.song];
+                std::cout << "  " << (completion.artist ? song.artist + " (artist)" : song.title + " - " + song.artist)
+                          << "\n";
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<SearchHit> hits = searchCatalog(query, 10);
+        auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (hits.empty()) {
+            std::cout << RED << "No songs match '" << query << "'.\n" << RESET;
+            // Leave the newline for the "Press Enter" prompt.
+            std::cin.unget();
+            return;
+        }
+
+        std::cout << GREEN << "\n" << hits.size() << " matches for '" << query << "' (" << std::fixed
+                  << std::setprecision(0) << elapsed << " us):\n" << RESET;
+        for (size_t i = 0; i < hits.size(); ++i) {
+            const Song& song = songDatabase[hits[i].id];
+            std::cout << CYAN << i + 1 << ". " << song.title << " - " << song.artist << yearSuffix(song)
+                      << RESET << " [match " << std::setprecision(0) << hits[i].score * 100.0f << "%]\n";
+        }
+        std::vector<SongId> shown;
+        for (const SearchHit& hit : hits) {
+            shown.push_back(hit.id);
+        }
+        offerSongsLike(shown);
     }
 
     void displayPlaylist(const std::vector<Song>& playlist) {
         std::cout << GREEN << "\nYour AI-generated playlist:\n" << RESET;
+        if (scoreProgram) {
+            std::cout << BLUE << "Ranked by " << scoreProgram->text() << "\n" << RESET;
+        } else if (rankingScore != RankingScore::Energy || rankingTieBreak != RankingTieBreak::Random) {
+            std::cout << BLUE << "Ranked by " << kRankingScoreNames[static_cast<int>(rankingScore)] << ", ties by "
+                      << kRankingTieBreakNames[static_cast<int>(rankingTieBreak)] << "\n" << RESET;
+        }
+        if (durationTarget) {
+            std::uint32_t total = 0;
+            for (const Song& song : playlist) {
+                total += song.durationSeconds > 0 ? static_cast<std::uint32_t>(song.durationSeconds)
+                                                  : kAssumedSongSeconds;
+            }
+            std::cout << BLUE << "Timed to " << formatDuration(durationTarget->seconds) << " (within "
+                      << formatDuration(durationTarget->toleranceSeconds) << ")";
+            if (durationTarget->artistGap > 1) {
+                std::cout << ", no artist twice within " << durationTarget->artistGap << " tracks";
+            }
+            std::cout << ": " << formatDuration(total) << "\n" << RESET;
+        } else if (sequencing == Sequencing::Arc) {
+            std::cout << BLUE << "Shaped to a warm-up, peak and cool-down energy arc\n" << RESET;
+        } else if (sequencing == Sequencing::Mix) {
+            std::cout << BLUE << "Mixed for smooth key, tempo and energy transitions\n" << RESET;
+        }
+        displayPlaylistSongs(playlist);
+    }
+
+    void displayPlaylistSongs(const std::vector<Song>& playlist) {
         for (size_t i = 0; i < playlist.size(); ++i) {
-            std::cout << CYAN << i + 1 << ". " << playlist[i].title << " - " << playlist[i].artist << " (" << playlist[i].year << ")" << RESET;
+            std::cout << CYAN << i + 1 << ". " << playlist[i].title << " - " << playlist[i].artist << yearSuffix(playlist[i]) << RESET;
             std::cout << " [Energy: " << std::string(playlist[i].energy, '|') 
                       << ", Danceability: " << std::string(playlist[i].danceability, '|') 
-                      << ", Plays: " << playlist[i].playCount << "]\n";
+                      << ", Plays: " << playlist[i].playCount;
+            if (playlist[i].bpm > 0.0f) {
+                std::cout << ", BPM: " << std::fixed << std::setprecision(0) << playlist[i].bpm;
+            }
+            if (playlist[i].key != kUnknownKey) {
+                std::cout << ", Key: " << keyName(playlist[i].key);
+            }
+            if (playlist[i].durationSeconds > 0) {
+                std::cout << ", Length: " << formatDuration(static_cast<std::uint32_t>(playlist[i].durationSeconds));
+            }
+            std::cout << "]\n";
         }
     }
 
@@ -227,9 +1067,13 @@ private:
             }
             file.close();
         }
+        moodHistory.save("mood_history.dat");
     }
 
     void loadUserPreferences() {
+        if (moodHistory.load("mood_history.dat")) {
+            moodHistory.forEachEvent([this](std::uint64_t, MoodId mood) { moodTransitions.record(mood); });
+        }
         std::ifstream file("user_preferences.txt");
         if (file.is_open()) {
             file >> userHappinessLevel;
@@ -240,22 +1084,29 @@ private:
                 if (line == "END_MOOD") {
                     currentMood = "";
                 } else if (currentMood.empty() && line.find(',') == std::string::npos) {
-                    currentMood = line;
-                } else if (line.find(',') != std::string::npos) {
+                    // Older files may file favorites under a mood query.
+                    currentMood = primaryMood(line);
+                    if (currentMood.empty()) {
+                        currentMood = line;
+                    }
+                } else if (currentMood.empty()) {
                     size_t commaPos = line.find(',');
                     std::string mood = line.substr(0, commaPos);
                     int count = std::stoi(line.substr(commaPos + 1));
                     moodCounts[mood] = count;
+                    if (auto id = moodIdOf(mood)) {
+                        moodAggregates.setCount(*id, count);
+                    }
                 } else {
+                    // Favorites inside a mood block; matched by normalised title
+                    // and artist so renamed catalog entries are still found.
                     size_t commaPos = line.find(',');
                     if (commaPos != std::string::npos) {
                         std::string title = line.substr(0, commaPos);
                         std::string artist = line.substr(commaPos + 1);
-                        for (const auto& song : songDatabase) {
-                            if (song.title == title && song.artist == artist) {
-                                userFavorites[currentMood].push_back(song);
-                                break;
-                            }
+                        if (auto id = findSong(title, artist)) {
+                            userFavorites[currentMood].push_back(songDatabase[*id]);
+                            ++favoritesVersions[currentMood];
                         }
                     }
                 }
@@ -265,7 +1116,11 @@ private:
     }
 
     void addToFavorites(const Song& song, const std::string& mood) {
-        userFavorites[mood].push_back(song);
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            userFavorites[mood].push_back(song);
+            ++favoritesVersions[mood];
+        }
         std::cout << GREEN << "Added '" << song.title << "' to your favorites for " << mood << " mood.\n" << RESET;
     }
 
@@ -295,28 +1150,23 @@ private:
     void displayMoodInsights() {
         std::cout << BLUE << "\nMood Insights:\n" << RESET;
 
-        // Find the most common mood
-        auto maxMood = std::max_element(moodCounts.begin(), moodCounts.end(),
-            [](const auto& p1, const auto& p2) { return p1.second < p2.second; });
-
-        std::cout << "Your most common mood: " << maxMood->first << "\n";
-
-        // Calculate average happiness level
-        int totalMoods = 0;
-        int weightedHappiness = 0;
-        std::map<std::string, int> moodWeights = {
-            {"happy", 10}, {"sad", 2}, {"energetic", 8}, {"calm", 6},
-
-            {"party", 9}, {"melancholy", 3}, {"motivational", 7},
-            {"epic", 8}, {"relaxed", 7}, {"thoughtful", 6}
-        };
+        if (auto mostCommon = moodAggregates.mostCommonMood()) {
+            std::cout << "Your most common mood: " << kMoodNames[*mostCommon] << "\n";
+        } else {
+            std::cout << "No moods recorded yet.\n";
+        }
 
-        for (const auto& pair : moodCounts) {
-            totalMoods += pair.second;
-            weightedHappiness += pair.second * moodWeights[pair.first];
+        // Mood distribution over the last week
+        const std::uint64_t now = static_cast<std::uint64_t>(std::time(nullptr));
+        const auto lastWeek = moodHistory.distribution(now - 7 * 24 * 3600, now + 1);
+        std::cout << "Your moods over the last 7 days:\n";
+        for (std::size_t i = 0; i < kMoodCount; ++i) {
+            if (lastWeek[i] > 0) {
+                std::cout << "  " << kMoodNames[i] << ": " << lastWeek[i] << "\n";
+            }
         }
 
-        double averageHappiness = totalMoods > 0 ? static_cast<double>(weightedHappiness) / totalMoods : 5.0;
+        double averageHappiness = moodAggregates.averageHappiness();
         std::cout << "Your average happiness level: " << std::fixed << std::setprecision(2) << averageHappiness << "/10\n";
 
         // Provide a mood-based recommendation
@@ -330,12 +1180,235 @@ private:
         }
     }
 
+    // Appends `song` and updates every index in place rather than rebuilding
+    // them. Call finishAddingSongs() after the last song of a batch. Caller
+    // must hold stateMutex.
+    SongId addSong(const Song& song, AudioFingerprint fingerprint) {
+        SongId id = static_cast<SongId>(songDatabase.size());
+        songDatabase.push_back(song);
+        songFingerprints.push_back(std::move(fingerprint));
+        songKeys.emplace(songDatabase.back().matchKey(), id);
+        catalogChecksum = mixChecksum(catalogChecksum, songDatabase.back().matchKey());
+        moodIndex.addSong(id, songDatabase.back());
+        attributeIndex.addSong(id, songDatabase.back());
+        songColumns.addSong(songDatabase.back());
+        songSearchIndex.addSong(id, songDatabase.back());
+        songFeatureMatrix.append(songFeatures(songDatabase.back()));
+        ++catalogVersion;
+        return id;
+    }
+
+    // The once-per-batch part of adding songs: the completion trie, mood tags
+    // for songs that came without any, then (as tagging changes the songs'
+    // features) the int8 features, whose scales span the whole catalog, and
+    // the nearest-neighbour graph. Caller must hold stateMutex.
+    void finishAddingSongs() {
+        if (!songCompletions.matches(songDatabase.size(), catalogChecksum)) {
+            songCompletions.assign(CompletionTrie::build(songDatabase, catalogChecksum));
+        }
+        autoTagUntaggedSongs();
+        songQuantizedFeatures = QuantizedFeatureMatrix::fromMatrix(songFeatureMatrix);
+        songIndex.insertNew();
+        songIndex.save(kSongIndexPath);
+    }
+
 public:
     MoodPlaylistGenerator() : userHappinessLevel(5) {
         initializeSongDatabase();
         loadUserPreferences();
     }
 
+    ~MoodPlaylistGenerator() { stopPrefetching(); }
+
+
+    // Analyses every .wav file under `directory` in parallel and updates the
+    // catalog in one go: songs named "Artist - Title.wav" that are already in the
+    // catalog get new energy, danceability, tempo, key and length values;
+    // anything else is added (and mood-tagged by clustering). The catalog file
+    // is rewritten afterwards.
+    std::size_t importAudioFiles(const std::string& directory) {
+        std::vector<std::string> paths;
+        std::error_code error;
+        for (std::filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end;
+             it.increment(error)) {
+            std::string extension = it->path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            if (it->is_regular_file() && extension == ".wav") {
+                paths.push_back(it->path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::optional<AudioFeatures>> results = analyzeAudioFiles(paths);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        std::size_t updated = 0, added = 0, skipped = 0;
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            if (!results[i]) {
+                std::cout << RED << "Skipping unreadable file: " << paths[i] << "\n" << RESET;
+                ++skipped;
+                continue;
+            }
+            std::string stem = std::filesystem::path(paths[i]).stem().string();
+            std::string artist = "Unknown Artist";
+            std::string title = stem;
+            size_t separator = stem.find(" - ");
+            if (separator != std::string::npos) {
+                artist = stem.substr(0, separator);
+                title = stem.substr(separator + 3);
+            }
+
+            Song song(title, artist, {}, results[i]->energy, results[i]->danceability, kUnknownYear);
+            song.bpm = static_cast<float>(results[i]->bpm);
+            song.key = results[i]->key;
+            song.durationSeconds = static_cast<int>(std::lround(results[i]->durationSeconds));
+            if (auto id = findSong(title, artist)) {
+                Song& existing = songDatabase[*id];
+                existing.energy = song.energy;
+                existing.danceability = song.danceability;
+                existing.bpm = song.bpm;
+                existing.key = song.key;
+                existing.durationSeconds = song.durationSeconds;
+                songFingerprints[*id] = std::move(results[i]->fingerprint);
+                ++updated;
+            } else {
+                addSong(song, std::move(results[i]->fingerprint));
+                ++added;
+            }
+        }
+        // New songs are indexed as they are added; changed ones need a rebuild.
+        if (updated > 0) {
+            rebuildCatalogIndexes();
+        } else if (added > 0) {
+            finishAddingSongs();
+        }
+        if (updated + added > 0) {
+            saveCatalog();
+        }
+
+        std::cout << GREEN << "Analysed " << paths.size() << " audio files in " << std::fixed << std::setprecision(2)
+                  << elapsed << " s: " << updated << " updated, " << added << " added, " << skipped << " skipped.\n"
+                  << RESET;
+        return updated + added;
+    }
+
+    // Finds songs that are the same recording, by audio fingerprint or by
+    // normalised title and artist, and prints them in groups. Returns the number
+    // of groups.
+    std::size_t findDuplicateSongs() {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        auto start = std::chrono::steady_clock::now();
+        FingerprintIndex index;
+        index.build(songFingerprints);
+        std::vector<DuplicatePair> pairs = index.findDuplicates(songFingerprints);
+        for (std::size_t i = 0; i < songDatabase.size(); ++i) {
+            SongId first = songKeys.at(songDatabase[i].matchKey());
+            if (first != i) {
+                pairs.push_back({first, static_cast<SongId>(i), 0});
+            }
+        }
+        std::vector<std::vector<SongId>> groups = duplicateGroups(pairs, songDatabase.size());
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << GREEN << "Found " << groups.size() << " groups of duplicate recordings in " << std::fixed
+                  << std::setprecision(2) << elapsed << " s.\n" << RESET;
+        for (const auto& group : groups) {
+            std::cout << CYAN << "Same recording:\n" << RESET;
+            for (SongId id : group) {
+                std::cout << "  - " << songDatabase[id].title << " by " << songDatabase[id].artist << "\n";
+            }
+        }
+        return groups.size();
+    }
+
+    // Fixes the seed used for every playlist in this session (for benchmarks and
+    // regression runs).
+    void setPlaylistSeed(std::uint64_t seed) {
+        playlistSeed = seed;
+    }
+
+    // Ranks playlist candidates by `formula` (see ScoreProgram) instead of
+    // taking the lowest-energy ones. Returns false and leaves the ranking
+    // unchanged if the formula does not compile.
+    bool setScoringFormula(const std::string& formula, std::string* error = nullptr) {
+        std::optional<ScoreProgram> program = ScoreProgram::parse(formula, currentYear, error);
+        if (!program) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(stateMutex);
+        scoreProgram = std::move(program);
+        return true;
+    }
+
+    // Picks the built-in ranking used when no scoring formula is set.
+    void setRanking(RankingScore score, RankingTieBreak tieBreak) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        rankingScore = score;
+        rankingTieBreak = tieBreak;
+    }
+
+    // Sets how playlists are ordered: "ramp" (the default), "arc" or "mix".
+    // Returns false for other names.
+    bool setSequencing(const std::string& name) {
+        if (name != "arc" && name != "ramp" && name != "mix") {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(stateMutex);
+        sequencing = name == "arc" ? Sequencing::Arc : name == "mix" ? Sequencing::Mix : Sequencing::Ramp;
+        return true;
+    }
+
+    // Beam width for "mix" playlists, and the time within which the search
+    // narrows the beam to finish (0 for no limit).
+    void setMixSearch(std::size_t width, double budgetMs) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        mixSearch.width = std::max<std::size_t>(width, 1);
+        mixSearch.budgetMs = budgetMs;
+    }
+
+    // Fills playlists to a length instead of a song count (see
+    // planTimedPlaylist); takes precedence over the sequencing.
+    void setDurationTarget(const DurationTarget& target) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        durationTarget = target;
+    }
+
+    static int yearNow() {
+        const std::time_t now = std::time(nullptr);
+        return std::localtime(&now)->tm_year + 1900;
+    }
+
+    // " (YYYY)" for listings, or nothing when the year is unknown.
+    static std::string yearSuffix(const Song& song) {
+        return song.year == kUnknownYear ? std::string() : " (" + std::to_string(song.year) + ")";
+    }
+
+    void displayEngineStats() const {
+        const auto& stats = playlistCache.stats();
+        std::cout << BLUE << "\nPlaylist cache:\n" << RESET
+                  << "  hits: " << stats.hits << ", misses: " << stats.misses
+                  << ", evictions: " << stats.evictions << ", entries: " << playlistCache.size() << "\n";
+
+        double hitRate = prefetchedRequests > 0 ? 100.0 * prefetchHits / prefetchedRequests : 0.0;
+        std::cout << BLUE << "Next-mood prefetch:\n" << RESET
+                  << "  predicted requests: " << prefetchedRequests << ", hits: " << prefetchHits
+                  << " (" << std::fixed << std::setprecision(1) << hitRate << "%)"
+                  << ", latency saved: " << prefetchTimeSaved.count() << " us\n";
+
+        if (durationTarget) {
+            std::cout << BLUE << "Last timed playlist:\n" << RESET
+                      << "  " << formatDuration(lastTimedPlan.totalSeconds)
+                      << (lastTimedPlan.withinTolerance ? " (in tolerance)" : " (out of tolerance)") << " from "
+                      << lastTimedPlan.candidatesSolved << " candidates in " << std::setprecision(2)
+                      << lastTimedPlan.ms << " ms" << (lastTimedPlan.timedOut ? " (budget hit)" : "")
+                      << ", artist swaps: " << lastTimedPlan.artistSwaps
+                      << ", gap violations: " << lastTimedPlan.gapViolations << "\n";
+        }
+    }
+
     void run() {
         bool exitProgram = false;
         while (!exitProgram) {
@@ -343,7 +1416,7 @@ public:
             displayHeader("AI Mood-Based Playlist Generator");
 
             std::cout << YELLOW << "1. Generate Playlist\n2. View Favorites\n3. Update Happiness Level\n"
-                      << "4. View Most Played Songs\n5. View Mood Insights\n6. Exit\n" << RESET;
+                      << "4. View Most Played Songs\n5. View Mood Insights\n6. Mood Radio\n7. More Like This\n8. Search Songs\n9. Exit\n" << RESET;
             int choice;
             std::cout << "Enter your choice: ";
             std::cin >> choice;
@@ -351,17 +1424,23 @@ public:
             switch (choice) {
                 case 1: {
                     std::string mood = getUserMood();
+                    const std::string primary = primaryMood(mood);
                     simulateAIProcessing();
                     displayMoodAnalysis(mood);
-                    std::vector<Song> playlist = generatePlaylist(mood, 5);
+                    std::vector<Song> playlist = nextPlaylist(mood, 5);
                     displayPlaylist(playlist);
-                    provideMoodRecommendation(mood);
+                    prefetchLikelyNextPlaylists(primary, 5);
+                    provideMoodRecommendation(primary);
 
                     std::cout << YELLOW << "\nWould you like to add any songs to your favorites? (Enter song number, or 0 to skip): " << RESET;
                     int favoriteChoice;
                     std::cin >> favoriteChoice;
                     if (favoriteChoice > 0 && favoriteChoice <= static_cast<int>(playlist.size())) {
-                        addToFavorites(playlist[favoriteChoice - 1], mood);
+                        const Song& favorite = playlist[favoriteChoice - 1];
+                        const std::string favoriteMood = favoriteMoodFor(favorite, mood);
+                        if (!favoriteMood.empty()) {
+                            addToFavorites(favorite, favoriteMood);
+                        }
                     }
                     break;
                 }
@@ -380,6 +1459,15 @@ public:
                     displayMoodInsights();
                     break;
                 case 6:
+                    playRadio(getUserMood());
+                    break;
+                case 7:
+                    displaySimilarSongs();
+                    break;
+                case 8:
+                    searchSongs();
+                    break;
+                case 9:
                     exitProgram = true;
                     break;
                 default:
@@ -393,6 +1481,9 @@ public:
             }
             clearScreen();
         }
+        // Nothing reads the predictions now, and the stats shown after run()
+        // should not change underneath.
+        stopPrefetching();
         saveUserPreferences();
     }
 
@@ -405,8 +1496,166 @@ public:
     }
 };
 
-int main() {
+// Parses all of `text` as a non-negative integer.
+static bool parseCount(const char* text, std::uint64_t& value) {
+    if (!std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    const unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (errno == ERANGE || *end != '\0') {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Parses all of `text` as a finite, non-negative number.
+static bool parseAmount(const char* text, double& value) {
+    errno = 0;
+    char* end = nullptr;
+    const double parsed = std::strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE || !std::isfinite(parsed) || parsed < 0.0) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --seed N            reproducible playlists\n"
+              << "  --stats             print engine statistics on exit\n"
+              << "  --rank SCORE[:TIE]  built-in ranking (energy, dance, recent, popular;\n"
+              << "                      ties by random, newest, plays, catalog)\n"
+              << "  --score FORMULA     rank by a scoring formula\n"
+              << "  --sequence ORDER    ramp, arc or mix\n"
+              << "  --beam-width N      beam width for mix playlists\n"
+              << "  --beam-budget MS    time limit for mix playlists (0 for none)\n"
+              << "  --minutes M         fill playlists to M minutes\n"
+              << "  --tolerance S       allowed deviation from --minutes, in seconds\n"
+              << "  --artist-gap N      no artist twice within N tracks\n"
+              << "  --time-budget MS    time limit for timed playlists (0 for none)\n"
+              << "  --ingest DIR        import .wav files from DIR\n"
+              << "  --dedup             list duplicate recordings\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::optional<std::uint64_t> seed;
+    std::string importDirectory;
+    bool dedup = false;
+    bool showStats = false;
+    std::string scoringFormula;
+    std::string ranking;
+    std::string sequencing;
+    std::uint64_t beamWidth = 8;
+    double beamBudgetMs = 50.0;
+    std::optional<double> minutes;
+    std::uint64_t toleranceSeconds = 60;
+    DurationTarget durationTarget;
+    for (int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        if (flag == "--stats") {
+            showStats = true;
+            continue;
+        } else if (flag == "--dedup") {
+            dedup = true;
+            continue;
+        } else if (flag == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Unknown option or missing value: " << flag << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+        std::uint64_t count = 0;
+        double amount = 0.0;
+        bool parsed = true;
+        if (flag == "--seed") {
+            parsed = parseCount(value, count);
+            seed = count;
+        } else if (flag == "--ingest") {
+            importDirectory = value;
+        } else if (flag == "--sequence") {
+            sequencing = value;
+        } else if (flag == "--beam-width") {
+            parsed = parseCount(value, beamWidth);
+        } else if (flag == "--beam-budget") {
+            parsed = parseAmount(value, beamBudgetMs);
+        } else if (flag == "--minutes") {
+            parsed = parseAmount(value, amount);
+            minutes = amount;
+        } else if (flag == "--tolerance") {
+            parsed = parseCount(value, toleranceSeconds);
+        } else if (flag == "--artist-gap") {
+            parsed = parseCount(value, count);
+            durationTarget.artistGap = count;
+        } else if (flag == "--time-budget") {
+            parsed = parseAmount(value, durationTarget.budgetMs);
+        } else if (flag == "--rank") {
+            ranking = value;
+        } else if (flag == "--score") {
+            scoringFormula = value;
+        } else {
+            std::cerr << "Unknown option: " << flag << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (!parsed) {
+            std::cerr << "Bad value for " << flag << ": " << value << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
     MoodPlaylistGenerator generator;
+    if (!importDirectory.empty() || dedup) {
+        if (!importDirectory.empty() && generator.importAudioFiles(importDirectory) == 0) {
+            return 1;
+        }
+        if (dedup) {
+            generator.findDuplicateSongs();
+        }
+        return 0;
+    }
+    if (seed) {
+        generator.setPlaylistSeed(*seed);
+    }
+    if (!ranking.empty()) {
+        auto policies = parseRanking(ranking);
+        if (!policies) {
+            std::cerr << "Bad --rank: expected energy, dance, recent or popular, optionally followed by "
+                      << ":random, :newest, :plays or :catalog\n";
+            return 1;
+        }
+        generator.setRanking(policies->first, policies->second);
+    }
+    if (!sequencing.empty() && !generator.setSequencing(sequencing)) {
+        std::cerr << "Bad --sequence: expected ramp, arc or mix\n";
+        return 1;
+    }
+    generator.setMixSearch(beamWidth, beamBudgetMs);
+    if (minutes) {
+        if (!(*minutes > 0.0 && *minutes <= 600.0) || toleranceSeconds > 3600) {
+            std::cerr << "Bad --minutes or --tolerance: expected up to 600 minutes within up to 3600 seconds\n";
+            return 1;
+        }
+        durationTarget.toleranceSeconds = static_cast<std::uint32_t>(toleranceSeconds);
+        durationTarget.seconds = static_cast<std::uint32_t>(std::lround(*minutes * 60.0));
+        generator.setDurationTarget(durationTarget);
+    }
+    std::string formulaError;
+    if (!scoringFormula.empty() && !generator.setScoringFormula(scoringFormula, &formulaError)) {
+        std::cerr << "Bad --score formula: " << formulaError << "\n";
+        return 1;
+    }
     generator.run();
+    if (showStats) {
+        generator.displayEngineStats();
+    }
     return 0;
-}
\ No newline at end of file
+}
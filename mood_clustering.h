@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "fast_random.h"
+#include "moods.h"
+#include "song.h"
+#include "song_features.h"
+
+struct MoodClusteringOptions {
+    std::size_t batchSize = 4096;
+    std::size_t iterations = 50;
+    std::size_t tagsPerSong = 2;
+    std::size_t threads = 0;
+    std::uint64_t seed = 7;
+};
+
+struct MoodAssignment {
+    SongId id;
+    std::vector<MoodId> moods;
+};
+
+// Tags songs that have no moods by clustering feature vectors. There is one
+// centroid per mood, started at the mean of the tagged songs with that mood and
+// refined with mini-batch k-means (Sculley 2010) over the untagged songs. Each
+// untagged song then gets the moods of its nearest centroids. Only the
+// non-mood dimensions are compared, since untagged songs have no mood bits.
+class MoodClustering {
+public:
+    explicit MoodClustering(MoodClusteringOptions clusteringOptions = MoodClusteringOptions())
+        : options(clusteringOptions) {
+        if (options.threads == 0) {
+            options.threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        }
+        weights = FeatureWeights::defaults();
+        for (std::size_t m = 0; m < kMoodCount; ++m) {
+            weights.weights[kFeatureFirstMood + m] = 0.0f;
+        }
+    }
+
+    std::vector<MoodAssignment> run(const FeatureMatrix& features) {
+        std::vector<SongId> untagged;
+        std::array<double, kMoodCount> taggedCounts{};
+        std::array<std::array<double, kFeatureDims>, kMoodCount> sums{};
+        for (std::size_t i = 0; i < features.size(); ++i) {
+            const float* row = features.row(static_cast<SongId>(i));
+            bool tagged = false;
+            for (std::size_t m = 0; m < kMoodCount; ++m) {
+                if (row[kFeatureFirstMood + m] > 0.5f) {
+                    tagged = true;
+                    taggedCounts[m] += 1.0;
+                    for (std::size_t d = 0; d < kFeatureDims; ++d) {
+                        sums[m][d] += row[d];
+                    }
+                }
+            }
+            if (!tagged) {
+                untagged.push_back(static_cast<SongId>(i));
+            }
+        }
+        if (untagged.empty()) {
+            return {};
+        }
+
+        // Moods with no tagged songs cannot be learned and are left out.
+        centroids.clear();
+        centroidMoods.clear();
+        std::vector<double> learnedCounts;
+        for (std::size_t m = 0; m < kMoodCount; ++m) {
+            if (taggedCounts[m] == 0.0) {
+                continue;
+            }
+            FeatureVector centroid{};
+            for (std::size_t d = 0; d < kFeatureDims; ++d) {
+                centroid[d] = static_cast<float>(sums[m][d] / taggedCounts[m]);
+            }
+            centroids.push_back(centroid);
+            centroidMoods.push_back(static_cast<MoodId>(m));
+            learnedCounts.push_back(taggedCounts[m]);
+        }
+        if (centroids.empty()) {
+            return {};
+        }
+
+        refine(features, untagged, learnedCounts);
+        return assign(features, untagged);
+    }
+
+private:
+    MoodClusteringOptions options;
+    FeatureWeights weights;
+    std::vector<FeatureVector> centroids;
+    std::vector<MoodId> centroidMoods;
+
+    std::size_t nearestCentroid(const float* row) const {
+        std::size_t best = 0;
+        float bestDistance = weightedDistance(centroids[0].data(), row, weights.weights.data());
+        for (std::size_t c = 1; c < centroids.size(); ++c) {
+            float d = weightedDistance(centroids[c].data(), row, weights.weights.data());
+            if (d < bestDistance) {
+                bestDistance = d;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    template <typename F>
+    void parallelFor(std::size_t count, F f) const {
+        const std::size_t workers = std::min(options.threads, std::max<std::size_t>(1, count / 1024));
+        if (workers <= 1) {
+            f(0, count);
+            return;
+        }
+        std::vector<std::thread> threads;
+        const std::size_t chunk = (count + workers - 1) / workers;
+        for (std::size_t w = 0; w < workers; ++w) {
+            const std::size_t begin = std::min(count, w * chunk);
+            const std::size_t end = std::min(count, begin + chunk);
+            threads.emplace_back([&f, begin, end] { f(begin, end); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Mini-batch k-means: nearest centroids for the batch are found in parallel,
+    // then each centroid moves towards its points with a per-centroid learning
+    // rate of 1 / (points seen). Counts start at the number of tagged songs, so
+    // centroids stay anchored to what the tagged songs say about each mood.
+    void refine(const FeatureMatrix& features, const std::vector<SongId>& untagged,
+                std::vector<double> counts) {
+        FastRandom rng(options.seed);
+        const std::size_t batchSize = std::min(options.batchSize, untagged.size());
+        std::vector<SongId> batch(batchSize);
+        std::vector<std::size_t> nearest(batchSize);
+        for (std::size_t iteration = 0; iteration < options.iterations; ++iteration) {
+            for (auto& id : batch) {
+                id = untagged[rng.below(untagged.size())];
+            }
+            parallelFor(batchSize, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    nearest[i] = nearestCentroid(features.row(batch[i]));
+                }
+            });
+            for (std::size_t i = 0; i < batchSize; ++i) {
+                FeatureVector& centroid = centroids[nearest[i]];
+                const double eta = 1.0 / ++counts[nearest[i]];
+                const float* row = features.row(batch[i]);
+                for (std::size_t d = 0; d < kFeatureDims; ++d) {
+                    centroid[d] += static_cast<float>(eta * (row[d] - centroid[d]));
+                }
+            }
+        }
+    }
+
+    std::vector<MoodAssignment> assign(const FeatureMatrix& features, const std::vector<SongId>& untagged) const {
+        const std::size_t tags = std::min(options.tagsPerSong, centroids.size());
+        std::vector<MoodAssignment> assignments(untagged.size());
+        parallelFor(untagged.size(), [&](std::size_t begin, std::size_t end) {
+            std::vector<std::pair<float, std::size_t>> ranked(centroids.size());
+            for (std::size_t i = begin; i < end; ++i) {
+                const float* row = features.row(untagged[i]);
+                for (std::size_t c = 0; c < centroids.size(); ++c) {
+                    ranked[c] = {weightedDistance(centroids[c].data(), row, weights.weights.data()), c};
+                }
+                std::partial_sort(ranked.begin(), ranked.begin() + tags, ranked.end());
+                assignments[i].id = untagged[i];
+                for (std::size_t t = 0; t < tags; ++t) {
+                    assignments[i].moods.push_back(centroidMoods[ranked[t].second]);
+                }
+            }
+        });
+        return assignments;
+    }
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "moods.h"
+
+// Timestamped mood history stored as compressed blocks. Each event is encoded as
+// a varint of (seconds since the previous event * 16 + mood ID), so a pick per day
+// costs about three bytes. Every block also keeps its time range and per-mood
+// totals: windowed queries add up whole blocks inside the window from those
+// totals, skip blocks outside it, and only decode the blocks at the two edges.
+class MoodHistory {
+public:
+    using Distribution = std::array<std::uint32_t, kMoodCount>;
+
+    void record(std::uint64_t timestamp, MoodId mood) {
+        if (blocks.empty() || blocks.back().count == kEventsPerBlock) {
+            const std::uint64_t previous = lastTimestamp();
+            blocks.emplace_back();
+            blocks.back().firstTime = std::max(timestamp, previous);
+            blocks.back().lastTime = blocks.back().firstTime;
+        }
+        Block& block = blocks.back();
+        // Clock changes never move time backwards in the series.
+        timestamp = std::max(timestamp, block.lastTime);
+        putVarint(block.bytes, (timestamp - block.lastTime) * 16 + mood);
+        block.lastTime = timestamp;
+        block.moodCounts[mood]++;
+        block.count++;
+    }
+
+    // Mood counts for events with from <= timestamp < to.
+    Distribution distribution(std::uint64_t from, std::uint64_t to) const {
+        Distribution result{};
+        auto it = std::partition_point(blocks.begin(), blocks.end(),
+                                       [&](const Block& block) { return block.lastTime < from; });
+        for (; it != blocks.end() && it->firstTime < to; ++it) {
+            if (it->firstTime >= from && it->lastTime < to) {
+                for (std::size_t m = 0; m < kMoodCount; ++m) {
+                    result[m] += it->moodCounts[m];
+                }
+                continue;
+            }
+            std::uint64_t time = it->firstTime;
+            std::size_t pos = 0;
+            for (std::uint16_t e = 0; e < it->count; ++e) {
+                std::uint64_t value = getVarint(it->bytes, pos);
+                time += value / 16;
+                if (time >= from && time < to) {
+                    result[value % 16]++;
+                }
+            }
+        }
+        return result;
+    }
+
+    // Calls f(timestamp, mood) for every event, oldest first.
+    template <typename F>
+    void forEachEvent(F f) const {
+        for (const auto& block : blocks) {
+            std::uint64_t time = block.firstTime;
+            std::size_t pos = 0;
+            for (std::uint16_t e = 0; e < block.count; ++e) {
+                std::uint64_t value = getVarint(block.bytes, pos);
+                time += value / 16;
+                f(time, static_cast<MoodId>(value % 16));
+            }
+        }
+    }
+
+    std::size_t eventCount() const {
+        std::size_t total = 0;
+        for (const auto& block : blocks) {
+            total += block.count;
+        }
+        return total;
+    }
+
+    std::size_t storageBytes() const {
+        std::size_t total = 0;
+        for (const auto& block : blocks) {
+            total += sizeof(Block) + block.bytes.size();
+        }
+        return total;
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        writePod(file, kMagic);
+        writePod(file, static_cast<std::uint32_t>(blocks.size()));
+        for (const auto& block : blocks) {
+            writePod(file, block.firstTime);
+            writePod(file, block.lastTime);
+            writePod(file, block.moodCounts);
+            writePod(file, block.count);
+            writePod(file, static_cast<std::uint32_t>(block.bytes.size()));
+            file.write(reinterpret_cast<const char*>(block.bytes.data()), block.bytes.size());
+        }
+        return static_cast<bool>(file);
+    }
+
+    // Rejects the whole file (keeping the current history) unless every block
+    // decodes to exactly its stated events, moods, totals and time range, in
+    // time order.
+    bool load(const std::string& path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            return false;
+        }
+        const auto fileSize = static_cast<std::uint64_t>(file.tellg());
+        file.seekg(0);
+        std::uint32_t magic = 0;
+        std::uint32_t blockCount = 0;
+        if (!readPod(file, magic) || magic != kMagic || !readPod(file, blockCount) ||
+            blockCount > fileSize / kBlockHeaderBytes) {
+            return false;
+        }
+        std::vector<Block> loaded(blockCount);
+        std::uint64_t previous = 0;
+        for (auto& block : loaded) {
+            std::uint32_t size = 0;
+            if (!readPod(file, block.firstTime) || !readPod(file, block.lastTime) ||
+                !readPod(file, block.moodCounts) || !readPod(file, block.count) || !readPod(file, size) ||
+                block.count == 0 || block.count > kEventsPerBlock || size > block.count * kMaxVarintBytes) {
+                return false;
+            }
+            block.bytes.resize(size);
+            if (!file.read(reinterpret_cast<char*>(block.bytes.data()), size) || block.firstTime < previous ||
+                !decodesCleanly(block)) {
+                return false;
+            }
+            previous = block.lastTime;
+        }
+        blocks = std::move(loaded);
+        return true;
+    }
+
+private:
+    static constexpr std::uint16_t kEventsPerBlock = 256;
+    static constexpr std::uint32_t kMagic = 0x31484D47;  // "GMH1"
+    // Saved size of a block without its events, and the longest varint.
+    static constexpr std::uint64_t kBlockHeaderBytes = 8 + 8 + 2 * kMoodCount + 2 + 4;
+    static constexpr std::size_t kMaxVarintBytes = 10;
+
+    struct Block {
+        std::uint64_t firstTime = 0;
+        std::uint64_t lastTime = 0;
+        std::array<std::uint16_t, kMoodCount> moodCounts{};
+        std::uint16_t count = 0;
+        std::vector<std::uint8_t> bytes;
+    };
+
+    std::vector<Block> blocks;
+
+    std::uint64_t lastTimestamp() const {
+        return blocks.empty() ? 0 : blocks.back().lastTime;
+    }
+
+    // True if the block's bytes are exactly `count` well-formed events with
+    // known moods that add up to its per-mood totals and end at lastTime.
+    static bool decodesCleanly(const Block& block) {
+        std::array<std::uint32_t, kMoodCount> counts{};
+        std::uint64_t time = block.firstTime;
+        std::size_t pos = 0;
+        for (std::uint16_t e = 0; e < block.count; ++e) {
+            const std::size_t start = pos;
+            while (pos < block.bytes.size() && pos - start < kMaxVarintBytes && (block.bytes[pos] & 0x80)) {
+                ++pos;
+            }
+            if (pos == block.bytes.size() || pos - start == kMaxVarintBytes) {
+                return false;
+            }
+            pos = start;
+            const std::uint64_t value = getVarint(block.bytes, pos);
+            if (value % 16 >= kMoodCount || value / 16 > block.lastTime - time) {
+                return false;
+            }
+            time += value / 16;
+            counts[value % 16]++;
+        }
+        for (std::size_t m = 0; m < kMoodCount; ++m) {
+            if (counts[m] != block.moodCounts[m]) {
+                return false;
+            }
+        }
+        return pos == block.bytes.size() && time == block.lastTime;
+    }
+
+    static void putVarint(std::vector<std::uint8_t>& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<std::uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<std::uint8_t>(value));
+    }
+
+    static std::uint64_t getVarint(const std::vector<std::uint8_t>& in, std::size_t& pos) {
+        std::uint64_t value = 0;
+        for (int shift = 0; pos < in.size(); shift += 7) {
+            std::uint8_t byte = in[pos++];
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        return value;
+    }
+
+    template <typename T>
+    static void writePod(std::ofstream& file, const T& value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool readPod(std::ifstream& file, T& value) {
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mood_query.h"
+#include "playlist_cache.h"
+#include "roaring_bitmap.h"
+#include "song.h"
+
+// Catalog songs for each mood, grouped by energy and as a compressed bitmap for
+// boolean mood queries. Moods and energy are fixed per song, so this is built
+// once per catalog version (one worker per group of moods) and then kept up to
+// date song by song as the catalog grows.
+class MoodIndex {
+public:
+    void rebuild(const std::vector<std::string>& indexedMoods, const std::vector<Song>& songDatabase) {
+        moods = indexedMoods;
+        songCount = songDatabase.size();
+        buckets.assign(moods.size(), EnergyBuckets());
+        bitmaps.assign(moods.size(), RoaringBitmap());
+
+        std::size_t workers = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        workers = std::min(workers, moods.size());
+        std::vector<std::thread> threads;
+        for (std::size_t w = 0; w < workers; ++w) {
+            threads.emplace_back([&, w] {
+                for (std::size_t m = w; m < moods.size(); m += workers) {
+                    std::vector<SongId> ids = scan(moods[m], songDatabase);
+                    bitmaps[m] = RoaringBitmap::fromSorted(ids);
+                    buckets[m] = EnergyBuckets::build(std::move(ids), songDatabase);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Call after appending `song` to the catalog under `id`.
+    void addSong(SongId id, const Song& song) {
+        songCount = std::max<std::size_t>(songCount, id + 1);
+        for (const auto& mood : song.moods) {
+            auto it = std::find(moods.begin(), moods.end(), mood);
+            if (it != moods.end()) {
+                buckets[it - moods.begin()].insert(id, song.energy);
+                bitmaps[it - moods.begin()].add(id);
+            }
+        }
+    }
+
+    // Energy buckets for `mood`, which may also be a boolean mood query such as
+    // "calm OR relaxed"; moods that are not indexed fall back to a scan.
+    EnergyBuckets bucketsFor(const std::string& mood, const std::vector<Song>& songDatabase) const {
+        auto it = std::find(moods.begin(), moods.end(), mood);
+        if (it != moods.end()) {
+            return buckets[it - moods.begin()];
+        }
+        if (auto query = MoodQuery::parse(mood, moods)) {
+            return EnergyBuckets::build(evaluate(*query).toVector(), songDatabase);
+        }
+        return EnergyBuckets::build(scan(mood, songDatabase), songDatabase);
+    }
+
+    // Songs tagged with a mood or matching a mood query; nullopt if `mood` is
+    // neither an indexed mood nor a valid query.
+    std::optional<RoaringBitmap> matching(const std::string& mood) const {
+        if (auto query = MoodQuery::parse(mood, moods)) {
+            return evaluate(*query);
+        }
+        return std::nullopt;
+    }
+
+    // Songs matching a query over the indexed moods.
+    RoaringBitmap evaluate(const MoodQuery& query) const {
+        return query.evaluate([this](const std::string& mood) -> const RoaringBitmap& { return bitmapFor(mood); },
+                              static_cast<std::uint32_t>(songCount));
+    }
+
+    const std::vector<std::string>& indexedMoods() const { return moods; }
+
+    // Songs tagged with an indexed mood (empty for other moods).
+    const RoaringBitmap& bitmapFor(const std::string& mood) const {
+        static const RoaringBitmap kEmpty;
+        auto it = std::find(moods.begin(), moods.end(), mood);
+        return it != moods.end() ? bitmaps[it - moods.begin()] : kEmpty;
+    }
+
+private:
+    std::vector<std::string> moods;
+    std::size_t songCount = 0;
+    std::vector<EnergyBuckets> buckets;
+    std::vector<RoaringBitmap> bitmaps;
+
+    static std::vector<SongId> scan(const std::string& mood, const std::vector<Song>& songDatabase) {
+        std::vector<SongId> ids;
+        for (SongId id = 0; id < songDatabase.size(); ++id) {
+            const auto& songMoods = songDatabase[id].moods;
+            if (std::find(songMoods.begin(), songMoods.end(), mood) != songMoods.end()) {
+                ids.push_back(id);
+            }
+        }
+        return ids;
+    }
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "roaring_bitmap.h"
+
+// A boolean expression over mood names, e.g. "energetic AND happy AND NOT party"
+// or "(calm OR relaxed) AND NOT sad". NOT binds tighter than AND, which binds
+// tighter than OR; keywords are case-insensitive and "&", "|" and "!" work too.
+class MoodQuery {
+public:
+    // Returns nullopt (and a message in `error`) for malformed expressions or
+    // names not in `knownMoods`.
+    static std::optional<MoodQuery> parse(const std::string& text, const std::vector<std::string>& knownMoods,
+                                          std::string* error = nullptr) {
+        MoodQuery query;
+        Parser parser{query, tokenize(text), 0, knownMoods, {}};
+        std::optional<int> root = parser.parseOr();
+        if (root && parser.pos < parser.tokens.size()) {
+            parser.error = "unexpected '" + parser.tokens[parser.pos] + "'";
+            root.reset();
+        }
+        if (!root) {
+            if (error) {
+                *error = parser.error;
+            }
+            return std::nullopt;
+        }
+        query.root = *root;
+        return query;
+    }
+
+    // Canonical spelling ("calm OR relaxed"), so equivalent inputs share cache
+    // entries.
+    std::string toString() const { return format(root); }
+
+    // Moods that appear without a NOT in front of them.
+    std::vector<std::string> positiveMoods() const {
+        std::vector<std::string> moods;
+        collectPositive(root, false, moods);
+        return moods;
+    }
+
+    // Songs matching the query. `bitmapOf(mood)` returns a reference to the
+    // bitmap of songs tagged with a mood; `songCount` bounds the result of a
+    // bare NOT. AND chains start from their smallest operand and apply negated
+    // operands as AND NOT, so the full catalog is only materialised when nothing
+    // else restricts a NOT.
+    template <typename BitmapOf>
+    RoaringBitmap evaluate(BitmapOf&& bitmapOf, std::uint32_t songCount) const {
+        return evaluateNode(root, bitmapOf, songCount);
+    }
+
+    // True if a song for which `hasMood(mood)` holds for exactly its moods
+    // matches the query.
+    template <typename HasMood>
+    bool matches(HasMood&& hasMood) const {
+        return matchesNode(root, hasMood);
+    }
+
+private:
+    enum class Op : std::uint8_t { Mood, Not, And, Or };
+
+    struct Node {
+        Op op;
+        std::string mood;
+        // Operands of And/Or (flattened) or the single operand of Not.
+        std::vector<int> operands;
+    };
+
+    std::vector<Node> nodes;
+    int root = -1;
+
+    static std::vector<std::string> tokenize(const std::string& text) {
+        std::vector<std::string> tokens;
+        std::size_t i = 0;
+        while (i < text.size()) {
+            const unsigned char c = static_cast<unsigned char>(text[i]);
+            if (std::isspace(c)) {
+                ++i;
+            } else if (c == '(' || c == ')' || c == '&' || c == '|' || c == '!') {
+                tokens.emplace_back(1, static_cast<char>(c));
+                ++i;
+            } else {
+                std::size_t end = i;
+                while (end < text.size() && !std::isspace(static_cast<unsigned char>(text[end])) &&
+                       std::string("()&|!").find(text[end]) == std::string::npos) {
+                    ++end;
+                }
+                std::string word = text.substr(i, end - i);
+                std::transform(word.begin(), word.end(), word.begin(),
+                               [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+                tokens.push_back(word == "and" ? "&" : word == "or" ? "|" : word == "not" ? "!" : word);
+                i = end;
+            }
+        }
+        return tokens;
+    }
+
+    struct Parser {
+        MoodQuery& query;
+        std::vector<std::string> tokens;
+        std::size_t pos;
+        const std::vector<std::string>& knownMoods;
+        std::string error;
+
+        bool accept(const char* token) {
+            if (pos < tokens.size() && tokens[pos] == token) {
+                ++pos;
+                return true;
+            }
+            return false;
+        }
+
+        std::optional<int> parseOr() { return parseChain("|", Op::Or, &Parser::parseAnd); }
+        std::optional<int> parseAnd() { return parseChain("&", Op::And, &Parser::parseUnary); }
+
+        std::optional<int> parseChain(const char* separator, Op op, std::optional<int> (Parser::*operand)()) {
+            std::optional<int> first = (this->*operand)();
+            if (!first || pos == tokens.size() || tokens[pos] != separator) {
+                return first;
+            }
+            Node node{op, {}, {*first}};
+            while (accept(separator)) {
+                std::optional<int> next = (this->*operand)();
+                if (!next) {
+                    return std::nullopt;
+                }
+                node.operands.push_back(*next);
+            }
+            return add(std::move(node));
+        }
+
+        std::optional<int> parseUnary() {
+            if (accept("!")) {
+                std::optional<int> operand = parseUnary();
+                if (!operand) {
+                    return std::nullopt;
+                }
+                return add({Op::Not, {}, {*operand}});
+            }
+            if (accept("(")) {
+                std::optional<int> inner = parseOr();
+                if (inner && !accept(")")) {
+                    error = "missing ')'";
+                    return std::nullopt;
+                }
+                return inner;
+            }
+            if (pos == tokens.size()) {
+                error = "expected a mood";
+                return std::nullopt;
+            }
+            const std::string& word = tokens[pos];
+            if (std::find(knownMoods.begin(), knownMoods.end(), word) == knownMoods.end()) {
+                error = word == "&" || word == "|" || word == ")" ? "expected a mood before '" + word + "'"
+                                                                   : "unknown mood '" + word + "'";
+                return std::nullopt;
+            }
+            ++pos;
+            return add({Op::Mood, word, {}});
+        }
+
+        int add(Node node) {
+            query.nodes.push_back(std::move(node));
+            return static_cast<int>(query.nodes.size()) - 1;
+        }
+    };
+
+    std::string format(int index) const {
+        const Node& node = nodes[index];
+        auto operand = [&](int child) {
+            const Op op = nodes[child].op;
+            return op == Op::And || op == Op::Or ? "(" + format(child) + ")" : format(child);
+        };
+        switch (node.op) {
+            case Op::Mood:
+                return node.mood;
+            case Op::Not:
+                return "NOT " + operand(node.operands[0]);
+            case Op::And:
+            case Op::Or: {
+                std::string text;
+                for (int child : node.operands) {
+                    if (!text.empty()) {
+                        text += node.op == Op::And ? " AND " : " OR ";
+                    }
+                    // AND binds tighter, so it needs no parentheses inside OR.
+                    text += node.op == Op::Or && nodes[child].op == Op::And ? format(child) : operand(child);
+                }
+                return text;
+            }
+        }
+        return "";
+    }
+
+    void collectPositive(int index, bool negated, std::vector<std::string>& moods) const {
+        const Node& node = nodes[index];
+        if (node.op == Op::Mood) {
+            if (!negated && std::find(moods.begin(), moods.end(), node.mood) == moods.end()) {
+                moods.push_back(node.mood);
+            }
+            return;
+        }
+        for (int operand : node.operands) {
+            collectPositive(operand, negated != (node.op == Op::Not), moods);
+        }
+    }
+
+    template <typename HasMood>
+    bool matchesNode(int index, HasMood& hasMood) const {
+        const Node& node = nodes[index];
+        switch (node.op) {
+            case Op::Mood:
+                return hasMood(node.mood);
+            case Op::Not:
+                return !matchesNode(node.operands[0], hasMood);
+            case Op::And:
+                return std::all_of(node.operands.begin(), node.operands.end(),
+                                   [&](int operand) { return matchesNode(operand, hasMood); });
+            case Op::Or:
+                return std::any_of(node.operands.begin(), node.operands.end(),
+                                   [&](int operand) { return matchesNode(operand, hasMood); });
+        }
+        return false;
+    }
+
+    template <typename BitmapOf>
+    RoaringBitmap evaluateNode(int index, BitmapOf& bitmapOf, std::uint32_t songCount) const {
+        const Node& node = nodes[index];
+        switch (node.op) {
+            case Op::Mood:
+                return bitmapOf(node.mood);
+            case Op::Not:
+                return andNot(RoaringBitmap::range(songCount), evaluateNode(node.operands[0], bitmapOf, songCount));
+            case Op::Or: {
+                RoaringBitmap result;
+                for (int operand : node.operands) {
+                    if (nodes[operand].op == Op::Mood) {
+                        result = result | bitmapOf(nodes[operand].mood);
+                    } else {
+                        result = result | evaluateNode(operand, bitmapOf, songCount);
+                    }
+                }
+                return result;
+            }
+            case Op::And: {
+                // Mood operands are used in place; only subexpressions are owned.
+                std::vector<RoaringBitmap> owned;
+                owned.reserve(node.operands.size());
+                std::vector<const RoaringBitmap*> included, excluded;
+                for (int operand : node.operands) {
+                    const bool negated = nodes[operand].op == Op::Not;
+                    const Node& child = nodes[negated ? nodes[operand].operands[0] : operand];
+                    const RoaringBitmap* bitmap;
+                    if (child.op == Op::Mood) {
+                        bitmap = &bitmapOf(child.mood);
+                    } else {
+                        owned.push_back(evaluateNode(negated ? nodes[operand].operands[0] : operand, bitmapOf,
+                                                     songCount));
+                        bitmap = &owned.back();
+                    }
+                    (negated ? excluded : included).push_back(bitmap);
+                }
+                std::sort(included.begin(), included.end(), [](const RoaringBitmap* a, const RoaringBitmap* b) {
+                    return a->cardinality() < b->cardinality();
+                });
+                RoaringBitmap result = included.empty() ? RoaringBitmap::range(songCount)
+                                       : included.size() == 1 ? *included[0]
+                                                              : *included[0] & *included[1];
+                for (std::size_t i = 2; i < included.size() && !result.empty(); ++i) {
+                    result = result & *included[i];
+                }
+                for (const RoaringBitmap* exclude : excluded) {
+                    if (result.empty()) {
+                        break;
+                    }
+                    result = andNot(result, *exclude);
+                }
+                return result;
+            }
+        }
+        return RoaringBitmap();
+    }
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "moods.h"
+
+// First-order Markov model of which mood the user picks after which, built up one
+// recorded mood at a time.
+class MoodTransitions {
+public:
+    void record(MoodId mood) {
+        if (previous) {
+            counts[*previous][mood]++;
+            totals[*previous]++;
+        }
+        previous = mood;
+    }
+
+    double probability(MoodId from, MoodId to) const {
+        return totals[from] > 0 ? static_cast<double>(counts[from][to]) / totals[from] : 0.0;
+    }
+
+    // Up to `limit` moods that have followed `from` before, most likely first.
+    std::vector<MoodId> likelyNext(MoodId from, std::size_t limit) const {
+        std::vector<MoodId> moods;
+        for (std::size_t to = 0; to < kMoodCount; ++to) {
+            if (counts[from][to] > 0) {
+                moods.push_back(static_cast<MoodId>(to));
+            }
+        }
+        std::stable_sort(moods.begin(), moods.end(), [&](MoodId a, MoodId b) {
+            return counts[from][a] > counts[from][b];
+        });
+        if (moods.size() > limit) {
+            moods.resize(limit);
+        }
+        return moods;
+    }
+
+private:
+    std::array<std::array<std::uint32_t, kMoodCount>, kMoodCount> counts{};
+    std::array<std::uint32_t, kMoodCount> totals{};
+    std::optional<MoodId> previous;
+};
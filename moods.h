@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Moods the user can pick, indexed by MoodId. Order matches the menu.
+using MoodId = std::uint8_t;
+
+constexpr std::array<const char*, 10> kMoodNames = {
+    "happy", "sad", "energetic", "calm", "party",
+    "melancholy", "motivational", "epic", "relaxed", "thoughtful"
+};
+constexpr std::size_t kMoodCount = kMoodNames.size();
+
+// How happy each mood is on a 1-10 scale, used for the average happiness level.
+constexpr std::array<int, kMoodCount> kMoodWeights = {10, 2, 8, 6, 9, 3, 7, 8, 7, 6};
+
+inline std::optional<MoodId> moodIdOf(const std::string& mood) {
+    for (std::size_t i = 0; i < kMoodCount; ++i) {
+        if (mood == kMoodNames[i]) {
+            return static_cast<MoodId>(i);
+        }
+    }
+    return std::nullopt;
+}
+
+// Running totals over the recorded moods, kept up to date on every change so
+// insights never need to rescan the history.
+class MoodAggregates {
+public:
+    void record(MoodId mood, long long count = 1) {
+        setCount(mood, counts[mood] + count);
+    }
+
+    void setCount(MoodId mood, long long count) {
+        const long long delta = count - counts[mood];
+        counts[mood] = count;
+        totalCount += delta;
+        weightedSum += delta * kMoodWeights[mood];
+        if (delta >= 0) {
+            if (counts[mood] > counts[mostCommon]) {
+                mostCommon = mood;
+            }
+        } else if (mood == mostCommon) {
+            for (std::size_t i = 0; i < kMoodCount; ++i) {
+                if (counts[i] > counts[mostCommon]) {
+                    mostCommon = static_cast<MoodId>(i);
+                }
+            }
+        }
+    }
+
+    long long total() const { return totalCount; }
+    long long count(MoodId mood) const { return counts[mood]; }
+
+    // Most common mood, or nullopt if nothing has been recorded.
+    std::optional<MoodId> mostCommonMood() const {
+        if (totalCount == 0) {
+            return std::nullopt;
+        }
+        return mostCommon;
+    }
+
+    double averageHappiness(double fallback = 5.0) const {
+        return totalCount > 0 ? static_cast<double>(weightedSum) / totalCount : fallback;
+    }
+
+private:
+    std::array<long long, kMoodCount> counts{};
+    long long totalCount = 0;
+    long long weightedSum = 0;
+    MoodId mostCommon = 0;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+
+// Keys are numbered 0-11 for C major .. B major and 12-23 for C minor .. B minor.
+constexpr int kUnknownKey = -1;
+constexpr int kKeyCount = 24;
+
+constexpr std::array<const char*, 12> kPitchClassNames = {"C", "C#", "D", "D#", "E", "F",
+                                                          "F#", "G", "G#", "A", "A#", "B"};
+
+inline bool isMinorKey(int key) { return key >= 12; }
+inline int keyTonic(int key) { return key % 12; }
+
+inline std::string keyName(int key) {
+    if (key < 0 || key >= kKeyCount) {
+        return "unknown";
+    }
+    return std::string(kPitchClassNames[keyTonic(key)]) + (isMinorKey(key) ? " minor" : " major");
+}
+
+// Position on the Camelot wheel used by DJs, 0-11 for 1-12: keys a fifth
+// apart are neighbours, and a major key shares its number with its relative
+// minor (C major is 8B, A minor 8A).
+inline int camelotNumber(int key) { return (7 * keyTonic(key) + (isMinorKey(key) ? 4 : 7)) % 12; }
+
+// Steps around the wheel plus one for switching between major and minor, so
+// the mixes that sound smooth (same key, a fifth up or down, relative
+// major/minor) cost 0 or 1.
+inline int camelotDistance(int a, int b) {
+    const int steps = std::abs(camelotNumber(a) - camelotNumber(b));
+    return std::min(steps, 12 - steps) + (isMinorKey(a) != isMinorKey(b));
+}
+
+// Krumhansl-Kessler key profiles, tonic first.
+constexpr std::array<double, 12> kMajorProfile = {6.35, 2.23, 3.48, 2.33, 4.38, 4.09,
+                                                  2.52, 5.19, 2.39, 3.66, 2.29, 2.88};
+constexpr std::array<double, 12> kMinorProfile = {6.33, 2.68, 3.52, 5.38, 2.60, 3.53,
+                                                  2.54, 4.75, 3.98, 2.69, 3.34, 3.17};
+
+struct KeyEstimate {
+    int key = kUnknownKey;
+    // Pearson correlation of the chroma with the winning profile.
+    double correlation = 0.0;
+};
+
+// Picks the key whose rotated profile correlates best with a 12-bin chroma
+// vector (Krumhansl-Schmuckler). Flat or empty chroma gives kUnknownKey.
+inline KeyEstimate estimateKey(const std::array<double, 12>& chroma, double minCorrelation = 0.6) {
+    double mean = 0.0;
+    for (double c : chroma) {
+        mean += c;
+    }
+    mean /= 12.0;
+    double chromaVariance = 0.0;
+    for (double c : chroma) {
+        chromaVariance += (c - mean) * (c - mean);
+    }
+    KeyEstimate best;
+    if (chromaVariance <= 1e-12) {
+        return best;
+    }
+
+    for (int key = 0; key < kKeyCount; ++key) {
+        const auto& profile = isMinorKey(key) ? kMinorProfile : kMajorProfile;
+        double profileMean = 0.0;
+        for (double p : profile) {
+            profileMean += p;
+        }
+        profileMean /= 12.0;
+        double covariance = 0.0, profileVariance = 0.0;
+        for (int pc = 0; pc < 12; ++pc) {
+            const double p = profile[(pc - keyTonic(key) + 12) % 12] - profileMean;
+            covariance += (chroma[pc] - mean) * p;
+            profileVariance += p * p;
+        }
+        const double correlation = covariance / std::sqrt(chromaVariance * profileVariance);
+        if (correlation > best.correlation) {
+            best.key = key;
+            best.correlation = correlation;
+        }
+    }
+    if (best.correlation < minCorrelation) {
+        best.key = kUnknownKey;
+    }
+    return best;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lru_cache.h"
+#include "song.h"
+
+// Candidate songs for a mood grouped by energy, lowest energy first. Building this
+// is the expensive part of a playlist request; ranking from it is cheap.
+struct EnergyBuckets {
+    std::vector<int> energies;
+    std::vector<std::vector<SongId>> songs;
+
+    std::size_t total() const {
+        std::size_t count = 0;
+        for (const auto& bucket : songs) {
+            count += bucket.size();
+        }
+        return count;
+    }
+
+    // Groups IDs by `songDatabase[id].energy`; duplicate IDs are dropped.
+    static EnergyBuckets build(std::vector<SongId> ids, const std::vector<Song>& songDatabase) {
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        std::stable_sort(ids.begin(), ids.end(), [&](SongId a, SongId b) {
+            return songDatabase[a].energy < songDatabase[b].energy;
+        });
+
+        EnergyBuckets buckets;
+        for (SongId id : ids) {
+            int energy = songDatabase[id].energy;
+            if (buckets.energies.empty() || buckets.energies.back() != energy) {
+                buckets.energies.push_back(energy);
+                buckets.songs.emplace_back();
+            }
+            buckets.songs.back().push_back(id);
+        }
+        return buckets;
+    }
+
+    // Adds a song to the bucket for its energy, keeping buckets ordered. Returns
+    // false if the song is already present.
+    bool insert(SongId id, int energy) {
+        auto pos = std::lower_bound(energies.begin(), energies.end(), energy);
+        auto index = static_cast<std::size_t>(pos - energies.begin());
+        if (pos == energies.end() || *pos != energy) {
+            energies.insert(pos, energy);
+            songs.emplace(songs.begin() + index);
+        }
+        auto& bucket = songs[index];
+        if (std::find(bucket.begin(), bucket.end(), id) != bucket.end()) {
+            return false;
+        }
+        bucket.push_back(id);
+        return true;
+    }
+};
+
+// A cached candidate set is valid for one mood as long as neither the user's
+// favorites for that mood nor the catalog have changed; both carry a version
+// counter that is bumped on every change, so stale entries can never match.
+struct PlaylistCacheKey {
+    std::string mood;
+    std::uint64_t favoritesVersion;
+    std::uint64_t catalogVersion;
+
+    bool operator==(const PlaylistCacheKey& other) const {
+        return mood == other.mood && favoritesVersion == other.favoritesVersion &&
+               catalogVersion == other.catalogVersion;
+    }
+};
+
+struct PlaylistCacheKeyHash {
+    std::size_t operator()(const PlaylistCacheKey& key) const {
+        std::size_t h = std::hash<std::string>()(key.mood);
+        h ^= std::hash<std::uint64_t>()(key.favoritesVersion) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+        h ^= std::hash<std::uint64_t>()(key.catalogVersion) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+using PlaylistCache = LruCache<PlaylistCacheKey, std::shared_ptr<const EnergyBuckets>, PlaylistCacheKeyHash>;
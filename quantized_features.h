@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "song.h"
+#include "song_features.h"
+
+// Feature rows stored as int8 with one scale per dimension: value = q * scale[d].
+// A row takes 16 bytes instead of 64, so scans over millions of songs move a
+// quarter of the memory traffic of the float matrix.
+using QuantizedRow = std::array<std::int8_t, kFeatureDims>;
+
+// sum_d weights[d] * (a[d] - b[d])^2 over quantized rows. `weights` must already
+// include scale[d]^2 (see QuantizedFeatureMatrix::combinedWeights).
+inline float quantizedDistance(const std::int8_t* a, const std::int8_t* b, const float* weights) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+    // Sign-extend to 16 bits; differences fit in [-254, 254] and their squares
+    // fit in an unsigned 16-bit lane.
+    __m128i aLo = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+    __m128i aHi = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+    __m128i bLo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+    __m128i bHi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+    __m128i dLo = _mm_sub_epi16(aLo, bLo);
+    __m128i dHi = _mm_sub_epi16(aHi, bHi);
+    __m128i sqLo = _mm_mullo_epi16(dLo, dLo);
+    __m128i sqHi = _mm_mullo_epi16(dHi, dHi);
+    __m128 s0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(sqLo, zero));
+    __m128 s1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(sqLo, zero));
+    __m128 s2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(sqHi, zero));
+    __m128 s3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(sqHi, zero));
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s0, _mm_loadu_ps(weights)),
+                                       _mm_mul_ps(s1, _mm_loadu_ps(weights + 4))),
+                            _mm_add_ps(_mm_mul_ps(s2, _mm_loadu_ps(weights + 8)),
+                                       _mm_mul_ps(s3, _mm_loadu_ps(weights + 12))));
+    __m128 shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+    sum = _mm_add_ps(sum, shuffled);
+    shuffled = _mm_movehl_ps(shuffled, sum);
+    sum = _mm_add_ss(sum, shuffled);
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0.0f;
+    for (std::size_t d = 0; d < kFeatureDims; ++d) {
+        int diff = a[d] - b[d];
+        sum += static_cast<float>(diff * diff) * weights[d];
+    }
+    return sum;
+#endif
+}
+
+// sum_d weights[d] * a[d] * b[d] over quantized rows, with scales folded into
+// `weights` as for quantizedDistance.
+inline float quantizedDot(const std::int8_t* a, const std::int8_t* b, const float* weights) {
+#if defined(__SSE2__)
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+    __m128i aLo = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+    __m128i aHi = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+    __m128i bLo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+    __m128i bHi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+    // |a * b| <= 127 * 128 fits in a signed 16-bit lane.
+    __m128i pLo = _mm_mullo_epi16(aLo, bLo);
+    __m128i pHi = _mm_mullo_epi16(aHi, bHi);
+    __m128 p0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(pLo, pLo), 16));
+    __m128 p1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(pLo, pLo), 16));
+    __m128 p2 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(pHi, pHi), 16));
+    __m128 p3 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(pHi, pHi), 16));
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_loadu_ps(weights)),
+                                       _mm_mul_ps(p1, _mm_loadu_ps(weights + 4))),
+                            _mm_add_ps(_mm_mul_ps(p2, _mm_loadu_ps(weights + 8)),
+                                       _mm_mul_ps(p3, _mm_loadu_ps(weights + 12))));
+    __m128 shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+    sum = _mm_add_ps(sum, shuffled);
+    shuffled = _mm_movehl_ps(shuffled, sum);
+    sum = _mm_add_ss(sum, shuffled);
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0.0f;
+    for (std::size_t d = 0; d < kFeatureDims; ++d) {
+        sum += static_cast<float>(a[d] * b[d]) * weights[d];
+    }
+    return sum;
+#endif
+}
+
+class QuantizedFeatureMatrix {
+public:
+    // Symmetric quantization: each dimension's scale maps its largest magnitude
+    // in `features` to 127.
+    static QuantizedFeatureMatrix fromMatrix(const FeatureMatrix& features) {
+        QuantizedFeatureMatrix quantized;
+        FeatureVector maxAbs{};
+        for (std::size_t i = 0; i < features.size(); ++i) {
+            const float* row = features.row(static_cast<SongId>(i));
+            for (std::size_t d = 0; d < kFeatureDims; ++d) {
+                maxAbs[d] = std::max(maxAbs[d], std::fabs(row[d]));
+            }
+        }
+        for (std::size_t d = 0; d < kFeatureDims; ++d) {
+            quantized.scale[d] = maxAbs[d] > 0.0f ? maxAbs[d] / 127.0f : 1.0f;
+        }
+        quantized.rows.reserve(features.size());
+        for (std::size_t i = 0; i < features.size(); ++i) {
+            quantized.rows.push_back(quantized.quantize(features.row(static_cast<SongId>(i))));
+        }
+        return quantized;
+    }
+
+    QuantizedRow quantize(const float* row) const {
+        QuantizedRow q;
+        for (std::size_t d = 0; d < kFeatureDims; ++d) {
+            float v = std::round(row[d] / scale[d]);
+            q[d] = static_cast<std::int8_t>(std::clamp(v, -127.0f, 127.0f));
+        }
+        return q;
+    }
+
+    void append(const float* row) { rows.push_back(quantize(row)); }
+
+    // Feature weights with the per-dimension scale folded in, for the kernels.
+    FeatureVector combinedWeights(const FeatureWeights& weights) const {
+        FeatureVector combined;
+        for (std::size_t d = 0; d < kFeatureDims; ++d) {
+            combined[d] = weights.weights[d] * scale[d] * scale[d];
+        }
+        return combined;
+    }
+
+    std::size_t size() const { return rows.size(); }
+    const std::int8_t* row(SongId id) const { return rows[id].data(); }
+    const FeatureVector& scales() const { return scale; }
+    std::size_t bytes() const { return rows.size() * sizeof(QuantizedRow); }
+
+    // Exact k-NN in the quantized space by brute force.
+    std::vector<Neighbor> nearest(const float* query, std::size_t k, const FeatureWeights& weights) const {
+        const QuantizedRow q = quantize(query);
+        const FeatureVector combined = combinedWeights(weights);
+        TopK best(k);
+        for (std::size_t i = 0; i < rows.size(); ++i) {
+            best.offer(static_cast<SongId>(i), quantizedDistance(rows[i].data(), q.data(), combined.data()));
+        }
+        return best.take();
+    }
+
+    // Exact k-NN in the quantized space among `ids` only.
+    std::vector<Neighbor> nearestAmong(const float* query, const std::vector<SongId>& ids, std::size_t k,
+                                       const FeatureWeights& weights) const {
+        const QuantizedRow q = quantize(query);
+        const FeatureVector combined = combinedWeights(weights);
+        TopK best(k);
+        for (SongId id : ids) {
+            best.offer(id, quantizedDistance(rows[id].data(), q.data(), combined.data()));
+        }
+        return best.take();
+    }
+
+private:
+    FeatureVector scale{};
+    std::vector<QuantizedRow> rows;
+};
+
+// The k of `ids` nearest to `query`: a scan of the int8 rows keeps the
+// `shortlist` nearest, which are then ordered by their float distance.
+inline std::vector<Neighbor> rerankedNearest(const FeatureMatrix& features, const QuantizedFeatureMatrix& quantized,
+                                             const float* query, const std::vector<SongId>& ids, std::size_t k,
+                                             std::size_t shortlist, const FeatureWeights& weights) {
+    std::vector<Neighbor> result = quantized.nearestAmong(query, ids, std::max(k, shortlist), weights);
+    for (Neighbor& neighbor : result) {
+        neighbor.distance = weightedDistance(features.row(neighbor.id), query, weights.weights.data());
+    }
+    std::sort(result.begin(), result.end(), [](const Neighbor& a, const Neighbor& b) {
+        return a.distance < b.distance || (a.distance == b.distance && a.id < b.id);
+    });
+    if (result.size() > k) {
+        result.resize(k);
+    }
+    return result;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "fast_random.h"
+#include "song.h"
+
+// Endless, lazily generated stream of songs for one mood. Each pull costs O(1)
+// expected time: a random candidate is drawn and rejected if it played within the
+// last `window` songs. Recent songs are tracked in a ring buffer plus a bitset over
+// song IDs, so the state does not grow with the number of songs played.
+class RadioStream {
+public:
+    RadioStream(std::vector<SongId> candidateIds, std::size_t catalogSize,
+                std::size_t noRepeatWindow, std::uint64_t seed)
+        : candidates(std::move(candidateIds)),
+          recentBits((catalogSize + 63) / 64, 0),
+          rng(seed) {
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        // With n candidates at most n - 1 of them can be held back.
+        windowSize = candidates.empty() ? 0 : std::min(noRepeatWindow, candidates.size() - 1);
+        recent.resize(windowSize);
+    }
+
+    bool empty() const { return candidates.empty(); }
+    std::size_t window() const { return windowSize; }
+
+    // Next song in the stream. Must not be called on an empty stream.
+    SongId next() {
+        SongId id = pick();
+        remember(id);
+        return id;
+    }
+
+    std::vector<SongId> next(std::size_t count) {
+        std::vector<SongId> batch;
+        batch.reserve(count);
+        for (std::size_t i = 0; i < count && !empty(); ++i) {
+            batch.push_back(next());
+        }
+        return batch;
+    }
+
+private:
+    static constexpr int kMaxRejections = 32;
+
+    std::vector<SongId> candidates;
+    std::vector<SongId> recent;
+    std::size_t windowSize = 0;
+    std::size_t ringPos = 0;
+    std::size_t ringFill = 0;
+    std::vector<std::uint64_t> recentBits;
+    FastRandom rng;
+
+    bool isRecent(SongId id) const {
+        return (recentBits[id / 64] >> (id % 64)) & 1;
+    }
+
+    void setRecent(SongId id, bool value) {
+        const std::uint64_t mask = std::uint64_t{1} << (id % 64);
+        if (value) {
+            recentBits[id / 64] |= mask;
+        } else {
+            recentBits[id / 64] &= ~mask;
+        }
+    }
+
+    SongId pick() {
+        for (int attempt = 0; attempt < kMaxRejections; ++attempt) {
+            SongId id = candidates[rng.below(candidates.size())];
+            if (!isRecent(id)) {
+                return id;
+            }
+        }
+        // The window covers almost every candidate; walk from a random start to the
+        // first one that is allowed (one always is, since window < candidates).
+        const std::size_t start = rng.below(candidates.size());
+        for (std::size_t i = 0; i < candidates.size(); ++i) {
+            SongId id = candidates[(start + i) % candidates.size()];
+            if (!isRecent(id)) {
+                return id;
+            }
+        }
+        return candidates[start];
+    }
+
+    void remember(SongId id) {
+        if (windowSize == 0) {
+            return;
+        }
+        if (ringFill == windowSize) {
+            setRecent(recent[ringPos], false);
+        } else {
+            ++ringFill;
+        }
+        recent[ringPos] = id;
+        setRecent(id, true);
+        ringPos = (ringPos + 1) % windowSize;
+    }
+};
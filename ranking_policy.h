@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fast_random.h"
+#include "playlist_cache.h"
+#include "song.h"
+#include "song_columns.h"
+
+// Built-in playlist rankings. A ranker is rankCandidates<Score, TieBreak>: the
+// policies are plain structs with static functions, so each combination is its
+// own instantiation with the scoring and comparison inlined, and the choice is
+// made once per request by looking the function up in rankerFor()'s table.
+// Formulas typed in by the user go through ScoreProgram instead.
+
+struct RankingContext {
+    const SongColumns& columns;
+    int currentYear;
+};
+
+// Scoring policies; higher scores rank first. kEnergyOrdered marks scores that
+// fall as energy rises and depend on nothing else, so the energy buckets are
+// already in rank order.
+struct EnergyAscending {
+    static constexpr bool kEnergyOrdered = true;
+    static float score(const RankingContext& context, SongId id) {
+        return -static_cast<float>(context.columns.energy[id]);
+    }
+};
+
+struct DanceabilityWeighted {
+    static constexpr bool kEnergyOrdered = false;
+    static float score(const RankingContext& context, SongId id) {
+        return 0.7f * context.columns.danceability[id] + 0.3f * context.columns.energy[id];
+    }
+};
+
+// Energy plus up to 5 points for new releases, fading out over ten years;
+// songs of unknown year get energy alone.
+struct RecencyBoosted {
+    static constexpr bool kEnergyOrdered = false;
+    static float score(const RankingContext& context, SongId id) {
+        const int year = context.columns.year[id];
+        const int boost = year == kUnknownYear ? 0 : std::clamp(10 - (context.currentYear - year), 0, 10);
+        return context.columns.energy[id] + 0.5f * static_cast<float>(boost);
+    }
+};
+
+struct MostPlayed {
+    static constexpr bool kEnergyOrdered = false;
+    static float score(const RankingContext& context, SongId id) {
+        return static_cast<float>(context.columns.playCount[id]);
+    }
+};
+
+// Tie-break policies; among equal scores the smaller key ranks first.
+struct RandomTieBreak {
+    static std::uint32_t key(const RankingContext&, SongId, FastRandom& rng) {
+        return static_cast<std::uint32_t>(rng());
+    }
+};
+
+// Songs of unknown year after all others.
+struct NewestFirst {
+    static std::uint32_t key(const RankingContext& context, SongId id, FastRandom&) {
+        const int year = context.columns.year[id];
+        return year == kUnknownYear ? 0xFFFFFFFFu : static_cast<std::uint32_t>(32767 - year);
+    }
+};
+
+struct MostPlayedFirst {
+    static std::uint32_t key(const RankingContext& context, SongId id, FastRandom&) {
+        return ~context.columns.playCount[id];
+    }
+};
+
+struct CatalogOrder {
+    static std::uint32_t key(const RankingContext&, SongId id, FastRandom&) { return id; }
+};
+
+// The `count` best of `candidates`, best first.
+template <typename Score, typename TieBreak>
+std::vector<SongId> rankCandidates(const EnergyBuckets& candidates, std::size_t count,
+                                   const RankingContext& context, FastRandom& rng) {
+    struct Ranked {
+        float score;
+        std::uint32_t tie;
+        SongId id;
+    };
+    auto better = [](const Ranked& a, const Ranked& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        return a.tie != b.tie ? a.tie < b.tie : a.id < b.id;
+    };
+    std::vector<SongId> picked;
+    if (count == 0) {
+        return picked;
+    }
+    // The best `limit` songs offered so far, as a heap with the worst in front,
+    // so the candidates are never materialised or sorted. The threshold only
+    // rises, so songs scoring below it can skip the tie-break key: they could
+    // never be picked.
+    std::vector<Ranked> best;
+    best.reserve(count);
+    auto offer = [&](float score, SongId id, std::size_t limit) {
+        if (best.size() < limit) {
+            best.push_back({score, TieBreak::key(context, id, rng), id});
+            std::push_heap(best.begin(), best.end(), better);
+            return;
+        }
+        if (score < best.front().score) {
+            return;
+        }
+        const Ranked song{score, TieBreak::key(context, id, rng), id};
+        if (better(song, best.front())) {
+            std::pop_heap(best.begin(), best.end(), better);
+            best.back() = song;
+            std::push_heap(best.begin(), best.end(), better);
+        }
+    };
+    auto takeBest = [&] {
+        std::sort_heap(best.begin(), best.end(), better);
+        for (const Ranked& song : best) {
+            picked.push_back(song.id);
+        }
+        best.clear();
+    };
+
+    if constexpr (Score::kEnergyOrdered) {
+        // Buckets come in rank order, so only songs within a bucket need
+        // comparing, and only buckets up to the one that fills the playlist.
+        for (const auto& bucket : candidates.songs) {
+            if (picked.size() == count) {
+                break;
+            }
+            const std::size_t limit = count - picked.size();
+            for (SongId id : bucket) {
+                offer(0.0f, id, limit);
+            }
+            takeBest();
+        }
+    } else {
+        for (const auto& bucket : candidates.songs) {
+            for (SongId id : bucket) {
+                offer(Score::score(context, id), id, count);
+            }
+        }
+        takeBest();
+    }
+    return picked;
+}
+
+enum class RankingScore : std::uint8_t { Energy, Danceability, Recency, Popularity };
+enum class RankingTieBreak : std::uint8_t { Random, Newest, MostPlayed, CatalogOrder };
+
+inline constexpr std::array<const char*, 4> kRankingScoreNames = {"energy", "dance", "recent", "popular"};
+inline constexpr std::array<const char*, 4> kRankingTieBreakNames = {"random", "newest", "plays", "catalog"};
+
+using Ranker = std::vector<SongId> (*)(const EnergyBuckets&, std::size_t, const RankingContext&, FastRandom&);
+
+template <typename Score>
+constexpr std::array<Ranker, kRankingTieBreakNames.size()> rankerRow() {
+    return {&rankCandidates<Score, RandomTieBreak>, &rankCandidates<Score, NewestFirst>,
+            &rankCandidates<Score, MostPlayedFirst>, &rankCandidates<Score, CatalogOrder>};
+}
+
+inline Ranker rankerFor(RankingScore score, RankingTieBreak tieBreak) {
+    static constexpr std::array<std::array<Ranker, kRankingTieBreakNames.size()>, kRankingScoreNames.size()> table =
+        {rankerRow<EnergyAscending>(), rankerRow<DanceabilityWeighted>(), rankerRow<RecencyBoosted>(),
+         rankerRow<MostPlayed>()};
+    return table[static_cast<std::size_t>(score)][static_cast<std::size_t>(tieBreak)];
+}
+
+// Parses "score" or "score:tiebreak" using the names above; the tie-break
+// defaults to random.
+inline std::optional<std::pair<RankingScore, RankingTieBreak>> parseRanking(const std::string& text) {
+    const std::size_t colon = text.find(':');
+    const std::string scoreName = text.substr(0, colon);
+    const std::string tieName = colon == std::string::npos ? kRankingTieBreakNames[0] : text.substr(colon + 1);
+    auto score = std::find(kRankingScoreNames.begin(), kRankingScoreNames.end(), scoreName);
+    auto tie = std::find(kRankingTieBreakNames.begin(), kRankingTieBreakNames.end(), tieName);
+    if (score == kRankingScoreNames.end() || tie == kRankingTieBreakNames.end()) {
+        return std::nullopt;
+    }
+    return std::make_pair(static_cast<RankingScore>(score - kRankingScoreNames.begin()),
+                          static_cast<RankingTieBreak>(tie - kRankingTieBreakNames.begin()));
+}
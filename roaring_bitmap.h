@@ -0,0 +1,621 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Compressed set of 32-bit ids in the style of Roaring bitmaps: ids are split
+// by their high 16 bits into containers, each stored as whichever of three
+// encodings is smallest for its contents:
+//
+//   array:  sorted 16-bit values, for up to 4096 ids
+//   bitmap: 65536 bits, for dense containers
+//   run:    (start, length - 1) pairs, for long stretches of consecutive ids
+//
+// AND, OR and AND NOT work container by container; dense containers are
+// combined 128 bits at a time and sparse ones by merging or probing, so no
+// operation touches individual ids of a bitmap container.
+class RoaringBitmap {
+public:
+    RoaringBitmap() = default;
+
+    // Builds from ids in ascending order.
+    static RoaringBitmap fromSorted(const std::vector<std::uint32_t>& ids) {
+        RoaringBitmap bitmap;
+        for (std::uint32_t id : ids) {
+            bitmap.add(id);
+        }
+        bitmap.runOptimize();
+        return bitmap;
+    }
+
+    // Builds from ids in any order, duplicates allowed, by setting bits in a
+    // dense buffer sized by the largest id (so meant for dense id spaces such as
+    // song ids) instead of sorting.
+    static RoaringBitmap fromUnsorted(const std::uint32_t* begin, const std::uint32_t* end) {
+        RoaringBitmap bitmap;
+        if (begin == end) {
+            return bitmap;
+        }
+        const std::uint32_t lastKey = *std::max_element(begin, end) >> 16;
+        std::vector<std::uint64_t> words((static_cast<std::size_t>(lastKey) + 1) * kBitmapWords);
+        for (const std::uint32_t* id = begin; id != end; ++id) {
+            words[*id / 64] |= std::uint64_t{1} << (*id % 64);
+        }
+        return fromWords(words.data(), words.size());
+    }
+
+    // Builds from a dense bitset: bit i of words[i / 64] is id i.
+    static RoaringBitmap fromWords(const std::uint64_t* words, std::size_t wordCount) {
+        RoaringBitmap bitmap;
+        for (std::size_t start = 0; start < wordCount; start += kBitmapWords) {
+            Container container;
+            container.kind = Kind::Bitmap;
+            container.words.assign(words + start, words + std::min(wordCount, start + kBitmapWords));
+            container.words.resize(kBitmapWords);
+            bitmap.append(static_cast<std::uint16_t>(start / kBitmapWords), finishWords(std::move(container)));
+        }
+        return bitmap;
+    }
+
+    // Sets the bits of this bitmap's ids in a dense bitset of `wordCount` words;
+    // ids beyond it are ignored.
+    void copyTo(std::uint64_t* words, std::size_t wordCount) const {
+        for (std::size_t i = 0; i < containers.size(); ++i) {
+            const std::size_t start = static_cast<std::size_t>(keys[i]) * kBitmapWords;
+            if (start >= wordCount) {
+                break;
+            }
+            if (start + kBitmapWords <= wordCount) {
+                Words scratch;
+                const std::uint64_t* bits = bitsOf(containers[i], scratch);
+                for (std::size_t w = 0; w < kBitmapWords; ++w) {
+                    words[start + w] |= bits[w];
+                }
+                continue;
+            }
+            forEachRun(containers[i], [&](std::uint32_t first, std::uint32_t last) {
+                last = std::min<std::uint32_t>(last, static_cast<std::uint32_t>((wordCount - start) * 64 - 1));
+                if (first <= last) {
+                    setRange(words + start, first, last);
+                }
+            });
+        }
+    }
+
+    // All ids in [0, end).
+    static RoaringBitmap range(std::uint32_t end) {
+        RoaringBitmap bitmap;
+        for (std::uint32_t start = 0; start < end; start += 0x10000) {
+            Container container;
+            container.kind = Kind::Run;
+            const std::uint32_t last = std::min<std::uint32_t>(end - start, 0x10000) - 1;
+            container.values = {0, static_cast<std::uint16_t>(last)};
+            container.cardinality = last + 1;
+            bitmap.keys.push_back(static_cast<std::uint16_t>(start >> 16));
+            bitmap.containers.push_back(std::move(container));
+        }
+        return bitmap;
+    }
+
+    // Cheapest when ids arrive in ascending order.
+    void add(std::uint32_t id) {
+        const std::uint16_t key = static_cast<std::uint16_t>(id >> 16);
+        const std::uint16_t low = static_cast<std::uint16_t>(id);
+        if (keys.empty() || keys.back() < key) {
+            keys.push_back(key);
+            containers.emplace_back();
+        }
+        std::size_t index = keys.size() - 1;
+        if (keys[index] != key) {
+            index = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+            if (keys[index] != key) {
+                keys.insert(keys.begin() + index, key);
+                containers.insert(containers.begin() + index, Container());
+            }
+        }
+        insert(containers[index], low);
+    }
+
+    bool contains(std::uint32_t id) const {
+        auto it = std::lower_bound(keys.begin(), keys.end(), static_cast<std::uint16_t>(id >> 16));
+        return it != keys.end() && *it == (id >> 16) &&
+               containsLow(containers[it - keys.begin()], static_cast<std::uint16_t>(id));
+    }
+
+    std::size_t cardinality() const {
+        std::size_t count = 0;
+        for (const auto& container : containers) {
+            count += container.cardinality;
+        }
+        return count;
+    }
+
+    bool empty() const { return containers.empty(); }
+
+    // Bytes of container payload (keys and values).
+    std::size_t sizeInBytes() const {
+        std::size_t bytes = keys.size() * sizeof(std::uint16_t);
+        for (const auto& container : containers) {
+            bytes += container.values.size() * sizeof(std::uint16_t) + container.words.size() * sizeof(std::uint64_t);
+        }
+        return bytes;
+    }
+
+    // Re-encodes each container as runs where that is smaller.
+    void runOptimize() {
+        for (auto& container : containers) {
+            std::vector<std::uint16_t> runs;
+            forEachRun(container, [&](std::uint32_t start, std::uint32_t last) {
+                runs.push_back(static_cast<std::uint16_t>(start));
+                runs.push_back(static_cast<std::uint16_t>(last - start));
+            });
+            const std::size_t currentBytes =
+                container.kind == Kind::Bitmap ? kBitmapWords * 8 : container.values.size() * 2;
+            if (container.kind != Kind::Run && runs.size() * 2 < currentBytes) {
+                container.kind = Kind::Run;
+                container.values = std::move(runs);
+                std::vector<std::uint64_t>().swap(container.words);
+            }
+        }
+    }
+
+    // Calls f(id) for every id in ascending order.
+    template <typename F>
+    void forEach(F&& f) const {
+        for (std::size_t i = 0; i < containers.size(); ++i) {
+            const std::uint32_t high = static_cast<std::uint32_t>(keys[i]) << 16;
+            const Container& container = containers[i];
+            switch (container.kind) {
+                case Kind::Array:
+                    for (std::uint16_t low : container.values) {
+                        f(high | low);
+                    }
+                    break;
+                case Kind::Bitmap:
+                    for (std::size_t w = 0; w < kBitmapWords; ++w) {
+                        for (std::uint64_t bits = container.words[w]; bits != 0; bits &= bits - 1) {
+                            f(high | static_cast<std::uint32_t>(w * 64 + __builtin_ctzll(bits)));
+                        }
+                    }
+                    break;
+                case Kind::Run:
+                    for (std::size_t r = 0; r < container.values.size(); r += 2) {
+                        const std::uint32_t start = container.values[r];
+                        for (std::uint32_t low = start; low <= start + container.values[r + 1]; ++low) {
+                            f(high | low);
+                        }
+                    }
+                    break;
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> toVector() const {
+        std::vector<std::uint32_t> ids;
+        ids.reserve(cardinality());
+        forEach([&](std::uint32_t id) { ids.push_back(id); });
+        return ids;
+    }
+
+    friend RoaringBitmap operator&(const RoaringBitmap& a, const RoaringBitmap& b) {
+        RoaringBitmap result;
+        for (std::size_t i = 0, j = 0; i < a.keys.size() && j < b.keys.size();) {
+            if (a.keys[i] < b.keys[j]) {
+                ++i;
+            } else if (b.keys[j] < a.keys[i]) {
+                ++j;
+            } else {
+                result.append(a.keys[i], intersect(a.containers[i], b.containers[j]));
+                ++i;
+                ++j;
+            }
+        }
+        return result;
+    }
+
+    friend RoaringBitmap operator|(const RoaringBitmap& a, const RoaringBitmap& b) {
+        RoaringBitmap result;
+        std::size_t i = 0, j = 0;
+        while (i < a.keys.size() || j < b.keys.size()) {
+            if (j == b.keys.size() || (i < a.keys.size() && a.keys[i] < b.keys[j])) {
+                result.append(a.keys[i], a.containers[i]);
+                ++i;
+            } else if (i == a.keys.size() || b.keys[j] < a.keys[i]) {
+                result.append(b.keys[j], b.containers[j]);
+                ++j;
+            } else {
+                result.append(a.keys[i], unite(a.containers[i], b.containers[j]));
+                ++i;
+                ++j;
+            }
+        }
+        return result;
+    }
+
+    // Ids in `a` but not in `b`.
+    friend RoaringBitmap andNot(const RoaringBitmap& a, const RoaringBitmap& b) {
+        RoaringBitmap result;
+        std::size_t j = 0;
+        for (std::size_t i = 0; i < a.keys.size(); ++i) {
+            while (j < b.keys.size() && b.keys[j] < a.keys[i]) {
+                ++j;
+            }
+            if (j < b.keys.size() && b.keys[j] == a.keys[i]) {
+                result.append(a.keys[i], subtract(a.containers[i], b.containers[j]));
+            } else {
+                result.append(a.keys[i], a.containers[i]);
+            }
+        }
+        return result;
+    }
+
+private:
+    static constexpr std::size_t kBitmapWords = 1024;
+    static constexpr std::size_t kMaxArraySize = 4096;
+
+    enum class Kind : std::uint8_t { Array, Bitmap, Run };
+
+    struct Container {
+        Kind kind = Kind::Array;
+        std::uint32_t cardinality = 0;
+        // Sorted values (array) or (start, length - 1) pairs (run).
+        std::vector<std::uint16_t> values;
+        // kBitmapWords words (bitmap).
+        std::vector<std::uint64_t> words;
+    };
+
+    using Words = std::array<std::uint64_t, kBitmapWords>;
+
+    std::vector<std::uint16_t> keys;
+    std::vector<Container> containers;
+
+    void append(std::uint16_t key, Container container) {
+        if (container.cardinality > 0) {
+            keys.push_back(key);
+            containers.push_back(std::move(container));
+        }
+    }
+
+    static void insert(Container& container, std::uint16_t low) {
+        if (container.kind == Kind::Run) {
+            toBitmap(container);
+        }
+        if (container.kind == Kind::Array) {
+            auto& values = container.values;
+            if (values.empty() || values.back() < low) {
+                values.push_back(low);
+            } else {
+                auto it = std::lower_bound(values.begin(), values.end(), low);
+                if (*it == low) {
+                    return;
+                }
+                values.insert(it, low);
+            }
+            ++container.cardinality;
+            if (values.size() > kMaxArraySize) {
+                toBitmap(container);
+            }
+            return;
+        }
+        std::uint64_t& word = container.words[low / 64];
+        const std::uint64_t bit = std::uint64_t{1} << (low % 64);
+        container.cardinality += (word & bit) == 0;
+        word |= bit;
+    }
+
+    static bool containsLow(const Container& container, std::uint16_t low) {
+        switch (container.kind) {
+            case Kind::Array:
+                return std::binary_search(container.values.begin(), container.values.end(), low);
+            case Kind::Bitmap:
+                return (container.words[low / 64] >> (low % 64)) & 1;
+            case Kind::Run: {
+                // Last run starting at or before `low`.
+                std::size_t lo = 0, hi = container.values.size() / 2;
+                while (lo < hi) {
+                    const std::size_t mid = (lo + hi) / 2;
+                    if (container.values[2 * mid] <= low) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                return lo > 0 && low - container.values[2 * (lo - 1)] <= container.values[2 * (lo - 1) + 1];
+            }
+        }
+        return false;
+    }
+
+    // Calls f(first, last) for each maximal run of consecutive values.
+    template <typename F>
+    static void forEachRun(const Container& container, F&& f) {
+        if (container.kind == Kind::Run) {
+            for (std::size_t r = 0; r < container.values.size(); r += 2) {
+                f(container.values[r], container.values[r] + container.values[r + 1]);
+            }
+            return;
+        }
+        std::uint32_t start = 0, previous = 0;
+        bool open = false;
+        auto visit = [&](std::uint32_t value) {
+            if (open && value == previous + 1) {
+                previous = value;
+                return;
+            }
+            if (open) {
+                f(start, previous);
+            }
+            start = previous = value;
+            open = true;
+        };
+        if (container.kind == Kind::Array) {
+            for (std::uint16_t value : container.values) {
+                visit(value);
+            }
+        } else {
+            for (std::size_t w = 0; w < kBitmapWords; ++w) {
+                for (std::uint64_t bits = container.words[w]; bits != 0; bits &= bits - 1) {
+                    visit(static_cast<std::uint32_t>(w * 64 + __builtin_ctzll(bits)));
+                }
+            }
+        }
+        if (open) {
+            f(start, previous);
+        }
+    }
+
+    // The container's bits, from the container itself if it is a bitmap and
+    // otherwise expanded into `scratch`.
+    static const std::uint64_t* bitsOf(const Container& container, Words& scratch) {
+        if (container.kind == Kind::Bitmap) {
+            return container.words.data();
+        }
+        scratch.fill(0);
+        if (container.kind == Kind::Array) {
+            for (std::uint16_t value : container.values) {
+                scratch[value / 64] |= std::uint64_t{1} << (value % 64);
+            }
+        } else {
+            for (std::size_t r = 0; r < container.values.size(); r += 2) {
+                setRange(scratch.data(), container.values[r], container.values[r] + container.values[r + 1]);
+            }
+        }
+        return scratch.data();
+    }
+
+    // Sets bits [first, last].
+    static void setRange(std::uint64_t* words, std::uint32_t first, std::uint32_t last) {
+        const std::size_t firstWord = first / 64, lastWord = last / 64;
+        const std::uint64_t firstMask = ~std::uint64_t{0} << (first % 64);
+        const std::uint64_t lastMask = ~std::uint64_t{0} >> (63 - last % 64);
+        if (firstWord == lastWord) {
+            words[firstWord] |= firstMask & lastMask;
+            return;
+        }
+        words[firstWord] |= firstMask;
+        for (std::size_t w = firstWord + 1; w < lastWord; ++w) {
+            words[w] = ~std::uint64_t{0};
+        }
+        words[lastWord] |= lastMask;
+    }
+
+    static void toBitmap(Container& container) {
+        Words scratch;
+        const std::uint64_t* bits = bitsOf(container, scratch);
+        container.words.assign(bits, bits + kBitmapWords);
+        container.values.clear();
+        container.values.shrink_to_fit();
+        container.kind = Kind::Bitmap;
+    }
+
+    enum class Op { And, Or, AndNot };
+
+    static std::uint32_t popcount(std::uint64_t x) {
+#if defined(__POPCNT__)
+        return static_cast<std::uint32_t>(__builtin_popcountll(x));
+#else
+        // Without the instruction the builtin is a library call.
+        x = x - ((x >> 1) & 0x5555555555555555ull);
+        x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+        return static_cast<std::uint32_t>((x * 0x0101010101010101ull) >> 56);
+#endif
+    }
+
+    // Combines two run containers interval by interval, stepping from one
+    // change of membership to the next.
+    static Container combineRuns(const Container& a, const Container& b, Op op) {
+        const std::vector<std::uint16_t>& x = a.values;
+        const std::vector<std::uint16_t>& y = b.values;
+        Container result;
+        result.kind = Kind::Run;
+        std::size_t i = 0, j = 0;
+        for (std::uint32_t position = 0; position < 0x10000;) {
+            // Runs as half-open [start, end).
+            while (i < x.size() && x[i] + x[i + 1] + 1u <= position) {
+                i += 2;
+            }
+            while (j < y.size() && y[j] + y[j + 1] + 1u <= position) {
+                j += 2;
+            }
+            const bool inA = i < x.size() && x[i] <= position;
+            const bool inB = j < y.size() && y[j] <= position;
+            const std::uint32_t nextA = i == x.size() ? 0x10000u : inA ? x[i] + x[i + 1] + 1u : x[i];
+            const std::uint32_t nextB = j == y.size() ? 0x10000u : inB ? y[j] + y[j + 1] + 1u : y[j];
+            const std::uint32_t next = std::min(nextA, nextB);
+            const bool keep = op == Op::And ? inA && inB : op == Op::Or ? inA || inB : inA && !inB;
+            if (keep) {
+                auto& runs = result.values;
+                if (!runs.empty() && runs[runs.size() - 2] + runs.back() + 1u == position) {
+                    runs.back() = static_cast<std::uint16_t>(runs.back() + (next - position));
+                } else {
+                    runs.push_back(static_cast<std::uint16_t>(position));
+                    runs.push_back(static_cast<std::uint16_t>(next - position - 1));
+                }
+                result.cardinality += next - position;
+            }
+            position = next;
+        }
+        return result;
+    }
+
+    static std::uint64_t combineWord(std::uint64_t a, std::uint64_t b, Op op) {
+        return op == Op::And ? a & b : op == Op::Or ? a | b : a & ~b;
+    }
+
+    // Combines two bitmaps word by word into a new container. The result is
+    // counted first, so a sparse one goes straight into an array without an
+    // intermediate bitmap.
+    static Container combineWords(const std::uint64_t* a, const std::uint64_t* b, Op op) {
+        Container result;
+        std::uint32_t count = 0;
+        for (std::size_t w = 0; w < kBitmapWords; ++w) {
+            count += popcount(combineWord(a[w], b[w], op));
+        }
+        result.cardinality = count;
+        if (count <= kMaxArraySize) {
+            result.values.resize(count);
+            std::uint16_t* values = result.values.data();
+            for (std::size_t w = 0; w < kBitmapWords; ++w) {
+                for (std::uint64_t bits = combineWord(a[w], b[w], op); bits != 0; bits &= bits - 1) {
+                    *values++ = static_cast<std::uint16_t>(w * 64 + __builtin_ctzll(bits));
+                }
+            }
+            return result;
+        }
+        result.kind = Kind::Bitmap;
+        result.words.resize(kBitmapWords);
+        std::uint64_t* out = result.words.data();
+#if defined(__SSE2__)
+        for (std::size_t w = 0; w < kBitmapWords; w += 2) {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + w));
+            const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + w));
+            const __m128i z = op == Op::And ? _mm_and_si128(x, y) : op == Op::Or ? _mm_or_si128(x, y)
+                                                                               : _mm_andnot_si128(y, x);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + w), z);
+        }
+#else
+        for (std::size_t w = 0; w < kBitmapWords; ++w) {
+            out[w] = combineWord(a[w], b[w], op);
+        }
+#endif
+        return result;
+    }
+
+    // Counts a freshly filled bitmap container and turns it into an array if
+    // it is sparse.
+    static Container finishWords(Container container) {
+        const std::uint64_t* words = container.words.data();
+        std::uint32_t count = 0;
+        for (std::size_t w = 0; w < kBitmapWords; ++w) {
+            count += popcount(words[w]);
+        }
+        container.cardinality = count;
+        if (count <= kMaxArraySize) {
+            container.kind = Kind::Array;
+            container.values.resize(count);
+            std::uint16_t* values = container.values.data();
+            for (std::size_t w = 0; w < kBitmapWords; ++w) {
+                for (std::uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+                    *values++ = static_cast<std::uint16_t>(w * 64 + __builtin_ctzll(bits));
+                }
+            }
+            std::vector<std::uint64_t>().swap(container.words);
+        }
+        return container;
+    }
+
+    // The values of an array container for which `keep` holds.
+    template <typename Keep>
+    static Container filterArray(const Container& array, Keep&& keep) {
+        Container result;
+        result.values.reserve(array.values.size());
+        for (std::uint16_t value : array.values) {
+            if (keep(value)) {
+                result.values.push_back(value);
+            }
+        }
+        result.cardinality = static_cast<std::uint32_t>(result.values.size());
+        return result;
+    }
+
+    static Container intersect(const Container& a, const Container& b) {
+        if (a.kind == Kind::Run && b.kind == Kind::Run) {
+            return combineRuns(a, b, Op::And);
+        }
+        if (a.kind == Kind::Array && b.kind == Kind::Array) {
+            const Container& small = a.values.size() <= b.values.size() ? a : b;
+            const Container& large = &small == &a ? b : a;
+            Container result;
+            result.values.reserve(small.values.size());
+            if (small.values.size() * 32 < large.values.size()) {
+                // Very different sizes: gallop through the larger array.
+                auto it = large.values.begin();
+                for (std::uint16_t value : small.values) {
+                    it = std::lower_bound(it, large.values.end(), value);
+                    if (it == large.values.end()) {
+                        break;
+                    }
+                    if (*it == value) {
+                        result.values.push_back(value);
+                    }
+                }
+            } else {
+                std::set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+                                      std::back_inserter(result.values));
+            }
+            result.cardinality = static_cast<std::uint32_t>(result.values.size());
+            return result;
+        }
+        if (a.kind == Kind::Array || b.kind == Kind::Array) {
+            const Container& array = a.kind == Kind::Array ? a : b;
+            const Container& other = &array == &a ? b : a;
+            if (other.kind == Kind::Bitmap) {
+                const std::uint64_t* words = other.words.data();
+                return filterArray(array, [words](std::uint16_t v) { return (words[v / 64] >> (v % 64)) & 1; });
+            }
+            return filterArray(array, [&other](std::uint16_t v) { return containsLow(other, v); });
+        }
+        Words scratchA, scratchB;
+        return combineWords(bitsOf(a, scratchA), bitsOf(b, scratchB), Op::And);
+    }
+
+    static Container unite(const Container& a, const Container& b) {
+        if (a.kind == Kind::Run && b.kind == Kind::Run) {
+            return combineRuns(a, b, Op::Or);
+        }
+        if (a.kind == Kind::Array && b.kind == Kind::Array && a.values.size() + b.values.size() <= kMaxArraySize) {
+            Container result;
+            result.values.reserve(a.values.size() + b.values.size());
+            std::set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+                           std::back_inserter(result.values));
+            result.cardinality = static_cast<std::uint32_t>(result.values.size());
+            return result;
+        }
+        Words scratchA, scratchB;
+        return combineWords(bitsOf(a, scratchA), bitsOf(b, scratchB), Op::Or);
+    }
+
+    static Container subtract(const Container& a, const Container& b) {
+        if (a.kind == Kind::Run && b.kind == Kind::Run) {
+            return combineRuns(a, b, Op::AndNot);
+        }
+        if (a.kind == Kind::Array) {
+            if (b.kind == Kind::Bitmap) {
+                const std::uint64_t* words = b.words.data();
+                return filterArray(a, [words](std::uint16_t v) { return !((words[v / 64] >> (v % 64)) & 1); });
+            }
+            return filterArray(a, [&b](std::uint16_t v) { return !containsLow(b, v); });
+        }
+        Words scratchA, scratchB;
+        return combineWords(bitsOf(a, scratchA), bitsOf(b, scratchB), Op::AndNot);
+    }
+};
@@ -0,0 +1,512 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "song.h"
+#include "song_columns.h"
+
+// A per-song scoring formula such as "0.6*energy + 0.4*danceability -
+// age_penalty", compiled to bytecode for a small stack machine. Each stack slot
+// holds a whole batch of songs, so a program dispatches every instruction once per
+// kBatch songs and the work is done by tight loops over float arrays that the
+// compiler vectorises, rather than by a switch per song per operator.
+//
+// Fields are energy, danceability (or dance), year, plays, bpm, age (years
+// since release, counted from the year passed to parse()) and age_penalty
+// (age / 10: a point per decade, on the scale of energy). Songs of unknown year
+// count as released that year, so age terms leave them alone. Formulas combine
+// them with numbers, + - * /, parentheses, min(a, b), max(a, b) and abs(x).
+class ScoreProgram {
+public:
+    // Songs scored per pass over the bytecode.
+    static constexpr std::size_t kBatch = 256;
+    // Deepest operand stack a program may need.
+    static constexpr std::size_t kMaxStack = 16;
+
+    // Returns nullopt (and a message in `error`) for malformed formulas,
+    // unknown names and formulas too large for the bytecode.
+    static std::optional<ScoreProgram> parse(const std::string& text, int currentYear, std::string* error = nullptr) {
+        Parser parser{tokenize(text), 0, {}, {}};
+        std::optional<int> root = parser.parseSum();
+        if (root && parser.pos < parser.tokens.size()) {
+            parser.error = "unexpected '" + parser.tokens[parser.pos] + "'";
+            root.reset();
+        }
+        ScoreProgram program;
+        program.sourceText = text;
+        program.currentYear = currentYear;
+        if (root && !program.compile(parser.nodes, *root, parser.error)) {
+            root.reset();
+        }
+        if (!root) {
+            if (error) {
+                *error = parser.error;
+            }
+            return std::nullopt;
+        }
+        return program;
+    }
+
+    const std::string& text() const { return sourceText; }
+    std::size_t codeSize() const { return code.size(); }
+
+    // scores[i] = score of song first + i, for i < count.
+    void scoreRange(const SongColumns& columns, std::size_t first, std::size_t count, float* scores) const {
+        execute(columns, count, scores, [first](std::size_t i) { return first + i; });
+    }
+
+    // scores[i] = score of song ids[i], for i < count.
+    void scoreSongs(const SongColumns& columns, const SongId* ids, std::size_t count, float* scores) const {
+        execute(columns, count, scores, [ids](std::size_t i) { return static_cast<std::size_t>(ids[i]); });
+    }
+
+    // One instruction per line, for debugging and benchmarks.
+    void disassemble(std::ostream& out) const {
+        for (std::size_t pc = 0; pc < code.size();) {
+            const Opcode op = static_cast<Opcode>(code[pc++]);
+            out << "  " << kOpcodeNames[static_cast<int>(op)];
+            if (op == Opcode::Load || op == Opcode::LoadScaled) {
+                out << " " << kFieldNames[code[pc++]];
+            }
+            if (op == Opcode::LoadScaled || op == Opcode::Const || op == Opcode::AddConst || op == Opcode::MulConst) {
+                out << " " << constants[code[pc++]];
+            }
+            out << "\n";
+        }
+    }
+
+private:
+    enum class Field : std::uint8_t { Energy, Danceability, Year, Plays, Bpm, Age };
+    static constexpr const char* kFieldNames[] = {"energy", "danceability", "year", "plays", "bpm", "age"};
+
+    // Load and LoadScaled take a field byte; LoadScaled, Const, AddConst and
+    // MulConst a constant-pool byte. Binary operators pop the top slot and
+    // combine it into the one below.
+    enum class Opcode : std::uint8_t {
+        Load, LoadScaled, Const, Add, Sub, Mul, Div, Min, Max, Neg, Abs, AddConst, MulConst
+    };
+    static constexpr const char* kOpcodeNames[] = {"load", "loadscaled", "const", "add", "sub",  "mul",  "div",
+                                                   "min",  "max",        "neg",   "abs", "addc", "mulc"};
+
+    enum class Kind : std::uint8_t { Const, Field, Neg, Abs, Add, Sub, Mul, Div, Min, Max };
+
+    struct Node {
+        Kind kind;
+        float value;
+        Field field;
+        // Operands; b is unused by Neg and Abs.
+        int a, b;
+    };
+
+    std::string sourceText;
+    std::vector<std::uint8_t> code;
+    std::vector<float> constants;
+    int currentYear = 0;
+
+    static float apply(Kind kind, float a, float b) {
+        switch (kind) {
+            case Kind::Neg:
+                return -a;
+            case Kind::Abs:
+                return a < 0.0f ? -a : a;
+            case Kind::Add:
+                return a + b;
+            case Kind::Sub:
+                return a - b;
+            case Kind::Mul:
+                return a * b;
+            case Kind::Div:
+                return a / b;
+            case Kind::Min:
+                return b < a ? b : a;
+            case Kind::Max:
+                return b > a ? b : a;
+            default:
+                return a;
+        }
+    }
+
+    static std::vector<std::string> tokenize(const std::string& text) {
+        std::vector<std::string> tokens;
+        std::size_t i = 0;
+        while (i < text.size()) {
+            const unsigned char c = static_cast<unsigned char>(text[i]);
+            std::size_t end = i + 1;
+            if (std::isspace(c)) {
+                ++i;
+                continue;
+            }
+            if (std::isdigit(c) || c == '.') {
+                char* stop = nullptr;
+                std::strtod(text.c_str() + i, &stop);
+                end = std::max(end, static_cast<std::size_t>(stop - text.c_str()));
+            } else if (std::isalpha(c) || c == '_') {
+                while (end < text.size() &&
+                       (std::isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_')) {
+                    ++end;
+                }
+            }
+            std::string token = text.substr(i, end - i);
+            std::transform(token.begin(), token.end(), token.begin(),
+                           [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+            tokens.push_back(token);
+            i = end;
+        }
+        return tokens;
+    }
+
+    struct Parser {
+        std::vector<std::string> tokens;
+        std::size_t pos;
+        std::vector<Node> nodes;
+        std::string error;
+
+        bool accept(const char* token) {
+            if (pos < tokens.size() && tokens[pos] == token) {
+                ++pos;
+                return true;
+            }
+            return false;
+        }
+
+        std::optional<int> parseSum() {
+            std::optional<int> left = parseProduct();
+            while (left && pos < tokens.size() && (tokens[pos] == "+" || tokens[pos] == "-")) {
+                const Kind kind = tokens[pos++] == "+" ? Kind::Add : Kind::Sub;
+                std::optional<int> right = parseProduct();
+                left = right ? std::optional<int>(add(kind, *left, *right)) : std::nullopt;
+            }
+            return left;
+        }
+
+        std::optional<int> parseProduct() {
+            std::optional<int> left = parseUnary();
+            while (left && pos < tokens.size() && (tokens[pos] == "*" || tokens[pos] == "/")) {
+                const Kind kind = tokens[pos++] == "*" ? Kind::Mul : Kind::Div;
+                std::optional<int> right = parseUnary();
+                left = right ? std::optional<int>(add(kind, *left, *right)) : std::nullopt;
+            }
+            return left;
+        }
+
+        std::optional<int> parseUnary() {
+            if (accept("-")) {
+                std::optional<int> operand = parseUnary();
+                return operand ? std::optional<int>(add(Kind::Neg, *operand)) : std::nullopt;
+            }
+            if (accept("+")) {
+                return parseUnary();
+            }
+            return parsePrimary();
+        }
+
+        std::optional<int> parsePrimary() {
+            if (pos == tokens.size()) {
+                error = "expected a number or field";
+                return std::nullopt;
+            }
+            const std::string token = tokens[pos++];
+            if (token == "(") {
+                std::optional<int> inner = parseSum();
+                if (inner && !accept(")")) {
+                    error = "missing ')'";
+                    return std::nullopt;
+                }
+                return inner;
+            }
+            if (std::isdigit(static_cast<unsigned char>(token[0])) || token[0] == '.') {
+                char* stop = nullptr;
+                const double value = std::strtod(token.c_str(), &stop);
+                if (stop != token.c_str() + token.size()) {
+                    error = "bad number '" + token + "'";
+                    return std::nullopt;
+                }
+                return constant(static_cast<float>(value));
+            }
+            if (token == "min" || token == "max" || token == "abs") {
+                return parseCall(token);
+            }
+            for (std::size_t f = 0; f < std::size(kFieldNames); ++f) {
+                if (token == kFieldNames[f]) {
+                    return field(static_cast<Field>(f));
+                }
+            }
+            if (token == "dance") {
+                return field(Field::Danceability);
+            }
+            if (token == "age_penalty") {
+                return add(Kind::Mul, field(Field::Age), constant(0.1f));
+            }
+            error = std::isalpha(static_cast<unsigned char>(token[0])) ? "unknown field '" + token + "'"
+                                                                        : "unexpected '" + token + "'";
+            return std::nullopt;
+        }
+
+        std::optional<int> parseCall(const std::string& name) {
+            if (!accept("(")) {
+                error = "expected '(' after " + name;
+                return std::nullopt;
+            }
+            std::optional<int> first = parseSum();
+            if (!first) {
+                return std::nullopt;
+            }
+            if (name == "abs") {
+                if (!accept(")")) {
+                    error = "abs takes one argument";
+                    return std::nullopt;
+                }
+                return add(Kind::Abs, *first);
+            }
+            if (!accept(",")) {
+                error = name + " takes two arguments";
+                return std::nullopt;
+            }
+            std::optional<int> second = parseSum();
+            if (second && !accept(")")) {
+                error = name + " takes two arguments";
+                return std::nullopt;
+            }
+            return second ? std::optional<int>(add(name == "min" ? Kind::Min : Kind::Max, *first, *second))
+                          : std::nullopt;
+        }
+
+        int constant(float value) { return push({Kind::Const, value, Field::Energy, -1, -1}); }
+        int field(Field f) { return push({Kind::Field, 0.0f, f, -1, -1}); }
+
+        // Folds operators whose operands are all constants.
+        int add(Kind kind, int a, int b = -1) {
+            if (nodes[a].kind == Kind::Const && (b < 0 || nodes[b].kind == Kind::Const)) {
+                return constant(apply(kind, nodes[a].value, b < 0 ? 0.0f : nodes[b].value));
+            }
+            return push({kind, 0.0f, Field::Energy, a, b});
+        }
+
+        int push(Node node) {
+            nodes.push_back(node);
+            return static_cast<int>(nodes.size()) - 1;
+        }
+    };
+
+    bool compile(const std::vector<Node>& nodes, int root, std::string& error) {
+        std::size_t depth = 0;
+        if (!emit(nodes, root, depth, error)) {
+            code.clear();
+            constants.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // Appends code leaving the value of node `index` on top of the stack.
+    // Multiplying a field by a constant, and adding or multiplying by a
+    // constant, take one instruction instead of two.
+    bool emit(const std::vector<Node>& nodes, int index, std::size_t& depth, std::string& error) {
+        const Node& node = nodes[index];
+        auto isConst = [&](int i) { return i >= 0 && nodes[i].kind == Kind::Const; };
+        switch (node.kind) {
+            case Kind::Const:
+                return push(depth, error) && emitOp(Opcode::Const, error, -1, node.value);
+            case Kind::Field:
+                return push(depth, error) && emitOp(Opcode::Load, error, static_cast<int>(node.field));
+            case Kind::Neg:
+            case Kind::Abs:
+                return emit(nodes, node.a, depth, error) &&
+                       emitOp(node.kind == Kind::Neg ? Opcode::Neg : Opcode::Abs, error);
+            default:
+                break;
+        }
+        if (node.kind == Kind::Mul || node.kind == Kind::Add || (node.kind == Kind::Sub && isConst(node.b))) {
+            const int constant = isConst(node.b) ? node.b : isConst(node.a) ? node.a : -1;
+            if (constant >= 0) {
+                const int other = constant == node.b ? node.a : node.b;
+                const float value = node.kind == Kind::Sub ? -nodes[constant].value : nodes[constant].value;
+                if (node.kind == Kind::Mul && nodes[other].kind == Kind::Field) {
+                    return push(depth, error) &&
+                           emitOp(Opcode::LoadScaled, error, static_cast<int>(nodes[other].field), value);
+                }
+                return emit(nodes, other, depth, error) &&
+                       emitOp(node.kind == Kind::Mul ? Opcode::MulConst : Opcode::AddConst, error, -1, value);
+            }
+        }
+        static constexpr Opcode binary[] = {Opcode::Add, Opcode::Sub, Opcode::Mul,
+                                            Opcode::Div, Opcode::Min, Opcode::Max};
+        if (!emit(nodes, node.a, depth, error) || !emit(nodes, node.b, depth, error)) {
+            return false;
+        }
+        --depth;
+        return emitOp(binary[static_cast<int>(node.kind) - static_cast<int>(Kind::Add)], error);
+    }
+
+    static bool push(std::size_t& depth, std::string& error) {
+        if (++depth > kMaxStack) {
+            error = "formula nests too deeply";
+            return false;
+        }
+        return true;
+    }
+
+    bool emitOp(Opcode op, std::string& error, int fieldOperand = -1, std::optional<float> constant = std::nullopt) {
+        code.push_back(static_cast<std::uint8_t>(op));
+        if (fieldOperand >= 0) {
+            code.push_back(static_cast<std::uint8_t>(fieldOperand));
+        }
+        if (constant) {
+            auto it = std::find(constants.begin(), constants.end(), *constant);
+            if (it == constants.end()) {
+                if (constants.size() == 256) {
+                    error = "too many constants";
+                    return false;
+                }
+                it = constants.insert(constants.end(), *constant);
+            }
+            code.push_back(static_cast<std::uint8_t>(it - constants.begin()));
+        }
+        return true;
+    }
+
+    template <typename T, typename Index>
+    static void gather(const std::vector<T>& column, const Index& index, std::size_t base, std::size_t n,
+                       float* __restrict out) {
+        const T* values = column.data();
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = static_cast<float>(values[index(base + i)]);
+        }
+        // The arithmetic always covers whole batches.
+        std::fill(out + n, out + kBatch, 0.0f);
+    }
+
+    template <typename Index>
+    void load(const SongColumns& columns, Field field, const Index& index, std::size_t base, std::size_t n,
+              float* out) const {
+        switch (field) {
+            case Field::Energy:
+                gather(columns.energy, index, base, n, out);
+                break;
+            case Field::Danceability:
+                gather(columns.danceability, index, base, n, out);
+                break;
+            case Field::Year:
+            case Field::Age: {
+                gather(columns.year, index, base, n, out);
+                const float now = static_cast<float>(currentYear);
+                for (std::size_t i = 0; i < n; ++i) {
+                    const float year = out[i] == static_cast<float>(kUnknownYear) ? now : out[i];
+                    out[i] = field == Field::Year ? year : now - year;
+                }
+                break;
+            }
+            case Field::Plays:
+                gather(columns.playCount, index, base, n, out);
+                break;
+            case Field::Bpm:
+                gather(columns.bpm, index, base, n, out);
+                break;
+        }
+    }
+
+    template <typename Index>
+    void execute(const SongColumns& columns, std::size_t count, float* scores, const Index& index) const {
+        alignas(16) float stack[kMaxStack][kBatch];
+        for (std::size_t base = 0; base < count; base += kBatch) {
+            const std::size_t n = std::min(kBatch, count - base);
+            std::size_t top = 0;
+            for (std::size_t pc = 0; pc < code.size();) {
+                const Opcode op = static_cast<Opcode>(code[pc++]);
+                // The top slot; binary operators combine into the one below.
+                float* __restrict a = stack[top - (top > 0)];
+                switch (op) {
+                    case Opcode::Load:
+                        load(columns, static_cast<Field>(code[pc++]), index, base, n, stack[top++]);
+                        continue;
+                    case Opcode::LoadScaled: {
+                        float* __restrict out = stack[top++];
+                        load(columns, static_cast<Field>(code[pc++]), index, base, n, out);
+                        const float k = constants[code[pc++]];
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            out[i] *= k;
+                        }
+                        continue;
+                    }
+                    case Opcode::Const:
+                        std::fill(stack[top], stack[top] + kBatch, constants[code[pc++]]);
+                        ++top;
+                        continue;
+                    case Opcode::Neg:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] = -a[i];
+                        }
+                        continue;
+                    case Opcode::Abs:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] = a[i] < 0.0f ? -a[i] : a[i];
+                        }
+                        continue;
+                    case Opcode::AddConst: {
+                        const float k = constants[code[pc++]];
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] += k;
+                        }
+                        continue;
+                    }
+                    case Opcode::MulConst: {
+                        const float k = constants[code[pc++]];
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] *= k;
+                        }
+                        continue;
+                    }
+                    default:
+                        break;
+                }
+                --top;
+                a = stack[top - 1];
+                const float* __restrict b = stack[top];
+                switch (op) {
+                    case Opcode::Add:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] += b[i];
+                        }
+                        break;
+                    case Opcode::Sub:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] -= b[i];
+                        }
+                        break;
+                    case Opcode::Mul:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] *= b[i];
+                        }
+                        break;
+                    case Opcode::Div:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] /= b[i];
+                        }
+                        break;
+                    case Opcode::Min:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] = b[i] < a[i] ? b[i] : a[i];
+                        }
+                        break;
+                    case Opcode::Max:
+                        for (std::size_t i = 0; i < kBatch; ++i) {
+                            a[i] = b[i] > a[i] ? b[i] : a[i];
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+            std::copy(stack[0], stack[0] + n, scores + base);
+        }
+    }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "musical_key.h"
+#include "text_normalize.h"
+
+// Songs are identified by their position in the catalog.
+using SongId = std::uint32_t;
+
+// Song::year when the release year is not known (imported files, say). Year
+// indexes and filters leave these songs out, and scoring treats them as
+// neither old nor new.
+constexpr int kUnknownYear = 0;
+
+class Song {
+public:
+    std::string title;
+    std::string artist;
+    std::vector<std::string> moods;
+    int energy;
+    int danceability;
+    // kUnknownYear if not known.
+    int year;
+    int playCount;
+    // Filled in by audio analysis; 0 and kUnknownKey until then.
+    float bpm;
+    int key;
+    // Length in seconds; 0 if unknown.
+    int durationSeconds;
+
+    Song()
+        : title(""), artist(""), energy(0), danceability(0), year(kUnknownYear), playCount(0), bpm(0.0f), key(kUnknownKey),
+          durationSeconds(0) {}
+
+    Song(std::string t, std::string a, std::vector<std::string> m, int e, int d, int y, int seconds = 0)
+        : title(t), artist(a), moods(m), energy(e), danceability(d), year(y), playCount(0), bpm(0.0f),
+          key(kUnknownKey), durationSeconds(seconds) {}
+
+    // Same key for titles and artists that normalise to the same text.
+    std::uint64_t matchKey() const { return songKey(title, artist); }
+
+    // Compares normalised title and artist, so case, accents, punctuation and
+    // "feat." credits do not matter.
+    bool operator==(const Song& other) const {
+        return normalizeText(title) == normalizeText(other.title) &&
+               normalizeText(artist) == normalizeText(other.artist);
+    }
+};
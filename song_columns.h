@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "musical_key.h"
+#include "song.h"
+
+// Narrow copies of the numeric song attributes, so a scan reads a few bytes per
+// song instead of striding over Song objects. Values are clamped to the column
+// types.
+class SongColumns {
+public:
+    std::vector<std::uint8_t> energy;
+    std::vector<std::uint8_t> danceability;
+    std::vector<std::int16_t> year;
+    std::vector<std::uint32_t> playCount;
+    std::vector<float> bpm;
+    // kUnknownKey where not analysed.
+    std::vector<std::int8_t> key;
+
+    void rebuild(const std::vector<Song>& songs) {
+        energy.clear();
+        danceability.clear();
+        year.clear();
+        playCount.clear();
+        bpm.clear();
+        key.clear();
+        for (const Song& song : songs) {
+            addSong(song);
+        }
+    }
+
+    void addSong(const Song& song) {
+        energy.push_back(static_cast<std::uint8_t>(std::clamp(song.energy, 0, 255)));
+        danceability.push_back(static_cast<std::uint8_t>(std::clamp(song.danceability, 0, 255)));
+        year.push_back(static_cast<std::int16_t>(std::clamp(song.year, -32768, 32767)));
+        playCount.push_back(static_cast<std::uint32_t>(std::max(song.playCount, 0)));
+        bpm.push_back(song.bpm);
+        key.push_back(static_cast<std::int8_t>(song.key >= 0 && song.key < kKeyCount ? song.key : kUnknownKey));
+    }
+
+    std::size_t size() const { return year.size(); }
+};
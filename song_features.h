@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "moods.h"
+#include "song.h"
+
+// Every song is described by a fixed-width feature vector so songs can be
+// compared numerically. Rows are padded to 16 floats so the distance kernel can
+// work on whole SSE registers.
+constexpr std::size_t kFeatureDims = 16;
+
+enum FeatureIndex : std::size_t {
+    kFeatureEnergy = 0,
+    kFeatureDanceability = 1,
+    kFeatureYear = 2,
+    kFeatureFirstMood = 3,
+    // Dimensions after the mood bits are reserved for audio features.
+    kFeatureFirstAudio = kFeatureFirstMood + kMoodCount,
+};
+
+using FeatureVector = std::array<float, kFeatureDims>;
+
+struct FeatureWeights {
+    FeatureVector weights;
+
+    static FeatureWeights defaults() {
+        FeatureWeights w;
+        w.weights.fill(0.0f);
+        w.weights[kFeatureEnergy] = 2.0f;
+        w.weights[kFeatureDanceability] = 1.0f;
+        w.weights[kFeatureYear] = 0.5f;
+        for (std::size_t m = 0; m < kMoodCount; ++m) {
+            w.weights[kFeatureFirstMood + m] = 0.5f;
+        }
+        return w;
+    }
+};
+
+// All attributes scaled to roughly [0, 1].
+inline FeatureVector songFeatures(const Song& song) {
+    FeatureVector f{};
+    f[kFeatureEnergy] = song.energy / 10.0f;
+    f[kFeatureDanceability] = song.danceability / 10.0f;
+    // An unknown year sits mid-range, as near to old songs as to new.
+    f[kFeatureYear] = song.year == kUnknownYear ? 0.5f : std::clamp((song.year - 1950) / 80.0f, 0.0f, 1.0f);
+    for (const auto& mood : song.moods) {
+        if (auto id = moodIdOf(mood)) {
+            f[kFeatureFirstMood + *id] = 1.0f;
+        }
+    }
+    return f;
+}
+
+struct Neighbor {
+    SongId id;
+    float distance;
+};
+
+// Weighted squared L2 distance between two padded rows.
+inline float weightedDistance(const float* a, const float* b, const float* w) {
+#if defined(__SSE2__)
+    __m128 sum = _mm_setzero_ps();
+    for (std::size_t d = 0; d < kFeatureDims; d += 4) {
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + d), _mm_loadu_ps(b + d));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(diff, diff), _mm_loadu_ps(w + d)));
+    }
+    __m128 shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+    sum = _mm_add_ps(sum, shuffled);
+    shuffled = _mm_movehl_ps(shuffled, sum);
+    sum = _mm_add_ss(sum, shuffled);
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0.0f;
+    for (std::size_t d = 0; d < kFeatureDims; ++d) {
+        float diff = a[d] - b[d];
+        sum += diff * diff * w[d];
+    }
+    return sum;
+#endif
+}
+
+// Keeps the k smallest distances seen so far.
+class TopK {
+public:
+    explicit TopK(std::size_t k) : k(k) {}
+
+    void offer(SongId id, float distance) {
+        if (k == 0) {
+            return;
+        }
+        if (heap.size() < k) {
+            heap.emplace(distance, id);
+        } else if (distance < heap.top().first) {
+            heap.pop();
+            heap.emplace(distance, id);
+        }
+    }
+
+    // Nearest first.
+    std::vector<Neighbor> take() {
+        std::vector<Neighbor> result(heap.size());
+        for (std::size_t i = result.size(); i-- > 0;) {
+            result[i] = {heap.top().second, heap.top().first};
+            heap.pop();
+        }
+        return result;
+    }
+
+private:
+    std::size_t k;
+    std::priority_queue<std::pair<float, SongId>> heap;
+};
+
+// Contiguous row-major matrix of song features, one row per SongId.
+class FeatureMatrix {
+public:
+    static FeatureMatrix fromSongs(const std::vector<Song>& songDatabase) {
+        FeatureMatrix matrix;
+        matrix.values.reserve(songDatabase.size() * kFeatureDims);
+        for (const auto& song : songDatabase) {
+            matrix.append(songFeatures(song));
+        }
+        return matrix;
+    }
+
+    void append(const FeatureVector& row) {
+        values.insert(values.end(), row.begin(), row.end());
+    }
+
+    std::size_t size() const { return values.size() / kFeatureDims; }
+    const float* row(SongId id) const { return values.data() + static_cast<std::size_t>(id) * kFeatureDims; }
+    float* row(SongId id) { return values.data() + static_cast<std::size_t>(id) * kFeatureDims; }
+
+    // Exact k nearest neighbours by brute force over every row.
+    std::vector<Neighbor> nearest(const float* query, std::size_t k, const FeatureWeights& weights) const {
+        TopK best(k);
+        const std::size_t rows = size();
+        for (std::size_t i = 0; i < rows; ++i) {
+            best.offer(static_cast<SongId>(i), weightedDistance(row(static_cast<SongId>(i)), query,
+                                                                weights.weights.data()));
+        }
+        return best.take();
+    }
+
+private:
+    std::vector<float> values;
+};
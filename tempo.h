@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+struct TempoEstimate {
+    double bpm = 0.0;
+    // Autocorrelation at the beat period relative to lag 0, in [0, 1].
+    double confidence = 0.0;
+};
+
+// Estimates tempo from an onset strength envelope sampled at `rate` values per
+// second. The envelope's autocorrelation is evaluated at the beat period and
+// its multiples for every candidate tempo on a 0.25 BPM grid (interpolating
+// between integer lags, which are coarse at typical hop sizes), and weighted
+// by a log-normal prior centred on 120 BPM so half and double tempo lose ties.
+// Envelopes without a clear periodicity give bpm = 0.
+inline TempoEstimate estimateTempo(const std::vector<float>& onsets, double rate, double minBpm = 60.0,
+                                   double maxBpm = 200.0, double minConfidence = 0.1) {
+    constexpr int kHarmonics = 4;
+    TempoEstimate best;
+    const std::size_t maxLag = static_cast<std::size_t>(std::ceil(60.0 * rate / minBpm * kHarmonics)) + 1;
+    if (rate <= 0.0 || onsets.size() < 2 * maxLag) {
+        return best;
+    }
+
+    double mean = 0.0;
+    for (float o : onsets) {
+        mean += o;
+    }
+    mean /= onsets.size();
+    std::vector<float> centred(onsets.size());
+    for (std::size_t i = 0; i < onsets.size(); ++i) {
+        centred[i] = static_cast<float>(onsets[i] - mean);
+    }
+
+    // Unbiased autocorrelation, normalised to acf[0] = 1.
+    std::vector<double> acf(maxLag + 1);
+    for (std::size_t lag = 0; lag <= maxLag; ++lag) {
+        const float* a = centred.data();
+        const float* b = centred.data() + lag;
+        const std::size_t n = centred.size() - lag;
+        double sum = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+            sum += a[i] * b[i];
+        }
+        acf[lag] = sum / n;
+    }
+    if (acf[0] <= 0.0) {
+        return best;
+    }
+    for (std::size_t lag = maxLag + 1; lag-- > 0;) {
+        acf[lag] /= acf[0];
+    }
+
+    auto acfAt = [&](double lag) {
+        const std::size_t i = static_cast<std::size_t>(lag);
+        if (i + 1 > maxLag) {
+            return 0.0;
+        }
+        const double t = lag - i;
+        return acf[i] * (1.0 - t) + acf[i + 1] * t;
+    };
+
+    double bestScore = -1.0;
+    for (double bpm = minBpm; bpm <= maxBpm; bpm += 0.25) {
+        const double period = 60.0 * rate / bpm;
+        double periodicity = 0.0;
+        for (int h = 1; h <= kHarmonics; ++h) {
+            periodicity += acfAt(period * h);
+        }
+        periodicity /= kHarmonics;
+        const double octaves = std::log2(bpm / 120.0);
+        const double score = periodicity * std::exp(-0.5 * octaves * octaves);
+        if (score > bestScore) {
+            bestScore = score;
+            best.bpm = bpm;
+            best.confidence = std::max(0.0, acfAt(period));
+        }
+    }
+    if (best.confidence < minConfidence) {
+        best = TempoEstimate();
+    }
+    return best;
+}
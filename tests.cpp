@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "attribute_index.h"
+#include "fast_random.h"
+#include "filter_plan.h"
+#include "filter_query.h"
+#include "mood_index.h"
+#include "mood_query.h"
+#include "moods.h"
+#include "score_program.h"
+#include "song.h"
+#include "song_columns.h"
+#include "text_normalize.h"
+#include "trigram_index.h"
+
+// Table-driven checks of the filter, scoring formula and mood query parsers
+// and of their evaluation against brute force, run with `make test`.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        ++failures;
+        std::cout << "FAIL: " << what << "\n";
+    }
+}
+
+static const std::vector<std::string> kMoods(kMoodNames.begin(), kMoodNames.end());
+
+// Songs with every field varied, some sharing title and artist words and one
+// in eight of unknown year.
+static std::vector<Song> testCatalog(std::size_t count) {
+    static const char* const kWords[] = {"love", "night", "queen", "daft", "punk", "blue", "river", "dance", "Café"};
+    FastRandom rng(7);
+    std::vector<Song> songs;
+    for (std::size_t i = 0; i < count; ++i) {
+        std::string title = kWords[rng() % std::size(kWords)];
+        title += std::string(" ") + kWords[rng() % std::size(kWords)];
+        std::string artist = std::string(kWords[rng() % std::size(kWords)]) + " " + kWords[rng() % std::size(kWords)];
+        std::vector<std::string> moods;
+        for (const auto& mood : kMoods) {
+            if (rng() % 4 == 0) {
+                moods.push_back(mood);
+            }
+        }
+        const int year = rng() % 8 == 0 ? kUnknownYear : 1950 + static_cast<int>(rng() % 76);
+        Song song(title, artist, moods, static_cast<int>(rng() % 11), static_cast<int>(rng() % 11), year);
+        song.playCount = static_cast<int>(rng() % 1000);
+        song.bpm = 60.0f + static_cast<float>(rng() % 1200) / 10.0f;
+        songs.push_back(std::move(song));
+    }
+    return songs;
+}
+
+// ---- FilterQuery and FilterPlan ----
+
+struct FilterParseCase {
+    const char* text;
+    // Canonical form, or the start of the error message if `ok` is false.
+    const char* expected;
+    bool ok;
+};
+
+static const FilterParseCase kFilterParseCases[] = {
+    {"mood:happy", "mood:happy", true},
+    {"MOOD=Happy", "mood:happy", true},
+    {"energy>=7", "energy>=7", true},
+    {"energy>7", "energy>=8", true},
+    {"energy<3", "energy<=2", true},
+    {"energy=5", "energy=5", true},
+    {"energy:3-6", "energy:3-6", true},
+    {"dance:4", "danceability=4", true},
+    {"energy!=5", "NOT energy=5", true},
+    {"year<2000", "year<=1999", true},
+    {"year>=1990", "year>=1990", true},
+    {"year!=1990", "year<=1989 OR year>=1991", true},
+    {"artist~queen", "artist~queen", true},
+    {"artist~\"Daft Punk\"", "artist~\"daft punk\"", true},
+    {"title:CAFÉ", "title~cafe", true},
+    {"mood:happy energy>=7", "mood:happy energy>=7", true},
+    {"mood:happy AND energy>=7", "mood:happy energy>=7", true},
+    // NOT binds tightest, implicit AND tighter than OR.
+    {"mood:happy OR mood:sad energy>5", "mood:happy OR mood:sad energy>=6", true},
+    {"(mood:happy OR mood:sad) energy>5", "(mood:happy OR mood:sad) energy>=6", true},
+    {"NOT mood:happy energy<3", "NOT mood:happy energy<=2", true},
+    {"-mood:happy", "NOT mood:happy", true},
+    {"NOT (mood:happy OR mood:sad)", "NOT (mood:happy OR mood:sad)", true},
+    {"energy:-1-3", "energy:-1-3", true},
+    {"mood:bored", "unknown mood 'bored'", false},
+    {"tempo>5", "unknown field 'tempo'", false},
+    {"energy", "expected an operator and a value after 'energy'", false},
+    {"energy>abc", "bad energy value 'abc'", false},
+    {"energy:7-3", "bad energy value '7-3'", false},
+    {"energy~5", "energy does not take '~'", false},
+    {"mood>happy", "mood takes ':'", false},
+    {"artist=queen", "artist takes '~'", false},
+    {"artist~\"queen", "missing closing quote", false},
+    {"(mood:happy", "missing ')'", false},
+    {"mood:happy)", "unexpected ')'", false},
+    {"mood:happy OR", "expected a filter term", false},
+    {"title~\"!!\"", "empty title text", false},
+};
+
+static void testFilterParse() {
+    for (const auto& test : kFilterParseCases) {
+        std::string error;
+        auto query = FilterQuery::parse(test.text, kMoods, &error);
+        if (test.ok) {
+            check(query && query->toString() == test.expected,
+                  std::string("filter '") + test.text + "' -> '" + (query ? query->toString() : "error: " + error) +
+                      "', expected '" + test.expected + "'");
+            if (query) {
+                // The canonical form parses back to itself.
+                auto again = FilterQuery::parse(query->toString(), kMoods);
+                check(again && again->toString() == query->toString(),
+                      std::string("filter '") + test.text + "' does not round-trip");
+            }
+        } else {
+            check(!query && error.rfind(test.expected, 0) == 0,
+                  std::string("filter '") + test.text + "' should fail with '" + test.expected + "', got '" +
+                      (query ? query->toString() : error) + "'");
+        }
+    }
+}
+
+static bool filterMatches(const FilterQuery& query, int index, const Song& song) {
+    const FilterQuery::Node& node = query.node(index);
+    switch (node.op) {
+        case FilterQuery::Op::Not:
+            return !filterMatches(query, node.operands[0], song);
+        case FilterQuery::Op::And:
+            return std::all_of(node.operands.begin(), node.operands.end(),
+                               [&](int operand) { return filterMatches(query, operand, song); });
+        case FilterQuery::Op::Or:
+            return std::any_of(node.operands.begin(), node.operands.end(),
+                               [&](int operand) { return filterMatches(query, operand, song); });
+        case FilterQuery::Op::Term:
+            break;
+    }
+    switch (node.field) {
+        case FilterQuery::Field::Mood:
+            return std::find(song.moods.begin(), song.moods.end(), node.text) != song.moods.end();
+        case FilterQuery::Field::Title:
+            return normalizeText(song.title).find(node.text) != std::string::npos;
+        case FilterQuery::Field::Artist:
+            return normalizeText(song.artist).find(node.text) != std::string::npos;
+        case FilterQuery::Field::Energy:
+            return song.energy >= node.lo && song.energy <= node.hi;
+        case FilterQuery::Field::Danceability:
+            return song.danceability >= node.lo && song.danceability <= node.hi;
+        case FilterQuery::Field::Year:
+            return song.year >= node.lo && song.year <= node.hi;
+    }
+    return false;
+}
+
+static const char* const kFilterPlanCases[] = {
+    "mood:happy",
+    "energy>=7",
+    "energy:0-10",
+    "energy>10",
+    "dance<3",
+    "year<2000",
+    "year!=1990",
+    "NOT year<2000",
+    "year:1960-1970 energy<5",
+    "artist~queen",
+    "title~\"blue river\"",
+    "title~ca",
+    "mood:happy energy>=7 year<2000",
+    "mood:happy OR mood:sad energy>5",
+    "(mood:happy OR mood:sad) NOT energy:3-7",
+    "NOT mood:happy NOT mood:sad",
+    "-artist~punk dance>=5 OR year>=2020",
+    "mood:calm mood:relaxed mood:thoughtful",
+    "NOT (energy<3 OR energy>8) artist~night",
+};
+
+static void testFilterPlans() {
+    const std::vector<Song> songs = testCatalog(5000);
+    MoodIndex moods;
+    moods.rebuild(kMoods, songs);
+    AttributeIndex attributes;
+    attributes.rebuild(songs);
+    SongColumns columns;
+    columns.rebuild(songs);
+    TrigramIndex text;
+    text.build(songs);
+    const FilterSources sources{songs, columns, moods, attributes, text};
+
+    static const std::pair<FilterPlan::Strategy, const char*> kStrategies[] = {
+        {FilterPlan::Strategy::Auto, "auto"},
+        {FilterPlan::Strategy::IndexOnly, "index"},
+        {FilterPlan::Strategy::ScanOnly, "scan"},
+    };
+    for (const char* text : kFilterPlanCases) {
+        auto query = FilterQuery::parse(text, kMoods);
+        check(query.has_value(), std::string("filter '") + text + "' does not parse");
+        if (!query) {
+            continue;
+        }
+        std::vector<std::uint32_t> expected;
+        for (std::size_t id = 0; id < songs.size(); ++id) {
+            if (filterMatches(*query, query->rootNode(), songs[id])) {
+                expected.push_back(static_cast<std::uint32_t>(id));
+            }
+        }
+        for (const auto& [strategy, name] : kStrategies) {
+            FilterPlan plan(*query, sources, strategy);
+            const std::vector<std::uint32_t> actual = plan.execute().toVector();
+            check(actual == expected, std::string("filter '") + text + "' (" + name + ") matched " +
+                                          std::to_string(actual.size()) + " songs, expected " +
+                                          std::to_string(expected.size()));
+        }
+    }
+}
+
+// ---- ScoreProgram ----
+
+struct ScoreCase {
+    const char* formula;
+    std::function<float(const Song&)> expected;
+};
+
+static constexpr int kCurrentYear = 2025;
+
+static float yearOf(const Song& song) {
+    return static_cast<float>(song.year == kUnknownYear ? kCurrentYear : song.year);
+}
+
+static float ageOf(const Song& song) { return static_cast<float>(kCurrentYear) - yearOf(song); }
+
+static const std::vector<ScoreCase>& scoreCases() {
+    static const std::vector<ScoreCase> cases = {
+        {"1 + 2 * 3", [](const Song&) { return 7.0f; }},
+        {"(1 + 2) * 3", [](const Song&) { return 9.0f; }},
+        {"10 - 4 - 3", [](const Song&) { return 3.0f; }},
+        {"12 / 3 / 2", [](const Song&) { return 2.0f; }},
+        {"-2 * -3", [](const Song&) { return 6.0f; }},
+        {"energy", [](const Song& s) { return static_cast<float>(s.energy); }},
+        {"dance + danceability", [](const Song& s) { return 2.0f * static_cast<float>(s.danceability); }},
+        {"energy - dance * 2", [](const Song& s) { return s.energy - s.danceability * 2.0f; }},
+        {"(energy - dance) * 2", [](const Song& s) { return (s.energy - s.danceability) * 2.0f; }},
+        {"0.6*energy + 0.4*danceability - age_penalty",
+         [](const Song& s) { return 0.6f * s.energy + 0.4f * s.danceability - ageOf(s) * 0.1f; }},
+        {"energy + 1", [](const Song& s) { return s.energy + 1.0f; }},
+        {"1 + energy", [](const Song& s) { return 1.0f + s.energy; }},
+        {"energy - 1", [](const Song& s) { return s.energy - 1.0f; }},
+        {"1 - energy", [](const Song& s) { return 1.0f - s.energy; }},
+        {"2 * (energy + 3)", [](const Song& s) { return 2.0f * (s.energy + 3.0f); }},
+        {"energy * (2 + 3)", [](const Song& s) { return s.energy * 5.0f; }},
+        {"energy / 2", [](const Song& s) { return s.energy / 2.0f; }},
+        {"-energy", [](const Song& s) { return -static_cast<float>(s.energy); }},
+        {"abs(energy - 5)", [](const Song& s) { return std::fabs(s.energy - 5.0f); }},
+        {"min(energy, dance) + max(energy, dance)",
+         [](const Song& s) { return static_cast<float>(std::min(s.energy, s.danceability) +
+                                                       std::max(s.energy, s.danceability)); }},
+        {"year / 1000", [](const Song& s) { return yearOf(s) / 1000.0f; }},
+        {"age", [](const Song& s) { return ageOf(s); }},
+        {"plays / 100 + bpm * 0.01", [](const Song& s) { return s.playCount / 100.0f + s.bpm * 0.01f; }},
+        {"ENERGY * 2", [](const Song& s) { return s.energy * 2.0f; }},
+    };
+    return cases;
+}
+
+static void testScorePrograms() {
+    const std::vector<Song> songs = testCatalog(1000);
+    SongColumns columns;
+    columns.rebuild(songs);
+    std::vector<SongId> reversed(songs.size());
+    for (std::size_t i = 0; i < songs.size(); ++i) {
+        reversed[i] = static_cast<SongId>(songs.size() - 1 - i);
+    }
+    std::vector<float> scores(songs.size()), picked(songs.size());
+    for (const auto& test : scoreCases()) {
+        std::string error;
+        auto program = ScoreProgram::parse(test.formula, kCurrentYear, &error);
+        check(program.has_value(), std::string("formula '") + test.formula + "' failed: " + error);
+        if (!program) {
+            continue;
+        }
+        program->scoreRange(columns, 0, songs.size(), scores.data());
+        program->scoreSongs(columns, reversed.data(), reversed.size(), picked.data());
+        std::size_t wrong = 0;
+        for (std::size_t i = 0; i < songs.size(); ++i) {
+            const float expected = test.expected(songs[i]);
+            const float tolerance = 1e-4f * std::max(1.0f, std::fabs(expected));
+            if (std::fabs(scores[i] - expected) > tolerance ||
+                std::fabs(picked[songs.size() - 1 - i] - expected) > tolerance) {
+                ++wrong;
+            }
+        }
+        check(wrong == 0, std::string("formula '") + test.formula + "' wrong for " + std::to_string(wrong) +
+                              " songs");
+    }
+}
+
+struct ScoreCodeCase {
+    const char* formula;
+    // disassemble() output with the leading spaces and newlines replaced by "; ".
+    const char* code;
+};
+
+static const ScoreCodeCase kScoreCodeCases[] = {
+    {"1 + 2 * 3", "const 7"},
+    {"2 * 3 + energy", "load energy; addc 6"},
+    {"0.5 * energy", "loadscaled energy 0.5"},
+    {"energy * 0.5", "loadscaled energy 0.5"},
+    {"energy + 1", "load energy; addc 1"},
+    {"energy - 1", "load energy; addc -1"},
+    {"1 - energy", "const 1; load energy; sub"},
+    {"(energy + dance) * 2", "load energy; load danceability; add; mulc 2"},
+    {"age_penalty", "loadscaled age 0.1"},
+    {"energy + dance", "load energy; load danceability; add"},
+};
+
+static void testScoreCode() {
+    for (const auto& test : kScoreCodeCases) {
+        auto program = ScoreProgram::parse(test.formula, kCurrentYear);
+        check(program.has_value(), std::string("formula '") + test.formula + "' does not parse");
+        if (!program) {
+            continue;
+        }
+        std::ostringstream out;
+        program->disassemble(out);
+        std::string code, line;
+        std::istringstream lines(out.str());
+        while (std::getline(lines, line)) {
+            code += (code.empty() ? "" : "; ") + line.substr(line.find_first_not_of(' '));
+        }
+        check(code == test.code,
+              std::string("formula '") + test.formula + "' compiled to '" + code + "', expected '" + test.code + "'");
+    }
+}
+
+static const std::pair<const char*, const char*> kScoreErrorCases[] = {
+    {"", "expected a number or field"},
+    {"energy +", "expected a number or field"},
+    {"(energy", "missing ')'"},
+    {"energy)", "unexpected ')'"},
+    {"tempo", "unknown field 'tempo'"},
+    {"min(energy)", "min takes two arguments"},
+    {"abs(energy, dance)", "abs takes one argument"},
+    {"max energy", "expected '(' after max"},
+    {"1.2.3", "unexpected '.3'"},
+    {"energy * .", "bad number '.'"},
+    {"energy $ 2", "unexpected '$'"},
+    {"((((((((((((((((energy))))))))))))))))", ""},
+    {"energy+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1)))))))))))))))))", ""},
+    {"energy+(dance+(energy+(dance+(energy+(dance+(energy+(dance+(energy+(dance+(energy+(dance+(energy+(dance+"
+     "(energy+(dance+energy)))))))))))))))",
+     "formula nests too deeply"},
+};
+
+static void testScoreErrors() {
+    for (const auto& [formula, message] : kScoreErrorCases) {
+        std::string error;
+        auto program = ScoreProgram::parse(formula, kCurrentYear, &error);
+        if (*message == '\0') {
+            check(program.has_value(), std::string("formula '") + formula + "' failed: " + error);
+        } else {
+            check(!program && error == message, std::string("formula '") + formula + "' should fail with '" +
+                                                    message + "', got '" + (program ? "ok" : error) + "'");
+        }
+    }
+}
+
+// ---- MoodQuery ----
+
+static const std::pair<const char*, const char*> kMoodQueryCases[] = {
+    {"happy", "happy"},
+    {"HAPPY and Energetic", "happy AND energetic"},
+    {"calm OR relaxed", "calm OR relaxed"},
+    {"calm | relaxed & !sad", "calm OR relaxed AND NOT sad"},
+    {"(calm OR relaxed) AND NOT sad", "(calm OR relaxed) AND NOT sad"},
+    {"energetic AND happy AND NOT party", "energetic AND happy AND NOT party"},
+    {"NOT (happy OR sad)", "NOT (happy OR sad)"},
+    {"NOT NOT happy", "NOT NOT happy"},
+    {"((happy))", "happy"},
+    {"bored", ""},
+    {"happy AND", ""},
+    {"AND happy", ""},
+    {"(happy", ""},
+    {"happy)", ""},
+    {"happy sad", ""},
+};
+
+static void testMoodQueries() {
+    for (const auto& [text, expected] : kMoodQueryCases) {
+        auto query = MoodQuery::parse(text, kMoods);
+        if (*expected == '\0') {
+            check(!query, std::string("mood query '") + text + "' should not parse");
+        } else {
+            check(query && query->toString() == expected, std::string("mood query '") + text + "' -> '" +
+                                                               (query ? query->toString() : "error") +
+                                                               "', expected '" + expected + "'");
+        }
+    }
+
+    static const std::pair<const char*, std::vector<std::string>> kPositiveCases[] = {
+        {"happy", {"happy"}},
+        {"energetic AND happy AND NOT party", {"energetic", "happy"}},
+        {"NOT sad", {}},
+        {"NOT (happy AND NOT calm)", {"calm"}},
+        {"calm OR calm", {"calm"}},
+    };
+    for (const auto& [text, expected] : kPositiveCases) {
+        auto query = MoodQuery::parse(text, kMoods);
+        check(query && query->positiveMoods() == expected,
+              std::string("positive moods of '") + text + "' are wrong");
+    }
+
+    const std::vector<Song> songs = testCatalog(3000);
+    MoodIndex index;
+    index.rebuild(kMoods, songs);
+    for (const char* text : {"happy", "happy AND energetic", "calm OR relaxed AND NOT sad", "NOT sad",
+                             "NOT (happy OR sad) AND NOT calm", "(calm OR relaxed) AND (party OR NOT epic)"}) {
+        auto query = MoodQuery::parse(text, kMoods);
+        if (!query) {
+            check(false, std::string("mood query '") + text + "' does not parse");
+            continue;
+        }
+        std::vector<std::uint32_t> expected;
+        for (std::size_t id = 0; id < songs.size(); ++id) {
+            const auto& moods = songs[id].moods;
+            if (query->matches([&](const std::string& mood) {
+                    return std::find(moods.begin(), moods.end(), mood) != moods.end();
+                })) {
+                expected.push_back(static_cast<std::uint32_t>(id));
+            }
+        }
+        check(index.evaluate(*query).toVector() == expected,
+              std::string("mood query '") + text + "' does not match per-song evaluation");
+    }
+}
+
+int main() {
+    testFilterParse();
+    testFilterPlans();
+    testScorePrograms();
+    testScoreCode();
+    testScoreErrors();
+    testMoodQueries();
+    if (failures > 0) {
+        std::cout << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All tests passed\n";
+    return 0;
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Matching form of a title or artist: case folded, diacritics removed,
+// apostrophes dropped ("Don't" -> "dont"), '&' spelled "and", any other
+// punctuation or whitespace run turned into one space, and everything from a
+// "feat."/"ft."/"featuring" word onwards cut off. "Don't Stop Believin'" and
+// "DONT STOP BELIEVIN" both become "dont stop believin".
+//
+// ASCII is folded 16 bytes at a time with SSE2. Other text is decoded as UTF-8
+// and folded per code point: Latin-1 and Latin Extended-A letters map to their
+// base letters (with "ss", "ae", "oe", "th" and "ij" for ligatures and the like),
+// Greek and Cyrillic capitals are lowercased, fullwidth ASCII is mapped to ASCII
+// and combining marks are dropped. Code points outside those blocks are kept.
+
+// Base letters for U+0100..U+017F, one per code point; '2' marks the two
+// ligature pairs (U+0132/3 "ij", U+0152/3 "oe").
+constexpr char kLatinExtendedABase[] =
+    "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii22jjkkkllllllllllnnnnnnnnnoooooo22rrrrrrssssssss"
+    "ttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+static_assert(sizeof(kLatinExtendedABase) == 129, "one entry per code point in U+0100..U+017F");
+
+// U+00C0..U+00FF; empty entries (U+00D7, U+00F7) are punctuation.
+constexpr const char* kLatin1Fold[64] = {
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "o", "",  "o", "u", "u", "u", "u", "y", "th", "ss",
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "o", "",  "o", "u", "u", "u", "u", "y", "th", "y"};
+
+class TextNormalizer {
+public:
+    // Writes the normalised form of `text` to `out`, reusing its storage.
+    void normalize(std::string_view text, std::string& out) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(text.data());
+        const std::size_t n = text.size();
+        // Output is written through a cursor into a buffer sized for the worst
+        // case ("&" -> " and", plus a 16-byte block written past a tail).
+        out.resize(5 * n + 32);
+        begin = cursor = &out[0];
+        pendingSpace = false;
+        std::size_t i = 0;
+        while (i < n) {
+#if defined(__SSE2__)
+            if (n - i >= 16) {
+                if (appendAsciiBlock(p + i)) {
+                    i += 16;
+                    continue;
+                }
+            } else {
+                // Short tails are padded with spaces, which only end the last word.
+                alignas(16) unsigned char tail[16];
+                std::memset(tail, ' ', sizeof(tail));
+                std::memcpy(tail, p + i, n - i);
+                if (appendAsciiBlock(tail)) {
+                    break;
+                }
+            }
+#endif
+            if (p[i] < 0x80) {
+                appendAscii(lowerAscii(p[i]));
+                ++i;
+                continue;
+            }
+            std::uint32_t codePoint;
+            std::size_t length = decodeUtf8(p + i, n - i, codePoint);
+            if (length == 0) {
+                pendingSpace = true;
+                ++i;
+                continue;
+            }
+            appendCodePoint(codePoint, p + i, length);
+            i += length;
+        }
+        out.resize(cursor - begin);
+        cutFeaturing(out);
+    }
+
+private:
+    char* begin = nullptr;
+    char* cursor = nullptr;
+    bool pendingSpace = false;
+
+    static unsigned char lowerAscii(unsigned char c) {
+        return c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c + 32) : c;
+    }
+
+    static bool isAlnum(unsigned char c) { return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'); }
+
+    void startWord() {
+        if (pendingSpace && cursor != begin) {
+            *cursor++ = ' ';
+        }
+        pendingSpace = false;
+    }
+
+    void appendLetters(const char* letters, std::size_t length) {
+        startWord();
+        std::memcpy(cursor, letters, length);
+        cursor += length;
+    }
+
+    // `c` is already lowercased.
+    void appendAscii(unsigned char c) {
+        if (isAlnum(c)) {
+            startWord();
+            *cursor++ = static_cast<char>(c);
+        } else if (c == '\'' || c == '`') {
+            // Apostrophes join: "don't" -> "dont".
+        } else if (c == '&') {
+            pendingSpace = true;
+            appendLetters("and", 3);
+            pendingSpace = true;
+        } else {
+            pendingSpace = true;
+        }
+    }
+
+#if defined(__SSE2__)
+    // Folds 16 bytes if they are all ASCII: alphanumeric runs are lowercased and
+    // copied as a whole, the remaining bytes go through appendAscii.
+    bool appendAsciiBlock(const unsigned char* p) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        if (_mm_movemask_epi8(v) != 0) {
+            return false;
+        }
+        // All bytes are below 0x80, so the signed compares are safe.
+        const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                            _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+        const __m128i lowered = _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(32)));
+        const __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lowered, _mm_set1_epi8('a' - 1)),
+                                             _mm_cmplt_epi8(lowered, _mm_set1_epi8('z' + 1)));
+        const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                            _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        const unsigned special = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(letter, digit))) & 0xFFFFu;
+
+        alignas(16) unsigned char folded[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(folded), lowered);
+        unsigned j = 0;
+        while (j < 16) {
+            if ((special >> j) & 1u) {
+                appendAscii(folded[j]);
+                ++j;
+                continue;
+            }
+            const unsigned rest = special >> j;
+            const unsigned run = rest ? static_cast<unsigned>(__builtin_ctz(rest)) : 16 - j;
+            appendLetters(reinterpret_cast<const char*>(folded + j), run);
+            j += run;
+        }
+        return true;
+    }
+#endif
+
+    // Returns the sequence length, or 0 for malformed UTF-8: bad lead or
+    // continuation bytes, overlong forms, surrogates and code points above
+    // U+10FFFF (RFC 3629, section 4).
+    static std::size_t decodeUtf8(const unsigned char* p, std::size_t available, std::uint32_t& codePoint) {
+        std::size_t length;
+        // Allowed range of the second byte, which is where the lead bytes
+        // E0, ED, F0 and F4 differ from the others.
+        unsigned char low = 0x80, high = 0xBF;
+        if (p[0] >= 0xC2 && p[0] < 0xE0) {
+            length = 2;
+            codePoint = p[0] & 0x1Fu;
+        } else if (p[0] >= 0xE0 && p[0] < 0xF0) {
+            length = 3;
+            codePoint = p[0] & 0x0Fu;
+            low = p[0] == 0xE0 ? 0xA0 : 0x80;
+            high = p[0] == 0xED ? 0x9F : 0xBF;
+        } else if (p[0] >= 0xF0 && p[0] < 0xF5) {
+            length = 4;
+            codePoint = p[0] & 0x07u;
+            low = p[0] == 0xF0 ? 0x90 : 0x80;
+            high = p[0] == 0xF4 ? 0x8F : 0xBF;
+        } else {
+            return 0;
+        }
+        if (length > available || p[1] < low || p[1] > high) {
+            return 0;
+        }
+        for (std::size_t k = 1; k < length; ++k) {
+            if ((p[k] & 0xC0u) != 0x80u) {
+                return 0;
+            }
+            codePoint = (codePoint << 6) | (p[k] & 0x3Fu);
+        }
+        return length;
+    }
+
+    void appendUtf8(std::uint32_t codePoint) {
+        if (codePoint < 0x800) {
+            *cursor++ = static_cast<char>(0xC0 | (codePoint >> 6));
+        } else if (codePoint < 0x10000) {
+            *cursor++ = static_cast<char>(0xE0 | (codePoint >> 12));
+            *cursor++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        } else {
+            *cursor++ = static_cast<char>(0xF0 | (codePoint >> 18));
+            *cursor++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            *cursor++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        }
+        *cursor++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+
+    void appendCodePoint(std::uint32_t cp, const unsigned char* bytes, std::size_t length) {
+        if (cp >= 0xC0 && cp <= 0xFF) {
+            const char* folded = kLatin1Fold[cp - 0xC0];
+            if (*folded) {
+                appendLetters(folded, std::strlen(folded));
+            } else {
+                pendingSpace = true;
+            }
+        } else if (cp >= 0x100 && cp <= 0x17F) {
+            const char base = kLatinExtendedABase[cp - 0x100];
+            if (base == '2') {
+                appendLetters(cp < 0x140 ? "ij" : "oe", 2);
+            } else {
+                appendLetters(&base, 1);
+            }
+        } else if (cp == 0xB4 || cp == 0x2BC || cp == 0x2018 || cp == 0x2019 || cp == 0x201B) {
+            // Acute accent and typographic apostrophes join like '\''.
+        } else if (cp < 0xC0 || (cp >= 0x2000 && cp <= 0x206F) || (cp >= 0x3000 && cp <= 0x303F)) {
+            // Latin-1 punctuation and symbols, general and CJK punctuation.
+            pendingSpace = true;
+        } else if (cp >= 0x300 && cp <= 0x36F) {
+            // Combining marks (decomposed diacritics) are dropped.
+        } else if (cp >= 0xFF01 && cp <= 0xFF5E) {
+            appendAscii(lowerAscii(static_cast<unsigned char>(cp - 0xFEE0)));
+        } else {
+            const std::uint32_t folded = foldLetter(cp);
+            if (folded == cp) {
+                appendLetters(reinterpret_cast<const char*>(bytes), length);
+            } else {
+                startWord();
+                appendUtf8(folded);
+            }
+        }
+    }
+
+    // Greek and Cyrillic lowercase without accents; other code points as is.
+    static std::uint32_t foldLetter(std::uint32_t cp) {
+        if ((cp >= 0x391 && cp <= 0x3A9) || (cp >= 0x410 && cp <= 0x42F)) {
+            return cp + 0x20;
+        }
+        if (cp == 0x401 || cp == 0x451) {
+            return 0x435;  // Ё, ё -> е
+        }
+        if (cp >= 0x400 && cp <= 0x40F) {
+            return cp + 0x50;
+        }
+        switch (cp) {
+            case 0x386: case 0x3AC: return 0x3B1;
+            case 0x388: case 0x3AD: return 0x3B5;
+            case 0x389: case 0x3AE: return 0x3B7;
+            case 0x38A: case 0x3AF: case 0x3CA: case 0x390: return 0x3B9;
+            case 0x38C: case 0x3CC: return 0x3BF;
+            case 0x38E: case 0x3CD: case 0x3CB: case 0x3B0: return 0x3C5;
+            case 0x38F: case 0x3CE: return 0x3C9;
+            case 0x3C2: return 0x3C3;  // final sigma
+            default: return cp;
+        }
+    }
+
+    // Drops a "feat"/"ft"/"featuring" word and everything after it, unless it is
+    // the first word.
+    static void cutFeaturing(std::string& out) {
+        for (std::size_t space = out.find(' '); space != std::string::npos; space = out.find(' ', space + 1)) {
+            const std::size_t start = space + 1;
+            std::size_t end = out.find(' ', start);
+            if (end == std::string::npos) {
+                end = out.size();
+            }
+            const std::string_view word(out.data() + start, end - start);
+            if (word == "feat" || word == "ft" || word == "featuring") {
+                out.resize(space);
+                return;
+            }
+        }
+    }
+};
+
+inline std::string normalizeText(std::string_view text) {
+    std::string out;
+    TextNormalizer().normalize(text, out);
+    return out;
+}
+
+// 64-bit hash of a byte string, eight bytes per step.
+inline std::uint64_t hashBytes(const char* data, std::size_t size, std::uint64_t seed) {
+    std::uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = (h ^ (word * 0xBF58476D1CE4E5B9ull)) * 0x94D049BB133111EBull;
+        h ^= h >> 31;
+    }
+    std::uint64_t tail = 0;
+    std::memcpy(&tail, data + i, size - i);
+    h = (h ^ (tail * 0xBF58476D1CE4E5B9ull)) * 0x94D049BB133111EBull;
+    h ^= h >> 29;
+    h *= 0xFF51AFD7ED558CCDull;
+    return h ^ (h >> 32);
+}
+
+// Compact identity of a song for hash lookups: equal for titles and artists
+// that normalise to the same text.
+inline std::uint64_t songKey(std::string_view title, std::string_view artist) {
+    thread_local TextNormalizer normalizer;
+    thread_local std::string normalizedTitle, normalizedArtist;
+    normalizer.normalize(title, normalizedTitle);
+    normalizer.normalize(artist, normalizedArtist);
+    return hashBytes(normalizedTitle.data(), normalizedTitle.size(),
+                     hashBytes(normalizedArtist.data(), normalizedArtist.size(), 0x5EED));
+}
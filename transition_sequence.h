@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "musical_key.h"
+#include "song.h"
+#include "song_columns.h"
+
+// Weights of the parts of a transition's cost: one Camelot step costs as much
+// as a 10 BPM change in tempo or two levels of energy.
+struct TransitionWeights {
+    float key = 1.0f;
+    float bpm = 0.1f;
+    float energy = 0.5f;
+};
+
+// The candidates for a DJ-style playlist as float columns padded to a multiple
+// of four, so the cost of moving from one song to every other song is a handful
+// of SIMD operations per four candidates.
+class TransitionPool {
+public:
+    // Mixing into or out of a song with no analysed key costs this many Camelot
+    // steps; a song with no tempo counts as this many BPM away.
+    static constexpr float kUnknownKeyCost = 2.0f;
+    static constexpr float kUnknownBpmGap = 10.0f;
+
+    TransitionPool(const SongColumns& columns, std::vector<SongId> ids) : songIds(std::move(ids)) {
+        const std::size_t padded = (songIds.size() + 3) / 4 * 4;
+        for (std::vector<float>* column : {&camelot, &minor, &hasKey, &bpm, &hasBpm, &energy}) {
+            column->assign(padded, 0.0f);
+        }
+        for (std::size_t i = 0; i < songIds.size(); ++i) {
+            const SongId id = songIds[i];
+            const int key = columns.key[id];
+            if (key != kUnknownKey) {
+                camelot[i] = static_cast<float>(camelotNumber(key));
+                minor[i] = isMinorKey(key) ? 1.0f : 0.0f;
+                hasKey[i] = 1.0f;
+            }
+            bpm[i] = columns.bpm[id];
+            hasBpm[i] = columns.bpm[id] > 0.0f ? 1.0f : 0.0f;
+            energy[i] = static_cast<float>(columns.energy[id]);
+        }
+    }
+
+    std::size_t size() const { return songIds.size(); }
+    // size() rounded up to a multiple of four: the length costsFrom() fills.
+    std::size_t paddedSize() const { return camelot.size(); }
+    SongId id(std::size_t position) const { return songIds[position]; }
+
+    // costs[i] = cost of playing pool song i right after pool song `from`.
+    void costsFrom(std::size_t from, const TransitionWeights& weights, float* costs) const {
+#if defined(__SSE2__)
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        auto abs = [&](__m128 x) { return _mm_andnot_ps(signMask, x); };
+        const __m128 twelve = _mm_set1_ps(12.0f);
+        const __m128 unknownKey = _mm_set1_ps(kUnknownKeyCost);
+        const __m128 unknownGap = _mm_set1_ps(kUnknownBpmGap);
+        const __m128 fromCamelot = _mm_set1_ps(camelot[from]), fromMinor = _mm_set1_ps(minor[from]);
+        const __m128 fromHasKey = _mm_set1_ps(hasKey[from]), fromBpm = _mm_set1_ps(bpm[from]);
+        const __m128 fromHasBpm = _mm_set1_ps(hasBpm[from]), fromEnergy = _mm_set1_ps(energy[from]);
+        const __m128 keyWeight = _mm_set1_ps(weights.key), bpmWeight = _mm_set1_ps(weights.bpm);
+        const __m128 energyWeight = _mm_set1_ps(weights.energy);
+        for (std::size_t i = 0; i < camelot.size(); i += 4) {
+            const __m128 steps = abs(_mm_sub_ps(_mm_loadu_ps(&camelot[i]), fromCamelot));
+            __m128 keyCost = _mm_add_ps(_mm_min_ps(steps, _mm_sub_ps(twelve, steps)),
+                                        abs(_mm_sub_ps(_mm_loadu_ps(&minor[i]), fromMinor)));
+            const __m128 bothKeys = _mm_mul_ps(_mm_loadu_ps(&hasKey[i]), fromHasKey);
+            keyCost = _mm_add_ps(unknownKey, _mm_mul_ps(bothKeys, _mm_sub_ps(keyCost, unknownKey)));
+            __m128 gap = abs(_mm_sub_ps(_mm_loadu_ps(&bpm[i]), fromBpm));
+            const __m128 bothBpms = _mm_mul_ps(_mm_loadu_ps(&hasBpm[i]), fromHasBpm);
+            gap = _mm_add_ps(unknownGap, _mm_mul_ps(bothBpms, _mm_sub_ps(gap, unknownGap)));
+            const __m128 energyGap = abs(_mm_sub_ps(_mm_loadu_ps(&energy[i]), fromEnergy));
+            const __m128 cost = _mm_add_ps(_mm_add_ps(_mm_mul_ps(keyWeight, keyCost), _mm_mul_ps(bpmWeight, gap)),
+                                           _mm_mul_ps(energyWeight, energyGap));
+            _mm_storeu_ps(costs + i, cost);
+        }
+#else
+        costsFromScalar(from, weights, costs);
+#endif
+    }
+
+    // costsFrom() one song at a time; the same arithmetic in the same order.
+    void costsFromScalar(std::size_t from, const TransitionWeights& weights, float* costs) const {
+        for (std::size_t i = 0; i < camelot.size(); ++i) {
+            costs[i] = cost(from, i, weights);
+        }
+    }
+
+    float cost(std::size_t from, std::size_t to, const TransitionWeights& weights) const {
+        const float steps = std::abs(camelot[to] - camelot[from]);
+        float keyCost = std::min(steps, 12.0f - steps) + std::abs(minor[to] - minor[from]);
+        keyCost = kUnknownKeyCost + hasKey[to] * hasKey[from] * (keyCost - kUnknownKeyCost);
+        float gap = std::abs(bpm[to] - bpm[from]);
+        gap = kUnknownBpmGap + hasBpm[to] * hasBpm[from] * (gap - kUnknownBpmGap);
+        return weights.key * keyCost + weights.bpm * gap + weights.energy * std::abs(energy[to] - energy[from]);
+    }
+
+private:
+    std::vector<SongId> songIds;
+    // Camelot number 0-11, 1 for minor keys, and 1 where the key is known;
+    // likewise for tempo.
+    std::vector<float> camelot, minor, hasKey;
+    std::vector<float> bpm, hasBpm;
+    std::vector<float> energy;
+};
+
+struct BeamSearchOptions {
+    // Partial playlists kept after each step; 1 is greedy nearest-neighbour.
+    std::size_t width = 8;
+    // Cheapest next songs tried after each partial playlist.
+    std::size_t expansions = 4;
+    // If positive, the width is narrowed as the search goes whenever the
+    // remaining steps would not fit in this many milliseconds at the current
+    // width.
+    double budgetMs = 0.0;
+};
+
+struct BeamSearchStats {
+    double ms = 0.0;
+    // Width of the last step, after any narrowing for the budget.
+    std::size_t finalWidth = 0;
+    float cost = 0.0f;
+};
+
+// Orders up to `length` pool songs, starting with pool song `first`, so that
+// the summed cost of consecutive transitions is low. Beam search: each step
+// scores every song as the next one after each of the `width` cheapest partial
+// playlists, takes the `expansions` cheapest unused songs for each, and keeps
+// the `width` cheapest of the results for the next step. Returns song ids.
+inline std::vector<SongId> sequenceTransitions(const TransitionPool& pool, std::size_t first, std::size_t length,
+                                               const TransitionWeights& weights, const BeamSearchOptions& options = {},
+                                               BeamSearchStats* stats = nullptr) {
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsedMs = [&] {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    std::vector<SongId> playlist;
+    length = std::min(length, pool.size());
+    if (length == 0 || first >= pool.size()) {
+        return playlist;
+    }
+
+    // Partial playlists share prefixes: each node is a song and the node
+    // before it.
+    struct Node {
+        std::uint32_t song;
+        std::int32_t parent;
+    };
+    struct Entry {
+        float cost;
+        std::int32_t node;
+    };
+    struct Option {
+        float cost;
+        std::uint32_t song;
+    };
+    auto cheaper = [](const auto& a, const auto& b) { return a.cost < b.cost; };
+    std::vector<Node> nodes = {{static_cast<std::uint32_t>(first), -1}};
+    std::vector<Entry> beam = {{0.0f, 0}}, next;
+    std::vector<float> costs(pool.paddedSize());
+    std::vector<std::uint8_t> used(pool.size(), 0);
+    std::vector<Option> cheapest;
+    const std::size_t expansions = std::max<std::size_t>(options.expansions, 1);
+    std::size_t width = std::max<std::size_t>(options.width, 1);
+
+    for (std::size_t step = 1; step < length; ++step) {
+        const double stepStart = elapsedMs();
+        next.clear();
+        for (const Entry& entry : beam) {
+            for (std::int32_t n = entry.node; n >= 0; n = nodes[n].parent) {
+                used[nodes[n].song] = 1;
+            }
+            pool.costsFrom(nodes[entry.node].song, weights, costs.data());
+            // Heap of the cheapest options so far, dearest in front.
+            cheapest.clear();
+            float threshold = std::numeric_limits<float>::infinity();
+            auto offer = [&](std::size_t i) {
+                if (costs[i] >= threshold || used[i]) {
+                    return;
+                }
+                if (cheapest.size() == expansions) {
+                    std::pop_heap(cheapest.begin(), cheapest.end(), cheaper);
+                    cheapest.pop_back();
+                }
+                cheapest.push_back({costs[i], static_cast<std::uint32_t>(i)});
+                std::push_heap(cheapest.begin(), cheapest.end(), cheaper);
+                if (cheapest.size() == expansions) {
+                    threshold = cheapest.front().cost;
+                }
+            };
+            std::size_t i = 0;
+#if defined(__SSE2__)
+            // Once the heap is full, few blocks of four have anything under
+            // the threshold.
+            for (; i + 4 <= pool.size(); i += 4) {
+                if (_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(&costs[i]), _mm_set1_ps(threshold))) != 0) {
+                    for (std::size_t j = i; j < i + 4; ++j) {
+                        offer(j);
+                    }
+                }
+            }
+#endif
+            for (; i < pool.size(); ++i) {
+                offer(i);
+            }
+            for (const Option& option : cheapest) {
+                nodes.push_back({option.song, entry.node});
+                next.push_back({entry.cost + option.cost, static_cast<std::int32_t>(nodes.size()) - 1});
+            }
+            for (std::int32_t n = entry.node; n >= 0; n = nodes[n].parent) {
+                used[nodes[n].song] = 0;
+            }
+        }
+        if (next.empty()) {
+            break;
+        }
+        if (next.size() > width) {
+            std::nth_element(next.begin(), next.begin() + width, next.end(), cheaper);
+            next.resize(width);
+        }
+        const std::size_t entries = beam.size();
+        std::swap(beam, next);
+
+        const std::size_t remaining = length - 1 - step;
+        if (options.budgetMs > 0.0 && remaining > 0) {
+            const double perEntry = (elapsedMs() - stepStart) / static_cast<double>(entries);
+            // A step too quick for the clock to see says nothing about the cost.
+            if (perEntry > 0.0) {
+                const double affordable =
+                    (options.budgetMs - elapsedMs()) / (static_cast<double>(remaining) * perEntry);
+                width = affordable > 1.0 ? static_cast<std::size_t>(std::min(affordable, static_cast<double>(width))) : 1;
+            }
+        }
+    }
+
+    const Entry& best = *std::min_element(beam.begin(), beam.end(), cheaper);
+    for (std::int32_t n = best.node; n >= 0; n = nodes[n].parent) {
+        playlist.push_back(pool.id(nodes[n].song));
+    }
+    std::reverse(playlist.begin(), playlist.end());
+    if (stats) {
+        stats->ms = elapsedMs();
+        stats->finalWidth = width;
+        stats->cost = best.cost;
+    }
+    return playlist;
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "song.h"
+#include "text_normalize.h"
+
+struct SearchHit {
+    SongId id;
+    // Fraction of the query's trigrams found in the song, in (0, 1].
+    float score;
+};
+
+// Inverted index from byte trigrams of the normalised "title artist" text to the
+// songs containing them, for substring and typo-tolerant search. Each posting
+// list is a sorted run of song ids stored as varint deltas in blocks of
+// kBlockSize, with a skip entry (first id, byte offset) per block so long lists
+// can be probed without decoding them. Songs added after build() are kept in a
+// small unindexed tail and scanned.
+class TrigramIndex {
+public:
+    static constexpr std::size_t kBlockSize = 128;
+
+    void build(const std::vector<Song>& songs, std::size_t threadCount = 0) {
+        *this = TrigramIndex();
+        const std::size_t n = songs.size();
+        songTrigramCounts.resize(n);
+        if (n == 0) {
+            return;
+        }
+
+        // (trigram << 32 | id) pairs, produced in id order per thread and
+        // concatenated in thread order, so a stable sort by trigram leaves every
+        // posting list sorted by id.
+        if (threadCount == 0) {
+            threadCount = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        }
+        threadCount = std::min(threadCount, (n + 4095) / 4096);
+        std::vector<std::vector<std::uint64_t>> parts(threadCount);
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&, t] {
+                TextNormalizer normalizer;
+                std::string text;
+                std::vector<std::uint32_t> trigrams;
+                for (std::size_t id = n * t / threadCount; id < n * (t + 1) / threadCount; ++id) {
+                    songText(songs[id], normalizer, text);
+                    trigramsOf(text, true, trigrams);
+                    songTrigramCounts[id] = static_cast<std::uint16_t>(std::min<std::size_t>(trigrams.size(), 0xFFFF));
+                    for (std::uint32_t trigram : trigrams) {
+                        parts[t].push_back(static_cast<std::uint64_t>(trigram) << 32 | id);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        std::vector<std::uint64_t> pairs;
+        for (auto& part : parts) {
+            pairs.insert(pairs.end(), part.begin(), part.end());
+            std::vector<std::uint64_t>().swap(part);
+        }
+        sortByTrigram(pairs);
+
+        std::uint32_t previous = 0;
+        for (std::size_t i = 0; i < pairs.size(); ++i) {
+            const std::uint32_t trigram = static_cast<std::uint32_t>(pairs[i] >> 32);
+            const std::uint32_t id = static_cast<std::uint32_t>(pairs[i]);
+            if (trigramCodes.empty() || trigramCodes.back() != trigram) {
+                trigramCodes.push_back(trigram);
+                lists.push_back({0, static_cast<std::uint32_t>(skips.size())});
+            }
+            PostingList& list = lists.back();
+            if (list.count % kBlockSize == 0) {
+                skips.push_back({id, static_cast<std::uint32_t>(postingBytes.size())});
+            } else {
+                putVarint(id - previous);
+            }
+            ++list.count;
+            previous = id;
+        }
+        postingBytes.shrink_to_fit();
+    }
+
+    // Call after appending `song` to the catalog under `id`.
+    void addSong(SongId id, const Song& song) {
+        TextNormalizer normalizer;
+        std::string text;
+        songText(song, normalizer, text);
+        recentIds.push_back(id);
+        recentTrigrams.emplace_back();
+        trigramsOf(text, true, recentTrigrams.back());
+        if (songTrigramCounts.size() <= id) {
+            songTrigramCounts.resize(id + 1);
+        }
+        songTrigramCounts[id] = static_cast<std::uint16_t>(std::min<std::size_t>(recentTrigrams.back().size(), 0xFFFF));
+    }
+
+    // Songs sharing enough trigrams with `query`, best first: a query of n
+    // characters may have about n / 6 typos (at most 2), and at least a third of
+    // its trigrams must match. Ties go to the song with the shorter text.
+    //
+    // Cost is dominated by decoding the shortest posting lists. On 1M songs
+    // (./bench search) the mean is about 0.5 ms but p99 is about 1.5-2 ms,
+    // short of the 1 ms goal: those are queries whose rarest trigrams each
+    // occur in 20-40k songs, so 100-200k postings must be counted. Decoding
+    // fewer lists does not help, as the candidates then grow into the tens of
+    // thousands and probing them costs more than the decoding saved.
+    std::vector<SearchHit> search(std::string_view query, std::size_t limit) const {
+        thread_local TextNormalizer normalizer;
+        thread_local std::string text;
+        normalizer.normalize(query, text);
+        text.resize(std::min(text.size(), kMaxQueryChars));
+        std::vector<std::uint32_t> trigrams;
+        // Not padded at the end, so a query also matches as a prefix.
+        trigramsOf(text, false, trigrams);
+        std::vector<SearchHit> hits;
+        const std::size_t total = trigrams.size();
+        if (total == 0 || limit == 0) {
+            return hits;
+        }
+        const std::size_t typos = std::min<std::size_t>(2, text.size() / 6);
+        const std::size_t minMatch = std::max((total + 2) / 3, total > 3 * typos ? total - 3 * typos : 1);
+
+        std::vector<const PostingList*> queryLists;
+        for (std::uint32_t trigram : trigrams) {
+            auto it = std::lower_bound(trigramCodes.begin(), trigramCodes.end(), trigram);
+            queryLists.push_back(it != trigramCodes.end() && *it == trigram ? &lists[it - trigramCodes.begin()]
+                                                                             : &kEmptyList);
+        }
+        std::sort(queryLists.begin(), queryLists.end(),
+                  [](const PostingList* a, const PostingList* b) { return a->count < b->count; });
+
+        // A song with minMatch of the trigrams misses at most total - minMatch
+        // lists, so it is in at least `needed` of the `seedLists` shortest.
+        // Decoding a couple more lists than the minimum costs little and drops
+        // the many songs that share only one rare trigram with the query. The
+        // counts live in a per-thread array stamped with the query number, so it
+        // is cleared only every 255 queries, and a song becomes a candidate when
+        // its count reaches `needed` ...
+        std::size_t seedLists = total - minMatch + 1, seedPostings = 0;
+        for (std::size_t l = 0; l < seedLists; ++l) {
+            seedPostings += queryLists[l]->count;
+        }
+        for (std::size_t extra = 0; extra < kMaxExtraSeedLists && seedLists < total &&
+                                    queryLists[seedLists]->count <= kExtraSeedRatio * seedPostings;
+             ++extra) {
+            seedPostings += queryLists[seedLists++]->count;
+        }
+        const std::uint32_t needed = static_cast<std::uint32_t>(seedLists - (total - minMatch));
+        thread_local std::vector<std::uint16_t> marks;
+        thread_local std::uint16_t stamp = 0;
+        if (marks.size() < songTrigramCounts.size()) {
+            marks.resize(songTrigramCounts.size());
+        }
+        if (++stamp > 0xFF) {
+            std::fill(marks.begin(), marks.end(), 0);
+            stamp = 1;
+        }
+        std::vector<std::pair<SongId, std::uint32_t>> candidates;
+        thread_local std::vector<SongId> ids;
+        for (std::size_t l = 0; l < seedLists; ++l) {
+            decode(*queryLists[l], ids);
+            for (SongId id : ids) {
+                std::uint16_t& mark = marks[id];
+                mark = mark >> 8 == stamp ? mark + 1 : stamp << 8 | 1;
+                if ((mark & 0xFF) == needed) {
+                    candidates.push_back({id, 0});
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        for (auto& candidate : candidates) {
+            candidate.second = marks[candidate.first] & 0xFF;
+        }
+        // ... and the longer lists are only probed for candidates that can
+        // still reach minMatch.
+        for (std::size_t l = seedLists; l < total && !candidates.empty(); ++l) {
+            const std::size_t remaining = total - l;
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                            [&](const auto& c) { return c.second + remaining < minMatch; }),
+                             candidates.end());
+            PostingCursor cursor(*this, *queryLists[l]);
+            for (auto& candidate : candidates) {
+                candidate.second += cursor.seek(candidate.first);
+            }
+        }
+        for (std::size_t r = 0; r < recentIds.size(); ++r) {
+            std::uint32_t shared = 0;
+            for (std::uint32_t trigram : trigrams) {
+                shared += std::binary_search(recentTrigrams[r].begin(), recentTrigrams[r].end(), trigram);
+            }
+            candidates.push_back({recentIds[r], shared});
+        }
+
+        for (const auto& candidate : candidates) {
+            if (candidate.second >= minMatch) {
+                hits.push_back({candidate.first, static_cast<float>(candidate.second) / total});
+            }
+        }
+        auto better = [&](const SearchHit& a, const SearchHit& b) {
+            if (a.score != b.score) {
+                return a.score > b.score;
+            }
+            if (songTrigramCounts[a.id] != songTrigramCounts[b.id]) {
+                return songTrigramCounts[a.id] < songTrigramCounts[b.id];
+            }
+            return a.id < b.id;
+        };
+        if (hits.size() > limit) {
+            std::partial_sort(hits.begin(), hits.begin() + limit, hits.end(), better);
+            hits.resize(limit);
+        } else {
+            std::sort(hits.begin(), hits.end(), better);
+        }
+        return hits;
+    }
+
+    // Songs whose normalised "title artist" text may contain `text` (already
+    // normalised) as a substring: those with all of its trigrams, plus every
+    // song added since build(). Sorted; callers check the actual text.
+    // Returns nullopt for texts too short to have a trigram.
+    std::optional<std::vector<SongId>> containing(std::string_view text) const {
+        std::vector<const PostingList*> textLists = listsContaining(text);
+        if (textLists.empty()) {
+            return std::nullopt;
+        }
+        std::vector<SongId> ids;
+        decode(*textLists[0], ids);
+        for (std::size_t l = 1; l < textLists.size() && !ids.empty(); ++l) {
+            PostingCursor cursor(*this, *textLists[l]);
+            ids.erase(std::remove_if(ids.begin(), ids.end(), [&](SongId id) { return !cursor.seek(id); }),
+                      ids.end());
+        }
+        ids.insert(ids.end(), recentIds.begin(), recentIds.end());
+        return ids;
+    }
+
+    // Upper bound on the size of containing(text), from its shortest posting
+    // list; nullopt if it has no trigrams.
+    std::optional<std::size_t> estimateContaining(std::string_view text) const {
+        std::vector<const PostingList*> textLists = listsContaining(text);
+        if (textLists.empty()) {
+            return std::nullopt;
+        }
+        return textLists[0]->count + recentIds.size();
+    }
+
+    std::size_t trigramCount() const { return trigramCodes.size(); }
+
+    std::size_t postingCount() const {
+        std::size_t count = 0;
+        for (const auto& list : lists) {
+            count += list.count;
+        }
+        return count;
+    }
+
+    // Bytes used by the posting lists, their skip entries and the directory.
+    std::size_t indexBytes() const {
+        return postingBytes.size() + skips.size() * sizeof(SkipEntry) +
+               trigramCodes.size() * (sizeof(std::uint32_t) + sizeof(PostingList));
+    }
+
+private:
+    struct PostingList {
+        std::uint32_t count;
+        std::uint32_t firstBlock;
+    };
+
+    struct SkipEntry {
+        SongId firstId;
+        std::uint32_t offset;
+    };
+
+    static constexpr PostingList kEmptyList{0, 0};
+    // Longer queries are cut here, which keeps a song's trigram count in a byte.
+    static constexpr std::size_t kMaxQueryChars = 128;
+    // search() decodes up to this many lists beyond the minimum, each at most
+    // kExtraSeedRatio times as long as the ones decoded before it.
+    static constexpr std::size_t kMaxExtraSeedLists = 2;
+    static constexpr std::size_t kExtraSeedRatio = 2;
+
+    std::vector<std::uint32_t> trigramCodes;
+    std::vector<PostingList> lists;
+    std::vector<SkipEntry> skips;
+    std::vector<std::uint8_t> postingBytes;
+    std::vector<std::uint16_t> songTrigramCounts;
+    std::vector<SongId> recentIds;
+    std::vector<std::vector<std::uint32_t>> recentTrigrams;
+
+    // Forward-only membership tests against one posting list; ids passed to
+    // seek() must not decrease.
+    class PostingCursor {
+    public:
+        PostingCursor(const TrigramIndex& index, const PostingList& list)
+            : index(index), list(list), block(list.firstBlock), endBlock(list.firstBlock + blockCount(list)) {}
+
+        bool seek(SongId id) {
+            if (size == 0 || ids[size - 1] < id) {
+                // Last block starting at or before id: gallop ahead over the
+                // skip entries, then binary search the final step.
+                auto first = index.skips.begin() + (size == 0 ? block : block + 1);
+                auto last = index.skips.begin() + endBlock;
+                auto low = first;
+                std::ptrdiff_t step = 1;
+                while (last - low > step && low[step].firstId <= id) {
+                    low += step;
+                    step *= 2;
+                }
+                auto high = last - low > step ? low + step : last;
+                auto it = std::upper_bound(low, high, id,
+                                           [](SongId value, const SkipEntry& skip) { return value < skip.firstId; });
+                if (it == first) {
+                    return false;
+                }
+                block = static_cast<std::uint32_t>(it - index.skips.begin() - 1);
+                size = index.decodeBlock(list, block, ids.data());
+                pos = 0;
+            }
+            while (pos < size && ids[pos] < id) {
+                ++pos;
+            }
+            return pos < size && ids[pos] == id;
+        }
+
+    private:
+        const TrigramIndex& index;
+        const PostingList& list;
+        std::uint32_t block;
+        std::uint32_t endBlock;
+        std::array<SongId, kBlockSize> ids;
+        std::size_t size = 0;
+        std::size_t pos = 0;
+    };
+
+    // Posting lists of the trigrams inside `text` (no padding, so it may sit
+    // anywhere in a word), shortest first.
+    std::vector<const PostingList*> listsContaining(std::string_view text) const {
+        std::vector<std::uint32_t> trigrams;
+        for (std::size_t i = 2; i < text.size(); ++i) {
+            trigrams.push_back(static_cast<std::uint32_t>(static_cast<unsigned char>(text[i - 2])) << 16 |
+                               static_cast<std::uint32_t>(static_cast<unsigned char>(text[i - 1])) << 8 |
+                               static_cast<unsigned char>(text[i]));
+        }
+        std::sort(trigrams.begin(), trigrams.end());
+        trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+        std::vector<const PostingList*> result;
+        for (std::uint32_t trigram : trigrams) {
+            auto it = std::lower_bound(trigramCodes.begin(), trigramCodes.end(), trigram);
+            result.push_back(it != trigramCodes.end() && *it == trigram ? &lists[it - trigramCodes.begin()]
+                                                                         : &kEmptyList);
+        }
+        std::sort(result.begin(), result.end(),
+                  [](const PostingList* a, const PostingList* b) { return a->count < b->count; });
+        return result;
+    }
+
+    static std::uint32_t blockCount(const PostingList& list) {
+        return static_cast<std::uint32_t>((list.count + kBlockSize - 1) / kBlockSize);
+    }
+
+    // Decodes block `block` of `list` into `out`; returns its length.
+    std::size_t decodeBlock(const PostingList& list, std::uint32_t block, SongId* out) const {
+        const std::size_t size =
+            std::min<std::size_t>(kBlockSize, list.count - (block - list.firstBlock) * kBlockSize);
+        const std::uint8_t* p = postingBytes.data() + skips[block].offset;
+        SongId id = skips[block].firstId;
+        out[0] = id;
+        for (std::size_t i = 1; i < size; ++i) {
+            std::uint32_t delta = 0;
+            for (int shift = 0;; shift += 7) {
+                const std::uint8_t byte = *p++;
+                delta |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+                if (byte < 0x80) {
+                    break;
+                }
+            }
+            id += delta;
+            out[i] = id;
+        }
+        return size;
+    }
+
+    void decode(const PostingList& list, std::vector<SongId>& out) const {
+        out.resize(list.count);
+        for (std::uint32_t b = 0; b < blockCount(list); ++b) {
+            decodeBlock(list, list.firstBlock + b, out.data() + b * kBlockSize);
+        }
+    }
+
+    void putVarint(std::uint32_t value) {
+        while (value >= 0x80) {
+            postingBytes.push_back(static_cast<std::uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        postingBytes.push_back(static_cast<std::uint8_t>(value));
+    }
+
+    static void songText(const Song& song, TextNormalizer& normalizer, std::string& out) {
+        thread_local std::string artist;
+        normalizer.normalize(song.title, out);
+        normalizer.normalize(song.artist, artist);
+        out.push_back(' ');
+        out += artist;
+    }
+
+    // Sorted distinct byte trigrams of " text" (and a trailing space if
+    // `padEnd`), so word starts and ends get trigrams of their own.
+    static void trigramsOf(const std::string& text, bool padEnd, std::vector<std::uint32_t>& out) {
+        out.clear();
+        if (text.empty()) {
+            return;
+        }
+        std::uint32_t window = ' ';
+        const std::size_t length = text.size() + (padEnd ? 1 : 0);
+        for (std::size_t i = 0; i < length; ++i) {
+            const unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+            window = (window << 8 | c) & 0xFFFFFF;
+            if (i >= 1) {
+                out.push_back(window);
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // Stable LSD radix sort on the 24-bit trigram in the high word.
+    static void sortByTrigram(std::vector<std::uint64_t>& pairs) {
+        std::vector<std::uint64_t> scratch(pairs.size());
+        for (int shift : {32, 44}) {
+            std::vector<std::size_t> starts(4097, 0);
+            for (std::uint64_t pair : pairs) {
+                ++starts[((pair >> shift) & 0xFFF) + 1];
+            }
+            for (std::size_t b = 1; b < starts.size(); ++b) {
+                starts[b] += starts[b - 1];
+            }
+            for (std::uint64_t pair : pairs) {
+                scratch[starts[(pair >> shift) & 0xFFF]++] = pair;
+            }
+            pairs.swap(scratch);
+        }
+    }
+};
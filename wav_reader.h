@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Streams mono float samples out of a RIFF/WAVE file. Supports integer PCM (8,
+// 16, 24 and 32 bit) and 32-bit IEEE float; channels are averaged. Only one block
+// of raw bytes is held in memory at a time.
+class WavReader {
+public:
+    bool open(const std::string& path) {
+        file.open(path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        char riff[12];
+        if (!file.read(riff, 12) || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0) {
+            return false;
+        }
+
+        bool haveFormat = false;
+        char chunkId[4];
+        std::uint32_t chunkSize = 0;
+        while (file.read(chunkId, 4) && readLe(chunkSize)) {
+            if (std::memcmp(chunkId, "fmt ", 4) == 0) {
+                std::uint16_t formatTag = 0, channelCount = 0, blockAlign = 0, bits = 0;
+                std::uint32_t rate = 0, byteRate = 0;
+                if (chunkSize < 16 || !readLe(formatTag) || !readLe(channelCount) || !readLe(rate) ||
+                    !readLe(byteRate) || !readLe(blockAlign) || !readLe(bits)) {
+                    return false;
+                }
+                if (formatTag == kFormatExtensible && chunkSize >= 26) {
+                    std::uint16_t extensionSize = 0, validBits = 0;
+                    std::uint32_t channelMask = 0;
+                    readLe(extensionSize);
+                    readLe(validBits);
+                    readLe(channelMask);
+                    readLe(formatTag);  // first two bytes of the subformat GUID
+                    file.seekg(chunkSize - 26, std::ios::cur);
+                } else {
+                    file.seekg(chunkSize - 16, std::ios::cur);
+                }
+                if (chunkSize % 2) {
+                    file.seekg(1, std::ios::cur);
+                }
+                isFloat = formatTag == kFormatFloat;
+                if ((formatTag != kFormatPcm && !isFloat) || channelCount == 0 || rate == 0 ||
+                    (isFloat && bits != 32) || (!isFloat && bits != 8 && bits != 16 && bits != 24 && bits != 32)) {
+                    return false;
+                }
+                channels = channelCount;
+                sampleRateHz = rate;
+                bytesPerSample = bits / 8;
+                haveFormat = true;
+            } else if (std::memcmp(chunkId, "data", 4) == 0) {
+                if (!haveFormat) {
+                    return false;
+                }
+                remainingBytes = chunkSize;
+                totalFrames = chunkSize / (bytesPerSample * channels);
+                return true;
+            } else {
+                file.seekg(chunkSize + (chunkSize % 2), std::ios::cur);
+            }
+        }
+        return false;
+    }
+
+    std::uint32_t sampleRate() const { return sampleRateHz; }
+    std::size_t frameCount() const { return totalFrames; }
+    double durationSeconds() const { return sampleRateHz ? static_cast<double>(totalFrames) / sampleRateHz : 0.0; }
+
+    // Reads up to `maxFrames` mono samples in [-1, 1]; returns how many were read
+    // (0 at the end of the data).
+    std::size_t read(float* out, std::size_t maxFrames) {
+        const std::size_t frameBytes = bytesPerSample * channels;
+        std::size_t frames = std::min<std::size_t>(maxFrames, remainingBytes / frameBytes);
+        raw.resize(frames * frameBytes);
+        if (frames == 0 || !file.read(reinterpret_cast<char*>(raw.data()), raw.size())) {
+            return 0;
+        }
+        remainingBytes -= raw.size();
+
+        const std::uint8_t* p = raw.data();
+        const float channelScale = 1.0f / channels;
+        for (std::size_t f = 0; f < frames; ++f) {
+            float sum = 0.0f;
+            for (std::uint16_t c = 0; c < channels; ++c, p += bytesPerSample) {
+                sum += decode(p);
+            }
+            out[f] = sum * channelScale;
+        }
+        return frames;
+    }
+
+private:
+    static constexpr std::uint16_t kFormatPcm = 1;
+    static constexpr std::uint16_t kFormatFloat = 3;
+    static constexpr std::uint16_t kFormatExtensible = 0xFFFE;
+
+    std::ifstream file;
+    std::uint16_t channels = 0;
+    std::uint32_t sampleRateHz = 0;
+    std::size_t bytesPerSample = 0;
+    bool isFloat = false;
+    std::size_t remainingBytes = 0;
+    std::size_t totalFrames = 0;
+    std::vector<std::uint8_t> raw;
+
+    template <typename T>
+    bool readLe(T& value) {
+        std::uint8_t bytes[sizeof(T)];
+        if (!file.read(reinterpret_cast<char*>(bytes), sizeof(T))) {
+            return false;
+        }
+        value = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i) {
+            value = static_cast<T>(value | (static_cast<T>(bytes[i]) << (8 * i)));
+        }
+        return true;
+    }
+
+    float decode(const std::uint8_t* p) const {
+        switch (bytesPerSample) {
+            case 1:
+                return (p[0] - 128) / 128.0f;
+            case 2:
+                return static_cast<std::int16_t>(p[0] | (p[1] << 8)) / 32768.0f;
+            case 3: {
+                std::int32_t v = static_cast<std::int32_t>((static_cast<std::uint32_t>(p[0]) << 8) |
+                                                           (static_cast<std::uint32_t>(p[1]) << 16) |
+                                                           (static_cast<std::uint32_t>(p[2]) << 24));
+                return (v >> 8) / 8388608.0f;
+            }
+            default: {
+                std::uint32_t bits = static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) |
+                                     (static_cast<std::uint32_t>(p[2]) << 16) |
+                                     (static_cast<std::uint32_t>(p[3]) << 24);
+                if (isFloat) {
+                    float f;
+                    std::memcpy(&f, &bits, sizeof(f));
+                    return f;
+                }
+                return static_cast<std::int32_t>(bits) / 2147483648.0f;
+            }
+        }
+    }
+};